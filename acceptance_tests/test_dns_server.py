@@ -1,11 +1,19 @@
 import dns.resolver
+import dns.flags
 import dns.message
+import dns.opcode
 import dns.rdatatype
 import dns.rdataclass
 import dns.query
+import dns.rcode
+import dns.update
+import dns.zone
 import pytest
+import signal
 import socket
+import subprocess
 import time
+from pathlib import Path
 
 # Default server settings
 SERVER_IP = '127.0.0.1'
@@ -55,6 +63,14 @@ class TestDNSServer:
         except dns.exception.DNSException as e:
             pytest.fail(f"Failed to resolve CNAME record: {e}")
     
+    def test_cname_chain_in_one_response(self, dns_server):
+        """Test that a CNAME is followed to the final records within the zone."""
+        q = dns.message.make_query('www.example.com', dns.rdatatype.A)
+        response = dns.query.udp(q, SERVER_IP, port=SERVER_PORT, timeout=5)
+        assert response.rcode() == dns.rcode.NOERROR
+        assert [(str(rrset.name), rrset.rdtype) for rrset in response.answer] == [
+            ('www.example.com.', dns.rdatatype.CNAME), ('example.com.', dns.rdatatype.A)]
+
     def test_ns_record_resolution(self, dns_server):
         """Test that the server correctly resolves NS records."""
         try:
@@ -110,7 +126,310 @@ class TestDNSServer:
     def test_nonexistent_domain(self, dns_server):
         """Test that the server correctly handles non-existent domains."""
         with pytest.raises(dns.resolver.NXDOMAIN):
-            self.resolver.resolve('nonexistent-domain-12345.com', 'A')
+            self.resolver.resolve('nonexistent-domain-12345.example.com', 'A')
+    
+    def test_negative_answers_carry_soa(self, dns_server):
+        """Test that NXDOMAIN and NODATA answers hold the zone SOA for negative caching."""
+        for qname, rdtype, rcode in [('nonexistent-domain-12345.example.com', dns.rdatatype.A, dns.rcode.NXDOMAIN),
+                                     ('mail.example.com', dns.rdatatype.TXT, dns.rcode.NOERROR)]:
+            q = dns.message.make_query(qname, rdtype)
+            response = dns.query.udp(q, SERVER_IP, port=SERVER_PORT, timeout=5)
+            assert response.rcode() == rcode
+            assert not response.answer
+            assert len(response.authority) == 1
+            soa = response.authority[0]
+            assert str(soa.name) == 'example.com.'
+            assert soa.rdtype == dns.rdatatype.SOA
+            assert soa.ttl == min(soa[0].minimum, 300)
+
+    def test_out_of_zone_domain_refused(self, dns_server):
+        """Test that names outside every served zone are REFUSED, not NXDOMAIN."""
+        q = dns.message.make_query('nonexistent-domain-12345.com', dns.rdatatype.A)
+        response = dns.query.udp(q, SERVER_IP, port=SERVER_PORT, timeout=5)
+        assert response.rcode() == dns.rcode.REFUSED
+    
+    def test_dynamic_update(self, dns_server):
+        """Test that an RFC 2136 update is applied and served."""
+        update = dns.update.UpdateMessage('example.com')
+        update.present('updated', 'A')
+        response = dns.query.udp(update, SERVER_IP, port=SERVER_PORT, timeout=5)
+        assert response.rcode() == dns.rcode.NXRRSET
+        
+        update = dns.update.UpdateMessage('example.com')
+        update.absent('updated')
+        update.add('updated', 300, 'A', '192.0.2.99')
+        response = dns.query.udp(update, SERVER_IP, port=SERVER_PORT, timeout=5)
+        assert response.rcode() == dns.rcode.NOERROR
+        
+        answers = self.resolver.resolve('updated.example.com', 'A')
+        assert [str(rdata) for rdata in answers] == ['192.0.2.99']
+    
+    def test_zone_transfer(self, dns_server):
+        """Test that AXFR over TCP returns the whole zone between two SOAs."""
+        zone = dns.zone.from_xfr(dns.query.xfr(SERVER_IP, 'example.com', port=SERVER_PORT, timeout=5))
+        assert zone.get_rdataset('@', 'SOA') is not None
+        assert str(zone.find_rdataset('mail', 'A')[0]) == '192.0.2.2'
+        assert len(zone.find_rdataset('@', 'NS')) == 2
+    
+    def test_incremental_zone_transfer(self, dns_server):
+        """Test that IXFR from a recent serial returns just the differences."""
+        serial = self.resolver.resolve('example.com', 'SOA')[0].serial
+        update = dns.update.UpdateMessage('example.com')
+        update.add('incremental', 300, 'A', '192.0.2.77')
+        response = dns.query.udp(update, SERVER_IP, port=SERVER_PORT, timeout=5)
+        assert response.rcode() == dns.rcode.NOERROR
+        
+        rrsets = [rrset for message in dns.query.xfr(SERVER_IP, 'example.com', port=SERVER_PORT, timeout=5,
+                                                     rdtype=dns.rdatatype.IXFR, serial=serial)
+                  for rrset in message.answer]
+        assert [rrset.rdtype for rrset in rrsets] == [dns.rdatatype.SOA, dns.rdatatype.SOA, dns.rdatatype.SOA,
+                                                      dns.rdatatype.A, dns.rdatatype.SOA]
+        assert rrsets[1][0].serial == serial
+        assert rrsets[2][0].serial == rrsets[0][0].serial != serial
+        assert str(rrsets[3].name) == 'incremental'   # xfr() makes names relative
+        
+        # A serial the server never had gets the whole zone instead
+        rrsets = [rrset for message in dns.query.xfr(SERVER_IP, 'example.com', port=SERVER_PORT, timeout=5,
+                                                     rdtype=dns.rdatatype.IXFR, serial=serial - 1000)
+                  for rrset in message.answer]
+        assert any(str(rrset.name) == 'mail' for rrset in rrsets)
+    
+    def test_secondary_instance(self, dns_server):
+        """Test that a second instance follows example.com from this one."""
+        server_path = Path(__file__).parent.parent / "cpp" / "build" / "dns_server"
+        secondary = subprocess.Popen([server_path, '--port=5354', f'--secondary=example.com@{SERVER_IP}:{SERVER_PORT}'],
+                                     stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            resolver = dns.resolver.Resolver()
+            resolver.nameservers = [SERVER_IP]
+            resolver.port = 5354
+            resolver.lifetime = 1
+            expected = str(self.resolver.resolve('example.com', 'SOA')[0])
+            for _ in range(50):
+                try:
+                    if str(resolver.resolve('example.com', 'SOA')[0]) == expected:
+                        break
+                except dns.exception.DNSException:
+                    pass
+                time.sleep(0.1)
+            assert str(resolver.resolve('example.com', 'SOA')[0]) == expected
+            assert str(resolver.resolve('mail.example.com', 'A')[0]) == '192.0.2.2'
+            
+            # REFRESH is an hour, so only a NOTIFY brings a change over quickly
+            update = dns.update.UpdateMessage('example.com')
+            update.add('notified', 300, 'A', '192.0.2.88')
+            assert dns.query.udp(update, SERVER_IP, port=SERVER_PORT, timeout=5).rcode() == dns.rcode.NOERROR
+            notify = dns.message.make_query('example.com', 'SOA')
+            notify.flags = dns.flags.AA
+            notify.set_opcode(dns.opcode.NOTIFY)
+            response = dns.query.udp(notify, SERVER_IP, port=5354, timeout=5)
+            assert response.rcode() == dns.rcode.NOERROR and response.opcode() == dns.opcode.NOTIFY
+            for _ in range(50):
+                try:
+                    if str(resolver.resolve('notified.example.com', 'A')[0]) == '192.0.2.88':
+                        break
+                except dns.exception.DNSException:
+                    pass
+                time.sleep(0.1)
+            assert str(resolver.resolve('notified.example.com', 'A')[0]) == '192.0.2.88'
+        finally:
+            secondary.send_signal(signal.SIGTERM)
+            secondary.wait(timeout=5)
+    
+    def test_reload_on_sighup(self, dns_server, tmp_path):
+        """Test that SIGHUP rereads the zone file while queries keep being answered."""
+        server_path = Path(__file__).parent.parent / "cpp" / "build" / "dns_server"
+        zone_file = tmp_path / "zones.txt"
+        soa = 'ns1.reload.test admin.reload.test {} 3600 900 1209600 300'
+        zone_file.write_text(f"reload.test SOA {soa.format(1)}\nhost.reload.test A 192.0.2.10\n")
+        instance = subprocess.Popen([server_path, '--port=5354', f'--zone-file={zone_file}'],
+                                    stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            resolver = dns.resolver.Resolver()
+            resolver.nameservers = [SERVER_IP]
+            resolver.port = 5354
+            resolver.lifetime = 1
+            for _ in range(50):
+                try:
+                    resolver.resolve('host.reload.test', 'A')
+                    break
+                except dns.exception.DNSException:
+                    time.sleep(0.1)
+            assert str(resolver.resolve('host.reload.test', 'A')[0]) == '192.0.2.10'
+            
+            zone_file.write_text(f"reload.test SOA {soa.format(2)}\nhost.reload.test A 192.0.2.20\n")
+            instance.send_signal(signal.SIGHUP)
+            for _ in range(50):
+                if str(resolver.resolve('host.reload.test', 'A')[0]) == '192.0.2.20':
+                    break
+                time.sleep(0.1)
+            assert str(resolver.resolve('host.reload.test', 'A')[0]) == '192.0.2.20'
+            assert resolver.resolve('reload.test', 'SOA')[0].serial == 2
+            
+            # A broken file is rejected and the zone stays as it was
+            zone_file.write_text("host.reload.test A not-an-address\n")
+            instance.send_signal(signal.SIGHUP)
+            time.sleep(0.5)
+            assert str(resolver.resolve('host.reload.test', 'A')[0]) == '192.0.2.20'
+            assert instance.poll() is None
+        finally:
+            instance.send_signal(signal.SIGTERM)
+            instance.wait(timeout=5)
+    
+    def test_restart_from_checkpoint(self, dns_server, tmp_path):
+        """Test that a killed instance comes back from its checkpoint and journal."""
+        server_path = Path(__file__).parent.parent / "cpp" / "build" / "dns_server"
+        zone_file = tmp_path / "zones.txt"
+        zone_file.write_text("restart.test SOA ns1.restart.test admin.restart.test 1 3600 900 1209600 300\n"
+                             "host.restart.test A 192.0.2.30\n")
+        checkpoint = tmp_path / "zones.checkpoint"
+        options = ['--port=5354', f'--checkpoint={checkpoint}', '--checkpoint-interval=1',
+                   f'--journal={tmp_path / "zones.journal"}']
+        resolver = dns.resolver.Resolver()
+        resolver.nameservers = [SERVER_IP]
+        resolver.port = 5354
+        resolver.lifetime = 1
+        
+        instance = subprocess.Popen([server_path, f'--zone-file={zone_file}'] + options,
+                                    stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            for _ in range(50):
+                if checkpoint.exists():
+                    break
+                time.sleep(0.1)
+            assert checkpoint.exists()
+            update = dns.update.UpdateMessage('restart.test')
+            update.add('late', 300, 'A', '192.0.2.31')
+            response = dns.query.udp(update, SERVER_IP, port=5354, timeout=5)
+            assert response.rcode() == dns.rcode.NOERROR
+        finally:
+            instance.kill()
+            instance.wait(timeout=5)
+        
+        # Without the zone file, everything comes from the checkpoint and the journal
+        instance = subprocess.Popen([server_path] + options, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            for _ in range(50):
+                try:
+                    resolver.resolve('host.restart.test', 'A')
+                    break
+                except dns.exception.DNSException:
+                    time.sleep(0.1)
+            assert str(resolver.resolve('host.restart.test', 'A')[0]) == '192.0.2.30'
+            assert str(resolver.resolve('late.restart.test', 'A')[0]) == '192.0.2.31'
+            assert resolver.resolve('restart.test', 'SOA')[0].serial == 2
+        finally:
+            instance.send_signal(signal.SIGTERM)
+            instance.wait(timeout=5)
+        
+        # A checkpoint with a flipped bit is ignored for the zone file and the whole journal
+        image = bytearray(checkpoint.read_bytes())
+        image[len(image) // 2] ^= 0x10
+        checkpoint.write_bytes(bytes(image))
+        instance = subprocess.Popen([server_path, f'--zone-file={zone_file}'] + options,
+                                    stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            for _ in range(50):
+                try:
+                    resolver.resolve('late.restart.test', 'A')
+                    break
+                except dns.exception.DNSException:
+                    time.sleep(0.1)
+            assert str(resolver.resolve('host.restart.test', 'A')[0]) == '192.0.2.30'
+            assert str(resolver.resolve('late.restart.test', 'A')[0]) == '192.0.2.31'
+            assert resolver.resolve('restart.test', 'SOA')[0].serial == 2
+        finally:
+            instance.send_signal(signal.SIGTERM)
+            instance.wait(timeout=5)
+    
+    def test_restart_after_reload(self, dns_server, tmp_path):
+        """Test that updates dropped by a reload stay dropped after a restart."""
+        server_path = Path(__file__).parent.parent / "cpp" / "build" / "dns_server"
+        zone_file = tmp_path / "zones.txt"
+        zone_file.write_text("again.test SOA ns1.again.test admin.again.test 1 3600 900 1209600 300\n"
+                             "host.again.test A 192.0.2.40\n")
+        checkpoint = tmp_path / "zones.checkpoint"
+        options = ['--port=5354', f'--zone-file={zone_file}', f'--checkpoint={checkpoint}',
+                   '--checkpoint-interval=3600', f'--journal={tmp_path / "zones.journal"}']
+        resolver = dns.resolver.Resolver()
+        resolver.nameservers = [SERVER_IP]
+        resolver.port = 5354
+        resolver.lifetime = 1
+
+        def wait_for(name):
+            for _ in range(50):
+                try:
+                    return resolver.resolve(name, 'A')
+                except dns.exception.DNSException:
+                    time.sleep(0.1)
+            return resolver.resolve(name, 'A')
+
+        def add(name):
+            update = dns.update.UpdateMessage('again.test')
+            update.add(name, 300, 'A', '192.0.2.41')
+            response = dns.query.udp(update, SERVER_IP, port=5354, timeout=5)
+            assert response.rcode() == dns.rcode.NOERROR
+
+        instance = subprocess.Popen([server_path] + options, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            wait_for('host.again.test')
+            add('before')
+            assert str(resolver.resolve('before.again.test', 'A')[0]) == '192.0.2.41'
+
+            # The unchanged file is served again, without the update
+            instance.send_signal(signal.SIGHUP)
+            for _ in range(50):
+                try:
+                    resolver.resolve('before.again.test', 'A')
+                    time.sleep(0.1)
+                except dns.resolver.NXDOMAIN:
+                    break
+            with pytest.raises(dns.resolver.NXDOMAIN):
+                resolver.resolve('before.again.test', 'A')
+            add('after')
+            for _ in range(50):
+                if checkpoint.exists():
+                    break
+                time.sleep(0.1)
+        finally:
+            instance.kill()
+            instance.wait(timeout=5)
+
+        instance = subprocess.Popen([server_path] + options, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            assert str(wait_for('after.again.test')[0]) == '192.0.2.41'
+            with pytest.raises(dns.resolver.NXDOMAIN):
+                resolver.resolve('before.again.test', 'A')
+            assert resolver.resolve('again.test', 'SOA')[0].serial == 2
+        finally:
+            instance.send_signal(signal.SIGTERM)
+            instance.wait(timeout=5)
+    
+    def test_synthesized_records(self, dns_server):
+        """Test that a synthesis rule answers PTR and A for a whole range."""
+        server_path = Path(__file__).parent.parent / "cpp" / "build" / "dns_server"
+        instance = subprocess.Popen([server_path, '--port=5354', '--synthesize=192.0.2.0/24=ip-*.example.com'],
+                                    stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            resolver = dns.resolver.Resolver()
+            resolver.nameservers = [SERVER_IP]
+            resolver.port = 5354
+            resolver.lifetime = 1
+            for _ in range(50):
+                try:
+                    resolver.resolve('example.com', 'SOA')
+                    break
+                except dns.exception.DNSException:
+                    time.sleep(0.1)
+            answer = resolver.resolve('77.2.0.192.in-addr.arpa', 'PTR')
+            assert str(answer[0]) == 'ip-192-0-2-77.example.com.'
+            assert str(resolver.resolve('ip-192-0-2-77.example.com', 'A')[0]) == '192.0.2.77'
+            
+            # The stored PTR still wins over the rule
+            assert str(resolver.resolve('1.2.0.192.in-addr.arpa', 'PTR')[0]) == 'example.com.'
+        finally:
+            instance.send_signal(signal.SIGTERM)
+            instance.wait(timeout=5)
     
     def test_case_insensitivity(self, dns_server):
         """Test that domain name lookups are case-insensitive as per RFC 1035."""
@@ -130,6 +449,32 @@ class TestDNSServer:
         except dns.exception.DNSException as e:
             pytest.fail(f"Failed to test case insensitivity: {e}")
     
+    def test_additional_section_glue(self, dns_server):
+        """Test that MX and NS answers carry the addresses of in-zone targets."""
+        q = dns.message.make_query('example.com', dns.rdatatype.MX)
+        response = dns.query.udp(q, SERVER_IP, port=SERVER_PORT, timeout=5)
+        glue = {(str(rrset.name), rrset.rdtype) for rrset in response.additional}
+        assert ('mail.example.com.', dns.rdatatype.A) in glue
+
+        q = dns.message.make_query('example.com', dns.rdatatype.NS)
+        response = dns.query.udp(q, SERVER_IP, port=SERVER_PORT, timeout=5)
+        glue = {str(rrset.name) for rrset in response.additional}
+        assert glue == {'ns1.example.com.', 'ns2.example.com.'}
+
+    def test_edns_opt_echoed(self, dns_server):
+        """Test that EDNS(0) queries get an OPT record with the server's payload size."""
+        q = dns.message.make_query('example.com', dns.rdatatype.NS, use_edns=0, payload=4096)
+        response = dns.query.udp(q, SERVER_IP, port=SERVER_PORT, timeout=5)
+        assert response.rcode() == dns.rcode.NOERROR
+        assert response.edns == 0
+        assert 512 <= response.payload <= 4096
+        assert response.answer
+
+        q = dns.message.make_query('example.com', dns.rdatatype.NS, use_edns=1)
+        response = dns.query.udp(q, SERVER_IP, port=SERVER_PORT, timeout=5)
+        assert response.rcode() == dns.rcode.BADVERS
+        assert response.edns == 0
+
     def test_truncated_responses(self, dns_server):
         """Test that the server correctly handles truncated responses."""
         # Create a query that will likely result in a large response
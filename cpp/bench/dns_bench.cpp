@@ -0,0 +1,471 @@
+// Micro-benchmarks for the DNS server library. Each mode prints one line per
+// measurement so results can be pasted into commit messages and reviews.
+//
+//   dns_bench load [records]     memory per stored record
+//   dns_bench index [names]      hash table vs perfect hash owner index
+//   dns_bench batch [queries]    heap allocations per answered query
+//   dns_bench bulk [records]     addRecords() vs addRecord(), and publish()
+//   dns_bench tlb [names]        lookups and dTLB misses per huge page mode
+//   dns_bench journal [updates]  journaled updates, fsync per update vs group commit
+//   dns_bench reverse [names]    PTR lookups by address key vs by name hash
+//   dns_bench checkpoint [names] restart from a checkpoint vs compiling the records
+#include "../src/checkpoint.h"
+#include "../src/dns_response.h"
+#include "../src/dns_server.h"
+#include "../src/dns_update.h"
+#include "../src/huge_pages.h"
+#include "../src/journal.h"
+#include "../src/parallel.h"
+#include "../src/reverse_name.h"
+#include "../src/scratch_arena.h"
+#include "../src/zone.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <malloc.h>
+#include <new>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Every global allocation in this binary is counted so the batch mode can
+// report malloc calls per query
+static std::atomic<size_t> allocationCount{0};
+
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+    throw std::bad_alloc();
+}
+
+// GCC pairs the replaced operator new with free() below and warns, but that
+// is exactly how the replacement is meant to be released
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+#pragma GCC diagnostic pop
+
+namespace {
+    // Resident set size in bytes
+    size_t residentBytes() {
+        long pages = 0, resident = 0;
+        FILE* f = std::fopen("/proc/self/statm", "r");
+        if (f == nullptr) return 0;
+        if (std::fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        std::fclose(f);
+        return static_cast<size_t>(resident) * sysconf(_SC_PAGESIZE);
+    }
+
+    size_t heapBytes() {
+        auto info = mallinfo2();
+        return info.uordblks + info.hblkhd;   // Small blocks plus mmapped large ones
+    }
+
+    std::string ownerName(size_t i) {
+        return "host" + std::to_string(i) + ".example.com";
+    }
+
+    std::string address(size_t i) {
+        return "10." + std::to_string((i >> 16) & 0xFF) + "." + std::to_string((i >> 8) & 0xFF) +
+               "." + std::to_string(i & 0xFF);
+    }
+
+    int benchLoad(size_t count) {
+        size_t heapBefore = heapBytes();
+        size_t rssBefore = residentBytes();
+        auto start = std::chrono::steady_clock::now();
+
+        DNSServer server;
+        for (size_t i = 0; i < count; ++i) {
+            server.addRecord(ownerName(i), RecordType::A, address(i));
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        size_t heap = heapBytes() - heapBefore;
+        size_t rss = residentBytes() - rssBefore;
+        std::printf("load: %zu records in %.2f s, heap %.1f B/record, rss %.1f B/record, store %.1f B/record\n",
+                    count, seconds, static_cast<double>(heap) / count, static_cast<double>(rss) / count,
+                    static_cast<double>(server.memoryUsage()) / count);
+        return server.empty() ? 1 : 0;
+    }
+
+    double secondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    int benchIndex(size_t count) {
+        DNSServer server;
+        server.addRecord("example.com", "SOA", "ns1.example.com admin.example.com 1 3600 900 1209600 300");
+        for (size_t i = 0; i < count; ++i) {
+            server.addRecord(ownerName(i), RecordType::A, address(i));
+        }
+
+        // Questions are parsed up front; half of them miss the zone
+        std::vector<dns_packet::WireName> names(1 << 20);
+        for (size_t i = 0; i < names.size(); ++i) {
+            size_t pick = (i * 2654435761u) % (count * 2);
+            if (!names[i].assign(ownerName(pick))) return 1;
+        }
+
+        for (bool perfect : {false, true}) {
+            SnapshotOptions options;
+            options.perfectHash = perfect;
+            server.setSnapshotOptions(options);
+            auto start = std::chrono::steady_clock::now();
+            server.publish();
+            double buildSeconds = secondsSince(start);
+            auto snapshot = server.zones()->find("example.com")->snapshot();
+
+            size_t hits = 0;
+            start = std::chrono::steady_clock::now();
+            for (const auto& name : names) {
+                hits += snapshot->find(name, name.hash()) != nullptr;
+            }
+            double lookupSeconds = secondsSince(start);
+            std::printf("index %-12s: %zu names, build %.2f s, index %.2f B/name, lookup %.1f ns (%zu hits)\n",
+                        perfect ? "perfect-hash" : "hash-table", snapshot->ownerCount(), buildSeconds,
+                        static_cast<double>(snapshot->indexMemory()) / snapshot->ownerCount(),
+                        lookupSeconds * 1e9 / names.size(), hits);
+        }
+        return 0;
+    }
+
+    // Reverse name of the i-th address of 10.0.0.0/8
+    std::string reverseName(size_t i) {
+        return std::to_string(i & 0xFF) + "." + std::to_string((i >> 8) & 0xFF) + "." +
+               std::to_string((i >> 16) & 0xFF) + ".10.in-addr.arpa";
+    }
+
+    // PTR lookups by name hash against lookups by the parsed address
+    int benchReverse(size_t count) {
+        DNSServer server;
+        server.addRecord("10.in-addr.arpa", "SOA", "ns1.example.com admin.example.com 1 3600 900 1209600 300");
+        for (size_t i = 0; i < count; ++i) {
+            server.addRecord(reverseName(i), "PTR", ownerName(i));
+        }
+        server.publish();
+        auto snapshot = server.zones()->find("10.in-addr.arpa")->snapshot();
+
+        // Half of the questions have no PTR
+        std::vector<dns_packet::WireName> names(1 << 20);
+        for (size_t i = 0; i < names.size(); ++i) {
+            size_t pick = (i * 2654435761u) % std::min<size_t>(count * 2, 1 << 24);
+            if (!names[i].assign(reverseName(pick))) return 1;
+        }
+
+        size_t hits = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& name : names) {
+            hits += snapshot->find(name, name.hash()) != nullptr;
+        }
+        double hashSeconds = secondsSince(start);
+
+        size_t reverseHits = 0;
+        start = std::chrono::steady_clock::now();
+        for (const auto& name : names) {
+            reverse_name::Prefix prefix;
+            reverseHits += reverse_name::parse(name.bytes(), prefix) && snapshot->findReverse(prefix) != nullptr;
+        }
+        double reverseSeconds = secondsSince(start);
+        std::printf("reverse: %zu PTRs, hashed name %.1f ns, parsed address %.1f ns (%zu/%zu hits)\n",
+                    count, hashSeconds * 1e9 / names.size(), reverseSeconds * 1e9 / names.size(), hits, reverseHits);
+        return hits == reverseHits ? 0 : 1;
+    }
+
+    size_t allocationsSince(size_t before) {
+        return allocationCount.load(std::memory_order_relaxed) - before;
+    }
+
+    int benchBulk(size_t count) {
+        std::vector<DNSRecord> records;
+        records.reserve(count + 1);
+        records.emplace_back("example.com", "SOA", "ns1.example.com admin.example.com 1 3600 900 1209600 300");
+        for (size_t i = 0; i < count; ++i) {
+            // Two records per owner, half a batch apart
+            records.emplace_back(ownerName(i % (count / 2)), i < count / 2 ? RecordType::A : RecordType::TXT,
+                                 i < count / 2 ? address(i) : "v=" + std::to_string(i));
+        }
+
+        {
+            DNSServer server;
+            size_t before = allocationCount.load(std::memory_order_relaxed);
+            auto start = std::chrono::steady_clock::now();
+            for (const auto& record : records) server.addRecord(record.name, record.type, record.value);
+            std::printf("bulk addRecord : %zu records in %.2f s, %.3f mallocs/record\n", records.size(),
+                        secondsSince(start), static_cast<double>(allocationsSince(before)) / records.size());
+        }
+
+        DNSServer server;
+        size_t before = allocationCount.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        size_t total = records.size();
+        server.addRecords(std::move(records));
+        std::printf("bulk addRecords: %zu records in %.2f s, %.3f mallocs/record\n", total,
+                    secondsSince(start), static_cast<double>(allocationsSince(before)) / total);
+
+        for (unsigned threads : {1u, 0u}) {
+            server.setSnapshotOptions({false, threads});
+            before = allocationCount.load(std::memory_order_relaxed);
+            start = std::chrono::steady_clock::now();
+            server.publish();
+            std::printf("bulk publish (%u threads): %.2f s, %.3f mallocs/record\n", resolveThreads(threads),
+                        secondsSince(start), static_cast<double>(allocationsSince(before)) / total);
+        }
+        return server.empty() ? 1 : 0;
+    }
+
+    // dTLB load misses of this thread, where perf events are permitted
+    class TlbMissCounter {
+    public:
+        TlbMissCounter() {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+        ~TlbMissCounter() { if (fd >= 0) close(fd); }
+
+        bool available() const { return fd >= 0; }
+        void start() { if (fd >= 0) { ioctl(fd, PERF_EVENT_IOC_RESET, 0); ioctl(fd, PERF_EVENT_IOC_ENABLE, 0); } }
+        uint64_t stop() {
+            uint64_t count = 0;
+            if (fd < 0) return 0;
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+            return count;
+        }
+
+    private:
+        int fd = -1;
+    };
+
+    int benchTlb(size_t count) {
+        // Questions are parsed up front; a quarter of them miss the zone
+        std::vector<dns_packet::WireName> names(1 << 20);
+        for (size_t i = 0; i < names.size(); ++i) {
+            size_t pick = (i * 2654435761u) % (count + count / 3);
+            if (!names[i].assign(ownerName(pick))) return 1;
+        }
+
+        TlbMissCounter misses;
+        if (!misses.available()) std::printf("tlb: perf events unavailable, reporting timings only\n");
+        for (auto mode : {huge_pages::Mode::Off, huge_pages::Mode::Transparent, huge_pages::Mode::Explicit}) {
+            huge_pages::setMode(mode);
+            DNSServer server;
+            server.addRecord("example.com", "SOA", "ns1.example.com admin.example.com 1 3600 900 1209600 300");
+            for (size_t i = 0; i < count; ++i) {
+                server.addRecord(ownerName(i), RecordType::A, address(i));
+            }
+            server.publish();
+            auto snapshot = server.zones()->find("example.com")->snapshot();
+            auto mapped = huge_pages::stats();
+
+            size_t hits = 0;
+            misses.start();
+            auto start = std::chrono::steady_clock::now();
+            for (const auto& name : names) {
+                if (!snapshot->mayContain(name.hash())) continue;
+                const auto* owner = snapshot->find(name, name.hash());
+                if (owner != nullptr) hits += snapshot->rr(snapshot->rrsets(*owner)[0].firstRR).size() != 0;
+            }
+            double seconds = secondsSince(start);
+            uint64_t missCount = misses.stop();
+            char missText[32] = "n/a";
+            if (misses.available()) {
+                std::snprintf(missText, sizeof(missText), "%.3f", static_cast<double>(missCount) / names.size());
+            }
+            std::printf("tlb %-8s: %zu names, %.1f ns/lookup, %s dTLB misses/lookup, "
+                        "hugetlb %zu MiB, thp %zu MiB, plain %zu MiB (%zu hits)\n",
+                        mode == huge_pages::Mode::Off ? "off" : mode == huge_pages::Mode::Transparent ? "thp" : "hugetlb",
+                        count, seconds * 1e9 / names.size(),
+                        missText, mapped.explicitBytes >> 20,
+                        mapped.transparentBytes >> 20, mapped.plainBytes >> 20, hits);
+        }
+        huge_pages::setMode(huge_pages::Mode::Off);
+        return 0;
+    }
+
+    // Replays a mix of hits, NXDOMAINs, MX and ANY questions through the
+    // packet path the way the server loop does, including the name decoded
+    // for the query log
+    int benchBatch(size_t count) {
+        DNSServer server;
+        server.addRecord("example.com", "SOA", "ns1.example.com admin.example.com 1 3600 900 1209600 300");
+        server.addRecord("example.com", "MX", "10 mail.example.com");
+        server.addRecord("example.com", "TXT", "v=spf1 include:_spf.example.com ~all");
+        for (size_t i = 0; i < 10000; ++i) {
+            server.addRecord(ownerName(i), RecordType::A, address(i));
+        }
+        server.publish();
+
+        std::vector<std::vector<uint8_t>> queries;
+        const uint16_t types[] = {1, 1, 15, 255};
+        for (size_t i = 0; i < 1024; ++i) {
+            std::vector<uint8_t> packet = {0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+            auto name = dns_packet::encodeDomainName(i % 4 == 2 || i % 4 == 3 ? "example.com" : ownerName(i * 7 % 20000));
+            packet.insert(packet.end(), name.begin(), name.end());
+            dns_packet::appendUint16(packet, types[i % 4]);
+            dns_packet::appendUint16(packet, dns_packet::CLASS_IN);
+            queries.push_back(std::move(packet));
+        }
+
+        size_t bytes = 0;
+        for (bool arena : {false, true}) {
+            ScratchArena& scratch = ScratchArena::local();
+            size_t allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < count; ++i) {
+                const auto& query = queries[i % queries.size()];
+                size_t offset = dns_packet::HEADER_SIZE;
+                if (arena) {
+                    auto response = createDNSResponse(query, server, scratch.resource());
+                    auto name = dns_packet::parseDomainName(query, offset, scratch.resource());
+                    bytes += response.size() + name.size();
+                    scratch.reset();
+                } else {
+                    auto response = createDNSResponse(query, server);
+                    auto name = dns_packet::parseDomainName(query, offset);
+                    bytes += response.size() + name.size();
+                }
+            }
+            double seconds = secondsSince(start);
+            size_t allocations = allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+            std::printf("batch %-5s: %zu queries, %.2f mallocs/query, %.1f ns/query\n", arena ? "arena" : "heap",
+                        count, static_cast<double>(allocations) / count, seconds * 1e9 / count);
+        }
+        return bytes == 0 ? 1 : 0;
+    }
+}
+
+namespace {
+    // One RFC2136 message replacing the TXT RRset of a host
+    std::vector<uint8_t> updateMessage(size_t i) {
+        std::vector<uint8_t> message = {0, 0, dns_packet::OPCODE_UPDATE << 3, 0, 0, 1, 0, 0, 0, 2, 0, 0};
+        auto append = [&](const std::string& name, uint16_t type, uint16_t rrClass, uint32_t ttl,
+                          const std::string& value) {
+            auto encoded = dns_packet::encodeDomainName(name);
+            message.insert(message.end(), encoded.begin(), encoded.end());
+            dns_packet::appendUint16(message, type);
+            dns_packet::appendUint16(message, rrClass);
+            dns_packet::appendUint32(message, ttl);
+            std::vector<uint8_t> rdata;
+            if (!value.empty() && !dns_packet::encodeRData(type, value, rdata)) std::abort();
+            dns_packet::appendUint16(message, static_cast<uint16_t>(rdata.size()));
+            message.insert(message.end(), rdata.begin(), rdata.end());
+        };
+        auto zone = dns_packet::encodeDomainName("example.com");
+        message.insert(message.end(), zone.begin(), zone.end());
+        dns_packet::appendUint16(message, 6);
+        dns_packet::appendUint16(message, dns_packet::CLASS_IN);
+        append(ownerName(i % 1000), 16, dns_packet::QTYPE_ANY, 0, "");
+        append(ownerName(i % 1000), 16, dns_packet::CLASS_IN, 300, "version " + std::to_string(i));
+        return message;
+    }
+
+    // Updates arrive `batch` at a time and are acknowledged after the commit
+    // that makes them durable; latency is from arrival to acknowledgement
+    int benchJournal(size_t count) {
+        const char* path = "dns_bench.journal";
+        std::vector<std::vector<uint8_t>> messages(count);
+        for (size_t i = 0; i < count; ++i) messages[i] = updateMessage(i);
+
+        for (size_t batch : {size_t{1}, size_t{32}, size_t{256}}) {
+            std::remove(path);
+            DNSServer server;
+            server.addRecord("example.com", "SOA", "ns1.example.com admin.example.com 1 3600 900 1209600 300");
+            for (size_t i = 0; i < 1000; ++i) server.addRecord(ownerName(i), RecordType::A, address(i));
+            server.publish();
+            Journal journal;
+            if (!journal.open(path)) return 1;
+            ZoneUpdater updater(server);
+            updater.setJournal(&journal);
+
+            double latency = 0.0;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t first = 0; first < count; first += batch) {
+                auto arrival = std::chrono::steady_clock::now();
+                size_t last = std::min(count, first + batch);
+                for (size_t i = first; i < last; ++i) {
+                    if ((updater.stage(messages[i])[3] & 0x0F) != dns_packet::RCODE_NOERROR) return 1;
+                }
+                updater.commit();
+                latency += secondsSince(arrival) * (last - first);
+            }
+            double seconds = secondsSince(start);
+            std::printf("journal %-18s: %zu updates in %.2f s, %.0f updates/s, latency %.1f us, %llu fsyncs\n",
+                        batch == 1 ? "fsync-per-update" : ("group-commit/" + std::to_string(batch)).c_str(),
+                        count, seconds, count / seconds, latency * 1e6 / count,
+                        static_cast<unsigned long long>(journal.stats().syncs));
+        }
+        std::remove(path);
+        return 0;
+    }
+
+    // Time to first answer after a restart: compiling the records again
+    // against mapping the last checkpoint
+    int benchCheckpoint(size_t count) {
+        const char* path = "dns_bench.checkpoint";
+        std::vector<DNSRecord> records;
+        records.reserve(count + 1);
+        records.emplace_back("example.com", "SOA", "ns1.example.com admin.example.com 1 3600 900 1209600 300");
+        for (size_t i = 0; i < count; ++i) records.emplace_back(ownerName(i), RecordType::A, address(i));
+        auto probe = dns_packet::encodeDomainName(ownerName(count / 2));
+        std::vector<uint8_t> query = {0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+        query.insert(query.end(), probe.begin(), probe.end());
+        dns_packet::appendUint16(query, 1);
+        dns_packet::appendUint16(query, dns_packet::CLASS_IN);
+
+        auto start = std::chrono::steady_clock::now();
+        DNSServer compiled;
+        compiled.setSnapshotOptions({.perfectHash = true});
+        compiled.addRecords(records);
+        compiled.publish();
+        if (dns_packet::readUint16(createDNSResponse(query, compiled), 6) != 1) return 1;
+        std::printf("checkpoint compile: %zu names, first answer after %.1f ms\n", count, secondsSince(start) * 1e3);
+
+        start = std::chrono::steady_clock::now();
+        uint64_t bytes = checkpoint::write(path, compiled.capture(), 0);
+        std::printf("checkpoint write  : %.1f MiB in %.1f ms\n", bytes / 1048576.0, secondsSince(start) * 1e3);
+
+        start = std::chrono::steady_clock::now();
+        std::vector<ZoneImage> images;
+        uint64_t journalFrom = 0;
+        std::string error;
+        DNSServer restored;
+        if (!checkpoint::read(path, images, journalFrom, error) || !restored.restore(std::move(images))) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        if (dns_packet::readUint16(createDNSResponse(query, restored), 6) != 1) return 1;
+        std::printf("checkpoint restore: %zu names, first answer after %.1f ms\n", count, secondsSince(start) * 1e3);
+        std::remove(path);
+        return 0;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string mode = argc > 1 ? argv[1] : "load";
+    size_t count = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10'000'000;
+
+    if (mode == "load") return benchLoad(count);
+    if (mode == "index") return benchIndex(count);
+    if (mode == "batch") return benchBatch(count);
+    if (mode == "bulk") return benchBulk(count);
+    if (mode == "tlb") return benchTlb(count);
+    if (mode == "journal") return benchJournal(count);
+    if (mode == "reverse") return benchReverse(count);
+    if (mode == "checkpoint") return benchCheckpoint(count);
+
+    std::fprintf(stderr, "usage: %s load|index|batch|bulk|tlb|journal|reverse|checkpoint [count]\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,99 @@
+#include "answer_subset.h"
+#include "dns_packet.h"
+#include "dns_server.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+namespace answer_subset {
+    namespace {
+        constexpr size_t RDATA_OFFSET = 10;   // TYPE, CLASS, TTL and RDLENGTH come first
+
+        bool parseNumber(std::string_view text, uint32_t& out) {
+            auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), out);
+            return error == std::errc{} && end == text.data() + text.size();
+        }
+    }
+
+    void buildAlias(std::span<const uint32_t> weights, std::span<AliasSlot> table) {
+        // Scale every weight so the average is 1, then pair each slot below
+        // 1 with one above it that tops it up
+        size_t n = weights.size();
+        double total = 0.0;
+        for (uint32_t weight : weights) total += weight;
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        for (uint32_t i = 0; i < n; ++i) {
+            scaled[i] = weights[i] * static_cast<double>(n) / total;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            uint32_t low = small.back();
+            uint32_t high = large.back();
+            small.pop_back();
+            table[low] = {static_cast<uint32_t>(scaled[low] * 4294967296.0), high};
+            scaled[high] -= 1.0 - scaled[low];
+            if (scaled[high] < 1.0) {
+                large.pop_back();
+                small.push_back(high);
+            }
+        }
+        // What is left is 1 up to rounding
+        for (uint32_t i : small) table[i] = {UINT32_MAX, i};
+        for (uint32_t i : large) table[i] = {UINT32_MAX, i};
+    }
+
+    uint32_t Rule::weightOf(std::span<const uint8_t> tail) const noexcept {
+        auto rdata = tail.subspan(RDATA_OFFSET);
+        for (const auto& [value, weight] : weights) {
+            if (value.size() == rdata.size() && std::memcmp(value.data(), rdata.data(), rdata.size()) == 0) {
+                return weight;
+            }
+        }
+        return 1;
+    }
+
+    bool Rules::add(std::string_view spec) {
+        size_t first = spec.find('/');
+        size_t second = first == std::string_view::npos ? first : spec.find('/', first + 1);
+        if (second == std::string_view::npos) return false;
+        size_t third = spec.find('/', second + 1);
+
+        Rule rule;
+        dns_packet::WireName owner;
+        std::string type(spec.substr(first + 1, second - first - 1));
+        uint32_t count = 0;
+        rule.type = to_type_code(parse_record_type(type));
+        if (!owner.assign(spec.substr(0, first)) || rule.type == 0 ||
+            !parseNumber(spec.substr(second + 1, third == std::string_view::npos ? third : third - second - 1), count) ||
+            count == 0 || count > UINT16_MAX) {
+            return false;
+        }
+        rule.owner.assign(owner.bytes().begin(), owner.bytes().end());
+        rule.count = static_cast<uint16_t>(count);
+
+        std::string_view list = third == std::string_view::npos ? std::string_view() : spec.substr(third + 1);
+        while (!list.empty()) {
+            size_t comma = list.find(',');
+            std::string_view entry = list.substr(0, comma);
+            list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+            size_t equals = entry.rfind('=');
+            uint32_t weight = 0;
+            std::vector<uint8_t> rdata;
+            if (equals == std::string_view::npos || !parseNumber(entry.substr(equals + 1), weight) || weight == 0 ||
+                !dns_packet::encodeRData(rule.type, entry.substr(0, equals), rdata)) {
+                return false;
+            }
+            rule.weights.emplace_back(std::move(rdata), weight);
+        }
+        rules.push_back(std::move(rule));
+        return true;
+    }
+
+    const Rule* Rules::find(std::span<const uint8_t> owner, uint16_t type) const noexcept {
+        auto rule = std::ranges::find_if(rules, [&](const Rule& r) {
+            return r.type == type && std::ranges::equal(r.owner, owner);
+        });
+        return rule != rules.end() ? &*rule : nullptr;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Weighted subsets of very large RRsets. A rule names an RRset, e.g. the
+// hundreds of A records of a service name, and how many of its records go
+// into one answer; each answer then carries that many distinct records,
+// drawn at random in proportion to their weights. Snapshots turn every
+// matching RRset into an alias table when they are built (Vose's method),
+// so a draw costs one random number and one table slot, and an answer of K
+// records costs O(K) however large the RRset.
+namespace answer_subset {
+    // One slot of an alias table: slot i is taken with probability
+    // threshold / 2^32, otherwise its alias is
+    struct AliasSlot {
+        uint32_t threshold;
+        uint32_t alias;
+    };
+
+    // Fill table (one slot per weight) so that draws pick index i with
+    // probability weights[i] / sum(weights). Weights must be positive.
+    void buildAlias(std::span<const uint32_t> weights, std::span<AliasSlot> table);
+
+    // Index drawn from a table with 64 random bits
+    [[nodiscard]]
+    inline uint32_t draw(std::span<const AliasSlot> table, uint64_t random) noexcept {
+        uint32_t slot = static_cast<uint32_t>(((random >> 32) * table.size()) >> 32);
+        return static_cast<uint32_t>(random) < table[slot].threshold ? slot : table[slot].alias;
+    }
+
+    struct Rule {
+        std::vector<uint8_t> owner;   // Lowercased wire-format name
+        uint16_t type = 0;
+        uint16_t count = 0;           // Records per answer
+        // RDATA with a weight other than 1
+        std::vector<std::pair<std::vector<uint8_t>, uint32_t>> weights;
+
+        // Weight of an RR given as TYPE..RDATA
+        [[nodiscard]]
+        uint32_t weightOf(std::span<const uint8_t> tail) const noexcept;
+    };
+
+    // The rules of a server; set up before serving and shared read-only
+    // with the snapshot builders through SnapshotOptions
+    class Rules {
+    public:
+        // spec is NAME/TYPE/COUNT, optionally followed by
+        // /VALUE=WEIGHT,VALUE=WEIGHT,... for records weighted other than 1,
+        // e.g. "pool.example.com/A/8/192.0.2.1=5,192.0.2.2=3". False when
+        // any part does not parse.
+        [[nodiscard]]
+        bool add(std::string_view spec);
+
+        // Rule for an owner and type, or nullptr
+        [[nodiscard]]
+        const Rule* find(std::span<const uint8_t> owner, uint16_t type) const noexcept;
+
+        [[nodiscard]]
+        bool empty() const noexcept { return rules.empty(); }
+
+    private:
+        std::vector<Rule> rules;
+    };
+}
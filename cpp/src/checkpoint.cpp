@@ -0,0 +1,251 @@
+#include "checkpoint.h"
+#include "huge_pages.h"
+#include "journal.h"
+#include "zone.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+    constexpr char MAGIC[8] = {'D', 'N', 'S', 'C', 'K', 'P', 'T', '6'};
+    constexpr size_t CHECKSUM_SIZE = 4;
+    constexpr char END_MARK[8] = {'D', 'N', 'S', 'C', 'K', 'E', 'N', 'D'};
+
+    [[noreturn]] void fail(const char* what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    void writeAll(int fd, const uint8_t* data, size_t size) {
+        for (size_t done = 0; done < size;) {
+            ssize_t n = ::write(fd, data + done, size - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) fail("checkpoint write");
+            done += static_cast<size_t>(n);
+        }
+    }
+
+    // Flush the directory holding path, which makes a rename into it durable
+    void syncDirectory(const std::string& path) {
+        size_t slash = path.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) fail("checkpoint directory open");
+        int result = fsync(fd);
+        int error = errno;
+        close(fd);
+        errno = error;
+        if (result != 0) fail("checkpoint directory fsync");
+    }
+
+    // Read-only mapping of a whole file, unmapped when the last snapshot
+    // viewing it goes
+    struct Mapping {
+        void* data = MAP_FAILED;
+        size_t size = 0;
+
+        ~Mapping() {
+            if (data != MAP_FAILED) munmap(data, size);
+        }
+    };
+}
+
+namespace checkpoint {
+    void Writer::raw(const void* data, size_t size) {
+        const auto* bytes = static_cast<const uint8_t*>(data);
+        crc = Journal::checksum({bytes, size}, crc);
+        if (buffer.size() + size <= BUFFER_SIZE) {
+            buffer.insert(buffer.end(), bytes, bytes + size);
+            return;
+        }
+        // Large arrays go straight from the snapshot to the file
+        flush();
+        if (size >= BUFFER_SIZE) {
+            writeAll(fd, bytes, size);
+            written += size;
+        } else {
+            buffer.insert(buffer.end(), bytes, bytes + size);
+        }
+    }
+
+    void Writer::pad(size_t alignment) {
+        static constexpr uint8_t ZEROS[64] = {};
+        size_t gap = (alignment - size() % alignment) % alignment;
+        raw(ZEROS, gap);
+    }
+
+    void Writer::flush() {
+        writeAll(fd, buffer.data(), buffer.size());
+        written += buffer.size();
+        buffer.clear();
+    }
+
+    uint64_t write(const std::string& path, std::span<const ZoneImage> zones, uint64_t journalPosition) {
+        std::string temporary = path + ".tmp";
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) fail("checkpoint open");
+
+        // A failed attempt leaves no partial image behind
+        auto abandon = [&](const char* what) {
+            int error = errno;
+            close(fd);
+            unlink(temporary.c_str());
+            errno = error;
+            fail(what);
+        };
+        uint64_t size = 0;
+        try {
+            Writer out(fd);
+            out.raw(MAGIC, sizeof(MAGIC));
+            out.u64(journalPosition);
+            out.u64(zones.size());
+            for (const ZoneImage& zone : zones) {
+                out.string(zone.origin);
+                out.u8(zone.transferred ? 1 : 0);
+                zone.snapshot->save(out);
+            }
+            out.raw(END_MARK, sizeof(END_MARK));
+            out.u32(out.checksum());
+            out.flush();
+            size = out.size();
+        } catch (const std::system_error& error) {
+            errno = error.code().value();
+            abandon("checkpoint write");
+        }
+        if (fsync(fd) != 0) abandon("checkpoint fsync");
+        if (close(fd) != 0) {
+            int error = errno;
+            unlink(temporary.c_str());
+            errno = error;
+            fail("checkpoint close");
+        }
+        if (rename(temporary.c_str(), path.c_str()) != 0) {
+            int error = errno;
+            unlink(temporary.c_str());
+            errno = error;
+            fail("checkpoint rename");
+        }
+        syncDirectory(path);
+        return size;
+    }
+
+    bool read(const std::string& path, std::vector<ZoneImage>& zones, uint64_t& journalPosition,
+              std::string& error) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error = "cannot open " + path + ": " + std::strerror(errno);
+            return false;
+        }
+        auto mapping = std::make_shared<Mapping>();
+        Mapping& file = *mapping;
+        struct stat info {};
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            file.size = static_cast<size_t>(info.st_size);
+            file.data = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        }
+        int mapError = errno;
+        close(fd);
+        if (file.data == MAP_FAILED) {
+            error = "cannot map " + path + ": " + std::strerror(file.size == 0 ? EINVAL : mapError);
+            return false;
+        }
+        // The tables are served from here now, so ask for the same huge
+        // pages a built snapshot gets; file pages may not be promoted
+        if (huge_pages::mode() != huge_pages::Mode::Off) madvise(file.data, file.size, MADV_HUGEPAGE);
+
+        // The indexes in the image are used unchecked on the packet path, so
+        // one with a flipped bit must not get that far
+        std::span<const uint8_t> image(static_cast<const uint8_t*>(file.data), file.size);
+        uint32_t stored = 0;
+        if (image.size() < sizeof(MAGIC) + CHECKSUM_SIZE ||
+            std::memcmp(image.data(), MAGIC, sizeof(MAGIC)) != 0) {
+            error = path + " is not a checkpoint";
+            return false;
+        }
+        std::memcpy(&stored, image.data() + image.size() - CHECKSUM_SIZE, CHECKSUM_SIZE);
+        image = image.first(image.size() - CHECKSUM_SIZE);
+        if (Journal::checksum(image) != stored) {
+            error = path + " fails its checksum";
+            return false;
+        }
+
+        Reader in(image, mapping);
+        char magic[sizeof(MAGIC)];
+        uint64_t count = 0;
+        if (!in.raw(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+            !in.u64(journalPosition) || !in.u64(count) || count > file.size) {
+            error = path + " is not a checkpoint";
+            return false;
+        }
+        std::vector<ZoneImage> loaded;
+        loaded.reserve(count);
+        for (uint64_t i = 0; i < count; ++i) {
+            ZoneImage zone;
+            uint8_t transferred = 0;
+            if (!in.string(zone.origin) || !in.u8(transferred) || !(zone.snapshot = ZoneSnapshot::load(in))) {
+                error = path + " is damaged at zone " + std::to_string(i);
+                return false;
+            }
+            zone.transferred = transferred != 0;
+            loaded.push_back(std::move(zone));
+        }
+        char end[sizeof(END_MARK)];
+        if (!in.raw(end, sizeof(end)) || std::memcmp(end, END_MARK, sizeof(END_MARK)) != 0 || !in.atEnd()) {
+            error = path + " is incomplete";
+            return false;
+        }
+        zones = std::move(loaded);
+        return true;
+    }
+}
+
+Checkpointer::Checkpointer(DNSServer& server, std::string path)
+    : server(server), path(std::move(path)) {}
+
+Checkpointer::~Checkpointer() {
+    wait();
+}
+
+bool Checkpointer::start(uint64_t journalPosition) {
+    if (running.exchange(true, std::memory_order_acq_rel)) return false;
+    if (worker.joinable()) worker.join();
+    worker = std::thread([this, zones = server.capture(), journalPosition] {
+        auto started = std::chrono::steady_clock::now();
+        bool ok = true;
+        uint64_t bytes = 0;
+        std::string error;
+        try {
+            bytes = checkpoint::write(path, zones, journalPosition);
+        } catch (const std::system_error& failure) {
+            ok = false;
+            error = failure.what();
+        }
+
+        Stats snapshot;
+        {
+            std::lock_guard lock(mutex);
+            (ok ? counters.written : counters.failures)++;
+            counters.lastDuration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - started);
+            counters.lastBytes = bytes;
+            counters.lastZones = zones.size();
+            if (!ok) counters.lastError = std::move(error);
+            snapshot = counters;
+        }
+        if (done) done(ok, snapshot);
+        running.store(false, std::memory_order_release);
+    });
+    return true;
+}
+
+void Checkpointer::wait() {
+    if (worker.joinable()) worker.join();
+}
+
+Checkpointer::Stats Checkpointer::stats() const {
+    std::lock_guard lock(mutex);
+    return counters;
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "dns_server.h"
+#include "mapped_array.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// On-disk image of the published zones, so a restart serves again without
+// recompiling them. Every snapshot is written as it is served: the owner,
+// RRset and pre-encoded RR arrays, the name index (hash table or perfect
+// hash), the negative filter and the reverse index, each as one raw block
+// in the byte order of the machine that wrote it, aligned for its element
+// type. A CRC-32C of everything before it closes the image, and is checked
+// before any of it is trusted. Loading maps the file, checks it and points
+// the restored snapshots' arrays into the mapping instead of copying them;
+// the mapping stays until the last snapshot reading from it is dropped.
+namespace checkpoint {
+    // Buffered appends to an open file; throws std::system_error when a
+    // write fails
+    class Writer {
+    public:
+        explicit Writer(int fd) : fd(fd) {}
+
+        void raw(const void* data, size_t size);
+        void u8(uint8_t value) { raw(&value, sizeof(value)); }
+        void u32(uint32_t value) { raw(&value, sizeof(value)); }
+        void u64(uint64_t value) { raw(&value, sizeof(value)); }
+
+        void string(std::string_view text) {
+            u64(text.size());
+            raw(text.data(), text.size());
+        }
+
+        // Element count, zero bytes up to the alignment of the element type,
+        // then the elements as they lie in memory
+        template <std::ranges::contiguous_range Array>
+        void array(const Array& values) {
+            using T = std::ranges::range_value_t<Array>;
+            static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= 64);
+            u64(std::ranges::size(values));
+            pad(alignof(T));
+            raw(std::ranges::data(values), std::ranges::size(values) * sizeof(T));
+        }
+
+        // Write out what is still buffered
+        void flush();
+
+        // Bytes taken so far, buffered ones included
+        [[nodiscard]]
+        uint64_t size() const noexcept { return written + buffer.size(); }
+
+        // CRC-32C of the bytes taken so far
+        [[nodiscard]]
+        uint32_t checksum() const noexcept { return crc; }
+
+    private:
+        static constexpr size_t BUFFER_SIZE = 1u << 20;
+
+        // Zero bytes up to the next multiple of alignment in the file
+        void pad(size_t alignment);
+
+        int fd;
+        std::vector<uint8_t> buffer;
+        uint64_t written = 0;
+        uint32_t crc = 0;
+    };
+
+    // Bounds-checked reads from a mapped image; every read is false, with
+    // nothing consumed, when the image ends first. data must start at the
+    // start of the file. Arrays view the image in place when mapping, which
+    // keeps it alive, is given, and are copied out of it otherwise.
+    class Reader {
+    public:
+        explicit Reader(std::span<const uint8_t> data, std::shared_ptr<const void> mapping = nullptr)
+            : data(data), mapping(std::move(mapping)) {}
+
+        [[nodiscard]]
+        bool raw(void* out, size_t size) {
+            if (size > data.size() - offset) return false;
+            std::memcpy(out, data.data() + offset, size);
+            offset += size;
+            return true;
+        }
+
+        [[nodiscard]]
+        bool u8(uint8_t& out) { return raw(&out, sizeof(out)); }
+
+        [[nodiscard]]
+        bool u32(uint32_t& out) { return raw(&out, sizeof(out)); }
+
+        [[nodiscard]]
+        bool u64(uint64_t& out) { return raw(&out, sizeof(out)); }
+
+        [[nodiscard]]
+        bool string(std::string& out) {
+            uint64_t size = 0;
+            if (!u64(size) || size > data.size() - offset) return false;
+            out.assign(reinterpret_cast<const char*>(data.data() + offset), size);
+            offset += size;
+            return true;
+        }
+
+        template <typename T>
+        [[nodiscard]]
+        bool array(MappedArray<T>& out) {
+            static_assert(std::is_trivially_copyable_v<T>);
+            uint64_t count = 0;
+            size_t start = offset;
+            size_t skip = (alignof(T) - (offset + sizeof(count)) % alignof(T)) % alignof(T);
+            if (!u64(count) || skip > data.size() - offset ||
+                count > (data.size() - offset - skip) / sizeof(T)) {
+                offset = start;
+                return false;
+            }
+            offset += skip;
+            if (mapping) {
+                out.map(reinterpret_cast<const T*>(data.data() + offset), count, mapping);
+            } else {
+                out.assign(count, T{});
+                std::memcpy(out.data(), data.data() + offset, count * sizeof(T));
+            }
+            offset += count * sizeof(T);
+            return true;
+        }
+
+        [[nodiscard]]
+        bool atEnd() const noexcept { return offset == data.size(); }
+
+    private:
+        std::span<const uint8_t> data;
+        std::shared_ptr<const void> mapping;
+        size_t offset = 0;
+    };
+
+    // Write zones, which include the journal up to journalPosition, to
+    // path: the image goes to path.tmp, is flushed to disk and renamed over
+    // path, so path always holds a complete checkpoint. Returns the bytes
+    // written; throws std::system_error on failure.
+    uint64_t write(const std::string& path, std::span<const ZoneImage> zones, uint64_t journalPosition);
+
+    // Map and load the checkpoint at path. False with error set when it
+    // cannot be read, is not a complete checkpoint or fails its checksum.
+    [[nodiscard]]
+    bool read(const std::string& path, std::vector<ZoneImage>& zones, uint64_t& journalPosition,
+              std::string& error);
+}
+
+// Writes checkpoints of a server's zones on a thread of its own. start()
+// captures the published snapshots on the calling thread, which takes only
+// their pointers, and the worker serializes those immutable snapshots while
+// updates carry on. Only the controlling thread calls start() and wait().
+class Checkpointer {
+public:
+    struct Stats {
+        uint64_t written = 0;
+        uint64_t failures = 0;
+        std::chrono::milliseconds lastDuration{0};   // Serialize and sync
+        uint64_t lastBytes = 0;
+        size_t lastZones = 0;
+        std::string lastError;                       // Of the last failure
+    };
+
+    Checkpointer(DNSServer& server, std::string path);
+    ~Checkpointer();
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+    // Called on the worker thread after every attempt
+    void setListener(std::function<void(bool ok, const Stats& stats)> listener) { done = std::move(listener); }
+
+    // Checkpoint the zones published now. journalPosition is the journal
+    // offset they include, so the caller must not have a batch written to
+    // the journal but not yet applied. False when a checkpoint is running.
+    bool start(uint64_t journalPosition);
+
+    [[nodiscard]]
+    bool busy() const noexcept { return running.load(std::memory_order_acquire); }
+
+    // Wait for a running checkpoint to finish
+    void wait();
+
+    [[nodiscard]]
+    Stats stats() const;
+
+private:
+    DNSServer& server;
+    const std::string path;
+    std::function<void(bool ok, const Stats& stats)> done;
+    mutable std::mutex mutex;      // Guards counters
+    Stats counters;
+    std::atomic<bool> running{false};
+    std::thread worker;
+};
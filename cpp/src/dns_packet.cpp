@@ -0,0 +1,530 @@
+#include "dns_packet.h"
+#include "dns_server.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <charconv>
+#include <cstring>
+
+namespace dns_packet {
+
+namespace {
+    constexpr uint64_t NAME_HASH_SEED = 0xcbf29ce484222325ULL;
+    constexpr uint64_t NAME_HASH_PRIME = 0x100000001b3ULL;
+
+    // Final avalanche step so table indices can be taken from the low bits
+    constexpr uint64_t mixHash(uint64_t h) noexcept {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    constexpr uint8_t lowerByte(uint8_t c) noexcept {
+        return (c >= 'A' && c <= 'Z') ? static_cast<uint8_t>(c + ('a' - 'A')) : c;
+    }
+
+    // Split off the next whitespace-separated token of value
+    std::string_view nextToken(std::string_view& value) {
+        size_t start = value.find_first_not_of(" \t");
+        if (start == std::string_view::npos) {
+            value = {};
+            return {};
+        }
+        size_t end = value.find_first_of(" \t", start);
+        std::string_view token = value.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start);
+        value = end == std::string_view::npos ? std::string_view{} : value.substr(end);
+        return token;
+    }
+
+    template <typename T>
+    bool parseNumber(std::string_view token, T& out) {
+        auto result = std::from_chars(token.data(), token.data() + token.size(), out);
+        return result.ec == std::errc{} && result.ptr == token.data() + token.size();
+    }
+
+    // Longest presentation form of a 255-byte wire name, dots included
+    constexpr size_t MAX_NAME_TEXT = 254;
+
+    // Encode a dotted name straight onto the end of out, one label at a
+    // time. False, with out as it was, for a name WireName::assign() would
+    // refuse: an empty label, one over 63 bytes or more than 255 in all.
+    bool appendDomainName(std::vector<uint8_t>& out, std::string_view domain) {
+        size_t start = out.size();
+        if (!domain.empty() && domain.back() == '.') domain.remove_suffix(1);
+        while (!domain.empty()) {
+            size_t dot = domain.find('.');
+            std::string_view label = domain.substr(0, dot);
+            if (label.empty() || label.size() > 63 || out.size() - start + label.size() + 2 > WireName::MAX_LENGTH) {
+                out.resize(start);
+                return false;
+            }
+            out.push_back(static_cast<uint8_t>(label.size()));
+            out.insert(out.end(), label.begin(), label.end());
+            domain = dot == std::string_view::npos ? std::string_view{} : domain.substr(dot + 1);
+        }
+        out.push_back(0);  // End with a zero length label
+        return true;
+    }
+
+    // Decode the (possibly compressed) name at offset into dotted text,
+    // appending to whichever string type the caller allocates from
+    template <typename String>
+    void appendDomainText(std::span<const uint8_t> packet, size_t& offset, String& domainName) {
+        while (offset < packet.size()) {
+            uint8_t labelLength = packet[offset++];
+            if (labelLength == 0) {
+                break;  // End of domain name
+            }
+
+            // Handle DNS message compression (RFC1035 section 4.1.4)
+            if ((labelLength & 0xC0) == 0xC0) {
+                if (offset >= packet.size()) break;
+                uint16_t pointer = ((labelLength & 0x3F) << 8) | packet[offset++];
+                size_t savedOffset = offset;
+                if (pointer >= savedOffset - 2) break;  // Only backwards pointers can terminate
+                offset = pointer;
+                appendDomainText(packet, offset, domainName);
+                offset = savedOffset;
+                return;
+            }
+
+            // Regular label
+            if (!domainName.empty()) {
+                domainName += '.';
+            }
+            for (int i = 0; i < labelLength && offset < packet.size(); i++) {
+                domainName += static_cast<char>(packet[offset++]);
+            }
+        }
+    }
+
+    // Append text as one or more <character-string>s of at most 255 bytes
+    void appendCharacterStrings(std::vector<uint8_t>& out, std::string_view text) {
+        do {
+            size_t chunk = std::min<size_t>(text.size(), 255);
+            out.push_back(static_cast<uint8_t>(chunk));
+            out.insert(out.end(), text.begin(), text.begin() + chunk);
+            text.remove_prefix(chunk);
+        } while (!text.empty());
+    }
+
+    // Decode a name inside RDATA ending at or before end; offset moves past it
+    bool decodeName(std::span<const uint8_t> message, size_t& offset, size_t end, std::string& out) {
+        WireName name;
+        if (!name.parse(message.first(end), offset)) return false;
+        out += name.toString();
+        return true;
+    }
+
+    bool decodeCharacterString(std::span<const uint8_t> message, size_t& offset, size_t end, std::string& out) {
+        if (offset >= end || offset + 1 + message[offset] > end) return false;
+        out.append(reinterpret_cast<const char*>(message.data() + offset + 1), message[offset]);
+        offset += 1 + message[offset];
+        return true;
+    }
+}
+
+uint64_t hashName(std::span<const uint8_t> wire) noexcept {
+    uint64_t h = NAME_HASH_SEED;
+    for (size_t i = wire.size(); i > 0; --i) {
+        h = (h ^ wire[i - 1]) * NAME_HASH_PRIME;
+    }
+    return mixHash(h);
+}
+
+bool WireName::parse(std::span<const uint8_t> packet, size_t& offset) noexcept {
+    size_t position = offset;
+    size_t jumps = 0;
+    bool jumped = false;
+    length_ = 0;
+    labels_ = 0;
+
+    while (true) {
+        if (position >= packet.size()) return false;
+        uint8_t labelLength = packet[position];
+
+        if ((labelLength & 0xC0) == 0xC0) {
+            // Compression pointer (RFC1035 section 4.1.4); bound the number of
+            // jumps so a pointer loop cannot spin forever
+            if (position + 1 >= packet.size() || ++jumps > MAX_LABELS) return false;
+            size_t target = ((labelLength & 0x3F) << 8) | packet[position + 1];
+            if (!jumped) {
+                offset = position + 2;
+                jumped = true;
+            }
+            position = target;
+            continue;
+        }
+        if ((labelLength & 0xC0) != 0) return false;  // Reserved label types
+
+        if (labelLength == 0) {
+            offsets_[labels_] = length_;
+            data_[length_++] = 0;
+            if (!jumped) offset = position + 1;
+            return true;
+        }
+
+        if (labels_ >= MAX_LABELS || length_ + labelLength + 2u > MAX_LENGTH ||
+            position + 1 + labelLength > packet.size()) {
+            return false;
+        }
+        offsets_[labels_++] = length_;
+        data_[length_++] = labelLength;
+        for (size_t i = 1; i <= labelLength; ++i) {
+            data_[length_++] = lowerByte(packet[position + i]);
+        }
+        position += 1 + labelLength;
+    }
+}
+
+bool WireName::assign(std::string_view text) noexcept {
+    length_ = 0;
+    labels_ = 0;
+    if (!text.empty() && text.back() == '.') text.remove_suffix(1);
+
+    while (!text.empty()) {
+        size_t dot = text.find('.');
+        std::string_view label = text.substr(0, dot);
+        if (label.empty() || label.size() > 63 || labels_ >= MAX_LABELS ||
+            length_ + label.size() + 2 > MAX_LENGTH) {
+            return false;
+        }
+        offsets_[labels_++] = length_;
+        data_[length_++] = static_cast<uint8_t>(label.size());
+        for (char c : label) {
+            data_[length_++] = lowerByte(static_cast<uint8_t>(c));
+        }
+        text = dot == std::string_view::npos ? std::string_view{} : text.substr(dot + 1);
+    }
+    offsets_[labels_] = length_;
+    data_[length_++] = 0;
+    return true;
+}
+
+void WireName::suffixHashes(uint64_t* out) const noexcept {
+    // One backwards pass; whenever the fold reaches the start of a label the
+    // running value is the (unmixed) hash of the suffix beginning there
+    uint64_t h = NAME_HASH_SEED;
+    size_t label = labels_;
+    h = (h ^ data_[length_ - 1]) * NAME_HASH_PRIME;
+    out[label] = mixHash(h);
+    for (size_t i = length_ - 1; i > 0; --i) {
+        h = (h ^ data_[i - 1]) * NAME_HASH_PRIME;
+        if (label > 0 && i - 1 == offsets_[label - 1]) {
+            out[--label] = mixHash(h);
+        }
+    }
+}
+
+std::string WireName::toString() const {
+    std::string result;
+    for (size_t i = 0; i < labels_; ++i) {
+        if (!result.empty()) result += '.';
+        size_t start = offsets_[i];
+        result.append(reinterpret_cast<const char*>(data_ + start + 1), data_[start]);
+    }
+    return result;
+}
+
+bool SOAData::parse(std::string_view value, SOAData& out) {
+    std::string_view mname = nextToken(value);
+    std::string_view rname = nextToken(value);
+    WireName check;
+    if (mname.empty() || rname.empty() || !check.assign(mname) || !check.assign(rname)) return false;
+    out.mname = std::string(mname);
+    out.rname = std::string(rname);
+
+    uint32_t* fields[] = {&out.serial, &out.refresh, &out.retry, &out.expire, &out.minimum};
+    for (uint32_t* field : fields) {
+        if (!parseNumber(nextToken(value), *field)) return false;
+    }
+    return nextToken(value).empty();
+}
+
+void SOAData::encode(std::vector<uint8_t>& out) const {
+    appendDomainName(out, mname);
+    appendDomainName(out, rname);
+    appendUint32(out, serial);
+    appendUint32(out, refresh);
+    appendUint32(out, retry);
+    appendUint32(out, expire);
+    appendUint32(out, minimum);
+}
+
+// Implementation of DNS packet reader's readDomainName method
+std::string PacketReader::readDomainName() {
+    std::string result;
+    uint8_t length = readUint8();
+
+    // Handle DNS domain name compression and standard format
+    while (length > 0) {
+        // Check if this is a pointer (compression method)
+        if ((length & 0xC0) == 0xC0) {
+            // This is a pointer - the next byte plus the lower 6 bits of this byte
+            // form a 14-bit offset to where the actual name is stored
+            uint8_t offsetLow = readUint8();
+            uint16_t offset = ((length & 0x3F) << 8) | offsetLow;
+
+            // Save current position
+            size_t savedPosition = position;
+
+            // Jump to the offset
+            position = offset;
+
+            // Read the rest of the name recursively
+            std::string suffix = readDomainName();
+            if (!result.empty()) {
+                result += ".";
+            }
+            result += suffix;
+
+            // Restore position and exit - pointers always terminate a name
+            position = savedPosition;
+            return result;
+        } else {
+            // This is a standard label
+            auto label = readBytes(length);
+
+            // Convert to string and append
+            if (!result.empty()) {
+                result += ".";
+            }
+
+            // Convert bytes to string using traditional methods
+            for (const auto& byte : label) {
+                result += static_cast<char>(byte);
+            }
+
+            // Read next length byte
+            length = readUint8();
+        }
+    }
+
+    return result;
+}
+
+std::string parseDomainName(std::span<const uint8_t> packet, size_t& offset) {
+    std::string domainName;
+    appendDomainText(packet, offset, domainName);
+    return domainName;
+}
+
+std::pmr::string parseDomainName(std::span<const uint8_t> packet, size_t& offset,
+                                 std::pmr::memory_resource* memory) {
+    std::pmr::string domainName(memory);
+    domainName.reserve(MAX_NAME_TEXT);
+    appendDomainText(packet, offset, domainName);
+    return domainName;
+}
+
+std::vector<uint8_t> encodeDomainName(std::string_view domain) {
+    std::vector<uint8_t> result;
+    result.reserve(domain.size() + 2);
+    if (!appendDomainName(result, domain)) result.clear();
+    return result;
+}
+
+bool encodeRData(uint16_t type, std::string_view value, std::vector<uint8_t>& out) {
+    switch (from_type_code(type)) {
+        case RecordType::A: {
+            std::string text(value);
+            uint8_t addr[4];
+            if (inet_pton(AF_INET, text.c_str(), addr) != 1) return false;
+            out.insert(out.end(), addr, addr + sizeof(addr));
+            return true;
+        }
+        case RecordType::AAAA: {
+            std::string text(value);
+            uint8_t addr[16];
+            if (inet_pton(AF_INET6, text.c_str(), addr) != 1) return false;
+            out.insert(out.end(), addr, addr + sizeof(addr));
+            return true;
+        }
+        case RecordType::NS:
+        case RecordType::CNAME:
+        case RecordType::PTR:
+            return appendDomainName(out, value);
+        case RecordType::MX: {
+            // Parse "priority hostname" format; a bare hostname gets priority 10
+            uint16_t priority = 10;
+            std::string_view rest = value;
+            std::string_view first = nextToken(rest);
+            std::string_view second = nextToken(rest);
+            std::string_view hostname = value;
+            if (!second.empty() && parseNumber(first, priority)) {
+                hostname = second;
+            }
+            size_t start = out.size();
+            appendUint16(out, priority);
+            if (appendDomainName(out, hostname)) return true;
+            out.resize(start);
+            return false;
+        }
+        case RecordType::SRV: {
+            // "priority weight port target", all four required
+            std::string_view rest = value;
+            uint16_t fields[3];
+            for (uint16_t& field : fields) {
+                if (!parseNumber(nextToken(rest), field)) return false;
+            }
+            std::string_view target = nextToken(rest);
+            if (target.empty() || !nextToken(rest).empty()) return false;
+            size_t start = out.size();
+            for (uint16_t field : fields) appendUint16(out, field);
+            if (appendDomainName(out, target)) return true;
+            out.resize(start);
+            return false;
+        }
+        case RecordType::TXT:
+            appendCharacterStrings(out, value);
+            return true;
+        case RecordType::HINFO: {
+            std::string_view rest = value;
+            std::string_view cpu = nextToken(rest);
+            std::string_view os = nextToken(rest);
+            appendCharacterStrings(out, cpu);
+            appendCharacterStrings(out, os);
+            return true;
+        }
+        case RecordType::SOA: {
+            SOAData soa;
+            if (!SOAData::parse(value, soa)) return false;
+            soa.encode(out);
+            return true;
+        }
+        case RecordType::Unknown:
+        default:
+            // For other record types, just encode as a string (fallback)
+            out.insert(out.end(), value.begin(), value.end());
+            return true;
+    }
+}
+
+bool decodeRData(uint16_t type, std::span<const uint8_t> message, size_t offset, size_t length,
+                 std::string& out) {
+    size_t end = offset + length;
+    if (end > message.size()) return false;
+    switch (from_type_code(type)) {
+        case RecordType::A:
+        case RecordType::AAAA: {
+            int family = length == 4 ? AF_INET : AF_INET6;
+            char text[INET6_ADDRSTRLEN];
+            if ((length != 4 && length != 16) || (type == to_type_code(RecordType::A)) != (length == 4) ||
+                inet_ntop(family, message.data() + offset, text, sizeof(text)) == nullptr) {
+                return false;
+            }
+            out += text;
+            return true;
+        }
+        case RecordType::NS:
+        case RecordType::CNAME:
+        case RecordType::PTR:
+            return decodeName(message, offset, end, out) && offset == end;
+        case RecordType::MX: {
+            if (length < 3) return false;
+            out += std::to_string(readUint16(message, offset));
+            out += ' ';
+            offset += 2;
+            return decodeName(message, offset, end, out) && offset == end;
+        }
+        case RecordType::SRV: {
+            if (length < 7) return false;
+            for (int field = 0; field < 3; ++field, offset += 2) {
+                out += std::to_string(readUint16(message, offset));
+                out += ' ';
+            }
+            return decodeName(message, offset, end, out) && offset == end;
+        }
+        case RecordType::TXT:
+            // encodeRData splits one string into 255-byte pieces; join them back
+            while (offset < end) {
+                if (!decodeCharacterString(message, offset, end, out)) return false;
+            }
+            return length > 0;
+        case RecordType::HINFO:
+            if (!decodeCharacterString(message, offset, end, out)) return false;
+            out += ' ';
+            return decodeCharacterString(message, offset, end, out) && offset == end;
+        case RecordType::SOA: {
+            if (!decodeName(message, offset, end, out)) return false;
+            out += ' ';
+            if (!decodeName(message, offset, end, out) || offset + 20 != end) return false;
+            for (int field = 0; field < 5; ++field, offset += 4) {
+                uint32_t value = (static_cast<uint32_t>(readUint16(message, offset)) << 16) |
+                                 readUint16(message, offset + 2);
+                out += ' ';
+                out += std::to_string(value);
+            }
+            return true;
+        }
+        case RecordType::Unknown:
+        default:
+            out.append(reinterpret_cast<const char*>(message.data() + offset), length);
+            return true;
+    }
+}
+
+void appendRecordTail(std::vector<uint8_t>& out, uint16_t type, uint32_t ttl,
+                      std::span<const uint8_t> rdata) {
+    appendUint16(out, type);
+    appendUint16(out, CLASS_IN);
+    appendUint32(out, ttl);
+    appendUint16(out, static_cast<uint16_t>(rdata.size()));
+    out.insert(out.end(), rdata.begin(), rdata.end());
+}
+
+bool appendRecordTail(std::vector<uint8_t>& out, uint16_t type, uint32_t ttl, std::string_view value) {
+    size_t start = out.size();
+    appendUint16(out, type);
+    appendUint16(out, CLASS_IN);
+    appendUint32(out, ttl);
+    appendUint16(out, 0);   // RDLENGTH, patched below
+    if (!encodeRData(type, value, out) || out.size() - start - 10 > 0xFFFF) {
+        out.resize(start);
+        return false;
+    }
+    writeUint16(out, start + 8, static_cast<uint16_t>(out.size() - start - 10));
+    return true;
+}
+
+bool readEdns(std::span<const uint8_t> message, size_t offset, Edns& out) noexcept {
+    out = {};
+    uint16_t arcount = readUint16(message, 10);
+    if (arcount == 0) return true;   // The common case: nothing to walk
+
+    // Skip any further questions and the answer and authority sections
+    size_t questions = readUint16(message, 4);
+    size_t skip = (questions > 1 ? questions - 1 : 0);
+    size_t records = readUint16(message, 6) + readUint16(message, 8);
+    WireName name;
+    for (size_t i = 0; i < skip; ++i) {
+        if (!name.parse(message, offset) || offset + 4 > message.size()) return false;
+        offset += 4;
+    }
+    for (size_t i = 0; i < records + arcount; ++i) {
+        if (!name.parse(message, offset) || offset + 10 > message.size()) return false;
+        uint16_t type = readUint16(message, offset);
+        size_t length = readUint16(message, offset + 8);
+        if (offset + 10 + length > message.size()) return false;
+        if (i >= records && type == TYPE_OPT) {
+            if (out.present || name.labelCount() != 0) return false;
+            out.present = true;
+            out.payload = readUint16(message, offset + 2);
+            out.version = message[offset + 5];
+        }
+        offset += 10 + length;
+    }
+    return true;
+}
+
+std::array<uint8_t, OPT_RR_SIZE> optRecord(uint16_t payload, uint16_t rcode) noexcept {
+    return {0,                                   // Root owner
+            0, TYPE_OPT,
+            static_cast<uint8_t>(payload >> 8), static_cast<uint8_t>(payload & 0xFF),
+            static_cast<uint8_t>(rcode >> 4), EDNS_VERSION, 0, 0,   // Extended RCODE, version, flags
+            0, 0};                               // No options
+}
+
+}
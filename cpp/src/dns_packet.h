@@ -0,0 +1,250 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>  // For uint8_t, uint16_t
+#include <memory_resource>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Wire-level helpers shared by the query path, the zone compiler and the tests
+namespace dns_packet {
+    constexpr size_t HEADER_SIZE = 12;
+    constexpr uint32_t DEFAULT_TTL = 300;
+
+    // Header flag bits (RFC1035 section 4.1.1)
+    constexpr uint8_t FLAG_QR = 0x80;
+    constexpr uint8_t FLAG_AA = 0x04;
+    constexpr uint8_t FLAG_TC = 0x02;
+    constexpr uint8_t FLAG_RD = 0x01;
+    constexpr uint8_t OPCODE_MASK = 0x78;
+
+    // Response codes
+    constexpr uint8_t RCODE_NOERROR = 0;
+    constexpr uint8_t RCODE_FORMERR = 1;
+    constexpr uint8_t RCODE_SERVFAIL = 2;
+    constexpr uint8_t RCODE_NXDOMAIN = 3;
+    constexpr uint8_t RCODE_NOTIMP = 4;
+    constexpr uint8_t RCODE_REFUSED = 5;
+    constexpr uint8_t RCODE_YXDOMAIN = 6;   // RFC2136: name exists when it should not
+    constexpr uint8_t RCODE_YXRRSET = 7;    // RRset exists when it should not
+    constexpr uint8_t RCODE_NXRRSET = 8;    // RRset that should exist does not
+    constexpr uint8_t RCODE_NOTAUTH = 9;    // Not authoritative for the zone
+    constexpr uint8_t RCODE_NOTZONE = 10;   // Name not within the zone
+
+    // Opcodes, as found in bits 3-6 of the third header byte
+    constexpr uint8_t OPCODE_QUERY = 0;
+    constexpr uint8_t OPCODE_NOTIFY = 4;
+    constexpr uint8_t OPCODE_UPDATE = 5;
+
+    constexpr uint16_t CLASS_IN = 1;
+    constexpr uint16_t CLASS_NONE = 254;
+    constexpr uint16_t CLASS_ANY = 255;
+    constexpr uint16_t QTYPE_ANY = 255;
+
+    // EDNS(0) (RFC6891): the OPT pseudo-RR in the additional section carries
+    // the sender's UDP payload size in its CLASS and the upper eight bits of
+    // the extended RCODE and the version in its TTL
+    constexpr uint16_t TYPE_OPT = 41;
+    constexpr size_t OPT_RR_SIZE = 11;        // Root owner, no options
+    constexpr size_t MAX_EDNS_PAYLOAD = 4096; // Largest UDP payload we accept or send
+    constexpr size_t DEFAULT_UDP_PAYLOAD = 1232;   // Fits an IPv6 minimum MTU without fragments
+    constexpr uint8_t EDNS_VERSION = 0;
+    constexpr uint16_t RCODE_BADVERS = 16;    // Extended RCODE: version not implemented
+
+    // Span-based DNS packet reader
+    class PacketReader {
+    private:
+        std::span<const uint8_t> data;
+        size_t position = 0;
+
+    public:
+        explicit PacketReader(std::span<const uint8_t> packet_data)
+            : data(packet_data) {}
+
+        [[nodiscard]]
+        uint8_t readUint8() {
+            if (position >= data.size()) throw std::out_of_range("Packet buffer overrun");
+            return data[position++];
+        }
+
+        [[nodiscard]]
+        uint16_t readUint16() {
+            if (position + 1 >= data.size()) throw std::out_of_range("Packet buffer overrun");
+            uint16_t value = (static_cast<uint16_t>(data[position]) << 8) | data[position + 1];
+            position += 2;
+            return value;
+        }
+
+        [[nodiscard]]
+        std::span<const uint8_t> readBytes(size_t length) {
+            if (position + length > data.size()) throw std::out_of_range("Packet buffer overrun");
+            auto result = data.subspan(position, length);
+            position += length;
+            return result;
+        }
+
+        [[nodiscard]]
+        std::string readDomainName();
+    };
+
+    // Big-endian field accessors
+    [[nodiscard]]
+    inline uint16_t readUint16(std::span<const uint8_t> data, size_t offset) {
+        return static_cast<uint16_t>((data[offset] << 8) | data[offset + 1]);
+    }
+
+    inline void writeUint16(std::span<uint8_t> data, size_t offset, uint16_t value) {
+        data[offset] = value >> 8;
+        data[offset + 1] = value & 0xFF;
+    }
+
+    inline void appendUint16(std::vector<uint8_t>& out, uint16_t value) {
+        out.push_back(value >> 8);
+        out.push_back(value & 0xFF);
+    }
+
+    inline void appendUint32(std::vector<uint8_t>& out, uint32_t value) {
+        out.push_back((value >> 24) & 0xFF);
+        out.push_back((value >> 16) & 0xFF);
+        out.push_back((value >> 8) & 0xFF);
+        out.push_back(value & 0xFF);
+    }
+
+    // Hash of a wire-format name. Bytes are folded from the end of the name
+    // towards the start, so the hash of every suffix falls out of a single
+    // backwards pass (see WireName::suffixHashes)
+    [[nodiscard]]
+    uint64_t hashName(std::span<const uint8_t> wire) noexcept;
+
+    // A domain name in uncompressed, lowercased wire format held in a fixed
+    // buffer, together with the offsets of its labels. Parsing a question into
+    // a WireName is the only per-query name work the lookup path does.
+    class WireName {
+    public:
+        static constexpr size_t MAX_LENGTH = 255;
+        static constexpr size_t MAX_LABELS = 127;
+
+        // Read a (possibly compressed) name at offset, advancing offset past it
+        [[nodiscard]]
+        bool parse(std::span<const uint8_t> packet, size_t& offset) noexcept;
+
+        // Build from presentation format ("www.Example.com" or "www.example.com.")
+        [[nodiscard]]
+        bool assign(std::string_view text) noexcept;
+
+        [[nodiscard]]
+        std::span<const uint8_t> bytes() const noexcept { return {data_, length_}; }
+
+        // Number of labels, not counting the root
+        [[nodiscard]]
+        size_t labelCount() const noexcept { return labels_; }
+
+        [[nodiscard]]
+        size_t labelOffset(size_t label) const noexcept { return offsets_[label]; }
+
+        // The trailing `labels` labels of the name, e.g. suffix(2) of
+        // www.example.com is example.com
+        [[nodiscard]]
+        std::span<const uint8_t> suffix(size_t labels) const noexcept {
+            size_t start = offsets_[labels_ - labels];
+            return {data_ + start, length_ - start};
+        }
+
+        // out[i] receives the hash of the name starting at label i; out must
+        // hold labelCount() + 1 entries (the last one is the root)
+        void suffixHashes(uint64_t* out) const noexcept;
+
+        [[nodiscard]]
+        uint64_t hash() const noexcept { return hashName(bytes()); }
+
+        [[nodiscard]]
+        std::string toString() const;
+
+    private:
+        uint8_t data_[MAX_LENGTH] = {0};
+        uint8_t length_ = 1;
+        uint8_t labels_ = 0;
+        uint8_t offsets_[MAX_LABELS + 1] = {0};
+    };
+
+    // SOA RDATA fields, parsed from "mname rname serial refresh retry expire minimum"
+    struct SOAData {
+        std::string mname;
+        std::string rname;
+        uint32_t serial = 0;
+        uint32_t refresh = 0;
+        uint32_t retry = 0;
+        uint32_t expire = 0;
+        uint32_t minimum = 0;
+
+        // False for a malformed field, or a name WireName would not take
+        [[nodiscard]]
+        static bool parse(std::string_view value, SOAData& out);
+
+        // The names are written as parse() accepted them
+        void encode(std::vector<uint8_t>& out) const;
+    };
+
+    [[nodiscard]]
+    inline uint8_t opcodeOf(std::span<const uint8_t> message) {
+        return static_cast<uint8_t>((message[2] & OPCODE_MASK) >> 3);
+    }
+
+    // What a message says about EDNS
+    struct Edns {
+        bool present = false;
+        uint16_t payload = 0;   // Advertised UDP payload size
+        uint8_t version = 0;
+    };
+
+    // Look for an OPT RR in the additional section of message, whose first
+    // question ends at offset. False when the sections after it are
+    // malformed, or hold more than one OPT or one not owned by the root
+    // (FORMERR).
+    [[nodiscard]]
+    bool readEdns(std::span<const uint8_t> message, size_t offset, Edns& out) noexcept;
+
+    // OPT RR advertising payload with the given extended RCODE (the full
+    // twelve-bit value; only its upper eight bits go in the OPT)
+    [[nodiscard]]
+    std::array<uint8_t, OPT_RR_SIZE> optRecord(uint16_t payload, uint16_t rcode = RCODE_NOERROR) noexcept;
+
+    // Function to parse domain name from a DNS query
+    std::string parseDomainName(std::span<const uint8_t> packet, size_t& offset);
+
+    // Same, with the text allocated from `memory` (e.g. a ScratchArena)
+    std::pmr::string parseDomainName(std::span<const uint8_t> packet, size_t& offset,
+                                     std::pmr::memory_resource* memory);
+
+    // Function to encode a domain name in DNS format; empty when it has an
+    // empty label, a label over 63 bytes or more than 255 bytes in all
+    std::vector<uint8_t> encodeDomainName(std::string_view domain);
+
+    // Encode the presentation-format value of a record as RDATA. Returns false
+    // when the value cannot be represented (e.g. a malformed address or a
+    // name with an empty or overlong label), with nothing appended to out.
+    [[nodiscard]]
+    bool encodeRData(uint16_t type, std::string_view value, std::vector<uint8_t>& out);
+
+    // The inverse: render the `length` bytes of RDATA at offset in message as
+    // the presentation format encodeRData() accepts. Names may be compressed
+    // against the rest of the message. Returns false for malformed RDATA.
+    [[nodiscard]]
+    bool decodeRData(uint16_t type, std::span<const uint8_t> message, size_t offset, size_t length,
+                     std::string& out);
+
+    // Append TYPE, CLASS, TTL, RDLENGTH and RDATA: everything in an RR that
+    // follows the owner name. The owner is written when the RR is copied into
+    // a message, since it is usually a compression pointer.
+    void appendRecordTail(std::vector<uint8_t>& out, uint16_t type, uint32_t ttl,
+                          std::span<const uint8_t> rdata);
+
+    // Same, encoding the presentation-format value straight into out. On
+    // failure out is left as it was and false is returned.
+    [[nodiscard]]
+    bool appendRecordTail(std::vector<uint8_t>& out, uint16_t type, uint32_t ttl, std::string_view value);
+}
@@ -0,0 +1,365 @@
+#include "dns_response.h"
+#include "reverse_name.h"
+#include "zone.h"
+#include <algorithm>
+#include <bit>
+
+using namespace dns_packet;
+
+namespace {
+    // Set the RCODE bits of the reply header
+    void setRcode(std::pmr::vector<uint8_t>& response, uint8_t rcode) {
+        response[3] = (response[3] & 0xF0) | rcode;
+    }
+
+    // Rotation state of one worker thread. Nothing is shared between
+    // workers, so ordering answers costs no atomic and no cache line
+    // bouncing; each worker cycles through its own sequence.
+    struct Rotation {
+        uint32_t next = 0;
+        uint64_t random = 0;
+    };
+
+    thread_local Rotation rotation;
+
+    // xorshift64, seeded from the state's own address, which differs per thread
+    uint64_t nextRandom() {
+        if (rotation.random == 0) rotation.random = reinterpret_cast<uintptr_t>(&rotation) | 1;
+        rotation.random ^= rotation.random << 13;
+        rotation.random ^= rotation.random >> 7;
+        rotation.random ^= rotation.random << 17;
+        return rotation.random;
+    }
+
+    // Index within an RRset of count RRs that the answer starts at
+    uint32_t firstRR(RRsetOrder order, uint32_t count) {
+        if (count < 2 || order == RRsetOrder::Fixed) return 0;
+        if (order == RRsetOrder::Cyclic) return rotation.next++ % count;
+        return static_cast<uint32_t>(((nextRandom() >> 32) * count) >> 32);
+    }
+
+    constexpr uint16_t TYPE_NS = to_type_code(RecordType::NS);
+    constexpr uint16_t TYPE_CNAME = to_type_code(RecordType::CNAME);
+    constexpr uint16_t TYPE_MX = to_type_code(RecordType::MX);
+    constexpr uint16_t TYPE_SRV = to_type_code(RecordType::SRV);
+
+    // Types whose RRs name a host the client will want the address of
+    bool hasGlue(uint16_t type) {
+        return type == TYPE_NS || type == TYPE_MX || type == TYPE_SRV;
+    }
+
+    // Address RRsets for the additional section, gathered while the answers
+    // are copied. Each one's owner is written as a pointer to the target
+    // name inside the answer RR that links to it, so glue costs no name
+    // bytes of its own. Fixed capacity, so collecting never allocates;
+    // links beyond it are left out, as additional data may be.
+    class GlueList {
+    public:
+        // Note the links of the RR at index, whose TYPE..RDATA goes to offset
+        void add(const ZoneSnapshot& snapshot, uint32_t index, size_t offset) {
+            for (const ZoneSnapshot::Glue& link : snapshot.glue(index)) {
+                size_t name = offset + link.nameOffset;
+                if (link.rrset == ZoneSnapshot::Glue::NONE || count == CAPACITY || name > 0x3FFF) continue;
+                if (std::find(rrsets, rrsets + count, link.rrset) != rrsets + count) continue;
+                rrsets[count] = link.rrset;
+                names[count++] = static_cast<uint16_t>(name);
+            }
+        }
+
+        // Append every RR of the gathered RRsets that fits in limit bytes;
+        // returns how many went in
+        uint16_t append(std::pmr::vector<uint8_t>& response, const ZoneSnapshot& snapshot, size_t limit) const {
+            uint16_t added = 0;
+            for (size_t i = 0; i < count; ++i) {
+                const auto& rrset = snapshot.rrset(rrsets[i]);
+                for (uint32_t j = 0; j < rrset.rrCount; ++j) {
+                    auto rr = snapshot.rr(rrset.firstRR + j);
+                    if (response.size() + 2 + rr.size() > limit) return added;
+                    response.push_back(0xC0 | (names[i] >> 8));
+                    response.push_back(names[i] & 0xFF);
+                    response.insert(response.end(), rr.begin(), rr.end());
+                    added++;
+                }
+            }
+            return added;
+        }
+
+    private:
+        static constexpr size_t CAPACITY = 16;
+
+        uint32_t rrsets[CAPACITY];
+        uint16_t names[CAPACITY];
+        size_t count = 0;
+    };
+
+    // Append up to count distinct RRs of rrset, owned by the name at offset
+    // name, drawn by weight from its alias table; returns how many went in.
+    // An RR that does not fit in limit bytes is passed over for the next
+    // draw, and truncated is set if the answer ends up short of count for
+    // want of room. A draw that repeats an RR is retried, up to a fixed
+    // number of draws in all, so this stays O(count) even for skewed
+    // weights; when that runs out the rest are taken in order from a random
+    // start. The RRs drawn so far go in an open-addressed set allocated
+    // where the reply is (the worker's scratch arena), so its size follows
+    // the answer rather than the RRset and nothing is kept between queries.
+    // glue, when given, collects the links of every RR that goes in.
+    uint16_t appendSubset(std::pmr::vector<uint8_t>& response, const ZoneSnapshot& snapshot,
+                          const ZoneSnapshot::RRset& rrset, std::span<const answer_subset::AliasSlot> table,
+                          uint32_t count, size_t name, size_t limit, GlueList* glue, bool& truncated) {
+        uint32_t size = static_cast<uint32_t>(table.size());
+        uint32_t wanted = std::min(count, size);
+        uint32_t maxDraws = 4 * count + 16;
+        size_t slots = std::bit_ceil(2 * size_t{std::min(size, maxDraws)});
+        // RR index + 1, 0 marks an empty slot
+        std::pmr::vector<uint32_t> drawn(slots, 0, response.get_allocator().resource());
+        uint16_t added = 0;
+        bool skipped = false;
+        auto take = [&](uint32_t index) {
+            auto rr = snapshot.rr(rrset.firstRR + index);
+            if (response.size() + 2 + rr.size() > limit) {
+                skipped = true;
+                return;
+            }
+            if (glue != nullptr) glue->add(snapshot, rrset.firstRR + index, response.size() + 2);
+            response.push_back(0xC0 | (name >> 8));
+            response.push_back(name & 0xFF);
+            response.insert(response.end(), rr.begin(), rr.end());
+            added++;
+        };
+        auto slotOf = [&](uint32_t index) {
+            size_t slot = index & (slots - 1);
+            while (drawn[slot] != 0 && drawn[slot] != index + 1) slot = (slot + 1) & (slots - 1);
+            return slot;
+        };
+
+        for (uint32_t draws = 0; added < wanted && draws < maxDraws; ++draws) {
+            uint32_t index = answer_subset::draw(table, nextRandom());
+            size_t slot = slotOf(index);
+            if (drawn[slot] != 0) continue;
+            drawn[slot] = index + 1;
+            take(index);
+        }
+        if (added < wanted) {
+            uint32_t start = static_cast<uint32_t>(((nextRandom() >> 32) * size) >> 32);
+            for (uint32_t i = 0; i < size && added < wanted; ++i) {
+                uint32_t index = start + i < size ? start + i : start + i - size;
+                if (drawn[slotOf(index)] == 0) take(index);
+            }
+        }
+        if (added < wanted && skipped) truncated = true;
+        return added;
+    }
+
+    // Put the zone's SOA in the authority section of a negative answer, if
+    // it fits, owned by a pointer to the apex's labels in the question
+    void appendNegativeSoa(std::pmr::vector<uint8_t>& response, const ZoneSnapshot& snapshot,
+                           const WireName& qname, const Zone& zone, size_t limit) {
+        auto soa = snapshot.negativeSoa();
+        if (soa.empty() || response.size() + 2 + soa.size() > limit) return;
+        size_t apex = HEADER_SIZE + qname.labelOffset(qname.labelCount() - zone.labelCount());
+        response.push_back(0xC0 | (apex >> 8));
+        response.push_back(apex & 0xFF);
+        response.insert(response.end(), soa.begin(), soa.end());
+        writeUint16(response, 8, 1);
+    }
+
+    // Fill in the reply to a well-formed question, whose header and
+    // question are already in response, keeping it within limit bytes
+    void answer(std::pmr::vector<uint8_t>& response, std::span<const uint8_t> query, size_t offset,
+                const WireName& qname, const DNSServer& server, size_t limit) {
+        if (opcodeOf(query) != OPCODE_QUERY) {
+            // Updates are only taken from trusted sources, by ZoneUpdater
+            setRcode(response, opcodeOf(query) == OPCODE_UPDATE ? RCODE_REFUSED : RCODE_NOTIMP);
+            return;
+        }
+
+        // Get qtype and qclass
+        uint16_t qtype = readUint16(query, offset);
+        uint16_t qclass = readUint16(query, offset + 2);
+
+        // Pick the zone with the longest matching apex; we are not authoritative
+        // for anything else. Reverse names are matched by the address their
+        // labels spell, here and in the zone below, so they are never hashed.
+        auto zones = server.zones();
+        reverse_name::Prefix reverse;
+        const Zone* zone = zones && reverse_name::parse(qname.bytes(), reverse) ? zones->selectReverse(reverse) : nullptr;
+        bool hashed = zone == nullptr;
+        uint64_t hashes[WireName::MAX_LABELS + 1];
+        if (hashed) {
+            qname.suffixHashes(hashes);
+            zone = zones ? zones->select(qname, hashes) : nullptr;
+        }
+        if (zone == nullptr || (qclass != CLASS_IN && qclass != CLASS_ANY)) {
+            setRcode(response, RCODE_REFUSED);
+            return;
+        }
+        response[2] |= FLAG_AA;
+
+        // Names the filter rules out skip the index and, unless a synthesis rule
+        // makes them, end as NXDOMAIN; random-subdomain floods mostly end here
+        auto snapshot = zone->snapshot();
+        bool mayExist = snapshot && (!hashed || snapshot->mayContain(hashes[0]));
+        const ZoneSnapshot::Owner* owner = nullptr;
+        if (mayExist) owner = hashed ? snapshot->find(qname, hashes[0]) : snapshot->findReverse(reverse);
+        if (owner == nullptr) {
+            // Names made by a synthesis rule exist without a stored record;
+            // one with nothing of qtype is NODATA
+            uint16_t synthesized = 0;
+            if (server.synthesis().answer(qname, qtype, response, synthesized, limit)) {
+                writeUint16(response, 6, synthesized);
+                if (synthesized == 0 && !(response[2] & FLAG_TC) && snapshot) {
+                    appendNegativeSoa(response, *snapshot, qname, *zone, limit);
+                }
+                return;
+            }
+            if (hashed) server.countFilterOutcome(!mayExist);
+            setRcode(response, RCODE_NXDOMAIN);
+            if (snapshot) appendNegativeSoa(response, *snapshot, qname, *zone, limit);
+            return;
+        }
+
+        // A CNAME answers every other type. The chain to the final name was
+        // followed when the snapshot was built; each of its RRs is owned by
+        // a pointer to the name the previous one points to.
+        uint16_t answerCount = 0;
+        bool truncated = false;
+        bool missing = false;
+        bool resolved = true;        // The answer ends at a name inside the zone
+        size_t name = HEADER_SIZE;   // Owner of the RRs copied next
+        auto rrsets = snapshot->rrsets(*owner);
+        uint32_t firstRRset = owner->firstRRset;
+        ZoneSnapshot::CnameChain chain;
+        auto cname = std::ranges::find(rrsets, TYPE_CNAME, &ZoneSnapshot::RRset::type);
+        if (qtype != TYPE_CNAME && qtype != QTYPE_ANY && cname != rrsets.end() &&
+            snapshot->chain(firstRRset + static_cast<uint32_t>(cname - rrsets.begin()), chain)) {
+            for (uint32_t hop : chain.rrs) {
+                if (name > 0x3FFF) break;   // Past what a pointer reaches; only in huge TCP replies
+                auto rr = snapshot->rr(hop);
+                if (response.size() + 2 + rr.size() > limit) {
+                    truncated = true;
+                    break;
+                }
+                response.push_back(0xC0 | (name >> 8));
+                response.push_back(name & 0xFF);
+                name = response.size() + 10;   // The target name in the RDATA
+                response.insert(response.end(), rr.begin(), rr.end());
+                answerCount++;
+            }
+            bool complete = !truncated && name <= 0x3FFF;
+            rrsets = complete && chain.targetCount > 0
+                         ? std::span(&snapshot->rrset(chain.target), chain.targetCount)
+                         : std::span<const ZoneSnapshot::RRset>();
+            firstRRset = chain.target;
+            missing = complete && chain.missing;
+            resolved = complete && (chain.targetCount > 0 || chain.missing);
+        }
+
+        // Add answer records: a pointer to the owner name followed by the
+        // pre-encoded remainder of each RR, rotated as the server is set up to.
+        // RRsets with a subset rule send a weighted sample that fits instead.
+        // Every RR is checked against the size budget before it is copied, so
+        // a reply that would not fit ends at an RR boundary.
+        GlueList glue;
+        bool found = false;
+        for (uint32_t n = 0; n < rrsets.size() && !truncated; ++n) {
+            const auto& rrset = rrsets[n];
+            if (qtype != QTYPE_ANY && rrset.type != qtype) continue;
+            found = true;
+            std::span<const answer_subset::AliasSlot> table;
+            uint32_t count = 0;
+            bool linked = hasGlue(rrset.type);
+            if (snapshot->subset(firstRRset + n, table, count)) {
+                answerCount += appendSubset(response, *snapshot, rrset, table, count, name, limit,
+                                            linked ? &glue : nullptr, truncated);
+                continue;
+            }
+            uint32_t first = firstRR(server.rrsetOrder(), rrset.rrCount);
+            for (uint32_t i = 0; i < rrset.rrCount; ++i) {
+                uint32_t index = first + i < rrset.rrCount ? first + i : first + i - rrset.rrCount;
+                auto rr = snapshot->rr(rrset.firstRR + index);
+                if (response.size() + 2 + rr.size() > limit) {
+                    truncated = true;
+                    break;
+                }
+                if (linked) glue.add(*snapshot, rrset.firstRR + index, response.size() + 2);
+                response.push_back(0xC0 | (name >> 8));
+                response.push_back(name & 0xFF);
+                response.insert(response.end(), rr.begin(), rr.end());
+                answerCount++;
+            }
+        }
+        if (missing) setRcode(response, RCODE_NXDOMAIN);
+        writeUint16(response, 6, answerCount);
+        if (truncated) {
+            response[2] |= FLAG_TC;
+        } else if (resolved && !found) {
+            // NXDOMAIN at the end of a chain, or NODATA
+            appendNegativeSoa(response, *snapshot, qname, *zone, limit);
+        } else {
+            writeUint16(response, 10, glue.append(response, *snapshot, limit));
+        }
+    }
+}
+
+std::vector<uint8_t> createDNSResponse(const std::span<const uint8_t> query, const DNSServer& server,
+                                       Transport transport) {
+    auto response = createDNSResponse(query, server, std::pmr::new_delete_resource(), transport);
+    return {response.begin(), response.end()};
+}
+
+std::pmr::vector<uint8_t> createDNSResponse(const std::span<const uint8_t> query, const DNSServer& server,
+                                            std::pmr::memory_resource* memory, Transport transport) {
+    std::pmr::vector<uint8_t> response(memory);
+    if (query.size() < HEADER_SIZE) {
+        return response;  // Not even a header to answer
+    }
+
+    // Parse the question, and the OPT record if the client sent one
+    WireName qname;
+    Edns edns;
+    size_t offset = HEADER_SIZE;
+    bool wellFormed = readUint16(query, 4) >= 1 && qname.parse(query, offset) &&
+                      offset + 4 <= query.size() && readEdns(query, offset + 4, edns);
+
+    // An EDNS client gets as much as it can take, up to what the server is
+    // set to send; others get the classic 512 bytes. Room for our own OPT
+    // is kept back from the budget.
+    size_t limit = MAX_DNS_PACKET_SIZE;
+    if (transport == Transport::Tcp) {
+        limit = MAX_TCP_MESSAGE_SIZE;
+    } else if (edns.present) {
+        limit = std::clamp<size_t>(edns.payload, MAX_DNS_PACKET_SIZE, server.maxUdpPayload());
+    }
+    if (edns.present) limit -= OPT_RR_SIZE;
+
+    // Echo the header and question only; anything the client put in the
+    // other sections does not belong in the reply
+    size_t echoed = wellFormed ? offset + 4 : HEADER_SIZE;
+    response.reserve(transport == Transport::Tcp ? MAX_DNS_PACKET_SIZE : limit + OPT_RR_SIZE);
+    response.assign(query.begin(), query.begin() + echoed);
+
+    // Set QR bit to 1 (response), keep OPCODE and RD, clear other flags
+    response[2] = FLAG_QR | (query[2] & (OPCODE_MASK | FLAG_RD));
+    response[3] = 0x00;
+    writeUint16(response, 4, wellFormed ? 1 : 0);
+    writeUint16(response, 6, 0);
+    writeUint16(response, 8, 0);
+    writeUint16(response, 10, 0);
+
+    if (!wellFormed) {
+        setRcode(response, RCODE_FORMERR);
+        return response;
+    }
+    if (edns.version > EDNS_VERSION) {
+        // Only version 0 exists; the OPT below tells the client so
+        setRcode(response, RCODE_BADVERS & 0x0F);
+    } else {
+        answer(response, query, offset, qname, server, limit);
+    }
+    if (edns.present) {
+        auto opt = optRecord(server.maxUdpPayload(), edns.version > EDNS_VERSION ? RCODE_BADVERS : RCODE_NOERROR);
+        response.insert(response.end(), opt.begin(), opt.end());
+        writeUint16(response, 10, readUint16(response, 10) + 1);
+    }
+    return response;
+}
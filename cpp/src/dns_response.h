@@ -0,0 +1,33 @@
+#pragma once
+
+#include "dns_server.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <span>
+#include <vector>
+
+constexpr size_t MAX_DNS_PACKET_SIZE = 512;  // Standard DNS UDP packet size
+constexpr size_t MAX_TCP_MESSAGE_SIZE = 65535;   // Two-byte length prefix (RFC1035 section 4.2.2)
+
+// What the reply travels over, which bounds its size
+enum class Transport {
+    Udp,
+    Tcp
+};
+
+// Function to create a DNS response. Names outside every published zone are
+// REFUSED; names inside a zone are answered from its current snapshot.
+// Answers are added while whole RRs fit the transport's size; when one does
+// not, the reply stops at the last RR that did, with the counts to match,
+// and TC set. Over UDP that size is 512 bytes, or for a query with an OPT
+// record the payload size it advertises, capped by the server's
+// maxUdpPayload(); such queries get an OPT record back.
+std::vector<uint8_t> createDNSResponse(std::span<const uint8_t> query, const DNSServer& server,
+                                       Transport transport = Transport::Udp);
+
+// Same, with the reply allocated from `memory` (normally the worker's
+// ScratchArena) so the query path does not touch the global heap
+std::pmr::vector<uint8_t> createDNSResponse(std::span<const uint8_t> query, const DNSServer& server,
+                                            std::pmr::memory_resource* memory,
+                                            Transport transport = Transport::Udp);
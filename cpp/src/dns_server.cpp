@@ -1,11 +1,21 @@
 #include "dns_server.h"
+#include "zone.h"
 #include <iostream>
 #include <algorithm>
+#include <bit>
 #include <cctype>
+#include <functional>
+#include <memory_resource>
+
+namespace {
+    // Room for any legal name in presentation form, so lowercasing a lookup
+    // key stays on the stack
+    constexpr size_t NAME_BUFFER_SIZE = 256;
+}
 
 // Helper function to convert a string to lowercase using modern C++ approaches
-std::string toLowercase(std::string_view str) {
-    std::string result;
+std::pmr::string toLowercase(std::string_view str, std::pmr::memory_resource* memory) {
+    std::pmr::string result(memory);
     result.reserve(str.size());
     
     // Using algorithm with a lambda function, more portable than ranges for now
@@ -16,72 +26,369 @@ std::string toLowercase(std::string_view str) {
 }
 
 void DNSServer::addRecord(const DNSRecord& record) {
+    insert(record.name, record.type, record.value);
+}
+
+void DNSServer::insert(std::string_view name, std::string_view type, std::string_view value) {
     // Store record with lowercase domain name for case-insensitive lookups
-    DNSRecord normalizedRecord(toLowercase(record.name), record.type, record.value);
-    records[normalizedRecord.name].push_back(normalizedRecord);
+    std::byte buffer[NAME_BUFFER_SIZE];
+    std::pmr::monotonic_buffer_resource scratch(buffer, sizeof(buffer));
+    store.add(toLowercase(name, &scratch), type, value);
+}
+
+void DNSServer::insertGrouped(RecordStore& target, std::span<const RecordView> records) {
+    // Lowercase every owner into one buffer, then order the batch by owner;
+    // stable so each owner's records keep their input order. Nothing here
+    // allocates per record.
+    std::string names;
+    std::vector<uint32_t> nameEnd(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        for (char c : records[i].name) {
+            names.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+        }
+        nameEnd[i] = static_cast<uint32_t>(names.size());
+    }
+    auto lowered = [&](uint32_t i) {
+        uint32_t begin = i == 0 ? 0 : nameEnd[i - 1];
+        return std::string_view(names).substr(begin, nameEnd[i] - begin);
+    };
+
+    // Number owners in order of first appearance through a scratch hash
+    // table, then counting-sort the batch by owner number
+    std::vector<uint32_t> group(records.size());
+    std::vector<uint32_t> groupSize;
+    {
+        std::vector<uint32_t> slots(std::bit_ceil(std::max<size_t>(records.size() * 2, 16)), 0);
+        size_t mask = slots.size() - 1;
+        std::hash<std::string_view> hasher;
+        for (uint32_t i = 0; i < records.size(); ++i) {
+            std::string_view name = lowered(i);
+            size_t slot = hasher(name) & mask;
+            while (slots[slot] != 0 && lowered(slots[slot] - 1) != name) slot = (slot + 1) & mask;
+            if (slots[slot] == 0) {
+                slots[slot] = i + 1;
+                group[i] = static_cast<uint32_t>(groupSize.size());
+                groupSize.push_back(0);
+            } else {
+                group[i] = group[slots[slot] - 1];
+            }
+            groupSize[group[i]]++;
+        }
+    }
+    std::vector<uint32_t> order(records.size());
+    {
+        uint32_t next = 0;
+        for (uint32_t& size : groupSize) {
+            uint32_t count = size;
+            size = next;
+            next += count;
+        }
+        for (uint32_t i = 0; i < records.size(); ++i) order[groupSize[group[i]]++] = i;
+    }
+    target.reserve(target.ownerCount() + groupSize.size(), target.recordCount() + records.size());
+
+    for (uint32_t i : order) {
+        target.add(lowered(i), records[i].type, records[i].value);
+    }
 }
 
 std::vector<DNSRecord> DNSServer::query(std::string_view name) const {
     // Convert query name to lowercase for case-insensitive lookups
-    std::string normalizedName = toLowercase(name);
+    std::byte buffer[NAME_BUFFER_SIZE];
+    std::pmr::monotonic_buffer_resource scratch(buffer, sizeof(buffer));
+    std::pmr::string normalizedName = toLowercase(name, &scratch);
     
-    // Look up in the map using the normalized name
-    auto it = records.find(normalizedName);
-    if (it != records.end()) {
-        return it->second;
+    // Look up the interned owner and materialize its records
+    uint32_t ownerIndex = store.findOwner(normalizedName);
+    if (ownerIndex == RecordStore::NONE) {
+        return {}; // Return empty vector if not found
     }
     
-    return {}; // Return empty vector if not found
+    std::vector<DNSRecord> results;
+    const auto& owner = store.owner(ownerIndex);
+    store.forEachRecord(owner, [&](const RecordStore::Record& record) {
+        results.emplace_back(store.name(owner), store.type(record), store.value(record));
+    });
+    return results;
 }
 
-// Implementation of DNS packet reader's readDomainName method
-std::string dns_packet::PacketReader::readDomainName() {
-    std::string result;
-    uint8_t length = readUint8();
-    
-    // Handle DNS domain name compression and standard format
-    while (length > 0) {
-        // Check if this is a pointer (compression method)
-        if ((length & 0xC0) == 0xC0) {
-            // This is a pointer - the next byte plus the lower 6 bits of this byte
-            // form a 14-bit offset to where the actual name is stored
-            uint8_t offsetLow = readUint8();
-            uint16_t offset = ((length & 0x3F) << 8) | offsetLow;
-            
-            // Save current position
-            size_t savedPosition = position;
-            
-            // Jump to the offset
-            position = offset;
-            
-            // Read the rest of the name recursively
-            std::string suffix = readDomainName();
-            if (!result.empty()) {
-                result += ".";
+void DNSServer::publish() {
+    std::lock_guard lock(writeMutex);
+    auto zoneList = compile(store);
+    std::atomic_store_explicit(&registry, std::shared_ptr<const ZoneRegistry>(std::make_shared<ZoneRegistry>(zoneList)),
+                               std::memory_order_release);
+}
+
+std::vector<std::shared_ptr<Zone>> DNSServer::compile(const RecordStore& source) const {
+    // Every owner with a parseable SOA record is a zone apex
+    std::vector<std::shared_ptr<Zone>> zoneList;
+    std::vector<ZoneSnapshot::Builder> builders;
+    for (uint32_t i = 0; i < source.ownerCount(); ++i) {
+        const auto& owner = source.owner(i);
+        bool isApex = false;
+        source.forEachRecord(owner, [&](const RecordStore::Record& record) {
+            dns_packet::WireName origin;
+            dns_packet::SOAData soa;
+            if (isApex || source.type(record) != to_string_view(RecordType::SOA) ||
+                !origin.assign(source.name(owner)) || !dns_packet::SOAData::parse(source.value(record), soa)) {
+                return;
             }
-            result += suffix;
-            
-            // Restore position and exit - pointers always terminate a name
-            position = savedPosition;
-            return result;
+            isApex = true;
+            zoneList.push_back(std::make_shared<Zone>(origin, nullptr));
+            builders.emplace_back(zoneList.back()->origin(), std::move(soa));
+        });
+    }
+
+    ZoneRegistry index(zoneList);
+    std::unordered_map<const Zone*, size_t> zoneIndex;
+    for (size_t i = 0; i < zoneList.size(); ++i) {
+        zoneIndex[zoneList[i].get()] = i;
+    }
+
+    // Hand each owner name to its closest enclosing zone
+    for (uint32_t i = 0; i < source.ownerCount(); ++i) {
+        const auto& owner = source.owner(i);
+        dns_packet::WireName name;
+        if (!name.assign(source.name(owner))) continue;
+        const Zone* zone = index.select(name);
+        if (zone == nullptr) continue;
+        auto& builder = builders[zoneIndex[zone]];
+        source.forEachRecord(owner, [&](const RecordStore::Record& record) {
+            builder.add(name, source.type(record), source.value(record));
+        });
+    }
+
+    for (size_t i = 0; i < zoneList.size(); ++i) {
+        zoneList[i]->publish(builders[i].build(snapshotOptions));
+    }
+    return zoneList;
+}
+
+bool DNSServer::reload(std::span<const DNSRecord> records, std::string& error) {
+    // Check every record up front, so a bad source never replaces a zone
+    std::vector<RecordView> views;
+    views.reserve(records.size());
+    std::vector<uint8_t> scratch;
+    bool hasSOA = false;
+    for (const DNSRecord& record : records) {
+        dns_packet::WireName name;
+        uint16_t type = to_type_code(parse_record_type(record.type));
+        scratch.clear();
+        if (!name.assign(record.name)) {
+            error = "bad owner name " + record.name;
+            return false;
+        }
+        if (type == 0 || !dns_packet::encodeRData(type, record.value, scratch)) {
+            error = "bad " + record.type + " record at " + record.name + ": " + record.value;
+            return false;
+        }
+        hasSOA = hasSOA || parse_record_type(record.type) == RecordType::SOA;
+        views.push_back({record.name, record.type, record.value});
+    }
+    if (!hasSOA) {
+        error = "no SOA record, so no zone";
+        return false;
+    }
+
+    // The replacement is built while the current zones are still served
+    // and still take updates
+    RecordStore fresh;
+    insertGrouped(fresh, views);
+    auto built = compile(fresh);
+
+    std::lock_guard lock(writeMutex);
+    auto current = zones();
+    std::vector<std::shared_ptr<Zone>> zoneList = built;
+    std::vector<const Zone*> carried;
+    for (const auto& zone : current ? current->all() : std::vector<std::shared_ptr<Zone>>{}) {
+        bool replaced = std::ranges::any_of(built, [&](const auto& other) { return other->origin() == zone->origin(); });
+        if (!replaced && transferredZones.contains(zone->origin())) {
+            zoneList.push_back(zone);
+            carried.push_back(zone.get());
+        }
+    }
+    auto next = std::make_shared<ZoneRegistry>(zoneList);
+
+    // Carried zones keep their records, read back from what they serve, as
+    // a restored zone has none in the old store
+    for (const Zone* zone : carried) storeSnapshot(fresh, *zone->snapshot());
+
+    std::atomic_store_explicit(&registry, std::shared_ptr<const ZoneRegistry>(std::move(next)),
+                               std::memory_order_release);
+    reloads.fetch_add(1, std::memory_order_release);
+    store = std::move(fresh);
+    for (const auto& zone : built) {
+        auto previous = current ? current->find(zone->origin()) : nullptr;
+        auto before = previous ? previous->snapshot() : nullptr;
+        if (changeListener && (!before || before->soa().serial != zone->snapshot()->soa().serial)) {
+            changeListener(zone->origin());
+        }
+    }
+    return true;
+}
+
+bool DNSServer::applyDelta(std::string_view origin, const ZoneDelta& delta) {
+    auto changes = storeChanges(delta);
+    std::lock_guard lock(writeMutex);
+    auto current = zones();
+    auto zone = current ? current->find(origin) : nullptr;
+    auto snapshot = zone ? zone->snapshot() : nullptr;
+    if (!snapshot || (delta.fromSerial && *delta.fromSerial != snapshot->soa().serial) ||
+        (delta.generation && *delta.generation != generation())) {
+        return false;
+    }
+    auto next = ZoneSnapshot::apply(snapshot, delta, snapshotOptions);
+    zone->history().record(ZoneChange::between(*snapshot, *next, zone->originWire(), delta));
+    zone->publish(std::move(next));
+    syncStore(changes);
+    if (changeListener) changeListener(zone->origin());
+    return true;
+}
+
+bool DNSServer::loadZone(std::string_view origin, ZoneDelta contents) {
+    dns_packet::WireName apex;
+    if (!apex.assign(origin)) return false;
+
+    // A whole zone is built without writeMutex, which the packet loop takes
+    // for UPDATEs and checkpoints. Should the zone change in the meantime
+    // the build is redone against what it has become.
+    for (;;) {
+        auto current = zones();
+        auto zone = current ? current->find(origin) : nullptr;
+        auto snapshot = zone ? zone->snapshot() : nullptr;
+        std::shared_ptr<const ZoneSnapshot> next;
+        std::shared_ptr<Zone> added;
+        if (snapshot) {
+            // Names that are gone get deleted along with the new contents
+            snapshot->forEachOwner([&](const ZoneSnapshot::Owner& owner) {
+                auto name = snapshot->ownerName(owner);
+                contents.owners.try_emplace(std::vector<uint8_t>(name.begin(), name.end()));
+            });
+            next = ZoneSnapshot::apply(snapshot, contents, snapshotOptions);
         } else {
-            // This is a standard label
-            auto label = readBytes(length);
-            
-            // Convert to string and append
-            if (!result.empty()) {
-                result += ".";
+            added = std::make_shared<Zone>(apex, nullptr);
+            ZoneSnapshot::Builder builder(added->origin(), contents.soa);
+            for (const auto& [name, tails] : contents.owners) {
+                for (const auto& tail : tails) builder.addEncoded(name, tail);
             }
-            
-            // Convert bytes to string using traditional methods
-            for (const auto& byte : label) {
-                result += static_cast<char>(byte);
+            added->publish(builder.build(snapshotOptions));
+        }
+        auto changes = storeChanges(contents);
+
+        std::lock_guard lock(writeMutex);
+        if (zones() != current || (zone && zone->snapshot() != snapshot)) continue;
+        if (snapshot) {
+            transferredZones.insert(zone->origin());
+            zone->history().clear();
+            zone->publish(std::move(next));
+        } else {
+            transferredZones.insert(added->origin());
+            std::vector<std::shared_ptr<Zone>> zoneList;
+            if (current) zoneList = current->all();
+            std::erase(zoneList, zone);
+            zoneList.push_back(added);
+            std::atomic_store_explicit(&registry,
+                                       std::shared_ptr<const ZoneRegistry>(std::make_shared<ZoneRegistry>(zoneList)),
+                                       std::memory_order_release);
+            zone = added;
+        }
+        syncStore(changes);
+        if (changeListener) changeListener(zone->origin());
+        return true;
+    }
+}
+
+std::vector<ZoneImage> DNSServer::capture() {
+    std::lock_guard lock(writeMutex);
+    std::vector<ZoneImage> images;
+    auto current = zones();
+    for (const auto& zone : current ? current->all() : std::vector<std::shared_ptr<Zone>>{}) {
+        images.push_back({zone->origin(), zone->snapshot(), transferredZones.contains(zone->origin())});
+    }
+    return images;
+}
+
+bool DNSServer::restore(std::vector<ZoneImage> images) {
+    std::vector<std::shared_ptr<Zone>> zoneList;
+    for (auto& image : images) {
+        dns_packet::WireName apex;
+        if (!apex.assign(image.origin) || !image.snapshot) return false;
+        zoneList.push_back(std::make_shared<Zone>(apex, std::move(image.snapshot)));
+    }
+
+    std::lock_guard lock(writeMutex);
+    transferredZones.clear();
+    for (const auto& image : images) {
+        if (image.transferred) transferredZones.insert(image.origin);
+    }
+    std::atomic_store_explicit(&registry, std::shared_ptr<const ZoneRegistry>(std::make_shared<ZoneRegistry>(zoneList)),
+                               std::memory_order_release);
+    store = RecordStore();
+    return true;
+}
+
+void DNSServer::storeSnapshot(RecordStore& target, const ZoneSnapshot& snapshot) {
+    snapshot.forEachOwner([&](const ZoneSnapshot::Owner& owner) {
+        dns_packet::WireName name;
+        size_t offset = 0;
+        auto wire = snapshot.ownerName(owner);
+        if (!name.parse(wire, offset)) return;
+        std::string text = name.toString();
+        for (const auto& rrset : snapshot.rrsets(owner)) {
+            for (uint32_t i = 0; i < rrset.rrCount; ++i) {
+                auto tail = snapshot.rr(rrset.firstRR + i);
+                std::string value;
+                if (!dns_packet::decodeRData(rrset.type, tail, 10, tail.size() - 10, value)) continue;
+                target.add(text, to_string_view(from_type_code(rrset.type)), value);
             }
-            
-            // Read next length byte
-            length = readUint8();
         }
+    });
+}
+
+std::vector<DNSServer::StoreChange> DNSServer::storeChanges(const ZoneDelta& delta) {
+    std::vector<StoreChange> changes;
+    changes.reserve(delta.owners.size());
+    for (const auto& [wire, tails] : delta.owners) {
+        dns_packet::WireName name;
+        size_t offset = 0;
+        if (!name.parse(wire, offset)) continue;
+        auto& change = changes.emplace_back();
+        change.owner = name.toString();
+        for (const auto& tail : tails) {
+            uint16_t type = dns_packet::readUint16(tail, 0);
+            std::string value;
+            if (!dns_packet::decodeRData(type, tail, 10, tail.size() - 10, value)) continue;
+            change.records.emplace_back(to_string_view(from_type_code(type)), std::move(value));
+        }
+    }
+    return changes;
+}
+
+void DNSServer::syncStore(std::span<const StoreChange> changes) {
+    // Only the changed names are rewritten in the store, so query() and the
+    // next full publish() agree with what is being served
+    for (const auto& change : changes) {
+        store.clearOwner(change.owner);
+        store.clearOwner(change.owner + '.');
+        for (const auto& [type, value] : change.records) store.add(change.owner, type, value);
     }
+}
+
+FilterStats DNSServer::filterStats() const {
+    FilterStats stats;
+    stats.rejected = filterRejected.load(std::memory_order_relaxed);
+    stats.falsePositives = filterFalsePositives.load(std::memory_order_relaxed);
     
-    return result;
+    // Weight each zone's estimate by its number of names
+    auto current = zones();
+    size_t names = 0;
+    double weighted = 0.0;
+    for (const auto& zone : current ? current->all() : std::vector<std::shared_ptr<Zone>>{}) {
+        auto snapshot = zone->snapshot();
+        if (!snapshot) continue;
+        names += snapshot->ownerCount();
+        weighted += snapshot->filter().estimatedFalsePositiveRate() * snapshot->ownerCount();
+    }
+    stats.estimatedFalsePositiveRate = names == 0 ? 0.0 : weighted / names;
+    return stats;
 }
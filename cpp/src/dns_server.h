@@ -1,16 +1,24 @@
 #pragma once
 
+#include "dns_packet.h"
+#include "record_store.h"
+#include "synthesis.h"
 #include <algorithm>
+#include <atomic>
 #include <concepts>
 #include <cstdint>  // For uint8_t, uint16_t
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <ranges>
 #include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 // Enumeration for common DNS record types with string view conversion
@@ -24,6 +32,7 @@ enum class RecordType {
     SOA,
     TXT,
     HINFO,
+    SRV,
     Unknown
 };
 
@@ -39,6 +48,7 @@ constexpr std::string_view to_string_view(RecordType type) {
         case RecordType::SOA:   return "SOA";
         case RecordType::TXT:   return "TXT";
         case RecordType::HINFO: return "HINFO";
+        case RecordType::SRV:   return "SRV";
         case RecordType::Unknown: 
         default:                return "Unknown";
     }
@@ -55,9 +65,107 @@ constexpr RecordType parse_record_type(std::string_view type_str) {
     if (type_str == "SOA")   return RecordType::SOA;
     if (type_str == "TXT")   return RecordType::TXT;
     if (type_str == "HINFO") return RecordType::HINFO;
+    if (type_str == "SRV")   return RecordType::SRV;
     return RecordType::Unknown;
 }
 
+// Wire TYPE code of a RecordType (RFC1035 section 3.2.2, RFC3596 for AAAA,
+// RFC2782 for SRV)
+constexpr uint16_t to_type_code(RecordType type) {
+    switch (type) {
+        case RecordType::A:     return 1;
+        case RecordType::NS:    return 2;
+        case RecordType::CNAME: return 5;
+        case RecordType::SOA:   return 6;
+        case RecordType::PTR:   return 12;
+        case RecordType::HINFO: return 13;
+        case RecordType::MX:    return 15;
+        case RecordType::TXT:   return 16;
+        case RecordType::AAAA:  return 28;
+        case RecordType::SRV:   return 33;
+        case RecordType::Unknown:
+        default:                return 0;
+    }
+}
+
+// Map a wire TYPE code back to a RecordType
+constexpr RecordType from_type_code(uint16_t code) {
+    switch (code) {
+        case 1:  return RecordType::A;
+        case 2:  return RecordType::NS;
+        case 5:  return RecordType::CNAME;
+        case 6:  return RecordType::SOA;
+        case 12: return RecordType::PTR;
+        case 13: return RecordType::HINFO;
+        case 15: return RecordType::MX;
+        case 16: return RecordType::TXT;
+        case 28: return RecordType::AAAA;
+        case 33: return RecordType::SRV;
+        default: return RecordType::Unknown;
+    }
+}
+
+// Order in which the RRs of an RRset go out. Fixed keeps insertion order;
+// Cyclic starts each answer one RR further on, Random at a random RR, so
+// clients that take the first address spread over all of them.
+enum class RRsetOrder {
+    Fixed,
+    Cyclic,
+    Random
+};
+
+// Parse "fixed", "cyclic" or "random"; false for anything else
+constexpr bool parse_rrset_order(std::string_view text, RRsetOrder& order) {
+    if (text == "fixed")  order = RRsetOrder::Fixed;
+    else if (text == "cyclic") order = RRsetOrder::Cyclic;
+    else if (text == "random") order = RRsetOrder::Random;
+    else return false;
+    return true;
+}
+
+namespace answer_subset {
+    class Rules;
+}
+
+class Zone;
+class ZoneRegistry;
+class ZoneSnapshot;
+struct ZoneDelta;
+
+// A published zone as a checkpoint holds it (see checkpoint.h)
+struct ZoneImage {
+    std::string origin;
+    std::shared_ptr<const ZoneSnapshot> snapshot;
+    bool transferred = false;   // Added by loadZone(), so reload() keeps it
+};
+
+// How snapshots index their owner names
+struct SnapshotOptions {
+    // Index owners with a minimal perfect hash instead of an open-addressing
+    // table. Meant for zones that are loaded once and served read-only: the
+    // directory is the owners array itself, so a lookup makes one access into
+    // it, and the index costs about 3 bits per name instead of 16-32 bytes.
+    bool perfectHash = false;
+    unsigned buildThreads = 0;   // Threads for RR encoding and the perfect hash, 0 = all cores
+    // RRsets answered with a weighted subset of their records (see
+    // answer_subset.h); snapshots build an alias table for each
+    std::shared_ptr<const answer_subset::Rules> subsets = nullptr;
+};
+
+// Counters of the negative-lookup filter in front of the zone indexes
+struct FilterStats {
+    uint64_t rejected = 0;              // Answered NXDOMAIN by the filter alone
+    uint64_t falsePositives = 0;        // Passed by the filter, then missed the index
+    double estimatedFalsePositiveRate = 0.0;   // Build-time estimate over all zones
+    
+    // Share of absent names the filter let through, as seen by live traffic
+    [[nodiscard]]
+    double observedFalsePositiveRate() const noexcept {
+        uint64_t absent = rejected + falsePositives;
+        return absent == 0 ? 0.0 : static_cast<double>(falsePositives) / absent;
+    }
+};
+
 class DNSRecord {
 public:
     std::string name;
@@ -78,14 +186,78 @@ public:
 
 class DNSServer {
 private:
-    // Standard unordered_map without the custom comparator for now
-    std::unordered_map<std::string, std::vector<DNSRecord>> records;
+    // Interned owner names and values; see record_store.h
+    RecordStore store;
+
+    // Zones compiled by publish(); swapped atomically so the packet path never
+    // sees a half-built registry
+    std::shared_ptr<const ZoneRegistry> registry;
+    
+    // Index options for snapshots built by publish()
+    SnapshotOptions snapshotOptions;
+    
+    // Serializes publish(), applyDelta() and loadZone(), which may run on
+    // the update path and the transfer client's thread at the same time,
+    // and setChangeListener() against the listener they call
+    std::mutex writeMutex;
+    
+    // Rule-made names, answered where the zones have no record of their own
+    Synthesizer synthesizer;
+    
+    // How the packet path orders the RRs of each answered RRset
+    RRsetOrder answerOrdering = RRsetOrder::Cyclic;
+    
+    // Largest UDP reply sent to an EDNS client, whatever it advertises
+    uint16_t udpPayloadLimit = dns_packet::DEFAULT_UDP_PAYLOAD;
+    
+    // Told about every zone version published after the first publish()
+    std::function<void(std::string_view origin)> changeListener;
+    
+    // Reloads published, for generation()
+    std::atomic<uint64_t> reloads{0};
+    
+    // Origins of the zones loadZone() added; reload() leaves them alone
+    std::unordered_set<std::string> transferredZones;
+    
+    // Updated from the const packet path
+    mutable std::atomic<uint64_t> filterRejected{0};
+    mutable std::atomic<uint64_t> filterFalsePositives{0};
+
+    // A record whose strings live elsewhere, for the bulk loader
+    struct RecordView {
+        std::string_view name;
+        std::string_view type;
+        std::string_view value;
+    };
+
+    void insert(std::string_view name, std::string_view type, std::string_view value);
+    static void insertGrouped(RecordStore& target, std::span<const RecordView> records);
+    
+    // One zone per SOA owner in source, each with its first snapshot
+    [[nodiscard]]
+    std::vector<std::shared_ptr<Zone>> compile(const RecordStore& source) const;
+    
+    // The names a delta touches with their records decoded back into text,
+    // ready to be written to the store
+    struct StoreChange {
+        std::string owner;
+        std::vector<std::pair<std::string_view, std::string>> records;   // Type, value
+    };
+
+    [[nodiscard]]
+    static std::vector<StoreChange> storeChanges(const ZoneDelta& delta);
+
+    // Rewrite the stored records of the changed names to match them
+    void syncStore(std::span<const StoreChange> changes);
+    
+    // Add every record of a snapshot to target, decoded back into text
+    static void storeSnapshot(RecordStore& target, const ZoneSnapshot& snapshot);
 
 public:
     // Mark functions that shouldn't have their return values ignored
     [[nodiscard]] 
     bool empty() const noexcept {
-        return records.empty();
+        return store.recordCount() == 0;
     }
     
     // Add record with string_view parameters
@@ -93,12 +265,35 @@ public:
     
     // Modern overload with string_view
     void addRecord(std::string_view name, std::string_view type, std::string_view value) {
-        addRecord(DNSRecord{name, type, value});
+        insert(name, type, value);
     }
     
     // Modern overload with RecordType enum
     void addRecord(std::string_view name, RecordType type, std::string_view value) {
-        addRecord(DNSRecord{name, type, value});
+        insert(name, to_string_view(type), value);
+    }
+    
+    // Bulk load, e.g. addRecords(std::move(records)). The store copies bytes
+    // straight out of the given records, which are grouped by owner name first
+    // so each owner is interned once and its records land together; table
+    // space is reserved for the whole batch. Ranges that yield temporaries
+    // are moved into a buffer first. Encoding into wire form happens in
+    // parallel at the next publish().
+    template <std::ranges::input_range R>
+        requires std::convertible_to<std::ranges::range_reference_t<R>, const DNSRecord&>
+    void addRecords(R&& records) {
+        if constexpr (std::is_lvalue_reference_v<std::ranges::range_reference_t<R>>) {
+            std::vector<RecordView> views;
+            if constexpr (std::ranges::sized_range<R>) views.reserve(std::ranges::size(records));
+            for (const DNSRecord& record : records) {
+                views.push_back({record.name, record.type, record.value});
+            }
+            insertGrouped(store, views);
+        } else {
+            std::vector<DNSRecord> owned;
+            for (auto&& record : records) owned.push_back(std::move(record));
+            addRecords(owned);
+        }
     }
     
     // Query with string_view for better performance
@@ -123,43 +318,104 @@ public:
     std::vector<DNSRecord> queryByType(std::string_view name, RecordType type) const {
         return queryByType(name, to_string_view(type));
     }
+    
+    // Compile the stored records into one immutable snapshot per zone (every
+    // owner with an SOA record is a zone apex) and publish the new registry.
+    // Records outside all zones are kept for query() but are not served.
+    void publish();
+    
+    // Replace every stored record with records and publish the zones they
+    // define in place of the current ones; zones added by loadZone() carry
+    // over unless records define them too. The new store and all snapshots
+    // are built before publishing is locked out, so updates and transfers
+    // wait only for the swap, and queries not at all. False, with nothing
+    // changed and error set, when a record has a bad name, an unknown type
+    // or a value that does not encode, or when no record is an SOA.
+    bool reload(std::span<const DNSRecord> records, std::string& error);
+    
+    // Bumped by every reload() that publishes. Changes journaled before a
+    // reload follow zones that are gone, so the journal starts over when
+    // this moves (see ZoneUpdater::followReload()).
+    [[nodiscard]]
+    uint64_t generation() const noexcept { return reloads.load(std::memory_order_acquire); }
+    
+    // Publish the next version of one zone with delta applied (see
+    // ZoneSnapshot::apply) and bring the stored records in line with it.
+    // False when origin is not a published zone, or when the delta has a
+    // fromSerial other than the zone's current serial or a generation
+    // other than the current one.
+    bool applyDelta(std::string_view origin, const ZoneDelta& delta);
+    
+    // Replace everything in a zone with contents (every name, apex SOA
+    // included), adding the zone when it is not published yet; this is how
+    // a full transfer lands. The zone's history starts over. False when
+    // origin is not a valid name.
+    bool loadZone(std::string_view origin, ZoneDelta contents);
+    
+    // The published zones as they are now, for a checkpoint
+    [[nodiscard]]
+    std::vector<ZoneImage> capture();
+    
+    // Publish zones read from a checkpoint in place of the current ones.
+    // The snapshots are served as they are, without decoding them into the
+    // record store, so query() and publish() see only records added or
+    // changed afterwards; reload() still carries restored secondary zones
+    // over. False when an origin is not a valid name.
+    bool restore(std::vector<ZoneImage> images);
+    
+    // Call listener with the origin of every zone applyDelta() or loadZone()
+    // publishes a new version of, or reload() publishes with a new serial,
+    // e.g. to send NOTIFY. It runs on the
+    // publishing thread with publishing locked out, so it should be quick.
+    // Safe to call while other threads publish; it waits for them.
+    void setChangeListener(std::function<void(std::string_view origin)> listener) {
+        std::lock_guard lock(writeMutex);
+        changeListener = std::move(listener);
+    }
+    
+    // Synthesis rules (see synthesis.h); set up before serving
+    [[nodiscard]]
+    Synthesizer& synthesis() noexcept { return synthesizer; }
+    
+    [[nodiscard]]
+    const Synthesizer& synthesis() const noexcept { return synthesizer; }
+    
+    // Set before serving; read by the packet path without locking
+    void setRRsetOrder(RRsetOrder order) noexcept { answerOrdering = order; }
+    
+    [[nodiscard]]
+    RRsetOrder rrsetOrder() const noexcept { return answerOrdering; }
+    
+    // Set before serving; clamped to 512..MAX_EDNS_PAYLOAD
+    void setMaxUdpPayload(size_t bytes) noexcept {
+        udpPayloadLimit = static_cast<uint16_t>(std::clamp<size_t>(bytes, 512, dns_packet::MAX_EDNS_PAYLOAD));
+    }
+    
+    [[nodiscard]]
+    uint16_t maxUdpPayload() const noexcept { return udpPayloadLimit; }
+    
+    // Options applied by subsequent publish() calls
+    void setSnapshotOptions(const SnapshotOptions& options) {
+        snapshotOptions = options;
+    }
+    
+    // Currently published zones, or nullptr before the first publish()
+    [[nodiscard]]
+    std::shared_ptr<const ZoneRegistry> zones() const noexcept {
+        return std::atomic_load_explicit(&registry, std::memory_order_acquire);
+    }
+    
+    // Record the outcome of a negative-filter check for a name not in its zone
+    void countFilterOutcome(bool rejected) const noexcept {
+        (rejected ? filterRejected : filterFalsePositives).fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    [[nodiscard]]
+    FilterStats filterStats() const;
+    
+    // Heap bytes held by the record store
+    [[nodiscard]]
+    size_t memoryUsage() const noexcept {
+        return store.memoryUsage();
+    }
 };
-
-// Helpers for DNS packet parsing using std::span
-namespace dns_packet {
-    // Span-based DNS packet reader
-    class PacketReader {
-    private:
-        std::span<const uint8_t> data;
-        size_t position = 0;
-        
-    public:
-        explicit PacketReader(std::span<const uint8_t> packet_data) 
-            : data(packet_data) {}
-            
-        [[nodiscard]]
-        uint8_t readUint8() {
-            if (position >= data.size()) throw std::out_of_range("Packet buffer overrun");
-            return data[position++];
-        }
-        
-        [[nodiscard]]
-        uint16_t readUint16() {
-            if (position + 1 >= data.size()) throw std::out_of_range("Packet buffer overrun");
-            uint16_t value = (static_cast<uint16_t>(data[position]) << 8) | data[position + 1];
-            position += 2;
-            return value;
-        }
-        
-        [[nodiscard]]
-        std::span<const uint8_t> readBytes(size_t length) {
-            if (position + length > data.size()) throw std::out_of_range("Packet buffer overrun");
-            auto result = data.subspan(position, length);
-            position += length;
-            return result;
-        }
-        
-        [[nodiscard]]
-        std::string readDomainName();
-    };
-}
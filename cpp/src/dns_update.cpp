@@ -0,0 +1,318 @@
+#include "dns_update.h"
+#include <algorithm>
+#include <ranges>
+
+using namespace dns_packet;
+
+namespace {
+    constexpr uint16_t TYPE_SOA = 6;
+    constexpr uint16_t TYPE_NS = 2;
+    constexpr uint16_t TYPE_CNAME = 5;
+    constexpr size_t TAIL_RDATA = 10;   // TYPE, CLASS, TTL and RDLENGTH precede the RDATA
+
+    uint16_t typeOf(const std::vector<uint8_t>& tail) { return readUint16(tail, 0); }
+
+    // Sequence space comparison of serials (RFC1982)
+    bool serialNewer(uint32_t a, uint32_t b) { return static_cast<int32_t>(a - b) > 0; }
+
+    bool readEntry(std::span<const uint8_t> message, size_t& offset, WireName& name, uint16_t& type,
+                   uint16_t& rrClass, uint32_t& ttl, size_t& rdata, uint16_t& rdLength) {
+        if (!name.parse(message, offset) || offset + TAIL_RDATA > message.size()) return false;
+        type = readUint16(message, offset);
+        rrClass = readUint16(message, offset + 2);
+        ttl = (static_cast<uint32_t>(readUint16(message, offset + 4)) << 16) | readUint16(message, offset + 6);
+        rdLength = readUint16(message, offset + 8);
+        rdata = offset + TAIL_RDATA;
+        offset = rdata + rdLength;
+        return offset <= message.size();
+    }
+
+    bool inZone(const WireName& name, std::span<const uint8_t> apex) {
+        auto bytes = name.bytes();
+        if (bytes.size() < apex.size()) return false;
+        for (size_t labels = 0; labels <= name.labelCount(); ++labels) {
+            auto suffix = name.suffix(labels);
+            if (suffix.size() == apex.size()) return std::equal(suffix.begin(), suffix.end(), apex.begin());
+        }
+        return false;
+    }
+
+    // Re-encode RDATA the way the zone compiler does, so RRs from a message
+    // compare byte for byte with RRs already in a snapshot
+    bool canonicalTail(uint16_t type, std::span<const uint8_t> message, size_t rdata, uint16_t length,
+                       std::vector<uint8_t>& tail) {
+        if (from_type_code(type) == RecordType::Unknown) return false;
+        std::string text;
+        return decodeRData(type, message, rdata, length, text) && appendRecordTail(tail, type, DEFAULT_TTL, text);
+    }
+
+    bool readSOA(const std::vector<uint8_t>& tail, SOAData& soa) {
+        std::string text;
+        return decodeRData(TYPE_SOA, tail, TAIL_RDATA, tail.size() - TAIL_RDATA, text) && SOAData::parse(text, soa);
+    }
+
+    // Sorted RDATA of one type, for comparing RRsets as sets
+    std::vector<std::vector<uint8_t>> rrset(const std::vector<std::vector<uint8_t>>& rrs, uint16_t type) {
+        std::vector<std::vector<uint8_t>> result;
+        for (const auto& tail : rrs) {
+            if (typeOf(tail) == type) result.push_back(tail);
+        }
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+}
+
+size_t ZoneUpdater::Outcome::published() const noexcept {
+    return static_cast<size_t>(std::ranges::count(zones | std::views::values, true));
+}
+
+bool ZoneUpdater::Outcome::published(const std::string& origin) const {
+    auto it = zones.find(origin);
+    return it == zones.end() || it->second;
+}
+
+std::vector<uint8_t> ZoneUpdater::stage(std::span<const uint8_t> message, std::string* zone) {
+    std::vector<uint8_t> response;
+    if (message.size() < HEADER_SIZE) return response;
+
+    // The reply is the header alone: ID and opcode echoed, every count zero
+    response.assign(message.begin(), message.begin() + HEADER_SIZE);
+    response[2] = FLAG_QR | (message[2] & OPCODE_MASK);
+    for (size_t i = 4; i < HEADER_SIZE; ++i) response[i] = 0;
+    response[3] = process(message, zone);
+    return response;
+}
+
+uint8_t ZoneUpdater::process(std::span<const uint8_t> message, std::string* zoneOrigin) {
+    if (opcodeOf(message) != OPCODE_UPDATE) return RCODE_NOTIMP;
+
+    // Zone section: one SOA entry naming a zone we serve
+    size_t offset = HEADER_SIZE;
+    WireName zoneName;
+    if (readUint16(message, 4) != 1 || !zoneName.parse(message, offset) || offset + 4 > message.size() ||
+        readUint16(message, offset) != TYPE_SOA) {
+        return RCODE_FORMERR;
+    }
+    offset += 4;
+    // Read before the zones, so a reload that publishes after this point
+    // always shows at commit
+    uint64_t version = server.generation();
+    auto zones = server.zones();
+    const Zone* zone = zones ? zones->select(zoneName) : nullptr;
+    if (zone == nullptr || zone->originWire().size() != zoneName.bytes().size()) return RCODE_NOTAUTH;
+    if (isSecondary && isSecondary(zone->originWire())) return RCODE_NOTAUTH;
+    if (zoneOrigin != nullptr) *zoneOrigin = zone->origin();
+    auto snapshot = zone->snapshot();
+    if (!snapshot) return RCODE_SERVFAIL;
+    Name apex(zoneName.bytes().begin(), zoneName.bytes().end());
+
+    auto stagedEntry = pending.find(zone->origin());
+    const Pending* staged = stagedEntry == pending.end() ? nullptr : &stagedEntry->second;
+
+    // Changes of this message only, merged into the staged set on success
+    std::map<Name, RRs> scratch;
+    auto current = [&](const Name& name) -> RRs {
+        auto it = scratch.find(name);
+        return it != scratch.end() ? it->second : contents(*snapshot, staged, name);
+    };
+
+    // Prerequisite section (section 3.2)
+    std::map<std::pair<Name, uint16_t>, std::vector<std::vector<uint8_t>>> required;
+    for (uint16_t i = 0, count = readUint16(message, 6); i < count; ++i) {
+        Entry rr;
+        if (!readEntry(message, offset, rr.name, rr.type, rr.rrClass, rr.ttl, rr.rdata, rr.rdLength)) {
+            return RCODE_FORMERR;
+        }
+        if (rr.ttl != 0) return RCODE_FORMERR;
+        if (!inZone(rr.name, apex)) return RCODE_NOTZONE;
+        Name name(rr.name.bytes().begin(), rr.name.bytes().end());
+        RRs rrs = current(name);
+        if (rr.rrClass == CLASS_ANY || rr.rrClass == CLASS_NONE) {
+            if (rr.rdLength != 0) return RCODE_FORMERR;
+            bool exists = rr.type == QTYPE_ANY ? !rrs.empty() : !rrset(rrs, rr.type).empty();
+            if (rr.rrClass == CLASS_ANY && !exists) return rr.type == QTYPE_ANY ? RCODE_NXDOMAIN : RCODE_NXRRSET;
+            if (rr.rrClass == CLASS_NONE && exists) return rr.type == QTYPE_ANY ? RCODE_YXDOMAIN : RCODE_YXRRSET;
+        } else if (rr.rrClass == CLASS_IN) {
+            std::vector<uint8_t> tail;
+            if (rr.type == QTYPE_ANY) return RCODE_FORMERR;
+            if (!canonicalTail(rr.type, message, rr.rdata, rr.rdLength, tail)) return RCODE_NXRRSET;
+            required[{std::move(name), rr.type}].push_back(std::move(tail));
+        } else {
+            return RCODE_FORMERR;
+        }
+    }
+    // Value-dependent prerequisites must match the RRset exactly
+    for (auto& [key, rrs] : required) {
+        std::sort(rrs.begin(), rrs.end());
+        rrs.erase(std::unique(rrs.begin(), rrs.end()), rrs.end());
+        if (rrset(current(key.first), key.second) != rrs) return RCODE_NXRRSET;
+    }
+
+    // Update section: check every entry before changing anything (3.4.1)
+    std::vector<Entry> updates(readUint16(message, 8));
+    for (Entry& rr : updates) {
+        if (!readEntry(message, offset, rr.name, rr.type, rr.rrClass, rr.ttl, rr.rdata, rr.rdLength)) {
+            return RCODE_FORMERR;
+        }
+        if (!inZone(rr.name, apex)) return RCODE_NOTZONE;
+        if (rr.rrClass == CLASS_IN) {
+            if (rr.type == QTYPE_ANY) return RCODE_FORMERR;
+            if (from_type_code(rr.type) == RecordType::Unknown) return RCODE_REFUSED;
+        } else if (rr.rrClass == CLASS_ANY) {
+            if (rr.ttl != 0 || rr.rdLength != 0) return RCODE_FORMERR;
+        } else if (rr.rrClass == CLASS_NONE) {
+            if (rr.ttl != 0 || rr.type == QTYPE_ANY) return RCODE_FORMERR;
+        } else {
+            return RCODE_FORMERR;
+        }
+    }
+
+    // Apply in message order (3.4.2)
+    bool serialSet = false;
+    for (const Entry& rr : updates) {
+        Name name(rr.name.bytes().begin(), rr.name.bytes().end());
+        auto touched = scratch.find(name);
+        if (touched == scratch.end()) touched = scratch.emplace(name, current(name)).first;
+        RRs& rrs = touched->second;
+        bool atApex = name == apex;
+        auto ofType = [&](uint16_t type) {
+            return std::count_if(rrs.begin(), rrs.end(), [&](const auto& tail) { return typeOf(tail) == type; });
+        };
+
+        if (rr.rrClass == CLASS_IN) {
+            std::vector<uint8_t> tail;
+            if (!canonicalTail(rr.type, message, rr.rdata, rr.rdLength, tail)) return RCODE_FORMERR;
+            if (rr.type == TYPE_SOA) {
+                // Only the apex has an SOA, and only a newer serial replaces it
+                SOAData next;
+                SOAData now;
+                auto existing = std::find_if(rrs.begin(), rrs.end(),
+                                             [](const auto& rrTail) { return typeOf(rrTail) == TYPE_SOA; });
+                if (!atApex || existing == rrs.end() || !readSOA(tail, next) || !readSOA(*existing, now) ||
+                    !serialNewer(next.serial, now.serial)) {
+                    continue;
+                }
+                *existing = std::move(tail);
+                serialSet = true;
+                continue;
+            }
+            // CNAME and other data never share a name
+            size_t cnames = ofType(TYPE_CNAME);
+            if (rr.type == TYPE_CNAME ? rrs.size() != cnames : cnames != 0) continue;
+            if (rr.type == TYPE_CNAME) rrs.clear();
+            if (std::find(rrs.begin(), rrs.end(), tail) == rrs.end()) rrs.push_back(std::move(tail));
+        } else if (rr.rrClass == CLASS_ANY) {
+            if (rr.type == QTYPE_ANY) {
+                // The apex keeps its SOA and NS RRsets
+                std::erase_if(rrs, [&](const auto& tail) {
+                    return !atApex || (typeOf(tail) != TYPE_SOA && typeOf(tail) != TYPE_NS);
+                });
+            } else if (!atApex || (rr.type != TYPE_SOA && rr.type != TYPE_NS)) {
+                std::erase_if(rrs, [&](const auto& tail) { return typeOf(tail) == rr.type; });
+            }
+        } else {
+            std::vector<uint8_t> tail;
+            if (rr.type == TYPE_SOA || !canonicalTail(rr.type, message, rr.rdata, rr.rdLength, tail)) continue;
+            // Never remove the last NS of the zone
+            if (atApex && rr.type == TYPE_NS && ofType(TYPE_NS) <= 1) continue;
+            std::erase(rrs, tail);
+        }
+    }
+
+    // Stage only the names that actually changed. The first message staged
+    // for a zone fixes the version the whole batch applies to.
+    auto target = [&]() -> Pending& {
+        auto [it, added] = pending.try_emplace(zone->origin());
+        if (added) {
+            it->second.apex = apex;
+            it->second.fromSerial = snapshot->soa().serial;
+            it->second.generation = version;
+        }
+        return it->second;
+    };
+    for (auto& [name, rrs] : scratch) {
+        RRs before = contents(*snapshot, staged, name);
+        if (before == rrs) continue;
+        target().owners[name] = std::move(rrs);
+    }
+    if (serialSet) target().serialSet = true;
+    return RCODE_NOERROR;
+}
+
+ZoneUpdater::RRs ZoneUpdater::contents(const ZoneSnapshot& snapshot, const Pending* staged, const Name& name) const {
+    if (staged != nullptr) {
+        auto it = staged->owners.find(name);
+        if (it != staged->owners.end()) return it->second;
+    }
+    RRs rrs;
+    const ZoneSnapshot::Owner* owner = snapshot.find(name, hashName(name));
+    if (owner == nullptr) return rrs;
+    for (const auto& set : snapshot.rrsets(*owner)) {
+        for (uint32_t i = 0; i < set.rrCount; ++i) {
+            auto tail = snapshot.rr(set.firstRR + i);
+            rrs.emplace_back(tail.begin(), tail.end());
+        }
+    }
+    return rrs;
+}
+
+void ZoneUpdater::followReload() {
+    uint64_t current = server.generation();
+    if (current == generation) return;
+    // Staged contents were read from the zones the reload replaced
+    std::erase_if(pending, [&](const auto& entry) {
+        if (entry.second.generation == current) return false;
+        dropped.insert(entry.first);
+        return true;
+    });
+    if (reloaded) reloaded();
+    generation = current;
+}
+
+ZoneUpdater::Outcome ZoneUpdater::commit() {
+    Outcome outcome;
+    // The journal follows the zones published now; a reload after this
+    // point makes applyDelta() refuse the batch, which leaves its entries
+    // to the generation that reload ends
+    followReload();
+    for (const std::string& origin : dropped) outcome.zones[origin] = false;
+    dropped.clear();
+
+    std::vector<std::pair<std::string, ZoneDelta>> deltas;
+    auto zones = server.zones();
+    for (auto& [origin, staged] : pending) {
+        auto zone = zones ? zones->find(origin) : nullptr;
+        auto snapshot = zone ? zone->snapshot() : nullptr;
+        outcome.zones[origin] = false;
+        if (!snapshot) continue;
+
+        // The delta applies only to the version its messages were checked
+        // against; applyDelta() refuses it once anything else published.
+        // A changed zone gets the next serial unless an update raised it already.
+        ZoneDelta delta;
+        delta.fromSerial = staged.fromSerial;
+        delta.generation = staged.generation;
+        RRs& apex = staged.owners.try_emplace(staged.apex, contents(*snapshot, nullptr, staged.apex)).first->second;
+        auto soaTail = std::find_if(apex.begin(), apex.end(), [](const auto& tail) { return typeOf(tail) == TYPE_SOA; });
+        if (soaTail == apex.end() || !readSOA(*soaTail, delta.soa)) continue;
+        if (!staged.serialSet || !serialNewer(delta.soa.serial, staged.fromSerial)) {
+            delta.soa.serial = staged.fromSerial + 1;
+        }
+        std::vector<uint8_t> rdata;
+        delta.soa.encode(rdata);
+        soaTail->clear();
+        appendRecordTail(*soaTail, TYPE_SOA, DEFAULT_TTL, std::span<const uint8_t>(rdata));
+
+        delta.owners = std::move(staged.owners);
+        deltas.emplace_back(origin, std::move(delta));
+    }
+    pending.clear();
+
+    if (journal != nullptr && !deltas.empty()) {
+        for (const auto& [origin, delta] : deltas) journal->append(origin, delta);
+        journal->sync();
+    }
+    for (const auto& [origin, delta] : deltas) outcome.zones[origin] = server.applyDelta(origin, delta);
+    return outcome;
+}
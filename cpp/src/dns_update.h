@@ -0,0 +1,114 @@
+#pragma once
+
+#include "dns_server.h"
+#include "journal.h"
+#include "zone.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <span>
+#include <string>
+#include <vector>
+
+// RFC2136 dynamic update. stage() checks one UPDATE message against the zone
+// as it stands (the published snapshot plus anything staged before it) and
+// queues its changes; commit() turns everything staged for a zone into one
+// ZoneDelta, bumps the SOA serial and publishes the next snapshot version.
+// A burst of updates therefore costs one copy-on-write publish per zone,
+// and readers keep answering from the previous version until the swap.
+class ZoneUpdater {
+public:
+    explicit ZoneUpdater(DNSServer& server) : server(server), generation(server.generation()) {}
+
+    // What commit() did with each zone that had changes staged
+    struct Outcome {
+        std::map<std::string, bool> zones;   // By origin: true when its delta was published
+
+        [[nodiscard]]
+        size_t published() const noexcept;
+
+        // False only for a zone whose staged changes were dropped; an update
+        // for it must not be acknowledged, so the client retries
+        [[nodiscard]]
+        bool published(const std::string& origin) const;
+    };
+
+    // Process one UPDATE message and return the response to send. A message
+    // that fails any check leaves nothing staged (RFC2136 section 3.4).
+    // zone, when given, receives the origin of the zone the message names
+    // once it is found to be one we serve.
+    [[nodiscard]]
+    std::vector<uint8_t> stage(std::span<const uint8_t> message, std::string* zone = nullptr);
+
+    // Publish everything staged so far. With a journal, the batch is appended
+    // and flushed once before any of it is published, and a journal failure
+    // (std::system_error) publishes nothing. A zone's delta is dropped when
+    // the zone changed under it (a reload, a transfer or a restore published
+    // in between, see DNSServer::applyDelta()); the outcome says which.
+    Outcome commit();
+
+    // Write ahead to journal from now on; nullptr turns it off
+    void setJournal(Journal* target) noexcept { journal = target; }
+
+    // Zones for which secondary returns true are pulled from a primary, and
+    // an update naming one is refused with NOTAUTH (RFC2136 section 3.1.2
+    // leaves forwarding optional); the argument is the zone's lowercased
+    // wire name
+    void setSecondary(std::function<bool(std::span<const uint8_t> apex)> secondary) {
+        isSecondary = std::move(secondary);
+    }
+
+    // A reload makes the zone files authoritative again: what they say is
+    // served, and the journal must not bring back the updates made before,
+    // neither now nor on restart. handler runs on the update path before
+    // anything is journaled after a reload; it restarts the journal (see
+    // Journal::restart()) along with whatever else holds the old zones.
+    void setReloadHandler(std::function<void()> handler) { reloaded = std::move(handler); }
+
+    // Run the reload handler if the zones were reloaded since it last ran,
+    // dropping whatever was staged against the zones from before the
+    // reload; the next commit() reports those zones as not published.
+    // commit() calls this too; calling it between batches as well starts
+    // the new journal without waiting for the next update. Throws what the
+    // handler throws, and then runs it again next time.
+    void followReload();
+
+    [[nodiscard]]
+    bool empty() const noexcept { return pending.empty(); }
+
+private:
+    using Name = std::vector<uint8_t>;                 // Lowercased wire format
+    using RRs = std::vector<std::vector<uint8_t>>;     // TYPE..RDATA tails of one name
+
+    struct Pending {
+        Name apex;
+        std::map<Name, RRs> owners;   // Full new contents of every changed name
+        bool serialSet = false;       // An update raised the serial itself
+        uint32_t fromSerial = 0;      // Serial of the snapshot the first message was checked against
+        uint64_t generation = 0;      // Server generation before that snapshot was read
+    };
+
+    // One RR of the prerequisite or update section
+    struct Entry {
+        dns_packet::WireName name;
+        uint16_t type;
+        uint16_t rrClass;
+        uint32_t ttl;
+        size_t rdata;                 // Offset of the RDATA in the message
+        uint16_t rdLength;
+    };
+
+    uint8_t process(std::span<const uint8_t> message, std::string* zoneOrigin);
+
+    // Contents of a name: staged changes first, then the published snapshot
+    RRs contents(const ZoneSnapshot& snapshot, const Pending* staged, const Name& name) const;
+
+    DNSServer& server;
+    Journal* journal = nullptr;
+    std::function<void()> reloaded;
+    std::function<bool(std::span<const uint8_t>)> isSecondary;
+    uint64_t generation;                      // Of the zones the journal follows
+    std::map<std::string, Pending> pending;   // By zone origin
+    std::set<std::string> dropped;            // Staged zones followReload() voided since the last commit
+};
@@ -0,0 +1,121 @@
+#include "huge_pages.h"
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <sys/mman.h>
+#include <unordered_map>
+
+namespace huge_pages {
+
+namespace {
+    std::atomic<Mode> currentMode{Mode::Off};
+    std::atomic<size_t> explicitBytes{0};
+    std::atomic<size_t> transparentBytes{0};
+    std::atomic<size_t> plainBytes{0};
+
+    enum class Route : uint8_t { Explicit, Transparent, Plain };
+
+    // How each live mapping was obtained, so deallocate() keeps the counters
+    // right even after the mode has changed. Mappings are 2 MiB and up, so
+    // there are few of them and the lock is never hot.
+    std::mutex routesLock;
+    std::unordered_map<void*, Route> routes;
+
+    size_t mappedSize(size_t bytes) noexcept {
+        return (bytes + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    }
+
+    std::atomic<size_t>& counter(Route route) noexcept {
+        switch (route) {
+            case Route::Explicit:    return explicitBytes;
+            case Route::Transparent: return transparentBytes;
+            case Route::Plain:
+            default:                 return plainBytes;
+        }
+    }
+
+    void* map(size_t length, int extraFlags) noexcept {
+        void* block = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extraFlags, -1, 0);
+        return block == MAP_FAILED ? nullptr : block;
+    }
+}
+
+void setMode(Mode mode) noexcept {
+    currentMode.store(mode, std::memory_order_relaxed);
+}
+
+Mode mode() noexcept {
+    return currentMode.load(std::memory_order_relaxed);
+}
+
+bool parseMode(const char* text, Mode& mode) noexcept {
+    if (std::strcmp(text, "off") == 0) mode = Mode::Off;
+    else if (std::strcmp(text, "thp") == 0) mode = Mode::Transparent;
+    else if (std::strcmp(text, "hugetlb") == 0) mode = Mode::Explicit;
+    else return false;
+    return true;
+}
+
+Stats stats() noexcept {
+    return {explicitBytes.load(std::memory_order_relaxed), transparentBytes.load(std::memory_order_relaxed),
+            plainBytes.load(std::memory_order_relaxed)};
+}
+
+void* allocate(size_t bytes, size_t alignment) {
+    if (bytes < PAGE_SIZE) {
+        return alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? ::operator new(bytes, std::align_val_t(alignment))
+                                                            : ::operator new(bytes);
+    }
+
+    size_t length = mappedSize(bytes);
+    Mode wanted = mode();
+    void* block = nullptr;
+    Route route = Route::Plain;
+    if (wanted == Mode::Explicit) {
+        // Fails unless vm.nr_hugepages has enough free pages; fall through
+        block = map(length, MAP_HUGETLB);
+        route = Route::Explicit;
+    }
+    if (block == nullptr) {
+        block = map(length, 0);
+        if (block == nullptr) throw std::bad_alloc();
+        route = wanted != Mode::Off && madvise(block, length, MADV_HUGEPAGE) == 0 ? Route::Transparent : Route::Plain;
+    }
+
+    try {
+        std::lock_guard<std::mutex> guard(routesLock);
+        routes.emplace(block, route);
+    } catch (...) {
+        munmap(block, length);
+        throw;
+    }
+    counter(route).fetch_add(length, std::memory_order_relaxed);
+    return block;
+}
+
+void deallocate(void* block, size_t bytes, size_t alignment) noexcept {
+    if (block == nullptr) return;
+    if (bytes < PAGE_SIZE) {
+        if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            ::operator delete(block, std::align_val_t(alignment));
+        } else {
+            ::operator delete(block);
+        }
+        return;
+    }
+
+    Route route = Route::Plain;
+    {
+        std::lock_guard<std::mutex> guard(routesLock);
+        auto it = routes.find(block);
+        if (it != routes.end()) {
+            route = it->second;
+            routes.erase(it);
+        }
+    }
+    size_t length = mappedSize(bytes);
+    counter(route).fetch_sub(length, std::memory_order_relaxed);
+    munmap(block, length);
+}
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+// Backing store for the large, randomly probed tables: the record arena,
+// the owner and name indexes, snapshot RR data and the negative filters.
+// With tens of gigabytes of zone data nearly every probe misses the dTLB on
+// 4 KiB pages; mapping those tables with 2 MiB pages cuts the number of
+// translations by 512x. Small blocks always come from operator new.
+namespace huge_pages {
+    constexpr size_t PAGE_SIZE = size_t{2} << 20;   // 2 MiB
+
+    enum class Mode {
+        Off,           // Plain anonymous mappings
+        Transparent,   // madvise(MADV_HUGEPAGE) and let THP promote them
+        Explicit       // MAP_HUGETLB from the reserved pool, else Transparent
+    };
+
+    // Applies to blocks allocated after the call; set it before loading zones
+    void setMode(Mode mode) noexcept;
+
+    [[nodiscard]]
+    Mode mode() noexcept;
+
+    // Parse "off", "thp" or "hugetlb"; false for anything else
+    bool parseMode(const char* text, Mode& mode) noexcept;
+
+    // Bytes currently mapped by each route, to see whether huge pages were
+    // actually obtained or every request fell back
+    struct Stats {
+        size_t explicitBytes = 0;
+        size_t transparentBytes = 0;
+        size_t plainBytes = 0;
+    };
+
+    [[nodiscard]]
+    Stats stats() noexcept;
+
+    // Blocks of PAGE_SIZE and up are mapped directly, rounded up to whole
+    // huge pages; throws std::bad_alloc when the system is out of memory
+    [[nodiscard]]
+    void* allocate(size_t bytes, size_t alignment);
+
+    void deallocate(void* block, size_t bytes, size_t alignment) noexcept;
+}
+
+// Standard allocator over huge_pages, for the containers named above
+template <typename T>
+class HugePageAllocator {
+public:
+    using value_type = T;
+
+    HugePageAllocator() noexcept = default;
+
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) noexcept {}
+
+    [[nodiscard]]
+    T* allocate(size_t n) {
+        return static_cast<T*>(huge_pages::allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* block, size_t n) noexcept {
+        huge_pages::deallocate(block, n * sizeof(T), alignof(T));
+    }
+
+    template <typename U>
+    bool operator==(const HugePageAllocator<U>&) const noexcept { return true; }
+};
+
+template <typename T>
+using LargeVector = std::vector<T, HugePageAllocator<T>>;
@@ -0,0 +1,229 @@
+#include "journal.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <fcntl.h>
+#include <system_error>
+#include <unistd.h>
+
+using namespace dns_packet;
+
+namespace {
+    constexpr size_t FRAME_SIZE = 8;   // Payload length and checksum
+    constexpr uint16_t TYPE_SOA = 6;
+
+    constexpr std::array<uint32_t, 256> CRC_TABLE = [] {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+    uint32_t readUint32(std::span<const uint8_t> data, size_t offset) {
+        return (static_cast<uint32_t>(readUint16(data, offset)) << 16) | readUint16(data, offset + 2);
+    }
+
+    [[noreturn]] void fail(const char* what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    // Bounds-checked cursor over one payload
+    struct Cursor {
+        std::span<const uint8_t> data;
+        size_t offset = 0;
+
+        bool has(size_t n) const { return offset + n <= data.size(); }
+
+        bool take(size_t n, std::span<const uint8_t>& out) {
+            if (!has(n)) return false;
+            out = data.subspan(offset, n);
+            offset += n;
+            return true;
+        }
+
+        bool u8(size_t& out) {
+            if (!has(1)) return false;
+            out = data[offset++];
+            return true;
+        }
+
+        bool u16(size_t& out) {
+            if (!has(2)) return false;
+            out = readUint16(data, offset);
+            offset += 2;
+            return true;
+        }
+
+        bool u32(size_t& out) {
+            if (!has(4)) return false;
+            out = readUint32(data, offset);
+            offset += 4;
+            return true;
+        }
+    };
+}
+
+Journal::~Journal() {
+    if (fd >= 0) close(fd);
+}
+
+bool Journal::open(const std::string& path) {
+    if (fd >= 0) close(fd);
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    return fd >= 0;
+}
+
+size_t Journal::replay(const Replay& apply, uint64_t from) {
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size < 0) fail("journal seek");
+    // A journal shorter than from is not the one the offset was taken in,
+    // and its entries cannot be placed relative to it, so none are replayed
+    from = std::min(from, static_cast<uint64_t>(size));
+    std::vector<uint8_t> contents(static_cast<size_t>(size) - from);
+    for (size_t done = 0; done < contents.size();) {
+        ssize_t n = pread(fd, contents.data() + done, contents.size() - done, static_cast<off_t>(from + done));
+        if (n <= 0) fail("journal read");
+        done += static_cast<size_t>(n);
+    }
+
+    size_t replayed = 0;
+    size_t offset = 0;
+    std::string origin;
+    while (offset + FRAME_SIZE <= contents.size()) {
+        uint32_t length = readUint32(contents, offset);
+        if (length > MAX_ENTRY_SIZE || offset + FRAME_SIZE + length > contents.size()) break;
+        auto payload = std::span<const uint8_t>(contents).subspan(offset + FRAME_SIZE, length);
+        ZoneDelta delta;
+        if (checksum(payload) != readUint32(contents, offset + 4) || !decode(payload, origin, delta)) break;
+        apply(origin, delta);
+        replayed++;
+        offset += FRAME_SIZE + length;
+    }
+
+    // Drop the torn tail so new entries follow the last good one
+    if (offset != contents.size() && ftruncate(fd, static_cast<off_t>(from + offset)) != 0) fail("journal truncate");
+    return replayed;
+}
+
+uint64_t Journal::position() const {
+    off_t end = lseek(fd, 0, SEEK_END);
+    if (end < 0) fail("journal seek");
+    return static_cast<uint64_t>(end);
+}
+
+void Journal::append(std::string_view origin, const ZoneDelta& delta) {
+    size_t start = buffer.size();
+    buffer.resize(start + FRAME_SIZE);
+    encode(origin, delta, buffer);
+    auto payload = std::span<const uint8_t>(buffer).subspan(start + FRAME_SIZE);
+    uint32_t length = static_cast<uint32_t>(payload.size());
+    uint32_t crc = checksum(payload);
+    writeUint16(buffer, start, static_cast<uint16_t>(length >> 16));
+    writeUint16(buffer, start + 2, static_cast<uint16_t>(length));
+    writeUint16(buffer, start + 4, static_cast<uint16_t>(crc >> 16));
+    writeUint16(buffer, start + 6, static_cast<uint16_t>(crc));
+    counters.entries++;
+}
+
+void Journal::sync() {
+    if (buffer.empty()) return;
+    std::vector<uint8_t> batch;
+    batch.swap(buffer);
+    off_t end = lseek(fd, 0, SEEK_END);
+    if (end < 0) fail("journal seek");
+
+    // On failure the batch is dropped, and so is anything of it that reached
+    // the file, so later entries do not end up behind a torn one
+    auto abandon = [&](const char* what) {
+        int error = errno;
+        if (ftruncate(fd, end) != 0) {
+            // Best effort; the original error is the one worth reporting
+        }
+        errno = error;
+        fail(what);
+    };
+    for (size_t done = 0; done < batch.size();) {
+        ssize_t n = write(fd, batch.data() + done, batch.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) abandon("journal write");
+        done += static_cast<size_t>(n);
+    }
+    if (fdatasync(fd) != 0) abandon("journal fdatasync");
+    counters.syncs++;
+    counters.bytes += batch.size();
+    batch.clear();
+    batch.swap(buffer);   // Keep the capacity for the next batch
+}
+
+void Journal::restart() {
+    buffer.clear();
+    if (ftruncate(fd, 0) != 0) fail("journal truncate");
+    if (fdatasync(fd) != 0) fail("journal fdatasync");
+}
+
+void Journal::encode(std::string_view origin, const ZoneDelta& delta, std::vector<uint8_t>& out) {
+    appendUint16(out, static_cast<uint16_t>(origin.size()));
+    out.insert(out.end(), origin.begin(), origin.end());
+    out.push_back(delta.fromSerial ? 1 : 0);
+    appendUint32(out, delta.fromSerial.value_or(0));
+
+    std::vector<uint8_t> soa;
+    delta.soa.encode(soa);
+    appendUint16(out, static_cast<uint16_t>(soa.size()));
+    out.insert(out.end(), soa.begin(), soa.end());
+
+    appendUint32(out, static_cast<uint32_t>(delta.owners.size()));
+    for (const auto& [name, tails] : delta.owners) {
+        out.push_back(static_cast<uint8_t>(name.size()));
+        out.insert(out.end(), name.begin(), name.end());
+        appendUint16(out, static_cast<uint16_t>(tails.size()));
+        for (const auto& tail : tails) {
+            appendUint16(out, static_cast<uint16_t>(tail.size()));
+            out.insert(out.end(), tail.begin(), tail.end());
+        }
+    }
+}
+
+bool Journal::decode(std::span<const uint8_t> payload, std::string& origin, ZoneDelta& delta) {
+    Cursor in{payload};
+    std::span<const uint8_t> bytes;
+    size_t length = 0;
+    if (!in.u16(length) || !in.take(length, bytes)) return false;
+    origin.assign(bytes.begin(), bytes.end());
+
+    size_t based = 0;
+    size_t fromSerial = 0;
+    if (!in.u8(based) || based > 1 || !in.u32(fromSerial)) return false;
+    delta.fromSerial.reset();
+    if (based) delta.fromSerial = static_cast<uint32_t>(fromSerial);
+
+    std::string soa;
+    if (!in.u16(length) || !in.has(length) || !decodeRData(TYPE_SOA, payload, in.offset, length, soa) ||
+        !SOAData::parse(soa, delta.soa)) {
+        return false;
+    }
+    in.offset += length;
+
+    size_t owners = 0;
+    if (!in.u32(owners)) return false;
+    delta.owners.clear();
+    for (size_t i = 0; i < owners; ++i) {
+        size_t count = 0;
+        if (!in.u8(length) || !in.take(length, bytes) || !in.u16(count)) return false;
+        auto& tails = delta.owners[std::vector<uint8_t>(bytes.begin(), bytes.end())];
+        for (size_t j = 0; j < count; ++j) {
+            if (!in.u16(length) || length < 10 || !in.take(length, bytes)) return false;
+            tails.emplace_back(bytes.begin(), bytes.end());
+        }
+    }
+    return in.offset == payload.size();
+}
+
+uint32_t Journal::checksum(std::span<const uint8_t> data, uint32_t previous) noexcept {
+    uint32_t crc = ~previous;
+    for (uint8_t byte : data) crc = CRC_TABLE[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
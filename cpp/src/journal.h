@@ -0,0 +1,86 @@
+#pragma once
+
+#include "zone.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Append-only journal of zone changes, written ahead of publishing them.
+// Each entry is one ZoneDelta for one zone, framed as payload length,
+// CRC-32C and payload. append() only encodes into a buffer; sync() writes
+// everything buffered with one write and one fdatasync, so a whole batch of
+// updates costs a single disk flush (group commit). Entries hold the full
+// new contents of each changed name and the serial they were made against,
+// so an entry only applies to the version it follows: replaying one twice,
+// or over zone files edited since, changes nothing.
+// Not thread-safe; the update path owns it.
+class Journal {
+public:
+    // Upper bound on one entry, to reject garbage lengths during replay
+    static constexpr uint32_t MAX_ENTRY_SIZE = 64u << 20;
+
+    struct Stats {
+        uint64_t entries = 0;   // Appended since open()
+        uint64_t syncs = 0;     // fdatasync calls
+        uint64_t bytes = 0;     // Bytes written
+    };
+
+    using Replay = std::function<void(std::string_view origin, const ZoneDelta& delta)>;
+
+    Journal() = default;
+    ~Journal();
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Open or create the journal file; false with errno set on failure
+    [[nodiscard]]
+    bool open(const std::string& path);
+
+    // Hand every intact entry from byte offset from on to apply, oldest
+    // first; from is 0 or a position() taken earlier, e.g. the one a
+    // checkpoint covers. The file is cut after the last entry, which
+    // discards one torn by a crash during its write. Returns the number of
+    // entries replayed.
+    size_t replay(const Replay& apply, uint64_t from = 0);
+
+    void append(std::string_view origin, const ZoneDelta& delta);
+
+    // Make everything appended durable. Throws std::system_error when the
+    // write or the flush fails; the batch is then discarded.
+    void sync();
+
+    // Start a new generation: drop every entry, durably, along with anything
+    // appended but not synced. For when the zones the entries follow are
+    // replaced wholesale, e.g. by a reload. Throws std::system_error.
+    void restart();
+
+    [[nodiscard]]
+    bool pending() const noexcept { return !buffer.empty(); }
+
+    // Offset the next synced batch starts at
+    [[nodiscard]]
+    uint64_t position() const;
+
+    [[nodiscard]]
+    const Stats& stats() const noexcept { return counters; }
+
+    // Entry encoding, exposed for tests; decode() is false for a corrupt payload
+    static void encode(std::string_view origin, const ZoneDelta& delta, std::vector<uint8_t>& out);
+
+    [[nodiscard]]
+    static bool decode(std::span<const uint8_t> payload, std::string& origin, ZoneDelta& delta);
+
+    // CRC-32C (Castagnoli) of data; pass the checksum of what came before
+    // it to checksum a stream piece by piece
+    [[nodiscard]]
+    static uint32_t checksum(std::span<const uint8_t> data, uint32_t previous = 0) noexcept;
+
+private:
+    int fd = -1;
+    std::vector<uint8_t> buffer;   // Framed entries not yet written
+    Stats counters;
+};
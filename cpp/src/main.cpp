@@ -1,4 +1,15 @@
+#include "answer_subset.h"
+#include "checkpoint.h"
 #include "dns_server.h"
+#include "dns_response.h"
+#include "dns_update.h"
+#include "huge_pages.h"
+#include "journal.h"
+#include "receive_pool.h"
+#include "scratch_arena.h"
+#include "transfer_client.h"
+#include "zone_reload.h"
+#include "zone_transfer.h"
 #include <iostream>
 #include <cstring>
 #include <unistd.h>
@@ -6,14 +17,34 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <csignal>
+#include <cstdlib>
 #include <thread>
 #include <atomic>
+#include <chrono>
 #include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
 #include <vector>
 
 constexpr uint16_t DNS_PORT = 5353;  // Using a non-privileged port instead of 53
-constexpr int MAX_DNS_PACKET_SIZE = 512;  // Standard DNS UDP packet size
 std::atomic<bool> running{true};
+std::atomic<bool> reloadRequested{false};
+
+// "192.0.2.1" or "192.0.2.1:5300", port 53 by default
+bool parseAddress(std::string_view spec, sockaddr_in& address) {
+    std::string host(spec);
+    int portNumber = 53;
+    if (size_t colon = host.find(':'); colon != std::string::npos) {
+        portNumber = std::atoi(host.c_str() + colon + 1);
+        host.resize(colon);
+    }
+    address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(portNumber));
+    return portNumber > 0 && portNumber < 65536 && inet_pton(AF_INET, host.c_str(), &address.sin_addr) == 1;
+}
 
 // Signal handler to gracefully shutdown the server
 void signalHandler(int signum) {
@@ -21,324 +52,187 @@ void signalHandler(int signum) {
     running = false;
 }
 
-// Function to parse domain name from a DNS query
-std::string parseDomainName(std::span<const uint8_t> packet, size_t& offset) {
-    std::string domainName;
-    
-    while (true) {
-        uint8_t labelLength = packet[offset++];
-        if (labelLength == 0) {
-            break;  // End of domain name
-        }
-        
-        // Handle DNS message compression (RFC1035 section 4.1.4)
-        if ((labelLength & 0xC0) == 0xC0) {
-            // Compression pointer
-            uint16_t pointer = ((labelLength & 0x3F) << 8) | packet[offset++];
-            size_t savedOffset = offset;
-            offset = pointer;
-            domainName += parseDomainName(packet, offset);
-            offset = savedOffset;
-            return domainName;
-        }
-        
-        // Regular label
-        if (!domainName.empty()) {
-            domainName += ".";
-        }
-        
-        for (int i = 0; i < labelLength; i++) {
-            domainName += packet[offset++];
-        }
-    }
-    
-    return domainName;
+// SIGHUP asks the main loop for a zone reload
+void reloadHandler(int) {
+    reloadRequested = true;
 }
 
-// Function to encode a domain name in DNS format
-std::vector<uint8_t> encodeDomainName(const std::string& domain) {
-    std::vector<uint8_t> result;
-    std::string label;
+int main(int argc, char* argv[]) {
+    // Setup signal handling for graceful shutdown
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+    signal(SIGHUP, reloadHandler);
     
-    for (char c : domain) {
-        if (c == '.') {
-            result.push_back(static_cast<uint8_t>(label.size()));
-            for (char lc : label) {
-                result.push_back(static_cast<uint8_t>(lc));
-            }
-            label.clear();
+    // --huge-pages=off|thp|hugetlb backs the zone tables with 2 MiB pages;
+    // --zone-file=PATH serves the zones in PATH and rereads it on SIGHUP;
+    // --rrset-order=fixed|cyclic|random orders multi-record answers;
+    // --answer-subset=NAME/TYPE/COUNT[/VALUE=WEIGHT,...] answers a large
+    // RRset with COUNT records drawn by weight;
+    // --synthesize=NETWORK=PATTERN answers PTR for NETWORK, and A or AAAA
+    // back, by rule (e.g. 192.0.2.0/24=ip-*.example.com);
+    // --journal=PATH makes dynamic updates survive a restart;
+    // --checkpoint=PATH writes the zones there every
+    // --checkpoint-interval=SECONDS (default 300) and restarts from it;
+    // --secondary=ZONE@ADDRESS[:PORT] follows ZONE from a primary;
+    // --notify=ADDRESS[:PORT] announces every zone change to a secondary,
+    // and --notify-window=MS sets how long NOTIFYs are coalesced
+    std::string journalPath;
+    std::string checkpointPath;
+    int checkpointInterval = 300;
+    std::vector<std::string> zoneFiles;
+    std::vector<std::pair<std::string, std::string>> synthesisRules;
+    uint16_t port = DNS_PORT;
+    std::vector<std::pair<std::string, sockaddr_in>> secondaries;
+    std::vector<sockaddr_in> notifyTargets;
+    int notifyWindow = -1;
+    RRsetOrder rrsetOrder = RRsetOrder::Cyclic;
+    size_t ednsPayload = dns_packet::DEFAULT_UDP_PAYLOAD;
+    auto subsets = std::make_shared<answer_subset::Rules>();
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        huge_pages::Mode mode;
+        RRsetOrder order;
+        sockaddr_in address{};
+        size_t at = arg.find('@');
+        if (arg.starts_with("--huge-pages=") && huge_pages::parseMode(argv[i] + 13, mode)) {
+            huge_pages::setMode(mode);
+        } else if (arg.starts_with("--rrset-order=") && parse_rrset_order(arg.substr(14), order)) {
+            rrsetOrder = order;
+        } else if (arg.starts_with("--edns-payload=") && std::atoi(argv[i] + 15) >= 512 &&
+                   std::atoi(argv[i] + 15) <= static_cast<int>(dns_packet::MAX_EDNS_PAYLOAD)) {
+            ednsPayload = static_cast<size_t>(std::atoi(argv[i] + 15));
+        } else if (arg.starts_with("--answer-subset=") && subsets->add(arg.substr(16))) {
+            // Applied to every snapshot built from here on
+        } else if (arg.starts_with("--zone-file=") && arg.size() > 12) {
+            zoneFiles.emplace_back(arg.substr(12));
+        } else if (arg.starts_with("--synthesize=") && arg.find('=', 13) != std::string_view::npos) {
+            size_t equals = arg.find('=', 13);
+            synthesisRules.emplace_back(std::string(arg.substr(13, equals - 13)), std::string(arg.substr(equals + 1)));
+        } else if (arg.starts_with("--journal=") && arg.size() > 10) {
+            journalPath = arg.substr(10);
+        } else if (arg.starts_with("--checkpoint=") && arg.size() > 13) {
+            checkpointPath = arg.substr(13);
+        } else if (arg.starts_with("--checkpoint-interval=") && std::atoi(argv[i] + 22) > 0) {
+            checkpointInterval = std::atoi(argv[i] + 22);
+        } else if (arg.starts_with("--port=") && std::atoi(argv[i] + 7) > 0 && std::atoi(argv[i] + 7) < 65536) {
+            port = static_cast<uint16_t>(std::atoi(argv[i] + 7));
+        } else if (arg.starts_with("--secondary=") && at != std::string_view::npos && at > 12 &&
+                   parseAddress(arg.substr(at + 1), address)) {
+            secondaries.emplace_back(std::string(arg.substr(12, at - 12)), address);
+        } else if (arg.starts_with("--notify=") && parseAddress(arg.substr(9), address)) {
+            notifyTargets.push_back(address);
+        } else if (arg.starts_with("--notify-window=") && arg.size() > 16 && std::atoi(argv[i] + 16) >= 0) {
+            notifyWindow = std::atoi(argv[i] + 16);
         } else {
-            label += c;
+            std::cerr << "Usage: " << argv[0] << " [--huge-pages=off|thp|hugetlb] [--zone-file=PATH]... [--journal=PATH]"
+                      << " [--rrset-order=fixed|cyclic|random] [--answer-subset=NAME/TYPE/COUNT[/VALUE=WEIGHT,...]]..."
+                      << " [--edns-payload=BYTES] [--checkpoint=PATH] [--checkpoint-interval=SECONDS]"
+                      << " [--port=PORT] [--synthesize=NETWORK=PATTERN]..."
+                      << " [--secondary=ZONE@ADDRESS[:PORT]]... [--notify=ADDRESS[:PORT]]..."
+                      << " [--notify-window=MS]" << std::endl;
+            return 1;
         }
     }
     
-    // Add the last label if any
-    if (!label.empty()) {
-        result.push_back(static_cast<uint8_t>(label.size()));
-        for (char lc : label) {
-            result.push_back(static_cast<uint8_t>(lc));
+    DNSServer server;
+    server.setRRsetOrder(rrsetOrder);
+    server.setMaxUdpPayload(ednsPayload);
+    if (!subsets->empty()) server.setSnapshotOptions({.subsets = subsets});
+    ZoneReloader reloader(server, zoneFiles);
+    for (const auto& [network, pattern] : synthesisRules) {
+        if (!server.synthesis().addRule(network, pattern)) {
+            std::cerr << "Invalid synthesis rule " << network << "=" << pattern << std::endl;
+            return 1;
         }
     }
     
-    // End with a zero length label
-    result.push_back(0);
-    
-    return result;
-}
-
-// Function to create a DNS response
-std::vector<uint8_t> createDNSResponse(const std::span<const uint8_t> query, const DNSServer& server) {
-    std::vector<uint8_t> response(query.begin(), query.end());
-    
-    // Set QR bit to 1 (response) and clear other flags
-    response[2] = 0x80; // QR=1, other flags 0
-    response[3] = 0x00; // Clear all flags
-    
-    // Parse the question
-    size_t offset = 12;  // Skip header
-    std::string domainName = parseDomainName(query, offset);
-    
-    // Get qtype and qclass
-    uint16_t qtype = (query[offset] << 8) | query[offset + 1];
-    offset += 4;  // Skip qtype (2) and qclass (2)
-    
-    // Get matching records
-    std::vector<DNSRecord> records;
-    if (qtype == 255) {  // ANY
-        records = server.query(domainName);
-    } else {
-        // Convert qtype to string representation
-        std::string typeStr;
-        switch (qtype) {
-            case 1: typeStr = "A"; break;
-            case 2: typeStr = "NS"; break;
-            case 5: typeStr = "CNAME"; break;
-            case 6: typeStr = "SOA"; break;
-            case 12: typeStr = "PTR"; break;
-            case 15: typeStr = "MX"; break;
-            case 16: typeStr = "TXT"; break;
-            default: typeStr = "A"; break;
+    // A checkpoint holds the zones as they were last served, compiled, so
+    // it is preferred over everything else; only the journal entries
+    // written after it are replayed. One that is damaged or fails its
+    // checksum is ignored for the zone files and the whole journal.
+    uint64_t journalFrom = 0;
+    bool restored = false;
+    if (!checkpointPath.empty() && access(checkpointPath.c_str(), F_OK) == 0) {
+        auto started = std::chrono::steady_clock::now();
+        std::vector<ZoneImage> images;
+        std::string error;
+        restored = checkpoint::read(checkpointPath, images, journalFrom, error) && server.restore(std::move(images));
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+        if (restored) {
+            std::cout << "Restored " << server.zones()->size() << " zones from " << checkpointPath << " in "
+                      << elapsed.count() << " ms" << std::endl;
+        } else {
+            std::cerr << "Ignoring checkpoint: " << (error.empty() ? "bad zone origin" : error)
+                      << "; loading the zone files and the whole journal" << std::endl;
+            journalFrom = 0;
         }
-        records = server.queryByType(domainName, typeStr);
     }
     
-    // Set answer count
-    uint16_t answerCount = records.size();
-    response[6] = answerCount >> 8;
-    response[7] = answerCount & 0xFF;
-    
-    // Check if we need to set RCODE to NXDOMAIN (3) when domain doesn't exist
-    if (records.empty() && server.query(domainName).empty()) {
-        response[3] |= 0x03; // RCODE = 3 (NXDOMAIN)
+    // Serve the zone files when there are any. Otherwise add test records,
+    // unless this instance is a secondary and gets its data from the primary.
+    if (restored) {
+        // Zone files are read again on SIGHUP
+    } else if (!zoneFiles.empty()) {
+        if (!reloader.load()) {
+            std::cerr << "Error loading zones: " << reloader.stats().lastError << std::endl;
+            return 1;
+        }
+    } else if (secondaries.empty()) {
+        server.addRecord("example.com", RecordType::A, "192.0.2.1");
+        server.addRecord("example.com", RecordType::MX, "10 mail.example.com");
+        server.addRecord("example.com", "TXT", "This is a test record");
+        server.addRecord("example.com", "NS", "ns1.example.com");
+        server.addRecord("example.com", "NS", "ns2.example.com");
+        server.addRecord("example.com", "SOA", "ns1.example.com admin.example.com 2023091401 3600 900 1209600 300");
+        server.addRecord("mail.example.com", RecordType::A, "192.0.2.2");
+        server.addRecord("ns1.example.com", RecordType::A, "192.0.2.3");
+        server.addRecord("ns2.example.com", RecordType::A, "192.0.2.4");
+        server.addRecord("www.example.com", "CNAME", "example.com");
+        server.addRecord("test.example.com", RecordType::A, "192.0.2.5");
+        // Add PTR record for reverse lookup, inside its own reverse zone
+        server.addRecord("2.0.192.in-addr.arpa", "SOA", "ns1.example.com admin.example.com 2023091401 3600 900 1209600 300");
+        server.addRecord("2.0.192.in-addr.arpa", "NS", "ns1.example.com");
+        server.addRecord("1.2.0.192.in-addr.arpa", "PTR", "example.com");
     }
     
-    // Add answer records
-    // Continuing after the question section - offset holds the current position
-     
-    for (const auto& record : records) {
-        // Add pointer to the domain name (compression)
-        response.push_back(0xC0);
-        response.push_back(0x0C);  // Pointer to offset 12
-        
-        // Add type
-        uint16_t type = 1;  // Default to A
-        if (record.type == "NS") type = 2;
-        else if (record.type == "CNAME") type = 5;
-        else if (record.type == "SOA") type = 6;
-        else if (record.type == "PTR") type = 12;
-        else if (record.type == "MX") type = 15;
-        else if (record.type == "TXT") type = 16;
-        
-        response.push_back(type >> 8);
-        response.push_back(type & 0xFF);
-        
-        // Add class (IN)
-        response.push_back(0x00);
-        response.push_back(0x01);
-        
-        // Add TTL (300 seconds)
-        response.push_back(0x00);
-        response.push_back(0x00);
-        response.push_back(0x01);
-        response.push_back(0x2C);
-        
-        // Add data based on the record type
-        if (type == 1) {  // A record
-            // Add data length for IPv4 address (4 bytes)
-            response.push_back(0x00);
-            response.push_back(0x04);
-            
-            // Convert IP address to binary
-            struct in_addr addr;
-            inet_pton(AF_INET, record.value.c_str(), &addr);
-            response.push_back((addr.s_addr >> 0) & 0xFF);
-            response.push_back((addr.s_addr >> 8) & 0xFF);
-            response.push_back((addr.s_addr >> 16) & 0xFF);
-            response.push_back((addr.s_addr >> 24) & 0xFF);
-        } 
-        else if (type == 2 || type == 5 || type == 12) {  // NS, CNAME, PTR records
-            // Encode domain name
-            auto encodedName = encodeDomainName(record.value);
-            
-            // Add data length
-            response.push_back(encodedName.size() >> 8);
-            response.push_back(encodedName.size() & 0xFF);
-            
-            // Add encoded domain name
-            response.insert(response.end(), encodedName.begin(), encodedName.end());
-        }
-        else if (type == 15) {  // MX record
-            // Parse "priority hostname" format
-            size_t spacePos = record.value.find(' ');
-            uint16_t priority = 10; // Default priority
-            std::string hostname = record.value;
-            
-            if (spacePos != std::string::npos) {
-                try {
-                    priority = std::stoi(record.value.substr(0, spacePos));
-                    hostname = record.value.substr(spacePos + 1);
-                } catch (...) {
-                    // Use defaults if parsing fails
-                }
-            }
-            
-            // Encode domain name
-            auto encodedName = encodeDomainName(hostname);
-            
-            // Add data length (2 bytes for priority + encoded domain name length)
-            response.push_back(0x00);
-            response.push_back(static_cast<uint8_t>(2 + encodedName.size()));
-            
-            // Add priority
-            response.push_back(priority >> 8);
-            response.push_back(priority & 0xFF);
-            
-            // Add encoded domain name
-            response.insert(response.end(), encodedName.begin(), encodedName.end());
-        }
-        else if (type == 16) {  // TXT record
-            // For TXT records, we need to add length byte before the actual text
-            std::string value = record.value;
-            if (value.size() > 255) {
-                value = value.substr(0, 255); // Truncate to max length
-            }
-            
-            // Add data length
-            response.push_back(0x00);
-            response.push_back(static_cast<uint8_t>(value.size() + 1)); // +1 for length byte
-            
-            // Add text length and text
-            response.push_back(static_cast<uint8_t>(value.size()));
-            for (char c : value) {
-                response.push_back(static_cast<uint8_t>(c));
-            }
-        }
-        else if (type == 6) {  // SOA record
-            // SOA record format: primary_ns admin_mailbox serial refresh retry expire minimum
-            // Simplified: just encode as two domain names followed by 5 32-bit values
-            std::string primaryNS = "ns1.example.com";
-            std::string adminMailbox = "admin.example.com";
-            uint32_t serial = 2023091401;
-            uint32_t refresh = 3600;
-            uint32_t retry = 900;
-            uint32_t expire = 1209600;
-            uint32_t minimum = 300;
-            
-            // Encode domain names
-            auto encodedPrimary = encodeDomainName(primaryNS);
-            auto encodedAdmin = encodeDomainName(adminMailbox);
-            
-            // Calculate total length
-            size_t totalLength = encodedPrimary.size() + encodedAdmin.size() + 20; // 5 32-bit values = 20 bytes
-            
-            // Add data length
-            response.push_back(totalLength >> 8);
-            response.push_back(totalLength & 0xFF);
-            
-            // Add primary NS
-            response.insert(response.end(), encodedPrimary.begin(), encodedPrimary.end());
-            
-            // Add admin mailbox
-            response.insert(response.end(), encodedAdmin.begin(), encodedAdmin.end());
-            
-            // Add serial
-            response.push_back((serial >> 24) & 0xFF);
-            response.push_back((serial >> 16) & 0xFF);
-            response.push_back((serial >> 8) & 0xFF);
-            response.push_back(serial & 0xFF);
-            
-            // Add refresh
-            response.push_back((refresh >> 24) & 0xFF);
-            response.push_back((refresh >> 16) & 0xFF);
-            response.push_back((refresh >> 8) & 0xFF);
-            response.push_back(refresh & 0xFF);
-            
-            // Add retry
-            response.push_back((retry >> 24) & 0xFF);
-            response.push_back((retry >> 16) & 0xFF);
-            response.push_back((retry >> 8) & 0xFF);
-            response.push_back(retry & 0xFF);
-            
-            // Add expire
-            response.push_back((expire >> 24) & 0xFF);
-            response.push_back((expire >> 16) & 0xFF);
-            response.push_back((expire >> 8) & 0xFF);
-            response.push_back(expire & 0xFF);
-            
-            // Add minimum
-            response.push_back((minimum >> 24) & 0xFF);
-            response.push_back((minimum >> 16) & 0xFF);
-            response.push_back((minimum >> 8) & 0xFF);
-            response.push_back(minimum & 0xFF);
+    // Compile the zones for the packet path
+    if (!restored && zoneFiles.empty()) server.publish();
+    
+    // Changes made at runtime are replayed on top of the compiled zones
+    Journal journal;
+    if (!journalPath.empty()) {
+        if (!journal.open(journalPath)) {
+            std::cerr << "Error opening journal " << journalPath << ": " << std::strerror(errno) << std::endl;
+            return 1;
         }
-        else {
-            // For other record types, just encode as a string (fallback)
-            std::string value = record.value;
-            
-            // Add data length
-            response.push_back(0x00);
-            response.push_back(static_cast<uint8_t>(value.size()));
-            
-            // Add data
-            for (char c : value) {
-                response.push_back(static_cast<uint8_t>(c));
+        // An entry only applies to the serial it was made against; zone files
+        // edited since make the rest of that zone's entries stale
+        size_t skipped = 0;
+        size_t replayed = journal.replay([&](std::string_view origin, const ZoneDelta& delta) {
+            if (server.applyDelta(origin, delta)) return;
+            auto zone = server.zones() ? server.zones()->find(origin) : nullptr;
+            auto snapshot = zone ? zone->snapshot() : nullptr;
+            std::cerr << "Skipping journal entry for " << origin << ": ";
+            if (snapshot) {
+                std::cerr << "zone is at serial " << snapshot->soa().serial << ", entry follows serial "
+                          << delta.fromSerial.value_or(0) << std::endl;
+            } else {
+                std::cerr << "zone is not served" << std::endl;
             }
-        }
+            skipped++;
+        }, journalFrom);
+        std::cout << "Replayed " << replayed - skipped << " journal entries from " << journalPath;
+        if (skipped > 0) std::cout << ", skipped " << skipped << " that no longer follow their zone";
+        std::cout << std::endl;
     }
     
-    // Check if response is too large and set TC flag if needed
-    if (response.size() > MAX_DNS_PACKET_SIZE) {
-        response[2] |= 0x02; // Set TC flag
-        response.resize(MAX_DNS_PACKET_SIZE);
+    if (huge_pages::mode() != huge_pages::Mode::Off) {
+        auto mapped = huge_pages::stats();
+        std::cout << "Huge pages: " << (mapped.explicitBytes >> 20) << " MiB hugetlb, "
+                  << (mapped.transparentBytes >> 20) << " MiB THP, "
+                  << (mapped.plainBytes >> 20) << " MiB without" << std::endl;
     }
     
-    return response;
-}
-
-int main() {
-    // Setup signal handling for graceful shutdown
-    signal(SIGINT, signalHandler);
-    signal(SIGTERM, signalHandler);
-    
-    DNSServer server;
-    
-    // Add test records
-    server.addRecord("example.com", RecordType::A, "192.0.2.1");
-    server.addRecord("example.com", RecordType::MX, "10 mail.example.com");
-    server.addRecord("example.com", "TXT", "This is a test record");
-    server.addRecord("example.com", "NS", "ns1.example.com");
-    server.addRecord("example.com", "NS", "ns2.example.com");
-    server.addRecord("example.com", "SOA", "ns1.example.com admin.example.com 2023091401 3600 900 1209600 300");
-    server.addRecord("mail.example.com", RecordType::A, "192.0.2.2");
-    server.addRecord("ns1.example.com", RecordType::A, "192.0.2.3");
-    server.addRecord("ns2.example.com", RecordType::A, "192.0.2.4");
-    server.addRecord("www.example.com", "CNAME", "example.com");
-    // Add A record for www.example.com to support direct resolution
-    server.addRecord("www.example.com", RecordType::A, "192.0.2.1");
-    server.addRecord("test.example.com", RecordType::A, "192.0.2.5");
-    // Add PTR record for reverse lookup
-    server.addRecord("1.2.0.192.in-addr.arpa", "PTR", "example.com");
-    
     // Create UDP socket
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sockfd < 0) {
@@ -359,19 +253,133 @@ int main() {
     memset(&serverAddr, 0, sizeof(serverAddr));
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_addr.s_addr = INADDR_ANY;
-    serverAddr.sin_port = htons(DNS_PORT);
+    serverAddr.sin_port = htons(port);
     
     if (bind(sockfd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
-        std::cerr << "Error binding to port " << DNS_PORT << std::endl;
+        std::cerr << "Error binding to port " << port << std::endl;
         std::cerr << "Try running with sudo or use a port > 1024" << std::endl;
         close(sockfd);
         return 1;
     }
     
-    std::cout << "DNS Server running on port " << DNS_PORT << "..." << std::endl;
+    // TCP queries and zone transfers run on their own thread
+    TransferServer tcp(server);
+    if (!tcp.start(port)) {
+        std::cerr << "Error listening on TCP port " << port << std::endl;
+        close(sockfd);
+        return 1;
+    }
     
+    // Secondary zones are pulled and refreshed in the background, and zone
+    // changes are announced from there too
+    TransferClient secondary(server);
+    if (notifyWindow >= 0) secondary.setNotifyWindow(std::chrono::milliseconds(notifyWindow));
+    for (const auto& target : notifyTargets) secondary.addNotifyTarget(target);
+    for (const auto& [zone, primary] : secondaries) {
+        if (!secondary.addZone(zone, primary)) {
+            std::cerr << "Invalid secondary zone " << zone << std::endl;
+            tcp.stop();
+            close(sockfd);
+            return 1;
+        }
+    }
+    // In place before the workers start, so their first changes are announced
+    server.setChangeListener([&](std::string_view origin) { secondary.zoneChanged(origin); });
+    if (!secondary.start()) {
+        std::cerr << "Error starting the transfer client" << std::endl;
+        server.setChangeListener(nullptr);
+        tcp.stop();
+        close(sockfd);
+        return 1;
+    }
+    Checkpointer checkpointer(server, checkpointPath);
+    checkpointer.setListener([&](bool ok, const Checkpointer::Stats& stats) {
+        if (ok) {
+            std::cout << "Checkpointed " << stats.lastZones << " zones to " << checkpointPath << " ("
+                      << (stats.lastBytes >> 20) << " MiB, " << stats.lastDuration.count() << " ms)" << std::endl;
+        } else {
+            std::cout << "Checkpoint failed: " << stats.lastError << std::endl;
+        }
+    });
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+    reloader.setListener([](bool ok, const ZoneReloader::Stats& stats) {
+        if (ok) {
+            std::cout << "Reloaded " << stats.lastRecords << " records into " << stats.lastZones << " zones";
+        } else {
+            std::cout << "Reload failed, zones unchanged: " << stats.lastError;
+        }
+        std::cout << " (" << stats.lastDuration.count() << " ms, peak RSS "
+                  << (stats.lastPeakBytes >> 20) << " MiB)" << std::endl;
+    });
+    
+    std::cout << "DNS Server running on port " << port << "..." << std::endl;
+    
+    // Receive slots are recycled after every reply, so the loop never allocates
+    ReceivePool pool(2 * ReceiveBatch::MAX_MESSAGES);
+    ReceiveBatch batch(pool);
+
+    // Dynamic updates are accepted from loopback only, and for the zones we
+    // are primary for. Those of one batch are published together and
+    // answered once they are visible.
+    ZoneUpdater updater(server);
+    if (!journalPath.empty()) updater.setJournal(&journal);
+    updater.setSecondary([&](std::span<const uint8_t> apex) { return secondary.follows(apex); });
+    
+    // After a reload the zone files are the truth again. A checkpoint or
+    // journal entries from before it would bring the old zones back on
+    // restart, so the checkpoint goes first (one being written is waited
+    // for, lest it land afterwards), then the journal starts over, and a
+    // fresh checkpoint of the reloaded zones is taken.
+    updater.setReloadHandler([&] {
+        if (!checkpointPath.empty()) {
+            checkpointer.wait();
+            if (unlink(checkpointPath.c_str()) != 0 && errno != ENOENT) {
+                throw std::system_error(errno, std::generic_category(), "checkpoint unlink");
+            }
+        }
+        if (!journalPath.empty()) journal.restart();
+        if (!checkpointPath.empty()) {
+            lastCheckpoint = std::chrono::steady_clock::now();
+            checkpointer.start(journalPath.empty() ? 0 : journal.position());
+        }
+    });
+    // Slot, reply and zone of every UPDATE of the current batch
+    struct UpdateReply {
+        size_t slot;
+        std::vector<uint8_t> reply;
+        std::string zone;
+    };
+    std::vector<UpdateReply> updateReplies;
+
     // Main server loop
     while (running) {
+        // The reload runs beside this loop, which keeps answering from the
+        // zones it finds published
+        if (reloadRequested.exchange(false)) {
+            if (zoneFiles.empty()) {
+                std::cout << "No zone files to reload" << std::endl;
+            } else if (!reloader.start()) {
+                std::cout << "Reload already running" << std::endl;
+            }
+        }
+        
+        // Between batches every journaled update is applied, so the journal
+        // position goes with the zones published now
+        try {
+            updater.followReload();
+        } catch (const std::system_error& error) {
+            std::cerr << "Journal not restarted after reload: " << error.what() << std::endl;
+        }
+        if (!checkpointPath.empty() && !checkpointer.busy() &&
+            std::chrono::steady_clock::now() - lastCheckpoint >= std::chrono::seconds(checkpointInterval)) {
+            lastCheckpoint = std::chrono::steady_clock::now();
+            try {
+                checkpointer.start(journalPath.empty() ? 0 : journal.position());
+            } catch (const std::system_error& error) {
+                std::cerr << "Checkpoint skipped: " << error.what() << std::endl;
+            }
+        }
+        
         fd_set readfds;
         FD_ZERO(&readfds);
         FD_SET(sockfd, &readfds);
@@ -398,41 +406,94 @@ int main() {
         }
         
         if (FD_ISSET(sockfd, &readfds)) {
-            // Receive DNS query
-            std::vector<uint8_t> buffer(MAX_DNS_PACKET_SIZE);
-            struct sockaddr_in clientAddr;
-            socklen_t clientLen = sizeof(clientAddr);
-            
-            ssize_t recvLen = recvfrom(sockfd, buffer.data(), buffer.size(), 0,
-                                      (struct sockaddr*)&clientAddr, &clientLen);
+            // Receive every queued DNS query in one call, straight into pool slots
+            size_t received = batch.receive(sockfd);
             
-            if (recvLen > 0) {
-                buffer.resize(recvLen);
-                std::span<const uint8_t> querySpan(buffer.data(), recvLen);
+            for (size_t i = 0; i < received; ++i) {
+                std::span<const uint8_t> querySpan = batch.packet(i);
+                const auto* source = reinterpret_cast<const sockaddr_in*>(batch.source(i));
+                if (querySpan.size() >= dns_packet::HEADER_SIZE &&
+                    dns_packet::opcodeOf(querySpan) == dns_packet::OPCODE_UPDATE &&
+                    (ntohl(source->sin_addr.s_addr) >> 24) == 127) {
+                    UpdateReply& update = updateReplies.emplace_back();
+                    update.slot = i;
+                    update.reply = updater.stage(querySpan, &update.zone);
+                    continue;
+                }
+                if (querySpan.size() >= dns_packet::HEADER_SIZE &&
+                    dns_packet::opcodeOf(querySpan) == dns_packet::OPCODE_NOTIFY) {
+                    auto reply = secondary.notify(querySpan, *source);
+                    if (!reply.empty()) {
+                        sendto(sockfd, reply.data(), reply.size(), 0, batch.source(i), batch.sourceLength(i));
+                    }
+                    batch.release(i);
+                    continue;
+                }
+                ScratchArena& scratch = ScratchArena::local();
                 
                 // Create response
-                std::vector<uint8_t> response = createDNSResponse(querySpan, server);
+                auto response = createDNSResponse(querySpan, server, scratch.resource());
                 
                 // Send response back to client
-                sendto(sockfd, response.data(), response.size(), 0,
-                      (struct sockaddr*)&clientAddr, clientLen);
+                sendto(sockfd, response.data(), response.size(), 0, batch.source(i), batch.sourceLength(i));
                 
                 // Log query details
+                const auto* clientAddr = reinterpret_cast<const sockaddr_in*>(batch.source(i));
                 char clientIP[INET_ADDRSTRLEN];
-                inet_ntop(AF_INET, &(clientAddr.sin_addr), clientIP, INET_ADDRSTRLEN);
-                std::cout << "Query from " << clientIP << ":" << ntohs(clientAddr.sin_port);
+                inet_ntop(AF_INET, &(clientAddr->sin_addr), clientIP, INET_ADDRSTRLEN);
+                std::cout << "Query from " << clientIP << ":" << ntohs(clientAddr->sin_port);
                 
                 // Extract query ID and domain from the query
                 size_t offset = 12;  // Skip header
-                std::string domainName = parseDomainName(querySpan, offset);
+                auto domainName = dns_packet::parseDomainName(querySpan, offset, scratch.resource());
                 
                 std::cout << " for " << domainName << std::endl;
+
+                // Everything above came from the arena and the slot, and is dead now
+                scratch.reset();
+                batch.release(i);
+            }
+
+            if (!updateReplies.empty()) {
+                // One journal flush covers every update of the batch, and
+                // none is acknowledged before it is durable
+                ZoneUpdater::Outcome outcome;
+                bool failed = false;
+                try {
+                    outcome = updater.commit();
+                } catch (const std::system_error& error) {
+                    std::cerr << "Updates not applied: " << error.what() << std::endl;
+                    failed = true;
+                }
+                // An update whose zone changed before its delta published was
+                // dropped, and is refused so that the client sends it again
+                for (auto& [i, reply, zone] : updateReplies) {
+                    if ((reply[3] & 0x0F) == dns_packet::RCODE_NOERROR && (failed || !outcome.published(zone))) {
+                        reply[3] |= dns_packet::RCODE_SERVFAIL;
+                    }
+                    sendto(sockfd, reply.data(), reply.size(), 0, batch.source(i), batch.sourceLength(i));
+                    batch.release(i);
+                }
+                std::cout << "Applied " << updateReplies.size() << " update(s) to " << outcome.published()
+                          << " zone(s)" << std::endl;
+                updateReplies.clear();
             }
         }
     }
     
     // Cleanup
+    reloader.wait();
+    checkpointer.wait();
+    server.setChangeListener(nullptr);
+    secondary.stop();
+    tcp.stop();
     close(sockfd);
+    
+    auto filter = server.filterStats();
+    std::cout << "Negative filter: " << filter.rejected << " rejected, "
+              << filter.falsePositives << " false positives (observed FPR "
+              << filter.observedFalsePositiveRate() << ", estimated "
+              << filter.estimatedFalsePositiveRate << ")" << std::endl;
     std::cout << "DNS Server stopped" << std::endl;
     
     return 0;
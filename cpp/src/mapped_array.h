@@ -0,0 +1,152 @@
+#pragma once
+
+#include "huge_pages.h"
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Array of a snapshot table: either a LargeVector of its own, as built, or a
+// read-only view of the same elements inside a mapped checkpoint, as
+// restored. A view holds a reference on the mapping, so the mapping lives as
+// long as any snapshot reading from it. Reads through a const array never
+// copy; any non-const access to a view copies the elements out to a vector
+// of its own first, since the mapping is read-only. Restored snapshots are
+// immutable, so in practice only builders ever own.
+template <typename T>
+class MappedArray {
+public:
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    MappedArray() = default;
+
+    explicit MappedArray(size_t count) : owned(count) { sync(); }
+
+    MappedArray(const MappedArray& other) : owned(other.owned), keep(other.keep) {
+        keep ? view(other.begin_, other.size_) : sync();
+    }
+
+    MappedArray(MappedArray&& other) noexcept : owned(std::move(other.owned)), keep(std::move(other.keep)) {
+        keep ? view(other.begin_, other.size_) : sync();
+        other.sync();
+    }
+
+    MappedArray& operator=(MappedArray other) noexcept {
+        owned.swap(other.owned);
+        keep.swap(other.keep);
+        keep ? view(other.begin_, other.size_) : sync();
+        return *this;
+    }
+
+    MappedArray& operator=(LargeVector<T>&& values) noexcept {
+        owned = std::move(values);
+        keep.reset();
+        sync();
+        return *this;
+    }
+
+    // Serve count elements at data in place; mapping keeps them valid
+    void map(const T* data, size_t count, std::shared_ptr<const void> mapping) {
+        LargeVector<T>().swap(owned);
+        keep = std::move(mapping);
+        view(data, count);
+    }
+
+    [[nodiscard]]
+    bool mapped() const noexcept { return keep != nullptr; }
+
+    [[nodiscard]]
+    const T* data() const noexcept { return begin_; }
+
+    [[nodiscard]]
+    T* data() { return own().data(); }
+
+    [[nodiscard]]
+    size_t size() const noexcept { return size_; }
+
+    [[nodiscard]]
+    bool empty() const noexcept { return size_ == 0; }
+
+    // Elements held in memory, mapped ones included
+    [[nodiscard]]
+    size_t capacity() const noexcept { return keep ? size_ : owned.capacity(); }
+
+    const T* begin() const noexcept { return begin_; }
+    const T* end() const noexcept { return begin_ + size_; }
+    T* begin() { return own().data(); }
+    T* end() { return own().data() + size_; }
+
+    const T& operator[](size_t index) const noexcept { return begin_[index]; }
+    T& operator[](size_t index) { return own()[index]; }
+
+    const T& front() const noexcept { return begin_[0]; }
+    T& front() { return own().front(); }
+
+    const T& back() const noexcept { return begin_[size_ - 1]; }
+    T& back() { return own().back(); }
+
+    void push_back(const T& value) {
+        own().push_back(value);
+        sync();
+    }
+
+    template <typename It>
+    void insert(const T* position, It first, It last) {
+        size_t at = static_cast<size_t>(position - begin_);
+        own().insert(owned.begin() + static_cast<ptrdiff_t>(at), first, last);
+        sync();
+    }
+
+    void reserve(size_t count) {
+        own().reserve(count);
+        sync();
+    }
+
+    void resize(size_t count) {
+        own().resize(count);
+        sync();
+    }
+
+    void assign(size_t count, const T& value) {
+        keep.reset();
+        owned.assign(count, value);
+        sync();
+    }
+
+    template <typename It>
+    void assign(It first, It last) {
+        keep.reset();
+        owned.assign(first, last);
+        sync();
+    }
+
+    void clear() noexcept {
+        keep.reset();
+        owned.clear();
+        sync();
+    }
+
+private:
+    void view(const T* data, size_t count) noexcept {
+        begin_ = data;
+        size_ = count;
+    }
+
+    void sync() noexcept { view(owned.data(), owned.size()); }
+
+    // The vector, after copying a mapped view into it
+    LargeVector<T>& own() {
+        if (keep) {
+            owned.assign(begin_, begin_ + size_);
+            keep.reset();
+            sync();
+        }
+        return owned;
+    }
+
+    LargeVector<T> owned;
+    std::shared_ptr<const void> keep;   // Set while viewing a mapping
+    const T* begin_ = nullptr;
+    size_t size_ = 0;
+};
@@ -0,0 +1,48 @@
+#include "negative_filter.h"
+#include "checkpoint.h"
+#include <algorithm>
+
+namespace {
+    constexpr size_t FALSE_POSITIVE_SAMPLES = 1 << 14;
+
+    // splitmix64, used to generate probe keys that are not in the set
+    uint64_t nextSample(uint64_t& state) noexcept {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+}
+
+void NegativeFilter::build(std::span<const uint64_t> hashes) {
+    size_t blockCount = std::max<size_t>(1, (hashes.size() * BITS_PER_KEY + 511) / 512);
+    blocks.assign(blockCount, Block{});
+
+    for (uint64_t hash : hashes) {
+        Block& block = blocks[blockIndex(hash)];
+        uint32_t h1 = static_cast<uint32_t>(hash);
+        uint32_t h2 = static_cast<uint32_t>(hash >> 17) | 1;
+        for (unsigned i = 0; i < PROBES; ++i) {
+            uint32_t bit = (h1 + i * h2) & 511;
+            block.words[bit / 64] |= uint64_t{1} << (bit % 64);
+        }
+    }
+
+    // Measure instead of using the textbook formula, which overestimates how
+    // well a blocked filter does when blocks fill unevenly
+    uint64_t state = hashes.size();
+    size_t positives = 0;
+    for (size_t i = 0; i < FALSE_POSITIVE_SAMPLES; ++i) {
+        positives += mayContain(nextSample(state));
+    }
+    falsePositiveRate = static_cast<double>(positives) / FALSE_POSITIVE_SAMPLES;
+}
+
+void NegativeFilter::save(checkpoint::Writer& out) const {
+    out.array(blocks);
+    out.raw(&falsePositiveRate, sizeof(falsePositiveRate));
+}
+
+bool NegativeFilter::load(checkpoint::Reader& in) {
+    return in.array(blocks) && in.raw(&falsePositiveRate, sizeof(falsePositiveRate));
+}
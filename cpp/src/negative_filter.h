@@ -0,0 +1,64 @@
+#pragma once
+
+#include "mapped_array.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace checkpoint {
+    class Reader;
+    class Writer;
+}
+
+// Blocked Bloom filter over 64-bit name hashes. Every key sets all of its bits
+// inside one 64-byte block, so a membership test touches a single cache line.
+// A zone snapshot builds one over its owner names; a "definitely absent"
+// answer lets the packet path reply NXDOMAIN without probing the name index,
+// which is what a random-subdomain flood would otherwise hammer.
+class NegativeFilter {
+public:
+    static constexpr size_t BITS_PER_KEY = 10;   // About 1% false positives
+    static constexpr unsigned PROBES = 6;
+
+    void build(std::span<const uint64_t> hashes);
+
+    // False means the key is definitely not in the set
+    [[nodiscard]]
+    bool mayContain(uint64_t hash) const noexcept {
+        if (blocks.empty()) return true;
+        const Block& block = blocks[blockIndex(hash)];
+        uint32_t h1 = static_cast<uint32_t>(hash);
+        uint32_t h2 = static_cast<uint32_t>(hash >> 17) | 1;
+        for (unsigned i = 0; i < PROBES; ++i) {
+            uint32_t bit = (h1 + i * h2) & 511;
+            if (!(block.words[bit / 64] & (uint64_t{1} << (bit % 64)))) return false;
+        }
+        return true;
+    }
+
+    // False-positive rate measured at build time against random non-members
+    [[nodiscard]]
+    double estimatedFalsePositiveRate() const noexcept { return falsePositiveRate; }
+
+    [[nodiscard]]
+    size_t memoryUsage() const noexcept { return blocks.capacity() * sizeof(Block); }
+
+    // Checkpoint form (see checkpoint.h); load() is false for a short image
+    void save(checkpoint::Writer& out) const;
+
+    [[nodiscard]]
+    bool load(checkpoint::Reader& in);
+
+private:
+    struct alignas(64) Block {
+        uint64_t words[8];
+    };
+
+    size_t blockIndex(uint64_t hash) const noexcept {
+        return ((hash >> 32) * blocks.size()) >> 32;
+    }
+
+    MappedArray<Block> blocks;
+    double falsePositiveRate = 1.0;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Work below this size is done inline; starting threads costs more
+constexpr size_t PARALLEL_THRESHOLD = 1 << 14;
+
+// Worker count for a build, 0 meaning one per core
+inline unsigned resolveThreads(unsigned threads) {
+    return threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Run f(begin, end, worker) over [0, n) split into one chunk per worker.
+// Chunks are contiguous and in worker order, so per-worker outputs can be
+// concatenated in worker order to preserve the input order.
+template <typename F>
+void parallelChunks(size_t n, unsigned workers, F&& f) {
+    if (workers <= 1 || n < PARALLEL_THRESHOLD) {
+        f(size_t{0}, n, 0u);
+        return;
+    }
+    std::vector<std::thread> threads;
+    size_t chunk = (n + workers - 1) / workers;
+    for (unsigned w = 0; w < workers; ++w) {
+        size_t begin = std::min(n, w * chunk);
+        size_t end = std::min(n, begin + chunk);
+        threads.emplace_back([&f, begin, end, w] { f(begin, end, w); });
+    }
+    for (auto& thread : threads) thread.join();
+}
@@ -0,0 +1,149 @@
+#include "perfect_hash.h"
+#include "checkpoint.h"
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+
+namespace {
+    constexpr size_t GAMMA = 2;   // Bits per unplaced key per level
+
+    uint64_t levelHash(uint64_t key, unsigned level) noexcept {
+        uint64_t h = key ^ ((level + 1) * 0x9e3779b97f4a7c15ULL);
+        h ^= h >> 31;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h;
+    }
+
+    // Map a hash onto [0, range) without a division
+    uint64_t reduce(uint64_t h, uint64_t range) noexcept {
+        return ((h >> 32) * range) >> 32;
+    }
+}
+
+bool PerfectHash::build(std::span<const uint64_t> keys, unsigned threads) {
+    levels.clear();
+    overflow.clear();
+    keyCount = keys.size();
+    threads = resolveThreads(threads);
+
+    std::vector<uint64_t> current(keys.begin(), keys.end());
+    uint64_t placed = 0;
+
+    for (unsigned level = 0; level < MAX_LEVELS && !current.empty(); ++level) {
+        size_t words = std::max<size_t>(1, (current.size() * GAMMA + 63) / 64);
+        words = (words + WORDS_PER_RANK - 1) / WORDS_PER_RANK * WORDS_PER_RANK;
+        uint64_t range = words * 64;
+
+        // Mark every position hit, and separately every position hit twice
+        auto seen = std::make_unique<std::atomic<uint64_t>[]>(words);
+        auto collided = std::make_unique<std::atomic<uint64_t>[]>(words);
+        parallelChunks(current.size(), threads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; ++i) {
+                uint64_t position = reduce(levelHash(current[i], level), range);
+                uint64_t mask = uint64_t{1} << (position % 64);
+                if (seen[position / 64].fetch_or(mask, std::memory_order_relaxed) & mask) {
+                    collided[position / 64].fetch_or(mask, std::memory_order_relaxed);
+                }
+            }
+        });
+
+        Level& out = levels.emplace_back();
+        out.bits.resize(words);
+        out.ranks.resize(words / WORDS_PER_RANK);
+        out.rankBase = placed;
+        uint64_t rank = 0;
+        for (size_t w = 0; w < words; ++w) {
+            if (w % WORDS_PER_RANK == 0) out.ranks[w / WORDS_PER_RANK] = static_cast<uint32_t>(rank);
+            out.bits[w] = seen[w].load(std::memory_order_relaxed) & ~collided[w].load(std::memory_order_relaxed);
+            rank += std::popcount(out.bits[w]);
+        }
+        placed += rank;
+
+        // Keys whose position collided go on to the next level
+        std::vector<std::vector<uint64_t>> survivors(threads);
+        parallelChunks(current.size(), threads, [&](size_t begin, size_t end, unsigned worker) {
+            for (size_t i = begin; i < end; ++i) {
+                uint64_t position = reduce(levelHash(current[i], level), range);
+                if (!(out.bits[position / 64] & (uint64_t{1} << (position % 64)))) {
+                    survivors[worker].push_back(current[i]);
+                }
+            }
+        });
+        current.clear();
+        for (const auto& part : survivors) current.insert(current.end(), part.begin(), part.end());
+    }
+
+    // Whatever is left collided on every level: only equal keys realistically do
+    std::sort(current.begin(), current.end());
+    if (std::adjacent_find(current.begin(), current.end()) != current.end()) {
+        levels.clear();
+        keyCount = 0;
+        return false;
+    }
+    for (uint64_t key : current) overflow.emplace_back(key, placed++);
+    return true;
+}
+
+uint64_t PerfectHash::lookup(uint64_t key) const noexcept {
+    for (unsigned level = 0; level < levels.size(); ++level) {
+        const Level& l = levels[level];
+        uint64_t position = reduce(levelHash(key, level), l.bits.size() * 64);
+        size_t word = position / 64;
+        uint64_t bit = uint64_t{1} << (position % 64);
+        if (!(l.bits[word] & bit)) continue;
+
+        uint64_t rank = l.rankBase + l.ranks[word / WORDS_PER_RANK];
+        for (size_t w = word - word % WORDS_PER_RANK; w < word; ++w) rank += std::popcount(l.bits[w]);
+        return rank + std::popcount(l.bits[word] & (bit - 1));
+    }
+    for (const auto& [overflowKey, index] : overflow) {
+        if (overflowKey == key) return index;
+    }
+    return NOT_FOUND;
+}
+
+size_t PerfectHash::memoryUsage() const noexcept {
+    size_t bytes = overflow.size() * sizeof(overflow[0]);
+    for (const auto& level : levels) {
+        bytes += level.bits.size() * sizeof(uint64_t) + level.ranks.size() * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+void PerfectHash::save(checkpoint::Writer& out) const {
+    out.u64(keyCount);
+    out.u32(static_cast<uint32_t>(levels.size()));
+    for (const Level& level : levels) {
+        out.array(level.bits);
+        out.array(level.ranks);
+        out.u64(level.rankBase);
+    }
+    out.u64(overflow.size());
+    for (const auto& [key, index] : overflow) {
+        out.u64(key);
+        out.u64(index);
+    }
+}
+
+bool PerfectHash::load(checkpoint::Reader& in) {
+    uint64_t keys = 0;
+    uint32_t levelCount = 0;
+    if (!in.u64(keys) || !in.u32(levelCount) || levelCount > MAX_LEVELS) return false;
+    levels.assign(levelCount, Level{});
+    for (Level& level : levels) {
+        if (!in.array(level.bits) || !in.array(level.ranks) || !in.u64(level.rankBase)) return false;
+    }
+    uint64_t overflowCount = 0;
+    if (!in.u64(overflowCount) || overflowCount > keys) return false;
+    overflow.resize(overflowCount);
+    for (auto& [key, index] : overflow) {
+        if (!in.u64(key) || !in.u64(index)) return false;
+    }
+    keyCount = keys;
+    return true;
+}
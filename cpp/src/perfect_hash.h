@@ -0,0 +1,64 @@
+#pragma once
+
+#include "mapped_array.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace checkpoint {
+    class Reader;
+    class Writer;
+}
+
+// Minimal perfect hash over a fixed set of 64-bit keys, built BBHash-style:
+// every level hashes the keys still unplaced into a bit array of gamma * n
+// bits; keys that landed alone are placed there, colliding keys move on to the
+// next level. A key's index is the rank of its bit across all levels, so the
+// n keys map one-to-one onto [0, n) with about 3 bits of metadata per key.
+//
+// Keys outside the build set map to an arbitrary index or to NOT_FOUND, so
+// callers must confirm a hit (ZoneSnapshot keeps a fingerprint per slot).
+class PerfectHash {
+public:
+    static constexpr uint64_t NOT_FOUND = UINT64_MAX;
+
+    // Build over distinct keys, splitting each level across `threads` worker
+    // threads (0 picks the hardware concurrency). Returns false when two keys
+    // are equal, in which case no perfect hash exists.
+    bool build(std::span<const uint64_t> keys, unsigned threads = 0);
+
+    [[nodiscard]]
+    uint64_t lookup(uint64_t key) const noexcept;
+
+    [[nodiscard]]
+    size_t size() const noexcept { return keyCount; }
+
+    [[nodiscard]]
+    bool empty() const noexcept { return keyCount == 0; }
+
+    [[nodiscard]]
+    size_t memoryUsage() const noexcept;
+
+    // Checkpoint form (see checkpoint.h); load() is false for a short image
+    void save(checkpoint::Writer& out) const;
+
+    [[nodiscard]]
+    bool load(checkpoint::Reader& in);
+
+private:
+    static constexpr unsigned MAX_LEVELS = 32;
+    static constexpr size_t WORDS_PER_RANK = 8;   // One rank sample per 512 bits
+
+    struct Level {
+        MappedArray<uint64_t> bits;
+        MappedArray<uint32_t> ranks;              // Set bits before each 512-bit block
+        uint64_t rankBase = 0;                    // Set bits in all earlier levels
+    };
+
+    std::vector<Level> levels;
+    // Keys still colliding after MAX_LEVELS, with their final indices; in
+    // practice this stays empty
+    std::vector<std::pair<uint64_t, uint64_t>> overflow;
+    size_t keyCount = 0;
+};
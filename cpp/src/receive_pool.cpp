@@ -0,0 +1,78 @@
+#include "receive_pool.h"
+#include <cstring>
+
+ReceivePool::ReceivePool(size_t slots)
+    : storage(std::make_unique_for_overwrite<Slot[]>(slots)), slotCount(slots) {
+    freeSlots.reserve(slots);
+    // Hand out low indices first so a lightly loaded worker keeps reusing
+    // the same few cache-warm slots
+    for (size_t i = slots; i > 0; --i) {
+        freeSlots.push_back(static_cast<uint32_t>(i - 1));
+    }
+}
+
+uint32_t ReceivePool::acquire() noexcept {
+    if (freeSlots.empty()) return NONE;
+    uint32_t slot = freeSlots.back();
+    freeSlots.pop_back();
+    return slot;
+}
+
+void ReceivePool::release(uint32_t slot) noexcept {
+    // Never grows: capacity was reserved for every slot up front
+    freeSlots.push_back(slot);
+}
+
+ReceiveBatch::ReceiveBatch(ReceivePool& pool) : pool(pool) {
+    std::memset(messages, 0, sizeof(messages));
+    for (size_t i = 0; i < MAX_MESSAGES; ++i) {
+        slots[i] = ReceivePool::NONE;
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_name = &sources[i];
+    }
+}
+
+ReceiveBatch::~ReceiveBatch() {
+    releaseAll();
+}
+
+size_t ReceiveBatch::receive(int fd) {
+    releaseAll();
+
+    size_t prepared = 0;
+    while (prepared < MAX_MESSAGES) {
+        uint32_t slot = pool.acquire();
+        if (slot == ReceivePool::NONE) break;
+        auto buffer = pool.buffer(slot);
+        slots[prepared] = slot;
+        vectors[prepared] = {buffer.data(), buffer.size()};
+        messages[prepared].msg_hdr.msg_namelen = sizeof(sources[prepared]);
+        ++prepared;
+    }
+    count = prepared;
+    if (prepared == 0) return 0;
+
+    int received = recvmmsg(fd, messages, static_cast<unsigned>(prepared), MSG_DONTWAIT, nullptr);
+    size_t used = received > 0 ? static_cast<size_t>(received) : 0;
+
+    // Slots the kernel did not fill go straight back
+    for (size_t i = used; i < prepared; ++i) {
+        release(i);
+    }
+    count = used;
+    return used;
+}
+
+void ReceiveBatch::release(size_t i) noexcept {
+    if (slots[i] == ReceivePool::NONE) return;
+    pool.release(slots[i]);
+    slots[i] = ReceivePool::NONE;
+}
+
+void ReceiveBatch::releaseAll() noexcept {
+    for (size_t i = 0; i < count; ++i) {
+        release(i);
+    }
+    count = 0;
+}
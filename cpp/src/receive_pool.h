@@ -0,0 +1,98 @@
+#pragma once
+
+#include "dns_packet.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <sys/socket.h>
+#include <vector>
+
+// Fixed set of receive buffers for one worker. Slots are cache-line aligned,
+// sized for the largest EDNS payload we accept, and live in one contiguous
+// block so a slot is identified by its index alone: that is the shape both
+// recvmmsg() iovecs and io_uring provided-buffer rings (buffer id = index)
+// expect. A slot is taken before a datagram is read and handed back as soon
+// as the reply is sent, so steady-state receiving never allocates. Not
+// thread-safe; each worker owns its pool.
+class ReceivePool {
+public:
+    static constexpr size_t SLOT_SIZE = dns_packet::MAX_EDNS_PAYLOAD;
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    explicit ReceivePool(size_t slots);
+
+    // Index of a free slot, or NONE when every slot is in flight
+    [[nodiscard]]
+    uint32_t acquire() noexcept;
+
+    void release(uint32_t slot) noexcept;
+
+    [[nodiscard]]
+    std::span<uint8_t> buffer(uint32_t slot) noexcept {
+        return {storage[slot].bytes, SLOT_SIZE};
+    }
+
+    // Start of the contiguous slot region, for registering it with the kernel
+    [[nodiscard]]
+    uint8_t* base() noexcept { return storage[0].bytes; }
+
+    [[nodiscard]]
+    size_t capacity() const noexcept { return slotCount; }
+
+    [[nodiscard]]
+    size_t available() const noexcept { return freeSlots.size(); }
+
+private:
+    struct alignas(64) Slot {
+        uint8_t bytes[SLOT_SIZE];
+    };
+
+    std::unique_ptr<Slot[]> storage;
+    std::vector<uint32_t> freeSlots;
+    size_t slotCount;
+};
+
+// One recvmmsg() worth of datagrams read straight into pool slots. The
+// message headers are set up once; receive() only attaches slots, and each
+// message's slot goes back to the pool through release() or, for whatever is
+// left, when the next batch starts or the batch is destroyed.
+class ReceiveBatch {
+public:
+    static constexpr size_t MAX_MESSAGES = 32;
+
+    explicit ReceiveBatch(ReceivePool& pool);
+    ~ReceiveBatch();
+    ReceiveBatch(const ReceiveBatch&) = delete;
+    ReceiveBatch& operator=(const ReceiveBatch&) = delete;
+
+    // Read up to MAX_MESSAGES pending datagrams without blocking. Returns how
+    // many arrived; 0 when nothing is queued, the pool is empty or on error.
+    size_t receive(int fd);
+
+    [[nodiscard]]
+    std::span<const uint8_t> packet(size_t i) const noexcept {
+        return {static_cast<const uint8_t*>(vectors[i].iov_base), messages[i].msg_len};
+    }
+
+    [[nodiscard]]
+    const sockaddr* source(size_t i) const noexcept {
+        return reinterpret_cast<const sockaddr*>(&sources[i]);
+    }
+
+    [[nodiscard]]
+    socklen_t sourceLength(size_t i) const noexcept { return messages[i].msg_hdr.msg_namelen; }
+
+    // Return message i's slot to the pool; its packet() is invalid afterwards
+    void release(size_t i) noexcept;
+
+private:
+    void releaseAll() noexcept;
+
+    ReceivePool& pool;
+    mmsghdr messages[MAX_MESSAGES];
+    iovec vectors[MAX_MESSAGES];
+    sockaddr_storage sources[MAX_MESSAGES];
+    uint32_t slots[MAX_MESSAGES];
+    size_t count = 0;
+};
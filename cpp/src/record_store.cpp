@@ -0,0 +1,121 @@
+#include "record_store.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+uint32_t ByteArena::append(std::string_view bytes) {
+    if (bytes.size() > CHUNK_SIZE) {
+        throw std::length_error("ByteArena: string longer than a chunk");
+    }
+    if (used + bytes.size() > CHUNK_SIZE) {
+        if (chunks.size() >= MAX_CHUNKS) {
+            throw std::length_error("ByteArena: 32-bit offset space exhausted");
+        }
+        chunks.emplace_back(static_cast<char*>(huge_pages::allocate(CHUNK_SIZE, 1)));
+        used = 0;
+    }
+    uint32_t offset = static_cast<uint32_t>((chunks.size() - 1) << CHUNK_BITS) + used;
+    std::memcpy(chunks.back().get() + used, bytes.data(), bytes.size());
+    used += static_cast<uint32_t>(bytes.size());
+    return offset;
+}
+
+namespace {
+    size_t hashName(std::string_view name) noexcept {
+        return std::hash<std::string_view>{}(name);
+    }
+}
+
+uint32_t RecordStore::findOwner(std::string_view name) const noexcept {
+    if (slots.empty()) return NONE;
+    size_t mask = slots.size() - 1;
+    for (size_t slot = hashName(name) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+        const Owner& candidate = owners[slots[slot] - 1];
+        if (candidate.nameLength == name.size() && this->name(candidate) == name) {
+            return slots[slot] - 1;
+        }
+    }
+    return NONE;
+}
+
+void RecordStore::add(std::string_view name, std::string_view type, std::string_view value) {
+    if (name.size() > UINT16_MAX) {
+        throw std::length_error("RecordStore: owner name too long");
+    }
+
+    // Bulk loads arrive grouped by owner; skip the probe for a run of records
+    // on the owner just created
+    uint32_t ownerIndex = NONE;
+    if (!owners.empty() && owners.back().nameLength == name.size() && this->name(owners.back()) == name) {
+        ownerIndex = static_cast<uint32_t>(owners.size() - 1);
+    } else {
+        ownerIndex = findOwner(name);
+    }
+    if (ownerIndex == NONE) {
+        // Keep the table at most half full
+        if ((owners.size() + 1) * 2 > slots.size()) {
+            rehash(std::max<size_t>(slots.size() * 2, 16));
+        }
+        ownerIndex = static_cast<uint32_t>(owners.size());
+        owners.push_back({arena.append(name), static_cast<uint16_t>(name.size()), NONE, NONE});
+
+        size_t mask = slots.size() - 1;
+        size_t slot = hashName(name) & mask;
+        while (slots[slot] != 0) slot = (slot + 1) & mask;
+        slots[slot] = ownerIndex + 1;
+    }
+
+    uint32_t recordIndex = static_cast<uint32_t>(records.size());
+    records.push_back({arena.append(value), static_cast<uint32_t>(value.size()), NONE, internType(type)});
+
+    Owner& owner = owners[ownerIndex];
+    if (owner.lastRecord == NONE) {
+        owner.firstRecord = recordIndex;
+    } else {
+        records[owner.lastRecord].next = recordIndex;
+    }
+    owner.lastRecord = recordIndex;
+}
+
+void RecordStore::clearOwner(std::string_view name) noexcept {
+    uint32_t index = findOwner(name);
+    if (index == NONE) return;
+    owners[index].firstRecord = NONE;
+    owners[index].lastRecord = NONE;
+}
+
+void RecordStore::reserve(size_t ownerCount, size_t recordCount) {
+    // Grow geometrically so a series of bulk loads stays amortized O(1)
+    if (ownerCount > owners.capacity()) owners.reserve(std::max(ownerCount, owners.capacity() * 2));
+    if (recordCount > records.capacity()) records.reserve(std::max(recordCount, records.capacity() * 2));
+    size_t capacity = std::bit_ceil(std::max<size_t>(ownerCount * 2, 16));
+    if (capacity > slots.size()) rehash(capacity);
+}
+
+uint16_t RecordStore::internType(std::string_view type) {
+    for (size_t i = 0; i < typeNames.size(); ++i) {
+        if (typeNames[i] == type) return static_cast<uint16_t>(i);
+    }
+    if (typeNames.size() > UINT16_MAX) {
+        throw std::length_error("RecordStore: too many distinct record types");
+    }
+    typeNames.emplace_back(type);
+    return static_cast<uint16_t>(typeNames.size() - 1);
+}
+
+void RecordStore::rehash(size_t capacity) {
+    slots.assign(capacity, 0);
+    size_t mask = capacity - 1;
+    for (uint32_t i = 0; i < owners.size(); ++i) {
+        size_t slot = hashName(name(owners[i])) & mask;
+        while (slots[slot] != 0) slot = (slot + 1) & mask;
+        slots[slot] = i + 1;
+    }
+}
+
+size_t RecordStore::memoryUsage() const noexcept {
+    return arena.capacity() + owners.capacity() * sizeof(Owner) +
+           records.capacity() * sizeof(Record) + slots.capacity() * sizeof(uint32_t);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "huge_pages.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Append-only byte arena addressed by 32-bit offsets. Storage grows in fixed
+// chunks, so appending never moves existing bytes and an offset stays valid
+// for the lifetime of the arena. A chunk is exactly one huge page when huge
+// pages are enabled.
+class ByteArena {
+public:
+    static constexpr uint32_t CHUNK_BITS = 21;
+    static constexpr uint32_t CHUNK_SIZE = uint32_t{1} << CHUNK_BITS;   // 2 MiB
+    static constexpr uint32_t MAX_CHUNKS = uint32_t{1} << (32 - CHUNK_BITS);
+
+    // Copy bytes into the arena and return their offset. Throws
+    // std::length_error for strings longer than a chunk or when the 32-bit
+    // offset space is exhausted.
+    uint32_t append(std::string_view bytes);
+
+    [[nodiscard]]
+    std::string_view view(uint32_t offset, uint32_t length) const noexcept {
+        return {chunks[offset >> CHUNK_BITS].get() + (offset & (CHUNK_SIZE - 1)), length};
+    }
+
+    // Bytes reserved from the system, including unused chunk tails
+    [[nodiscard]]
+    size_t capacity() const noexcept { return chunks.size() * size_t{CHUNK_SIZE}; }
+
+private:
+    struct ChunkDeleter {
+        void operator()(char* chunk) const noexcept { huge_pages::deallocate(chunk, CHUNK_SIZE, 1); }
+    };
+
+    std::vector<std::unique_ptr<char[], ChunkDeleter>> chunks;
+    uint32_t used = CHUNK_SIZE;   // Bytes used in the last chunk
+};
+
+// Compact record storage behind DNSServer. Each owner name is interned once
+// in the arena; records refer to it by owner index and keep their value in
+// the arena too, so a record costs a few fixed-size words instead of four
+// heap blocks. Owners are found through an open-addressing table of 32-bit
+// owner indices, and each owner's records form an insertion-ordered list
+// threaded through the flat records array.
+class RecordStore {
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Owner {
+        uint32_t nameOffset;
+        uint16_t nameLength;
+        uint32_t firstRecord;
+        uint32_t lastRecord;
+    };
+
+    struct Record {
+        uint32_t valueOffset;
+        uint32_t valueLength;
+        uint32_t next;        // Next record of the same owner, or NONE
+        uint16_t type;        // Index into the type name table
+    };
+
+    // name must already be lowercased
+    void add(std::string_view name, std::string_view type, std::string_view value);
+
+    // Drop every record of an owner. The records stay behind as garbage until
+    // the store is rebuilt; the name stays interned with an empty list.
+    void clearOwner(std::string_view name) noexcept;
+
+    // Owner index for a lowercased name, or NONE
+    [[nodiscard]]
+    uint32_t findOwner(std::string_view name) const noexcept;
+
+    // Pre-size the tables for a bulk load
+    void reserve(size_t ownerCount, size_t recordCount);
+
+    [[nodiscard]]
+    size_t ownerCount() const noexcept { return owners.size(); }
+
+    [[nodiscard]]
+    size_t recordCount() const noexcept { return records.size(); }
+
+    [[nodiscard]]
+    const Owner& owner(uint32_t index) const noexcept { return owners[index]; }
+
+    [[nodiscard]]
+    const Record& record(uint32_t index) const noexcept { return records[index]; }
+
+    [[nodiscard]]
+    std::string_view name(const Owner& owner) const noexcept {
+        return arena.view(owner.nameOffset, owner.nameLength);
+    }
+
+    [[nodiscard]]
+    std::string_view value(const Record& record) const noexcept {
+        return arena.view(record.valueOffset, record.valueLength);
+    }
+
+    [[nodiscard]]
+    std::string_view type(const Record& record) const noexcept { return typeNames[record.type]; }
+
+    // Call f(record) for each record of an owner in insertion order
+    template <typename F>
+    void forEachRecord(const Owner& owner, F&& f) const {
+        for (uint32_t i = owner.firstRecord; i != NONE; i = records[i].next) {
+            f(records[i]);
+        }
+    }
+
+    // Approximate heap footprint of the store
+    [[nodiscard]]
+    size_t memoryUsage() const noexcept;
+
+private:
+    uint16_t internType(std::string_view type);
+    void rehash(size_t capacity);
+
+    ByteArena arena;
+    LargeVector<Owner> owners;
+    LargeVector<Record> records;
+    LargeVector<uint32_t> slots;           // Owner index + 1, 0 marks an empty slot
+    std::vector<std::string> typeNames;    // A handful of distinct type strings
+};
@@ -0,0 +1,101 @@
+#include "reverse_index.h"
+#include "checkpoint.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <utility>
+
+namespace {
+    // width bits of key starting at bit offset at (from the top); width < 64
+    uint64_t bitsAt(const reverse_name::Key& key, unsigned at, unsigned width) {
+        if (width == 0) return 0;
+        uint64_t high = at < 64 ? key.high << at | (at == 0 ? 0 : key.low >> (64 - at)) : key.low << (at - 64);
+        return high >> (64 - width);
+    }
+
+    // Leading bits a and b have in common
+    unsigned commonBits(const reverse_name::Key& a, const reverse_name::Key& b) {
+        if (a.high != b.high) return static_cast<unsigned>(std::countl_zero(a.high ^ b.high));
+        return 64 + static_cast<unsigned>(std::countl_zero(a.low ^ b.low));
+    }
+}
+
+void ReverseIndex::build(std::vector<Entry> list) {
+    std::ranges::stable_sort(list, {}, &Entry::prefix);
+    auto duplicates = std::ranges::unique(list, {}, &Entry::prefix);
+    list.erase(duplicates.begin(), duplicates.end());
+
+    // Entries go to checkpoints as raw bytes, so their padding is zeroed
+    // rather than left as whatever the allocation held
+    entries.assign(list.size(), Entry{});
+    std::memset(static_cast<void*>(entries.data()), 0, entries.size() * sizeof(Entry));
+    for (size_t i = 0; i < list.size(); ++i) {
+        entries[i].prefix.key = list[i].prefix.key;
+        entries[i].prefix.length = list[i].prefix.length;
+        entries[i].prefix.ipv4 = list[i].prefix.ipv4;
+        entries[i].value = list[i].value;
+    }
+    lengths[0].reset();
+    lengths[1].reset();
+    for (const Entry& entry : entries) lengths[entry.prefix.ipv4].set(entry.prefix.length);
+
+    // Keys are sorted, so the bits after their shared prefix rise along the
+    // table and each directory bucket is one contiguous run
+    sharedBits = entries.empty() ? 0 : commonBits(entries.front().prefix.key, entries.back().prefix.key);
+    shared = entries.empty() ? reverse_name::Key{} : reverse_name::mask(entries.front().prefix.key, sharedBits);
+    directoryBits = std::min({static_cast<unsigned>(std::bit_width(entries.size())), MAX_DIRECTORY_BITS,
+                              128 - std::min(sharedBits, 128u)});
+    directory.assign((size_t{1} << directoryBits) + 1, 0);
+    for (const Entry& entry : entries) directory[bucket(entry.prefix.key) + 1]++;
+    for (size_t i = 1; i < directory.size(); ++i) directory[i] += directory[i - 1];
+}
+
+size_t ReverseIndex::bucket(const reverse_name::Key& key) const noexcept {
+    return static_cast<size_t>(bitsAt(key, sharedBits, directoryBits));
+}
+
+uint32_t ReverseIndex::exact(const reverse_name::Prefix& prefix) const noexcept {
+    if (entries.empty() || reverse_name::mask(prefix.key, sharedBits) != shared) return NONE;
+    size_t slot = bucket(prefix.key);
+    auto first = entries.begin() + directory[slot];
+    auto last = entries.begin() + directory[slot + 1];
+    auto it = std::ranges::lower_bound(first, last, prefix, {}, &Entry::prefix);
+    return it != last && it->prefix == prefix ? it->value : NONE;
+}
+
+uint32_t ReverseIndex::longest(const reverse_name::Prefix& prefix) const noexcept {
+    const auto& held = lengths[prefix.ipv4];
+    for (unsigned length = prefix.length + 1; length-- > 0;) {
+        if (!held.test(length)) continue;
+        uint32_t value = exact({reverse_name::mask(prefix.key, length), length, prefix.ipv4});
+        if (value != NONE) return value;
+    }
+    return NONE;
+}
+
+void ReverseIndex::save(checkpoint::Writer& out) const {
+    out.array(entries);
+    out.array(directory);
+    out.u64(shared.high);
+    out.u64(shared.low);
+    out.u32(sharedBits);
+    out.u32(directoryBits);
+}
+
+bool ReverseIndex::load(checkpoint::Reader& in) {
+    if (!in.array(entries) || !in.array(directory) || !in.u64(shared.high) || !in.u64(shared.low) ||
+        !in.u32(sharedBits) || !in.u32(directoryBits) || directoryBits > MAX_DIRECTORY_BITS ||
+        (!directory.empty() &&
+         (directory.size() != (size_t{1} << directoryBits) + 1 || std::as_const(directory).back() != entries.size())) ||
+        (directory.empty() && !entries.empty())) {
+        return false;
+    }
+    // The lengths held follow from the entries
+    lengths[0].reset();
+    lengths[1].reset();
+    for (const Entry& entry : std::as_const(entries)) {
+        if (entry.prefix.length > 128) return false;
+        lengths[entry.prefix.ipv4].set(entry.prefix.length);
+    }
+    return true;
+}
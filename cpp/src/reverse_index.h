@@ -0,0 +1,71 @@
+#pragma once
+
+#include "mapped_array.h"
+#include "reverse_name.h"
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace checkpoint {
+    class Reader;
+    class Writer;
+}
+
+// Sorted table of reverse-name prefixes, looked up by the integer key a
+// reverse name parses to instead of by its text. A directory on the key bits
+// right after the prefix all entries share narrows an exact lookup to a
+// bucket of about one entry, so it costs two memory accesses however long
+// the name. Longest-prefix lookups probe only the prefix lengths the table
+// holds, longest first, so an IPv4 table costs at most five probes. Zones
+// use it for the PTR owners of reverse zones, and the registry for the
+// reverse zones themselves, where the longest match is the most specific
+// delegation.
+class ReverseIndex {
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Entry {
+        reverse_name::Prefix prefix;
+        uint32_t value;
+    };
+
+    // Replace the contents; for prefixes given twice the first value wins
+    void build(std::vector<Entry> entries);
+
+    // Value stored for exactly prefix, or NONE
+    [[nodiscard]]
+    uint32_t exact(const reverse_name::Prefix& prefix) const noexcept;
+
+    // Value of the longest stored prefix that contains prefix, or NONE
+    [[nodiscard]]
+    uint32_t longest(const reverse_name::Prefix& prefix) const noexcept;
+
+    [[nodiscard]]
+    size_t size() const noexcept { return entries.size(); }
+
+    [[nodiscard]]
+    size_t memoryUsage() const noexcept {
+        return entries.capacity() * sizeof(Entry) + directory.capacity() * sizeof(uint32_t);
+    }
+
+    // Checkpoint form (see checkpoint.h); load() is false for a short image
+    void save(checkpoint::Writer& out) const;
+
+    [[nodiscard]]
+    bool load(checkpoint::Reader& in);
+
+private:
+    static constexpr unsigned MAX_DIRECTORY_BITS = 20;
+
+    // Directory slot of a key
+    [[nodiscard]]
+    size_t bucket(const reverse_name::Key& key) const noexcept;
+
+    MappedArray<Entry> entries;        // Ordered by prefix
+    MappedArray<uint32_t> directory;   // First entry of each bucket, plus the end
+    reverse_name::Key shared;          // Leading bits every key has
+    unsigned sharedBits = 0;
+    unsigned directoryBits = 0;
+    std::bitset<129> lengths[2];       // Prefix lengths held, per family (IPv6, IPv4)
+};
@@ -0,0 +1,118 @@
+#include "reverse_name.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <charconv>
+#include <string>
+
+namespace reverse_name {
+    namespace {
+        constexpr uint8_t IN_ADDR_ARPA[] = {7, 'i', 'n', '-', 'a', 'd', 'd', 'r', 4, 'a', 'r', 'p', 'a', 0};
+        constexpr uint8_t IP6_ARPA[] = {3, 'i', 'p', '6', 4, 'a', 'r', 'p', 'a', 0};
+
+        bool endsWith(std::span<const uint8_t> wire, std::span<const uint8_t> suffix) {
+            return wire.size() >= suffix.size() && std::equal(suffix.begin(), suffix.end(), wire.end() - suffix.size());
+        }
+
+        // Set the 8 or 4 bits at bit offset `at` (from the top) of key
+        void setBits(Key& key, unsigned at, unsigned width, unsigned value) {
+            uint64_t& half = at < 64 ? key.high : key.low;
+            half |= uint64_t{value} << (64 - at % 64 - width);
+        }
+
+        int hexDigit(uint8_t c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            return -1;
+        }
+    }
+
+    Key mask(const Key& key, unsigned length) noexcept {
+        Key out;
+        if (length >= 128) return key;
+        if (length > 64) {
+            out.high = key.high;
+            out.low = key.low & ~(~uint64_t{0} >> (length - 64));
+        } else if (length > 0) {
+            out.high = key.high & ~(length == 64 ? 0 : ~uint64_t{0} >> length);
+        }
+        return out;
+    }
+
+    bool Prefix::contains(const Prefix& other) const noexcept {
+        return other.ipv4 == ipv4 && other.length >= length && mask(other.key, length) == key;
+    }
+
+    Key fromBytes(std::span<const uint8_t> bytes) noexcept {
+        Key key;
+        unsigned at = 0;
+        if (bytes.size() == 4) {
+            key.low = uint64_t{0xFFFF} << 32;
+            at = IPV4_MAPPED_BITS;
+        }
+        for (uint8_t byte : bytes) {
+            setBits(key, at, 8, byte);
+            at += 8;
+        }
+        return key;
+    }
+
+    bool parse(std::span<const uint8_t> wire, Prefix& out) noexcept {
+        bool ipv4 = endsWith(wire, IN_ADDR_ARPA);
+        if (!ipv4 && !endsWith(wire, IP6_ARPA)) return false;
+        size_t end = wire.size() - (ipv4 ? sizeof(IN_ADDR_ARPA) : sizeof(IP6_ARPA));
+        unsigned width = ipv4 ? 8 : 4;
+
+        // The labels hold the address backwards, so they are counted first
+        // and then placed from the bottom of the prefix up
+        unsigned count = 0;
+        for (size_t offset = 0; offset < end; offset += 1 + wire[offset]) count++;
+        if (count * width > (ipv4 ? 32u : 128u)) return false;
+
+        out = {};
+        out.ipv4 = ipv4;
+        unsigned base = ipv4 ? IPV4_MAPPED_BITS : 0;
+        if (ipv4) out.key.low = uint64_t{0xFFFF} << 32;
+        out.length = base + count * width;
+        unsigned at = out.length;
+        for (size_t offset = 0; offset < end; offset += 1 + wire[offset]) {
+            size_t length = wire[offset];
+            const uint8_t* label = &wire[offset + 1];
+            unsigned value = 0;
+            if (ipv4) {
+                if (length == 0 || length > 3 || (length > 1 && label[0] == '0')) return false;
+                for (size_t i = 0; i < length; ++i) {
+                    if (label[i] < '0' || label[i] > '9') return false;
+                    value = value * 10 + (label[i] - '0');
+                }
+                if (value > 255) return false;
+            } else {
+                int digit = length == 1 ? hexDigit(label[0]) : -1;
+                if (digit < 0) return false;
+                value = static_cast<unsigned>(digit);
+            }
+            at -= width;
+            setBits(out.key, at, width, value);
+        }
+        return true;
+    }
+
+    bool parseNetwork(std::string_view text, Prefix& out) {
+        size_t slash = text.find('/');
+        if (slash == std::string_view::npos) return false;
+        std::string address(text.substr(0, slash));
+        std::string_view bits = text.substr(slash + 1);
+        unsigned length = 0;
+        auto [end, error] = std::from_chars(bits.data(), bits.data() + bits.size(), length);
+        if (error != std::errc{} || end != bits.data() + bits.size()) return false;
+
+        uint8_t bytes[16];
+        if (inet_pton(AF_INET, address.c_str(), bytes) == 1 && length <= 32) {
+            out = {fromBytes(std::span(bytes, 4)), IPV4_MAPPED_BITS + length, true};
+        } else if (inet_pton(AF_INET6, address.c_str(), bytes) == 1 && length <= 128) {
+            out = {fromBytes(std::span(bytes, 16)), length, false};
+        } else {
+            return false;
+        }
+        return mask(out.key, out.length) == out.key;
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// Addresses behind reverse-mapping names (in-addr.arpa, RFC1035 section
+// 3.5; ip6.arpa, RFC3596 section 2.5), read straight from the wire labels
+// without building any text. Both families share one 128-bit key space:
+// IPv4 addresses map to ::ffff:0:0/96, so 192.0.2.0/24 is a /120.
+namespace reverse_name {
+    constexpr unsigned IPV4_MAPPED_BITS = 96;
+
+    // A 128-bit address, most significant half first so keys sort as
+    // addresses do
+    struct Key {
+        uint64_t high = 0;
+        uint64_t low = 0;
+
+        auto operator<=>(const Key&) const = default;
+
+        [[nodiscard]]
+        uint8_t byte(size_t index) const noexcept {
+            uint64_t half = index < 8 ? high : low;
+            return static_cast<uint8_t>(half >> (56 - 8 * (index % 8)));
+        }
+    };
+
+    // The first `length` bits of key; the rest are zero. The family is kept
+    // apart, so in-addr.arpa and the ip6.arpa name of ::ffff:0:0/96 differ.
+    struct Prefix {
+        Key key;
+        unsigned length = 0;
+        bool ipv4 = false;
+
+        auto operator<=>(const Prefix&) const = default;
+
+        // True when other is this prefix or lies inside it
+        [[nodiscard]]
+        bool contains(const Prefix& other) const noexcept;
+    };
+
+    // Keep the first length bits of key
+    [[nodiscard]]
+    Key mask(const Key& key, unsigned length) noexcept;
+
+    // Key of 4 (IPv4) or 16 (IPv6) address bytes in network order
+    [[nodiscard]]
+    Key fromBytes(std::span<const uint8_t> bytes) noexcept;
+
+    // Read an uncompressed, lowercased reverse name. The prefix length is the
+    // bits its labels give, 8 per octet label or 4 per nibble label, so
+    // 2.0.192.in-addr.arpa is 192.0.2.0/24 in IPv4 terms. False for names
+    // outside in-addr.arpa and ip6.arpa, extra labels, and labels that are
+    // not a canonical decimal octet or a single hex digit.
+    [[nodiscard]]
+    bool parse(std::span<const uint8_t> wire, Prefix& out) noexcept;
+
+    // Read "192.0.2.0/24" or "2001:db8::/32"; host bits must be zero
+    [[nodiscard]]
+    bool parseNetwork(std::string_view text, Prefix& out);
+}
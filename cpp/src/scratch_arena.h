@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+// Per-worker bump allocator for everything a single query needs: the reply
+// buffer, names decoded for logging, and similar temporaries. Allocation is
+// a pointer bump inside a fixed buffer owned by the thread, and reset()
+// rewinds it once the reply is sent, so the query path never calls malloc
+// and workers never contend on the allocator. Requests that outgrow the
+// buffer spill to the heap and are returned by the same reset().
+class ScratchArena {
+public:
+    static constexpr size_t SIZE = 64 * 1024;
+
+    ScratchArena() = default;
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    [[nodiscard]]
+    std::pmr::memory_resource* resource() noexcept { return &arena; }
+
+    // Rewind to the start of the buffer; everything allocated since the last
+    // reset becomes invalid
+    void reset() noexcept { arena.release(); }
+
+    // The calling thread's arena
+    [[nodiscard]]
+    static ScratchArena& local() noexcept {
+        thread_local ScratchArena instance;
+        return instance;
+    }
+
+private:
+    alignas(64) std::byte buffer[SIZE];
+    std::pmr::monotonic_buffer_resource arena{buffer, SIZE, std::pmr::new_delete_resource()};
+};
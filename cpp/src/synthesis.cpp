@@ -0,0 +1,178 @@
+#include "synthesis.h"
+#include <algorithm>
+#include <cctype>
+
+using namespace dns_packet;
+
+namespace {
+    constexpr uint16_t TYPE_A = 1;
+    constexpr uint16_t TYPE_PTR = 12;
+    constexpr uint16_t TYPE_AAAA = 28;
+    constexpr size_t MAX_LABEL = 63;
+    constexpr size_t IPV4_SPELLING = 15;   // 255-255-255-255
+    constexpr size_t IPV6_SPELLING = 39;   // Eight groups of four hex digits
+    constexpr char HEX[] = "0123456789abcdef";
+
+    void push16(std::pmr::vector<uint8_t>& out, uint16_t value) {
+        out.push_back(static_cast<uint8_t>(value >> 8));
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    // Owner pointer, TYPE, CLASS, TTL and RDLENGTH of an answer RR
+    // An RR of rdlength bytes fits below limit; one that does not is left
+    // out and the reply marked truncated, so it ends at an RR boundary
+    bool fits(std::pmr::vector<uint8_t>& out, size_t rdlength, size_t limit) {
+        if (out.size() + 12 + rdlength <= limit) return true;
+        out[2] |= FLAG_TC;
+        return false;
+    }
+
+    void pushHeader(std::pmr::vector<uint8_t>& out, uint16_t type, uint32_t ttl, size_t rdlength) {
+        out.push_back(0xC0);
+        out.push_back(0x0C);   // Pointer to the question name
+        push16(out, type);
+        push16(out, CLASS_IN);
+        push16(out, static_cast<uint16_t>(ttl >> 16));
+        push16(out, static_cast<uint16_t>(ttl));
+        push16(out, static_cast<uint16_t>(rdlength));
+    }
+
+    // Spell an address the way names of a rule carry it; returns the length
+    size_t spell(const reverse_name::Key& address, bool ipv4, char* out) {
+        char* at = out;
+        if (ipv4) {
+            for (size_t i = 12; i < 16; ++i) {
+                unsigned octet = address.byte(i);
+                if (i > 12) *at++ = '-';
+                if (octet >= 100) *at++ = static_cast<char>('0' + octet / 100);
+                if (octet >= 10) *at++ = static_cast<char>('0' + octet / 10 % 10);
+                *at++ = static_cast<char>('0' + octet % 10);
+            }
+        } else {
+            for (size_t i = 0; i < 16; ++i) {
+                if (i > 0 && i % 2 == 0) *at++ = '-';
+                *at++ = HEX[address.byte(i) >> 4];
+                *at++ = HEX[address.byte(i) & 0x0F];
+            }
+        }
+        return static_cast<size_t>(at - out);
+    }
+
+    int hexDigit(uint8_t c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    }
+}
+
+bool Synthesizer::addRule(std::string_view network, std::string_view pattern, uint32_t ttl) {
+    Rule rule;
+    if (!reverse_name::parseNetwork(network, rule.network)) return false;
+
+    size_t dot = pattern.find('.');
+    std::string_view first = pattern.substr(0, dot);
+    size_t star = first.find('*');
+    dns_packet::WireName domain;
+    if (dot == std::string_view::npos || star == std::string_view::npos ||
+        first.find('*', star + 1) != std::string_view::npos || !domain.assign(pattern.substr(dot + 1))) {
+        return false;
+    }
+    for (char c : first.substr(0, star)) rule.head.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+    for (char c : first.substr(star + 1)) rule.tail.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+    size_t spelling = rule.network.ipv4 ? IPV4_SPELLING : IPV6_SPELLING;
+    if (rule.head.size() + spelling + rule.tail.size() > MAX_LABEL ||
+        1 + MAX_LABEL + domain.bytes().size() > dns_packet::WireName::MAX_LENGTH) {
+        return false;
+    }
+    rule.domain.assign(domain.bytes().begin(), domain.bytes().end());
+    rule.ttl = ttl;
+    rules.push_back(std::move(rule));
+    return true;
+}
+
+bool Synthesizer::parseLabel(const Rule& rule, std::span<const uint8_t> label, reverse_name::Prefix& address) {
+    if (label.size() < rule.head.size() + rule.tail.size() ||
+        !std::equal(rule.head.begin(), rule.head.end(), label.begin()) ||
+        !std::equal(rule.tail.begin(), rule.tail.end(), label.end() - rule.tail.size())) {
+        return false;
+    }
+    auto text = label.subspan(rule.head.size(), label.size() - rule.head.size() - rule.tail.size());
+
+    // Only the canonical spelling counts, so every address has one name
+    uint8_t bytes[16];
+    size_t at = 0;
+    if (rule.network.ipv4) {
+        for (size_t i = 0; i < 4; ++i) {
+            if (i > 0 && (at >= text.size() || text[at++] != '-')) return false;
+            size_t begin = at;
+            unsigned value = 0;
+            while (at < text.size() && at - begin < 3 && text[at] >= '0' && text[at] <= '9') {
+                value = value * 10 + (text[at++] - '0');
+            }
+            if (at == begin || value > 255 || (at - begin > 1 && text[begin] == '0')) return false;
+            bytes[i] = static_cast<uint8_t>(value);
+        }
+        if (at != text.size()) return false;
+        address = {reverse_name::fromBytes(std::span(bytes, 4)), 128, true};
+        return true;
+    }
+
+    if (text.size() != IPV6_SPELLING) return false;
+    for (size_t i = 0; i < 16; ++i) {
+        if (i > 0 && i % 2 == 0 && text[at++] != '-') return false;
+        int high = hexDigit(text[at++]);
+        int low = hexDigit(text[at++]);
+        if (high < 0 || low < 0) return false;
+        bytes[i] = static_cast<uint8_t>(high << 4 | low);
+    }
+    address = {reverse_name::fromBytes(std::span(bytes, 16)), 128, false};
+    return true;
+}
+
+bool Synthesizer::answer(const dns_packet::WireName& qname, uint16_t qtype, std::pmr::vector<uint8_t>& response,
+                         uint16_t& count, size_t limit) const {
+    if (rules.empty() || qname.labelCount() == 0) return false;
+
+    // Reverse direction: a complete address under in-addr.arpa or ip6.arpa
+    reverse_name::Prefix reverse;
+    if (reverse_name::parse(qname.bytes(), reverse)) {
+        if (reverse.length != 128) return false;
+        auto rule = std::ranges::find_if(rules, [&](const Rule& r) { return r.network.contains(reverse); });
+        if (rule == rules.end()) return false;
+        if (qtype == TYPE_PTR || qtype == QTYPE_ANY) {
+            char spelled[IPV6_SPELLING];
+            size_t length = spell(reverse.key, rule->network.ipv4, spelled);
+            size_t label = rule->head.size() + length + rule->tail.size();
+            if (!fits(response, 1 + label + rule->domain.size(), limit)) return true;
+            pushHeader(response, TYPE_PTR, rule->ttl, 1 + label + rule->domain.size());
+            response.push_back(static_cast<uint8_t>(label));
+            response.insert(response.end(), rule->head.begin(), rule->head.end());
+            response.insert(response.end(), spelled, spelled + length);
+            response.insert(response.end(), rule->tail.begin(), rule->tail.end());
+            response.insert(response.end(), rule->domain.begin(), rule->domain.end());
+            count++;
+        }
+        return true;
+    }
+
+    // Forward direction: the first label spells an address, the rest is the
+    // rule's domain
+    auto bytes = qname.bytes();
+    auto label = bytes.subspan(1, bytes[0]);
+    auto rest = qname.suffix(qname.labelCount() - 1);
+    for (const Rule& rule : rules) {
+        reverse_name::Prefix address;
+        if (!std::ranges::equal(rule.domain, rest) || !parseLabel(rule, label, address) ||
+            !rule.network.contains(address)) {
+            continue;
+        }
+        bool ipv4 = rule.network.ipv4;
+        if ((qtype == (ipv4 ? TYPE_A : TYPE_AAAA) || qtype == QTYPE_ANY) && fits(response, ipv4 ? 4 : 16, limit)) {
+            pushHeader(response, ipv4 ? TYPE_A : TYPE_AAAA, rule.ttl, ipv4 ? 4 : 16);
+            for (size_t i = ipv4 ? 12 : 0; i < 16; ++i) response.push_back(address.key.byte(i));
+            count++;
+        }
+        return true;
+    }
+    return false;
+}
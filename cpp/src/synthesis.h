@@ -0,0 +1,51 @@
+#pragma once
+
+#include "dns_packet.h"
+#include "reverse_name.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Answers whole address ranges by rule instead of by stored records. A rule
+// pairs a network with a name pattern such as "ip-*.example.net": the PTR
+// for 192.0.2.1 is ip-192-0-2-1.example.net and the A record of that name
+// is 192.0.2.1 (IPv6 names spell all eight groups, ip-2001-0db8-...-0001).
+// Reverse names are read into integers and both directions are encoded by
+// arithmetic, so a rule costs the same for a /8 as for a /30. Rules are set
+// up before serving and read without locking afterwards.
+class Synthesizer {
+public:
+    // network is "192.0.2.0/24" or "2001:db8::/32"; pattern has one '*' in
+    // its first label. False when either does not parse or the names the
+    // rule makes would not fit in a label.
+    [[nodiscard]]
+    bool addRule(std::string_view network, std::string_view pattern, uint32_t ttl = dns_packet::DEFAULT_TTL);
+
+    [[nodiscard]]
+    bool empty() const noexcept { return rules.empty(); }
+
+    // When qname is a name some rule makes, append its answers for qtype
+    // to response (each owned by a pointer to the question), add their
+    // number to count and return true; an existing name may have none.
+    // An answer that would take response past limit bytes is left out and
+    // TC set instead. False when no rule covers qname.
+    bool answer(const dns_packet::WireName& qname, uint16_t qtype, std::pmr::vector<uint8_t>& response,
+                uint16_t& count, size_t limit) const;
+
+private:
+    struct Rule {
+        reverse_name::Prefix network;
+        std::string head;               // First label before the address
+        std::string tail;               // and after it
+        std::vector<uint8_t> domain;    // Wire form of the labels after the first
+        uint32_t ttl;
+    };
+
+    // Address spelled by the first label of a forward name, or false
+    static bool parseLabel(const Rule& rule, std::span<const uint8_t> label, reverse_name::Prefix& address);
+
+    std::vector<Rule> rules;
+};
@@ -0,0 +1,70 @@
+#include "timer_wheel.h"
+#include <algorithm>
+
+void TimerWheel::schedule(uint32_t id, uint64_t deadline) {
+    if (id >= timers.size()) timers.resize(id + 1);
+    if (timers[id].slot != NONE) unlink(id);
+    timers[id].deadline = std::min(std::max(deadline, current + 1), current + MAX_DELAY);
+    link(id);
+}
+
+void TimerWheel::cancel(uint32_t id) {
+    if (id < timers.size() && timers[id].slot != NONE) unlink(id);
+}
+
+void TimerWheel::link(uint32_t id) {
+    Timer& timer = timers[id];
+
+    // The lowest level in which deadline and current differ only within
+    // one slot's reach; level 0 holds the next SLOTS ticks
+    uint64_t delta = timer.deadline ^ current;
+    size_t level = 0;
+    while (level + 1 < LEVELS && (delta >> (SLOT_BITS * (level + 1))) != 0) level++;
+    auto slot = static_cast<uint32_t>(level * SLOTS + ((timer.deadline >> (SLOT_BITS * level)) & (SLOTS - 1)));
+
+    timer.slot = slot;
+    timer.prev = NONE;
+    timer.next = heads[slot];
+    if (timer.next != NONE) timers[timer.next].prev = id;
+    heads[slot] = id;
+    pending++;
+}
+
+void TimerWheel::unlink(uint32_t id) {
+    Timer& timer = timers[id];
+    if (timer.prev != NONE) {
+        timers[timer.prev].next = timer.next;
+    } else {
+        heads[timer.slot] = timer.next;
+    }
+    if (timer.next != NONE) timers[timer.next].prev = timer.prev;
+    timer.slot = NONE;
+    pending--;
+}
+
+void TimerWheel::cascade() {
+    // Level l's slot comes round when the bits below it wrap to zero
+    for (size_t level = 1; level < LEVELS; ++level) {
+        if ((current & ((uint64_t{1} << (SLOT_BITS * level)) - 1)) != 0) break;
+        auto slot = static_cast<uint32_t>(level * SLOTS + ((current >> (SLOT_BITS * level)) & (SLOTS - 1)));
+        uint32_t id = heads[slot];
+        while (id != NONE) {
+            uint32_t next = timers[id].next;
+            unlink(id);
+            link(id);
+            id = next;
+        }
+    }
+}
+
+uint64_t TimerWheel::nextEvent() const noexcept {
+    if (pending == 0) return NEVER;
+
+    // Timers above level 0 move down no earlier than the next wrap of
+    // level 0, and the ones in level 0 all fall before it
+    uint64_t wrap = (current | (SLOTS - 1)) + 1;
+    for (uint64_t tick = current + 1; tick <= wrap; ++tick) {
+        if (heads[tick & (SLOTS - 1)] != NONE) return tick;
+    }
+    return wrap;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timer wheel over integer ticks. Each level has SLOTS slots
+// and covers SLOTS times the span of the level below; a timer sits in the
+// lowest level whose span reaches its deadline and moves down a level each
+// time the slot it is in comes round. Scheduling, rescheduling and
+// cancelling are O(1) through intrusive lists, and advancing costs one
+// slot per tick plus the timers that move or fire, so thousands of zone
+// timers cost no more than a handful. Timers are identified by small
+// integers chosen by the caller; an id has at most one pending deadline.
+// Not thread-safe.
+class TimerWheel {
+public:
+    static constexpr unsigned SLOT_BITS = 6;
+    static constexpr size_t SLOTS = size_t{1} << SLOT_BITS;
+    static constexpr size_t LEVELS = 4;
+    static constexpr uint64_t MAX_DELAY = (uint64_t{1} << (SLOT_BITS * LEVELS)) - 1;   // Longer delays are clamped
+    static constexpr uint64_t NEVER = UINT64_MAX;
+
+    explicit TimerWheel(uint64_t now = 0) : current(now) { heads.fill(NONE); }
+
+    // Fire id at tick deadline, replacing any deadline it had. A deadline
+    // that has passed fires on the next advance().
+    void schedule(uint32_t id, uint64_t deadline);
+
+    void cancel(uint32_t id);
+
+    // Pending deadline of id, or NEVER
+    [[nodiscard]]
+    uint64_t deadline(uint32_t id) const noexcept {
+        return id < timers.size() && timers[id].slot != NONE ? timers[id].deadline : NEVER;
+    }
+
+    // Move time forward to now, calling expired(id) for every timer that is
+    // due, in deadline order between ticks. Callbacks may schedule again.
+    template <typename F>
+    void advance(uint64_t now, F&& expired) {
+        while (current < now) {
+            current++;
+            cascade();
+            uint32_t slot = static_cast<uint32_t>(current & (SLOTS - 1));
+            while (heads[slot] != NONE) {
+                uint32_t id = heads[slot];
+                unlink(id);
+                expired(id);
+            }
+        }
+    }
+
+    // Earliest tick at which advance() may have work to do, or NEVER
+    [[nodiscard]]
+    uint64_t nextEvent() const noexcept;
+
+    [[nodiscard]]
+    uint64_t now() const noexcept { return current; }
+
+    [[nodiscard]]
+    size_t size() const noexcept { return pending; }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Timer {
+        uint64_t deadline = 0;
+        uint32_t slot = NONE;    // level * SLOTS + slot, NONE when idle
+        uint32_t prev = NONE;
+        uint32_t next = NONE;
+    };
+
+    void link(uint32_t id);
+    void unlink(uint32_t id);
+
+    // Redistribute the higher-level slots that come round at current
+    void cascade();
+
+    uint64_t current;
+    std::vector<Timer> timers;                 // By id
+    std::array<uint32_t, SLOTS * LEVELS> heads;
+    size_t pending = 0;
+};
@@ -0,0 +1,654 @@
+#include "transfer_client.h"
+#include <algorithm>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace dns_packet;
+
+namespace {
+    constexpr uint16_t TYPE_SOA = 6;
+    constexpr size_t PREFIX_SIZE = 2;   // TCP message length
+
+    // Sequence space comparison of serials (RFC1982)
+    bool serialNewer(uint32_t a, uint32_t b) { return static_cast<int32_t>(a - b) > 0; }
+
+    // Same RR as TYPE..RDATA tails go: TYPE, CLASS and RDATA equal, the
+    // TTL (bytes 4 to 8) aside, which the primary may set differently
+    bool sameRR(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+        constexpr size_t TTL_END = 8;
+        return a.size() == b.size() && a.size() >= TTL_END && std::equal(a.begin(), a.begin() + 4, b.begin()) &&
+               std::equal(a.begin() + TTL_END, a.end(), b.begin() + TTL_END);
+    }
+
+    bool endsWith(std::span<const uint8_t> name, std::span<const uint8_t> suffix) {
+        return name.size() >= suffix.size() &&
+               std::equal(suffix.begin(), suffix.end(), name.end() - static_cast<ptrdiff_t>(suffix.size()));
+    }
+
+    // TCP connection to the primary with I/O timeouts; -1 on failure
+    int connectTo(const sockaddr_in& primary) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        timeval timeout{TransferClient::IO_TIMEOUT_SECONDS, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (connect(fd, reinterpret_cast<const sockaddr*>(&primary), sizeof(primary)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Query for the apex, 2-byte length prefix included
+    std::vector<uint8_t> makeQuery(uint16_t id, std::span<const uint8_t> apex, uint16_t qtype) {
+        std::vector<uint8_t> query = {0, 0, static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id),
+                                      0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
+        query.insert(query.end(), apex.begin(), apex.end());
+        appendUint16(query, qtype);
+        appendUint16(query, CLASS_IN);
+        return query;
+    }
+
+    // Each read or write gets the I/O timeout, within the transfer's deadline
+    zone_transfer::Deadline ioDeadline(zone_transfer::Deadline deadline) {
+        return std::min(deadline,
+                        std::chrono::steady_clock::now() + std::chrono::seconds(TransferClient::IO_TIMEOUT_SECONDS));
+    }
+
+    bool sendQuery(int fd, std::vector<uint8_t>& query, zone_transfer::Deadline deadline) {
+        writeUint16(query, 0, static_cast<uint16_t>(query.size() - PREFIX_SIZE));
+        const iovec message[] = {{query.data(), query.size()}};
+        return zone_transfer::sendAll(fd, message, ioDeadline(deadline));
+    }
+
+    bool receiveMessage(int fd, std::vector<uint8_t>& message, zone_transfer::Deadline deadline) {
+        uint8_t prefix[PREFIX_SIZE];
+        if (!zone_transfer::receiveAll(fd, prefix, sizeof(prefix), ioDeadline(deadline))) return false;
+        message.resize(readUint16(prefix, 0));
+        return zone_transfer::receiveAll(fd, message.data(), message.size(), ioDeadline(deadline));
+    }
+
+    // Serial of the SOA answering an SOA query
+    bool answerSerial(std::span<const uint8_t> message, uint16_t id, uint32_t& serial) {
+        if (message.size() < HEADER_SIZE || readUint16(message, 0) != id || (message[3] & 0x0F) != RCODE_NOERROR ||
+            readUint16(message, 6) == 0) {
+            return false;
+        }
+        WireName name;
+        size_t offset = HEADER_SIZE;
+        for (uint16_t i = readUint16(message, 4); i > 0; --i) {
+            if (!name.parse(message, offset)) return false;
+            offset += 4;
+        }
+        if (!name.parse(message, offset) || offset + 10 > message.size() || readUint16(message, offset) != TYPE_SOA) {
+            return false;
+        }
+        std::string value;
+        SOAData soa;
+        if (!decodeRData(TYPE_SOA, message, offset + 10, readUint16(message, offset + 8), value) ||
+            !SOAData::parse(value, soa)) {
+            return false;
+        }
+        serial = soa.serial;
+        return true;
+    }
+}
+
+TransferReader::TransferReader(std::span<const uint8_t> apex, uint16_t id, std::shared_ptr<const ZoneSnapshot> base)
+    : apex(apex.begin(), apex.end()), id(id), base(std::move(base)) {}
+
+TransferReader::State TransferReader::feed(std::span<const uint8_t> message) {
+    if (state_ != State::More) return state_;
+    if (message.size() < HEADER_SIZE || readUint16(message, 0) != id || !(message[2] & FLAG_QR) ||
+        (message[3] & 0x0F) != RCODE_NOERROR) {
+        finish(State::Failed);
+        return state_;
+    }
+
+    WireName name;
+    size_t offset = HEADER_SIZE;
+    for (uint16_t i = readUint16(message, 4); i > 0; --i) {
+        if (!name.parse(message, offset) || offset + 4 > message.size()) {
+            finish(State::Failed);
+            return state_;
+        }
+        offset += 4;
+    }
+
+    std::string value;
+    for (uint16_t i = readUint16(message, 6); i > 0 && state_ == State::More; --i) {
+        if (!name.parse(message, offset) || offset + 10 > message.size()) {
+            finish(State::Failed);
+            return state_;
+        }
+        uint16_t type = readUint16(message, offset);
+        uint32_t ttl = static_cast<uint32_t>(readUint16(message, offset + 4)) << 16 | readUint16(message, offset + 6);
+        size_t length = readUint16(message, offset + 8);
+        size_t rdata = offset + 10;
+        offset = rdata + length;
+        if (offset > message.size()) {
+            finish(State::Failed);
+            return state_;
+        }
+
+        // Types we cannot encode are skipped, as they would be in a zone file
+        std::vector<uint8_t> tail;
+        value.clear();
+        if (!decodeRData(type, message, rdata, length, value) || !appendRecordTail(tail, type, ttl, value)) continue;
+        SOAData soa;
+        bool isSoa = type == TYPE_SOA && SOAData::parse(value, soa);
+        if (!take(Name(name.bytes().begin(), name.bytes().end()), std::move(tail), isSoa ? &soa : nullptr)) {
+            finish(State::Failed);
+        }
+    }
+
+    // An IXFR answered with nothing but our own SOA means we are current
+    if (state_ == State::More && phase == Phase::Second && base && !serialNewer(newest.serial, base->soa().serial)) {
+        finish(State::UpToDate);
+    }
+    return state_;
+}
+
+bool TransferReader::take(Name name, std::vector<uint8_t> tail, const SOAData* soa) {
+    bool framing = soa != nullptr && name == apex;
+    if (!framing && !endsWith(name, apex)) return true;   // Out of zone, ignored
+
+    switch (phase) {
+    case Phase::First:
+        if (!framing) return false;
+        newest = *soa;
+        newestTail = std::move(tail);
+        phase = Phase::Second;
+        return true;
+
+    case Phase::Second:
+        // A second SOA with the serial we hold opens the first IXFR step
+        if (framing && base && soa->serial == base->soa().serial && soa->serial != newest.serial) {
+            phase = Phase::Deleting;
+            return true;
+        }
+        phase = Phase::Full;
+        delta.owners[apex].push_back(newestTail);
+        [[fallthrough]];
+
+    case Phase::Full:
+        if (framing) {
+            if (soa->serial != newest.serial) return false;
+            finish(State::Full);
+            return true;
+        }
+        delta.owners[name].push_back(std::move(tail));
+        return true;
+
+    case Phase::Deleting:
+        if (framing) {
+            stepSerial = soa->serial;
+            phase = Phase::Adding;
+            return true;
+        }
+        {
+            RRs& rrs = contents(name);
+            auto found = std::ranges::find_if(rrs, [&](const auto& rr) { return sameRR(rr, tail); });
+            if (found == rrs.end()) return false;   // Not what we hold
+            rrs.erase(found);
+        }
+        return true;
+
+    case Phase::Adding:
+        if (framing) {
+            // Either the next step's old SOA or, after the last step, the end
+            if (soa->serial != stepSerial) return false;
+            if (stepSerial == newest.serial) {
+                finish(State::Incremental);
+            } else {
+                phase = Phase::Deleting;
+            }
+            return true;
+        }
+        {
+            // An RR added again keeps the TTL it is added with
+            RRs& rrs = contents(name);
+            auto found = std::ranges::find_if(rrs, [&](const auto& rr) { return sameRR(rr, tail); });
+            if (found == rrs.end()) {
+                rrs.push_back(std::move(tail));
+            } else {
+                *found = std::move(tail);
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+TransferReader::RRs& TransferReader::contents(const Name& name) {
+    auto [entry, inserted] = delta.owners.try_emplace(name);
+    if (inserted && base) {
+        if (const ZoneSnapshot::Owner* owner = base->find(name, hashName(name))) {
+            for (const auto& rrset : base->rrsets(*owner)) {
+                for (uint32_t i = 0; i < rrset.rrCount; ++i) {
+                    auto rr = base->rr(rrset.firstRR + i);
+                    entry->second.emplace_back(rr.begin(), rr.end());
+                }
+            }
+        }
+    }
+    return entry->second;
+}
+
+void TransferReader::finish(State outcome) {
+    state_ = outcome;
+    if (outcome == State::Incremental) {
+        // The steps carry SOAs only as framing; the apex gets the newest one
+        RRs& rrs = contents(apex);
+        std::erase_if(rrs, [](const auto& tail) { return readUint16(tail, 0) == TYPE_SOA; });
+        rrs.insert(rrs.begin(), newestTail);
+        // The changes hold against base only; applyDelta() refuses them
+        // once the zone has moved on
+        delta.fromSerial = base->soa().serial;
+    }
+    if (outcome == State::Full || outcome == State::Incremental) {
+        delta.soa = newest;
+    } else {
+        delta.owners.clear();
+    }
+}
+
+TransferClient::TransferClient(DNSServer& server)
+    : server(server), epoch(std::chrono::steady_clock::now()) {}
+
+TransferClient::~TransferClient() {
+    stop();
+}
+
+bool TransferClient::addZone(std::string_view origin, const sockaddr_in& primary) {
+    Secondary zone;
+    if (!zone.apex.assign(origin)) return false;
+    zone.origin = zone.apex.toString();
+    zone.primary = primary;
+    {
+        std::lock_guard lock(mutex);
+        wheel.schedule(zoneTimer(zones.size()), ticks());
+        zones.push_back(std::move(zone));
+    }
+    wakeUp();
+    return true;
+}
+
+bool TransferClient::follows(std::span<const uint8_t> apex) const {
+    std::lock_guard lock(mutex);
+    return std::ranges::any_of(zones, [&](const Secondary& zone) { return std::ranges::equal(zone.apex.bytes(), apex); });
+}
+
+void TransferClient::addNotifyTarget(const sockaddr_in& target) {
+    std::lock_guard lock(mutex);
+    notifyTargets.push_back(target);
+}
+
+bool TransferClient::start() {
+    if (running) return true;
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    notifySocket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (wakeFd < 0 || notifySocket < 0) {
+        if (wakeFd >= 0) close(wakeFd);
+        if (notifySocket >= 0) close(notifySocket);
+        wakeFd = notifySocket = -1;
+        return false;
+    }
+    running = true;
+    worker = std::thread(&TransferClient::run, this);
+    for (size_t i = 0; i < MAX_TRANSFERS; ++i) transferWorkers.emplace_back(&TransferClient::work, this);
+    return true;
+}
+
+void TransferClient::stop() {
+    {
+        // Checks in flight fail at once rather than at their deadline
+        std::lock_guard lock(mutex);
+        running = false;
+        stopping = true;
+        for (int fd : connections) shutdown(fd, SHUT_RDWR);
+    }
+    queueChanged.notify_all();
+    wakeUp();
+    if (worker.joinable()) worker.join();
+    for (auto& thread : transferWorkers) thread.join();
+    transferWorkers.clear();
+    std::lock_guard lock(mutex);
+    stopping = false;
+    for (size_t index : queued) wheel.schedule(zoneTimer(index), ticks());   // Still due after a restart
+    queued.clear();
+    for (auto& zone : zones) zone.checking = zone.recheck = false;
+    if (wakeFd >= 0) close(wakeFd);
+    if (notifySocket >= 0) close(notifySocket);
+    wakeFd = notifySocket = -1;
+}
+
+TransferClient::Outcome TransferClient::refresh(std::string_view origin) {
+    WireName apex;
+    if (!apex.assign(origin)) return Outcome::Failed;
+    size_t index = 0;
+    {
+        std::lock_guard lock(mutex);
+        auto found = std::find_if(zones.begin(), zones.end(), [&](const Secondary& zone) {
+            return std::ranges::equal(zone.apex.bytes(), apex.bytes());
+        });
+        if (found == zones.end()) return Outcome::Failed;
+        index = static_cast<size_t>(found - zones.begin());
+    }
+    return check(index);
+}
+
+std::vector<uint8_t> TransferClient::notify(std::span<const uint8_t> message, const sockaddr_in& source) {
+    if (message.size() < HEADER_SIZE) return {};
+
+    // The response echoes the header and question with QR set
+    WireName apex;
+    size_t offset = HEADER_SIZE;
+    bool valid = readUint16(message, 4) == 1 && apex.parse(message, offset) && offset + 4 <= message.size();
+    std::vector<uint8_t> response(message.begin(), message.begin() + (valid ? offset + 4 : HEADER_SIZE));
+    response[2] = static_cast<uint8_t>((response[2] & OPCODE_MASK) | FLAG_QR | FLAG_AA);
+    response[3] = valid ? RCODE_NOERROR : RCODE_FORMERR;
+    writeUint16(response, 4, valid ? 1 : 0);
+    for (size_t field = 6; field < HEADER_SIZE; field += 2) writeUint16(response, field, 0);
+    if (!valid) return response;
+
+    {
+        std::lock_guard lock(mutex);
+        auto found = std::find_if(zones.begin(), zones.end(), [&](const Secondary& zone) {
+            return std::ranges::equal(zone.apex.bytes(), apex.bytes());
+        });
+        if (found == zones.end()) {
+            response[3] = RCODE_NOTAUTH;
+            return response;
+        }
+        if (found->primary.sin_addr.s_addr != source.sin_addr.s_addr) {
+            response[3] = RCODE_REFUSED;
+            return response;
+        }
+
+        // Bring the check forward to the end of the window, once per window
+        counters.notifiesReceived++;
+        if (!found->notified) {
+            found->notified = true;
+            uint32_t timer = zoneTimer(static_cast<size_t>(found - zones.begin()));
+            wheel.schedule(timer, std::min(wheel.deadline(timer), ticksAfter(notifyWindow)));
+        }
+    }
+    wakeUp();
+    return response;
+}
+
+void TransferClient::zoneChanged(std::string_view origin) {
+    {
+        std::lock_guard lock(mutex);
+        for (const sockaddr_in& target : notifyTargets) {
+            auto found = std::find_if(outgoing.begin(), outgoing.end(), [&](const Outgoing& entry) {
+                return entry.origin == origin && entry.target.sin_addr.s_addr == target.sin_addr.s_addr &&
+                       entry.target.sin_port == target.sin_port;
+            });
+            if (found == outgoing.end()) {
+                found = outgoing.insert(outgoing.end(), Outgoing{std::string(origin), target});
+            }
+
+            // Already waiting out the window: this change rides along
+            if (found->active && found->tries == 0) continue;
+            found->active = true;
+            found->tries = 0;
+            wheel.schedule(notifyTimer(static_cast<size_t>(found - outgoing.begin())), ticksAfter(notifyWindow));
+        }
+    }
+    wakeUp();
+}
+
+TransferClient::Stats TransferClient::stats() const {
+    std::lock_guard lock(mutex);
+    return counters;
+}
+
+TransferClient::Outcome TransferClient::check(size_t index) {
+    Secondary zone;
+    {
+        std::lock_guard lock(mutex);
+        zone = zones[index];
+    }
+    Outcome outcome = transfer(zone);
+
+    uint32_t seconds = DEFAULT_RETRY_SECONDS;
+    auto current = server.zones();
+    auto held = current ? current->find(zone.origin) : nullptr;
+    if (auto snapshot = held ? held->snapshot() : nullptr) {
+        seconds = outcome == Outcome::Failed ? snapshot->soa().retry : snapshot->soa().refresh;
+    }
+    std::lock_guard lock(mutex);
+    zones[index].notified = false;
+    counters.checks++;
+    if (outcome == Outcome::Incremental || outcome == Outcome::Full) counters.transfers++;
+    wheel.schedule(zoneTimer(index), ticksAfter(std::chrono::seconds(std::max<uint32_t>(seconds, 1))));
+    return outcome;
+}
+
+void TransferClient::sendNotify(size_t entry) {
+    std::vector<uint8_t> message;
+    sockaddr_in target;
+    {
+        std::lock_guard lock(mutex);
+        Outgoing& notice = outgoing[entry];
+        WireName apex;
+        if (!notice.active || !apex.assign(notice.origin)) return;
+        notice.id = nextId++;
+        notice.tries++;
+        if (notice.tries < NOTIFY_TRIES) {
+            wheel.schedule(notifyTimer(entry), ticksAfter(NOTIFY_RETRY));
+        } else {
+            notice.active = false;   // Given up until the next change
+        }
+        counters.notifiesSent++;
+        message = makeQuery(notice.id, apex.bytes(), TYPE_SOA);
+        message.erase(message.begin(), message.begin() + PREFIX_SIZE);
+        message[2] = static_cast<uint8_t>((OPCODE_NOTIFY << 3) | FLAG_AA);
+        target = notice.target;
+    }
+    sendto(notifySocket, message.data(), message.size(), 0, reinterpret_cast<const sockaddr*>(&target),
+           sizeof(target));
+}
+
+void TransferClient::receiveAcks() {
+    uint8_t buffer[512];
+    sockaddr_in source{};
+    socklen_t length = sizeof(source);
+    ssize_t size;
+    while ((size = recvfrom(notifySocket, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&source),
+                            &length)) >= static_cast<ssize_t>(HEADER_SIZE)) {
+        std::span<const uint8_t> message(buffer, static_cast<size_t>(size));
+        length = sizeof(source);
+        if (!(message[2] & FLAG_QR) || opcodeOf(message) != OPCODE_NOTIFY) continue;
+        std::lock_guard lock(mutex);
+        for (size_t i = 0; i < outgoing.size(); ++i) {
+            Outgoing& notice = outgoing[i];
+            if (notice.active && notice.tries > 0 && notice.id == readUint16(message, 0) &&
+                notice.target.sin_addr.s_addr == source.sin_addr.s_addr && notice.target.sin_port == source.sin_port) {
+                notice.active = false;
+                wheel.cancel(notifyTimer(i));
+            }
+        }
+    }
+}
+
+uint64_t TransferClient::ticks() const {
+    return static_cast<uint64_t>((std::chrono::steady_clock::now() - epoch) / TICK);
+}
+
+uint64_t TransferClient::ticksAfter(std::chrono::milliseconds delay) const {
+    // Round up, so nothing fires early
+    return ticks() + static_cast<uint64_t>((delay + TICK - std::chrono::milliseconds(1)) / TICK);
+}
+
+void TransferClient::wakeUp() {
+    uint64_t one = 1;
+    if (wakeFd >= 0 && write(wakeFd, &one, sizeof(one)) < 0) {
+        // Already signalled; the counter is saturated
+    }
+}
+
+void TransferClient::run() {
+    std::vector<uint32_t> expired;
+    while (running) {
+        uint64_t next;
+        {
+            std::lock_guard lock(mutex);
+            expired.clear();
+            wheel.advance(ticks(), [&](uint32_t timer) { expired.push_back(timer); });
+            next = wheel.nextEvent();
+        }
+        for (uint32_t timer : expired) {
+            if (!running) break;
+            if (timer % 2 == 0) {
+                // Checks go to the workers, so a slow primary holds up
+                // nothing but its own zone
+                std::lock_guard lock(mutex);
+                Secondary& zone = zones[timer / 2];
+                if (zone.checking) {
+                    zone.recheck = true;
+                } else {
+                    zone.checking = true;
+                    queued.push_back(timer / 2);
+                    queueChanged.notify_one();
+                }
+            } else {
+                sendNotify(timer / 2);
+            }
+        }
+        if (!expired.empty()) continue;   // That took time; look again
+
+        int timeout = -1;
+        if (next != TimerWheel::NEVER) {
+            auto due = epoch + next * TICK;
+            auto wait = std::chrono::ceil<std::chrono::milliseconds>(due - std::chrono::steady_clock::now());
+            timeout = static_cast<int>(std::max<int64_t>(wait.count(), 0));
+        }
+        pollfd ready[] = {{wakeFd, POLLIN, 0}, {notifySocket, POLLIN, 0}};
+        if (poll(ready, 2, timeout) <= 0) continue;
+        if (ready[0].revents & POLLIN) {
+            uint64_t count;
+            if (read(wakeFd, &count, sizeof(count)) < 0) {
+                // Raced with another reader; nothing to do
+            }
+        }
+        if (ready[1].revents & POLLIN) receiveAcks();
+    }
+}
+
+void TransferClient::work() {
+    for (;;) {
+        size_t index;
+        {
+            std::unique_lock lock(mutex);
+            queueChanged.wait(lock, [&] { return !running || !queued.empty(); });
+            if (!running) return;
+            index = queued.front();
+            queued.pop_front();
+        }
+        check(index);
+        {
+            std::lock_guard lock(mutex);
+            Secondary& zone = zones[index];
+            zone.checking = false;
+            if (zone.recheck) {
+                zone.recheck = false;
+                wheel.schedule(zoneTimer(index), ticks());
+            }
+        }
+        wakeUp();   // The zone's next deadline may come before the one waited for
+    }
+}
+
+int TransferClient::openConnection(const Secondary& zone) {
+    int fd = connectTo(zone.primary);
+    if (fd < 0) return -1;
+    std::lock_guard lock(mutex);
+    if (stopping) {
+        close(fd);
+        return -1;
+    }
+    connections.push_back(fd);
+    return fd;
+}
+
+void TransferClient::closeConnection(int fd) {
+    {
+        std::lock_guard lock(mutex);
+        std::erase(connections, fd);
+    }
+    close(fd);
+}
+
+TransferClient::Outcome TransferClient::transfer(const Secondary& zone) {
+    auto current = server.zones();
+    auto held = current ? current->find(zone.origin) : nullptr;
+    auto base = held ? held->snapshot() : nullptr;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(TRANSFER_TIMEOUT_SECONDS);
+
+    int fd = openConnection(zone);
+    if (fd < 0) return Outcome::Failed;
+    uint16_t id = nextId++;
+    auto query = makeQuery(id, zone.apex.bytes(), TYPE_SOA);
+    std::vector<uint8_t> reply;
+    uint32_t serial = 0;
+    if (!sendQuery(fd, query, deadline) || !receiveMessage(fd, reply, deadline) || !answerSerial(reply, id, serial)) {
+        closeConnection(fd);
+        return Outcome::Failed;
+    }
+    if (base && !serialNewer(serial, base->soa().serial)) {
+        closeConnection(fd);
+        return Outcome::UpToDate;
+    }
+
+    Outcome outcome = pull(fd, zone, base, deadline);
+    closeConnection(fd);
+    if (outcome == Outcome::Failed && base) {
+        // The IXFR could not be used, or the zone changed before it could be
+        // applied; a full transfer needs nothing from us
+        fd = openConnection(zone);
+        if (fd < 0) return Outcome::Failed;
+        outcome = pull(fd, zone, nullptr, deadline);
+        closeConnection(fd);
+    }
+    return outcome;
+}
+
+TransferClient::Outcome TransferClient::pull(int fd, const Secondary& zone,
+                                             const std::shared_ptr<const ZoneSnapshot>& base,
+                                             zone_transfer::Deadline deadline) {
+    uint16_t id = nextId++;
+    auto apex = zone.apex.bytes();
+    auto query = makeQuery(id, apex, base ? zone_transfer::TYPE_IXFR : zone_transfer::TYPE_AXFR);
+    if (base) {
+        // IXFR names the version we hold with its SOA in the authority section
+        auto soa = base->firstRR(apex, TYPE_SOA);
+        writeUint16(query, PREFIX_SIZE + 8, 1);
+        query.push_back(0xC0);
+        query.push_back(static_cast<uint8_t>(HEADER_SIZE));
+        query.insert(query.end(), soa.begin(), soa.end());
+    }
+    if (!sendQuery(fd, query, deadline)) return Outcome::Failed;
+
+    TransferReader reader(apex, id, base);
+    std::vector<uint8_t> message;
+    while (reader.state() == TransferReader::State::More) {
+        if (!receiveMessage(fd, message, deadline)) return Outcome::Failed;
+        reader.feed(message);
+    }
+
+    switch (reader.state()) {
+    case TransferReader::State::UpToDate:
+        return Outcome::UpToDate;
+    case TransferReader::State::Full:
+        return server.loadZone(zone.origin, std::move(reader.result())) ? Outcome::Full : Outcome::Failed;
+    case TransferReader::State::Incremental:
+        return server.applyDelta(zone.origin, reader.result()) ? Outcome::Incremental : Outcome::Failed;
+    default:
+        return Outcome::Failed;
+    }
+}
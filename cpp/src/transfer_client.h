@@ -0,0 +1,230 @@
+#pragma once
+
+#include "dns_packet.h"
+#include "dns_server.h"
+#include "timer_wheel.h"
+#include "zone.h"
+#include "zone_transfer.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Reads the answer to an AXFR or IXFR request one message at a time, so a
+// transfer is never held in memory as raw messages. A full transfer ends
+// up as the complete new contents of the zone; an incremental one is
+// applied to the touched names only, starting from their contents in the
+// base snapshot, and ends up as a ZoneDelta. RDATA is decoded and encoded
+// again, which drops the sender's compression pointers.
+class TransferReader {
+public:
+    enum class State {
+        More,          // Feed the next message
+        UpToDate,      // IXFR answered with our own serial
+        Full,          // result() holds every name of the zone
+        Incremental,   // result() holds the changed names
+        Failed
+    };
+
+    // apex is the zone's lowercased wire name; base is the version we hold,
+    // or nullptr when we hold none
+    TransferReader(std::span<const uint8_t> apex, uint16_t id, std::shared_ptr<const ZoneSnapshot> base);
+
+    // Take one message (no TCP length prefix)
+    State feed(std::span<const uint8_t> message);
+
+    [[nodiscard]]
+    State state() const noexcept { return state_; }
+
+    [[nodiscard]]
+    ZoneDelta& result() noexcept { return delta; }
+
+private:
+    using Name = std::vector<uint8_t>;
+    using RRs = std::vector<std::vector<uint8_t>>;
+
+    enum class Phase { First, Second, Full, Deleting, Adding };
+
+    // Handle one RR; false when the stream is inconsistent
+    bool take(Name name, std::vector<uint8_t> tail, const dns_packet::SOAData* soa);
+
+    // Working contents of a name during an incremental transfer
+    RRs& contents(const Name& name);
+
+    void finish(State outcome);
+
+    std::vector<uint8_t> apex;
+    uint16_t id;
+    std::shared_ptr<const ZoneSnapshot> base;
+    State state_ = State::More;
+    Phase phase = Phase::First;
+    uint32_t stepSerial = 0;       // Serial the current step moves to
+    dns_packet::SOAData newest;
+    std::vector<uint8_t> newestTail;
+    ZoneDelta delta;
+};
+
+// Secondary side of zone transfer, plus the NOTIFY messages (RFC1996) that
+// tie primaries and secondaries together. Each followed zone is checked
+// against its primary on one of MAX_TRANSFERS worker threads: an SOA query
+// over TCP, and when the primary's serial is newer, IXFR from the serial we
+// hold (AXFR when we hold nothing or the IXFR cannot be used). The answer
+// is parsed as it arrives and the next version is built on that worker;
+// readers switch to it with the usual atomic snapshot swap. A check gives
+// up at its deadline, and while it runs the timers keep firing for every
+// other zone.
+//
+// Zones are checked again after their SOA REFRESH interval, RETRY after a
+// failure, or shortly after a NOTIFY from their primary. NOTIFYs for a
+// zone within the notify window collapse into one check. In the other
+// direction, zoneChanged() queues a NOTIFY to every notify target after
+// the same window, so a burst of changes is announced once, and resends it
+// until acknowledged. All deadlines live in one timer wheel, so thousands
+// of zones cost one timer thread and no per-zone scanning.
+class TransferClient {
+public:
+    enum class Outcome { UpToDate, Incremental, Full, Failed };
+
+    struct Stats {
+        uint64_t checks = 0;             // SOA polls, whatever came of them
+        uint64_t transfers = 0;          // IXFR or AXFR applied
+        uint64_t notifiesReceived = 0;   // Accepted from a primary
+        uint64_t notifiesSent = 0;       // Including resends
+    };
+
+    static constexpr int IO_TIMEOUT_SECONDS = 10;
+    static constexpr int TRANSFER_TIMEOUT_SECONDS = 300;    // SOA query and transfer together
+    static constexpr size_t MAX_TRANSFERS = 4;              // Zones checked at the same time
+    static constexpr uint32_t DEFAULT_RETRY_SECONDS = 60;   // Until the zone has an SOA of its own
+    static constexpr std::chrono::milliseconds TICK{100};   // Timer resolution
+    static constexpr std::chrono::milliseconds DEFAULT_NOTIFY_WINDOW{1000};
+    static constexpr std::chrono::milliseconds NOTIFY_RETRY{2000};
+    static constexpr unsigned NOTIFY_TRIES = 5;
+
+    explicit TransferClient(DNSServer& server);
+    ~TransferClient();
+    TransferClient(const TransferClient&) = delete;
+    TransferClient& operator=(const TransferClient&) = delete;
+
+    // Follow origin from primary; the first check is due at once. False
+    // when origin is not a valid name.
+    [[nodiscard]]
+    bool addZone(std::string_view origin, const sockaddr_in& primary);
+
+    // Whether the zone with this lowercased wire name is one we follow; its
+    // contents come from the primary and are not ours to change
+    [[nodiscard]]
+    bool follows(std::span<const uint8_t> apex) const;
+
+    // Send NOTIFY for every changed zone to target
+    void addNotifyTarget(const sockaddr_in& target);
+
+    // How long NOTIFYs, in and out, are held back to be coalesced
+    void setNotifyWindow(std::chrono::milliseconds window) { notifyWindow = window; }
+
+    // Run the timers on a thread of their own; false when its sockets
+    // could not be set up
+    [[nodiscard]]
+    bool start();
+
+    void stop();
+
+    // Check one zone now on the calling thread and apply what it brings
+    Outcome refresh(std::string_view origin);
+
+    // Handle a NOTIFY request from source and return the response to send
+    [[nodiscard]]
+    std::vector<uint8_t> notify(std::span<const uint8_t> message, const sockaddr_in& source);
+
+    // A zone has a new version; NOTIFY the targets once the window passes
+    void zoneChanged(std::string_view origin);
+
+    [[nodiscard]]
+    Stats stats() const;
+
+private:
+    struct Secondary {
+        std::string origin;
+        dns_packet::WireName apex;
+        sockaddr_in primary;
+        bool notified = false;     // A check is already brought forward
+        bool checking = false;     // Queued for or running on a worker
+        bool recheck = false;      // Fired again meanwhile; check once more after
+    };
+
+    // One zone announced to one target
+    struct Outgoing {
+        std::string origin;
+        sockaddr_in target;
+        uint16_t id = 0;           // Of the NOTIFY last sent
+        unsigned tries = 0;        // Sent since the last change
+        bool active = false;       // Not acknowledged yet
+    };
+
+    // Timer ids: zones and outgoing NOTIFYs interleaved
+    static uint32_t zoneTimer(size_t zone) { return static_cast<uint32_t>(2 * zone); }
+    static uint32_t notifyTimer(size_t entry) { return static_cast<uint32_t>(2 * entry + 1); }
+
+    // SOA poll and transfer for one zone
+    Outcome transfer(const Secondary& zone);
+
+    // Pull one AXFR or IXFR over an open connection and apply it
+    Outcome pull(int fd, const Secondary& zone, const std::shared_ptr<const ZoneSnapshot>& base,
+                 zone_transfer::Deadline deadline);
+
+    // Connection to a zone's primary that stop() can cut short; -1 on failure
+    int openConnection(const Secondary& zone);
+    void closeConnection(int fd);
+
+    // Check a zone and set its next deadline from the outcome
+    Outcome check(size_t zone);
+
+    // Send or resend the NOTIFY of one outgoing entry
+    void sendNotify(size_t entry);
+
+    // Take NOTIFY responses off the socket
+    void receiveAcks();
+
+    // Timer ticks since construction
+    [[nodiscard]]
+    uint64_t ticks() const;
+
+    [[nodiscard]]
+    uint64_t ticksAfter(std::chrono::milliseconds delay) const;
+
+    void wakeUp();
+    void run();
+
+    // Check the zones the timer thread queued
+    void work();
+
+    DNSServer& server;
+    const std::chrono::steady_clock::time_point epoch;
+    std::chrono::milliseconds notifyWindow = DEFAULT_NOTIFY_WINDOW;
+    mutable std::mutex mutex;      // Guards everything below but the sockets
+    std::vector<Secondary> zones;
+    std::vector<sockaddr_in> notifyTargets;
+    std::vector<Outgoing> outgoing;
+    std::deque<size_t> queued;     // Zones due for a check
+    std::vector<int> connections;  // Open to primaries
+    bool stopping = false;         // Workers are winding down; no new connections
+    std::condition_variable queueChanged;
+    TimerWheel wheel;
+    Stats counters;
+    std::atomic<bool> running{false};
+    std::atomic<uint16_t> nextId{1};   // Message IDs, shared by refresh() callers and the thread
+    int wakeFd = -1;                   // eventfd that interrupts the thread's poll
+    int notifySocket = -1;             // UDP, for NOTIFYs and their responses
+    std::thread worker;
+    std::vector<std::thread> transferWorkers;
+};
@@ -0,0 +1,815 @@
+#include "zone.h"
+#include "checkpoint.h"
+#include "parallel.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+namespace {
+    constexpr uint16_t TYPE_A = 1;
+    constexpr uint16_t TYPE_NS = 2;
+    constexpr uint16_t TYPE_CNAME = 5;
+    constexpr uint16_t TYPE_SOA = 6;
+    constexpr uint16_t TYPE_MX = 15;
+    constexpr uint16_t TYPE_AAAA = 28;
+    constexpr uint16_t TYPE_SRV = 33;
+
+    // Offset of the target name in the TYPE..RDATA of an RR of a type that
+    // gets glue (RDATA starts at 10), or 0 for other types
+    uint32_t glueNameOffset(uint16_t type) {
+        switch (type) {
+            case TYPE_NS:  return 10;
+            case TYPE_MX:  return 12;   // After the preference
+            case TYPE_SRV: return 16;   // After priority, weight and port
+            default:       return 0;
+        }
+    }
+
+    // Table capacity for n keys at a load factor of at most one half
+    size_t tableCapacity(size_t n) {
+        return std::bit_ceil(std::max<size_t>(n * 2, 8));
+    }
+
+    bool sameName(std::span<const uint8_t> a, std::span<const uint8_t> b) {
+        return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size()) == 0;
+    }
+
+    // True when name is apex or below it
+    bool within(const dns_packet::WireName& name, const dns_packet::WireName& apex) {
+        return name.labelCount() >= apex.labelCount() && sameName(name.suffix(apex.labelCount()), apex.bytes());
+    }
+
+    // Target of the CNAME whose TYPE..RDATA is tail
+    bool cnameTarget(std::span<const uint8_t> tail, dns_packet::WireName& target) {
+        size_t offset = 10;
+        return target.parse(tail, offset);
+    }
+}
+
+ZoneSnapshot::Builder::Builder(std::string_view origin, dns_packet::SOAData soa)
+    : snapshot(std::make_shared<ZoneSnapshot>()) {
+    snapshot->origin_ = std::string(origin);
+    snapshot->soa_ = std::move(soa);
+    dns_packet::WireName apex;
+    reverse_name::Prefix prefix;
+    snapshot->reverseIndexed_ = apex.assign(origin) && reverse_name::parse(apex.bytes(), prefix);
+}
+
+bool ZoneSnapshot::Builder::add(const dns_packet::WireName& owner, std::string_view typeName,
+                                std::string_view value) {
+    uint16_t type = to_type_code(parse_record_type(typeName));
+    if (type == 0) return false;
+
+    pending.push_back({intern(owner.bytes()), type, false, value});
+    return true;
+}
+
+void ZoneSnapshot::Builder::addEncoded(std::span<const uint8_t> owner, std::span<const uint8_t> tail) {
+    pending.push_back({intern(owner), dns_packet::readUint16(tail, 0), true,
+                       {reinterpret_cast<const char*>(tail.data()), tail.size()}});
+}
+
+void ZoneSnapshot::Builder::setBase(std::shared_ptr<const ZoneSnapshot> base) {
+    ZoneSnapshot& snap = *snapshot;
+    snap.nameBase_ = static_cast<uint32_t>(base->names_.size());
+    snap.rrsetBase_ = static_cast<uint32_t>(base->rrsets_.size());
+    snap.rrBase_ = static_cast<uint32_t>(base->recordCount());
+    snap.base_ = std::move(base);
+}
+
+void ZoneSnapshot::Builder::addTombstone(std::span<const uint8_t> owner) {
+    snapshot->owners_[intern(owner)].flags |= TOMBSTONE;
+}
+
+void ZoneSnapshot::Builder::addFlags(std::span<const uint8_t> owner, uint8_t flags) {
+    snapshot->owners_[intern(owner)].flags |= flags;
+}
+
+uint32_t ZoneSnapshot::Builder::lookup(std::span<const uint8_t> name, uint64_t hash) const {
+    if (ownerSlots.empty()) return NOT_FOUND;
+    const ZoneSnapshot& snap = *snapshot;
+    size_t mask = ownerSlots.size() - 1;
+    for (size_t slot = hash & mask; ownerSlots[slot] != 0; slot = (slot + 1) & mask) {
+        uint32_t candidate = ownerSlots[slot] - 1;
+        if (ownerHashes[candidate] == hash && sameName(snap.ownerName(snap.owners_[candidate]), name)) {
+            return candidate;
+        }
+    }
+    return NOT_FOUND;
+}
+
+void ZoneSnapshot::Builder::addEmptyNonTerminals() {
+    ZoneSnapshot& snap = *snapshot;
+    dns_packet::WireName apex;
+    if (!apex.assign(snap.origin_)) return;
+    const ZoneSnapshot* base = snap.base_.get();
+
+    // Walk up from every name until an ancestor already flagged; names added
+    // on the way are walked from here too, so they are not looked at again
+    size_t count = snap.owners_.size();
+    for (size_t i = 0; i < count; ++i) {
+        if (snap.owners_[i].flags & TOMBSTONE) continue;
+        std::vector<uint8_t> name(snap.ownerName(snap.owners_[i]).begin(), snap.ownerName(snap.owners_[i]).end());
+        if (name.size() <= apex.bytes().size() || !sameName(std::span(name).last(apex.bytes().size()), apex.bytes())) {
+            continue;
+        }
+        for (std::span<const uint8_t> parent = std::span(name).subspan(1 + name[0]); parent.size() >= apex.bytes().size();
+             parent = parent.subspan(1 + parent[0])) {
+            uint64_t hash = dns_packet::hashName(parent);
+            uint32_t local = lookup(parent, hash);
+            if (local != NOT_FOUND) {
+                Owner& owner = snap.owners_[local];
+                if (owner.flags & ANCESTOR) break;
+                // A name deleted in this overlay that still has names below it
+                if (owner.flags & TOMBSTONE) owner.flags = EMPTY_NONTERMINAL;
+                owner.flags |= ANCESTOR;
+                continue;
+            }
+            const Owner* inBase = base ? base->find(parent, hash) : nullptr;
+            if (inBase != nullptr && (inBase->flags & ANCESTOR)) break;
+            // A base name that only now gets names below it moves into the
+            // overlay, so deleting it later leaves an empty non-terminal
+            uint32_t added = intern(parent);
+            snap.owners_[added].flags |= ANCESTOR | (inBase ? inBase->flags & EMPTY_NONTERMINAL : EMPTY_NONTERMINAL);
+            if (inBase == nullptr) continue;
+            for (const RRset& rrset : base->rrsets(*inBase)) {
+                for (uint32_t j = 0; j < rrset.rrCount; ++j) {
+                    auto tail = base->rr(rrset.firstRR + j);
+                    pending.push_back({added, rrset.type, true, {reinterpret_cast<const char*>(tail.data()), tail.size()}});
+                }
+            }
+        }
+    }
+}
+
+uint32_t ZoneSnapshot::Builder::intern(std::span<const uint8_t> name) {
+    ZoneSnapshot& snap = *snapshot;
+
+    // Callers hand over records grouped by owner, so most adds stop here
+    if (!snap.owners_.empty() && sameName(snap.ownerName(snap.owners_.back()), name)) {
+        return static_cast<uint32_t>(snap.owners_.size() - 1);
+    }
+
+    if ((snap.owners_.size() + 1) * 2 > ownerSlots.size()) {
+        ownerSlots.assign(tableCapacity(snap.owners_.size() + 1), 0);
+        size_t mask = ownerSlots.size() - 1;
+        for (uint32_t i = 0; i < ownerHashes.size(); ++i) {
+            size_t slot = ownerHashes[i] & mask;
+            while (ownerSlots[slot] != 0) slot = (slot + 1) & mask;
+            ownerSlots[slot] = i + 1;
+        }
+    }
+
+    uint64_t hash = dns_packet::hashName(name);
+    size_t mask = ownerSlots.size() - 1;
+    size_t slot = hash & mask;
+    for (; ownerSlots[slot] != 0; slot = (slot + 1) & mask) {
+        uint32_t candidate = ownerSlots[slot] - 1;
+        if (ownerHashes[candidate] == hash && sameName(snap.ownerName(snap.owners_[candidate]), name)) {
+            return candidate;
+        }
+    }
+
+    uint32_t id = static_cast<uint32_t>(snap.owners_.size());
+    ownerSlots[slot] = id + 1;
+    ownerHashes.push_back(hash);
+    snap.owners_.push_back({snap.nameBase_ + static_cast<uint32_t>(snap.names_.size()),
+                            static_cast<uint8_t>(name.size()), 0, 0, 0, static_cast<uint32_t>(hash >> 32)});
+    snap.names_.insert(snap.names_.end(), name.begin(), name.end());
+    return id;
+}
+
+std::shared_ptr<const ZoneSnapshot> ZoneSnapshot::Builder::build(const SnapshotOptions& options) {
+    ZoneSnapshot& snap = *snapshot;
+    addEmptyNonTerminals();
+
+    // Group by owner, then by type in order of first appearance; stable so
+    // RRs keep their insertion order within an RRset. An owner has a handful
+    // of types, so each run is ordered with a short list of types seen.
+    std::vector<uint32_t> order(pending.size());
+    {
+        // Counting sort on the owner index
+        std::vector<uint32_t> start(snap.owners_.size() + 1, 0);
+        for (const Pending& entry : pending) start[entry.owner + 1]++;
+        for (size_t i = 1; i < start.size(); ++i) start[i] += start[i - 1];
+        for (uint32_t i = 0; i < pending.size(); ++i) order[start[pending[i].owner]++] = i;
+    }
+    std::vector<uint16_t> typesSeen;
+    std::vector<uint32_t> rank(pending.size());
+    for (size_t begin = 0; begin < order.size();) {
+        size_t end = begin;
+        typesSeen.clear();
+        for (; end < order.size() && pending[order[end]].owner == pending[order[begin]].owner; ++end) {
+            uint16_t type = pending[order[end]].type;
+            auto seen = std::find(typesSeen.begin(), typesSeen.end(), type);
+            rank[order[end]] = static_cast<uint32_t>(seen - typesSeen.begin());
+            if (seen == typesSeen.end()) typesSeen.push_back(type);
+        }
+        if (typesSeen.size() > 1 && end - begin > 32) {
+            std::stable_sort(order.begin() + begin, order.begin() + end,
+                             [&](uint32_t a, uint32_t b) { return rank[a] < rank[b]; });
+        } else if (typesSeen.size() > 1) {
+            // Insertion sort: stable, in place, and typical runs are short
+            for (size_t i = begin + 1; i < end; ++i) {
+                uint32_t entry = order[i];
+                size_t j = i;
+                for (; j > begin && rank[order[j - 1]] > rank[entry]; --j) order[j] = order[j - 1];
+                order[j] = entry;
+            }
+        }
+        begin = end;
+    }
+
+    // Encode in final order, one contiguous run per worker; concatenating the
+    // runs gives the wire image. A zero length marks a record that failed.
+    unsigned threads = resolveThreads(options.buildThreads);
+    std::vector<std::vector<uint8_t>> runs(threads);
+    std::vector<uint32_t> tailLength(order.size(), 0);
+    parallelChunks(order.size(), threads, [&](size_t begin, size_t end, unsigned worker) {
+        auto& out = runs[worker];
+        out.reserve((end - begin) * 16);
+        for (size_t i = begin; i < end; ++i) {
+            const Pending& entry = pending[order[i]];
+            size_t before = out.size();
+            if (entry.encoded) {
+                out.insert(out.end(), entry.value.begin(), entry.value.end());
+            } else if (!dns_packet::appendRecordTail(out, entry.type, dns_packet::DEFAULT_TTL, entry.value)) {
+                continue;
+            }
+            tailLength[i] = static_cast<uint32_t>(out.size() - before);
+        }
+    });
+    size_t wireSize = 0;
+    for (const auto& run : runs) wireSize += run.size();
+    snap.wire_.reserve(wireSize);
+    for (auto& run : runs) {
+        snap.wire_.insert(snap.wire_.end(), run.begin(), run.end());
+        std::vector<uint8_t>().swap(run);
+    }
+
+    snap.rrOffsets_.reserve(order.size() + 1);
+    uint32_t offset = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (tailLength[i] == 0) continue;
+        const Pending& entry = pending[order[i]];
+        Owner& owner = snap.owners_[entry.owner];
+        if (owner.rrsetCount == 0 || snap.rrsets_.back().type != entry.type) {
+            if (owner.rrsetCount == 0) owner.firstRRset = snap.rrsetBase_ + static_cast<uint32_t>(snap.rrsets_.size());
+            owner.rrsetCount++;
+            snap.rrsets_.push_back({entry.type, 0, snap.rrBase_ + static_cast<uint32_t>(snap.rrOffsets_.size())});
+        }
+        snap.rrsets_.back().rrCount++;
+        snap.rrOffsets_.push_back(offset);
+        offset += tailLength[i];
+    }
+    snap.rrOffsets_.push_back(offset);
+
+    // A name with RRs of its own is not empty, whatever it was flagged with
+    for (Owner& owner : snap.owners_) {
+        if (owner.rrsetCount > 0) owner.flags &= ~EMPTY_NONTERMINAL;
+    }
+
+    // Only names with RRs count; empty non-terminals and tombstones do not
+    auto counted = [](const Owner& owner) { return !(owner.flags & (TOMBSTONE | EMPTY_NONTERMINAL)); };
+    snap.ownerTotal_ = static_cast<size_t>(std::ranges::count_if(snap.owners_, counted));
+    snap.recordTotal_ = snap.rrOffsets_.size() - 1;
+    if (snap.base_) {
+        // Names the overlay replaces or deletes no longer count for the base
+        const ZoneSnapshot& base = *snap.base_;
+        snap.ownerTotal_ += base.ownerCount();
+        snap.recordTotal_ += base.recordCount();
+        for (const Owner& owner : snap.owners_) {
+            auto name = snap.ownerName(owner);
+            const Owner* shadowed = base.find(name, dns_packet::hashName(name));
+            if (shadowed == nullptr) continue;
+            for (const RRset& rrset : base.rrsets(*shadowed)) snap.recordTotal_ -= rrset.rrCount;
+            snap.ownerTotal_ -= counted(*shadowed);
+        }
+    }
+
+    snap.buildNegativeSoa();
+    snap.buildSubsets(options);
+
+    // Overlays stay small and change every update, so they always use the table
+    SnapshotOptions indexOptions = options;
+    if (snap.base_) indexOptions.perfectHash = false;
+    snap.buildIndex(indexOptions);
+    snap.buildGlue();
+    snap.buildChains();
+
+    pending.clear();
+    ownerHashes.clear();
+    ownerSlots.clear();
+    return std::move(snapshot);
+}
+
+void ZoneSnapshot::buildIndex(const SnapshotOptions& options) {
+    std::vector<uint64_t> hashes(owners_.size());
+    for (size_t i = 0; i < owners_.size(); ++i) {
+        hashes[i] = dns_packet::hashName(ownerName(owners_[i]));
+    }
+    filter_.build(hashes);
+
+    if (options.perfectHash && perfect_.build(hashes, options.buildThreads)) {
+        // Put every owner in the slot its hash maps to, making owners_ the directory
+        LargeVector<Owner> ordered(owners_.size());
+        for (size_t i = 0; i < owners_.size(); ++i) {
+            ordered[perfect_.lookup(hashes[i])] = owners_[i];
+        }
+        owners_ = std::move(ordered);
+    } else {
+        // Without a perfect hash (or when two names share a 64-bit hash) use the table
+        index_.assign(tableCapacity(owners_.size()), IndexSlot{0, 0});
+        size_t mask = index_.size() - 1;
+        for (uint32_t i = 0; i < owners_.size(); ++i) {
+            size_t slot = hashes[i] & mask;
+            while (index_[slot].owner != 0) slot = (slot + 1) & mask;
+            index_[slot] = {static_cast<uint32_t>(hashes[i] >> 32), i + 1};
+        }
+    }
+
+    if (reverseIndexed_) {
+        std::vector<ReverseIndex::Entry> entries;
+        for (uint32_t i = 0; i < owners_.size(); ++i) {
+            reverse_name::Prefix prefix;
+            if (reverse_name::parse(ownerName(owners_[i]), prefix)) entries.push_back({prefix, i});
+        }
+        reverse_.build(std::move(entries));
+    }
+}
+
+void ZoneSnapshot::buildNegativeSoa() {
+    std::vector<uint8_t> rdata;
+    soa_.encode(rdata);
+    negativeSoa_.clear();
+    dns_packet::appendRecordTail(negativeSoa_, TYPE_SOA, std::min(dns_packet::DEFAULT_TTL, soa_.minimum), rdata);
+}
+
+void ZoneSnapshot::buildSubsets(const SnapshotOptions& options) {
+    if (!options.subsets || options.subsets->empty()) return;
+    std::vector<uint32_t> weights;
+    for (const Owner& owner : owners_) {
+        for (uint32_t i = 0; i < owner.rrsetCount; ++i) {
+            const RRset& rrset = rrsets_[owner.firstRRset - rrsetBase_ + i];
+            const answer_subset::Rule* rule = options.subsets->find(ownerName(owner), rrset.type);
+            if (rule == nullptr || rrset.rrCount <= rule->count) continue;
+            weights.clear();
+            for (uint32_t j = 0; j < rrset.rrCount; ++j) weights.push_back(rule->weightOf(rr(rrset.firstRR + j)));
+            subsets_.push_back({owner.firstRRset + i, rule->count, static_cast<uint32_t>(alias_.size())});
+            alias_.resize(alias_.size() + weights.size());
+            answer_subset::buildAlias(weights, std::span(alias_).last(weights.size()));
+        }
+    }
+    std::ranges::sort(subsets_, {}, &Subset::rrset);
+}
+
+void ZoneSnapshot::buildGlue() {
+    // Link an RR to the address RRsets of the target name at nameOffset in
+    // its tail; false when the zone has none
+    auto link = [&](uint32_t rrIndex, std::span<const uint8_t> tail, uint32_t nameOffset) {
+        dns_packet::WireName target;
+        size_t offset = nameOffset;
+        const Owner* owner = target.parse(tail, offset) ? find(target.bytes(), target.hash()) : nullptr;
+        if (owner == nullptr) return false;
+        size_t before = glue_.size();
+        for (uint32_t i = 0; i < owner->rrsetCount; ++i) {
+            uint16_t type = rrset(owner->firstRRset + i).type;
+            if (type == TYPE_A || type == TYPE_AAAA) glue_.push_back({rrIndex, owner->firstRRset + i, nameOffset});
+        }
+        return glue_.size() > before;
+    };
+
+    for (const Owner& owner : owners_) {
+        if (owner.flags & TOMBSTONE) continue;
+        for (const RRset& set : rrsets(owner)) {
+            uint32_t nameOffset = glueNameOffset(set.type);
+            if (nameOffset == 0) continue;
+            for (uint32_t i = 0; i < set.rrCount; ++i) {
+                link(set.firstRR + i, rr(set.firstRR + i), nameOffset);
+            }
+        }
+    }
+
+    // Base links to names the overlay replaced or deleted are relinked, or
+    // dropped. Base RRs whose target only gains addresses in the overlay go
+    // without glue until the next compaction, which is merely suboptimal.
+    if (base_) {
+        const auto& links = base_->glue_;
+        for (size_t i = 0; i < links.size(); ++i) {
+            if (i > 0 && links[i].rr == links[i - 1].rr) continue;
+            auto tail = base_->rr(links[i].rr);
+            dns_packet::WireName target;
+            size_t offset = links[i].nameOffset;
+            if (target.parse(tail, offset) && findLocal(target.bytes(), target.hash()) != nullptr &&
+                !link(links[i].rr, tail, links[i].nameOffset)) {
+                glue_.push_back({links[i].rr, Glue::NONE, links[i].nameOffset});
+            }
+        }
+    }
+    std::ranges::stable_sort(glue_, {}, &Glue::rr);
+}
+
+ZoneSnapshot::Chain ZoneSnapshot::follow(uint32_t rrset, uint32_t hop, const dns_packet::WireName& apex) {
+    Chain chain{rrset, static_cast<uint32_t>(chainRRs_.size()), 0, 0, 0, 0};
+    while (true) {
+        chainRRs_.push_back(hop);
+        chain.length++;
+        dns_packet::WireName target;
+        if (!cnameTarget(rr(hop), target) || !within(target, apex)) break;
+        const Owner* next = find(target.bytes(), target.hash());
+        if (next == nullptr) {
+            chain.missing = 1;
+            break;
+        }
+        auto sets = rrsets(*next);
+        auto cname = std::ranges::find(sets, TYPE_CNAME, &RRset::type);
+        if (cname == sets.end()) {
+            chain.target = next->firstRRset;
+            chain.targetCount = next->rrsetCount;
+            break;
+        }
+        auto seen = std::span(chainRRs_).last(chain.length);
+        if (chain.length == CnameChain::MAX_LENGTH || std::ranges::find(seen, cname->firstRR) != seen.end()) break;
+        hop = cname->firstRR;
+    }
+    return chain;
+}
+
+void ZoneSnapshot::buildChains() {
+    dns_packet::WireName apex;
+    if (!apex.assign(origin_)) return;
+    for (const Owner& owner : owners_) {
+        if (owner.flags & TOMBSTONE) continue;
+        auto sets = rrsets(owner);
+        for (uint32_t i = 0; i < sets.size(); ++i) {
+            if (sets[i].type == TYPE_CNAME) chains_.push_back(follow(owner.firstRRset + i, sets[i].firstRR, apex));
+        }
+    }
+
+    // A base chain through a name the overlay replaced, added or deleted
+    // is followed again here, through the overlay
+    if (base_) {
+        for (const Chain& chain : base_->chains_) {
+            auto hops = std::span(base_->chainRRs_).subspan(chain.first, chain.length);
+            bool changed = std::ranges::any_of(hops, [&](uint32_t hop) {
+                dns_packet::WireName target;
+                return cnameTarget(base_->rr(hop), target) && findLocal(target.bytes(), target.hash()) != nullptr;
+            });
+            if (changed) chains_.push_back(follow(chain.rrset, hops.front(), apex));
+        }
+    }
+    std::ranges::sort(chains_, {}, &Chain::rrset);
+}
+
+bool ZoneSnapshot::chain(uint32_t rrset, CnameChain& out) const noexcept {
+    auto it = std::ranges::lower_bound(chains_, rrset, {}, &Chain::rrset);
+    if (it == chains_.end() || it->rrset != rrset) return rrset < rrsetBase_ && base_->chain(rrset, out);
+    out.rrs = std::span<const uint32_t>(chainRRs_).subspan(it->first, it->length);
+    out.target = it->target;
+    out.targetCount = it->targetCount;
+    out.missing = it->missing != 0;
+    return true;
+}
+
+std::span<const ZoneSnapshot::Glue> ZoneSnapshot::glue(uint32_t rr) const noexcept {
+    auto [first, last] = std::ranges::equal_range(glue_, rr, {}, &Glue::rr);
+    if (first == last && rr < rrBase_) return base_->glue(rr);
+    return {first, last};
+}
+
+bool ZoneSnapshot::subset(uint32_t rrset, std::span<const answer_subset::AliasSlot>& table,
+                          uint32_t& count) const noexcept {
+    if (rrset < rrsetBase_) return base_->subset(rrset, table, count);
+    if (subsets_.empty()) return false;
+    auto it = std::ranges::lower_bound(subsets_, rrset, {}, &Subset::rrset);
+    if (it == subsets_.end() || it->rrset != rrset) return false;
+    table = std::span<const answer_subset::AliasSlot>(alias_).subspan(it->table, rrsets_[rrset - rrsetBase_].rrCount);
+    count = it->count;
+    return true;
+}
+
+const ZoneSnapshot::Owner* ZoneSnapshot::findLocal(std::span<const uint8_t> name, uint64_t hash) const noexcept {
+    if (!perfect_.empty()) {
+        // One probe into the directory; the fingerprint rejects almost every
+        // name outside the zone before its bytes are compared
+        uint64_t slot = perfect_.lookup(hash);
+        if (slot >= owners_.size()) return nullptr;
+        const Owner& owner = owners_[slot];
+        if (owner.fingerprint != static_cast<uint32_t>(hash >> 32)) return nullptr;
+        return sameName(ownerName(owner), name) ? &owner : nullptr;
+    }
+    if (index_.empty()) return nullptr;
+    size_t mask = index_.size() - 1;
+    uint32_t tag = static_cast<uint32_t>(hash >> 32);
+    for (size_t slot = hash & mask; index_[slot].owner != 0; slot = (slot + 1) & mask) {
+        if (index_[slot].tag != tag) continue;
+        const Owner& owner = owners_[index_[slot].owner - 1];
+        if (sameName(ownerName(owner), name)) return &owner;
+    }
+    return nullptr;
+}
+
+const ZoneSnapshot::Owner* ZoneSnapshot::find(std::span<const uint8_t> name, uint64_t hash) const noexcept {
+    const Owner* owner = findLocal(name, hash);
+    if (owner != nullptr) return (owner->flags & TOMBSTONE) ? nullptr : owner;
+    return base_ ? base_->find(name, hash) : nullptr;
+}
+
+const ZoneSnapshot::Owner* ZoneSnapshot::findReverse(const reverse_name::Prefix& prefix) const noexcept {
+    uint32_t index = reverse_.exact(prefix);
+    if (index != ReverseIndex::NONE) {
+        const Owner& owner = owners_[index];
+        return (owner.flags & TOMBSTONE) ? nullptr : &owner;
+    }
+    return base_ ? base_->findReverse(prefix) : nullptr;
+}
+
+std::span<const uint8_t> ZoneSnapshot::firstRR(std::span<const uint8_t> name, uint16_t type) const noexcept {
+    const Owner* owner = find(name, dns_packet::hashName(name));
+    if (owner == nullptr) return {};
+    for (const RRset& rrset : rrsets(*owner)) {
+        if (rrset.type == type && rrset.rrCount > 0) return rr(rrset.firstRR);
+    }
+    return {};
+}
+
+std::shared_ptr<const ZoneSnapshot> ZoneSnapshot::apply(const std::shared_ptr<const ZoneSnapshot>& current,
+                                                        const ZoneDelta& delta, const SnapshotOptions& options) {
+    const std::shared_ptr<const ZoneSnapshot>& flat = current->base_ ? current->base_ : current;
+    Builder builder(current->origin_, delta.soa);
+
+    // Copy one live owner's RRs out of whichever layer holds them
+    auto carry = [&](const ZoneSnapshot& from, const Owner& owner) {
+        auto name = from.ownerName(owner);
+        for (const RRset& rrset : from.rrsets(owner)) {
+            for (uint32_t i = 0; i < rrset.rrCount; ++i) builder.addEncoded(name, from.rr(rrset.firstRR + i));
+        }
+    };
+    auto inDelta = [&](std::span<const uint8_t> name) {
+        return delta.owners.contains(std::vector<uint8_t>(name.begin(), name.end()));
+    };
+
+    // Overlays are read-through, so once one holds a good share of the zone
+    // fold everything into a new flat snapshot instead
+    size_t overlay = current->overlayCount() + delta.owners.size();
+    bool compact = overlay > std::max<size_t>(COMPACT_MIN_OVERLAY, flat->ownerCount() / 8);
+    if (compact) {
+        current->forEachOwner([&](const Owner& owner) {
+            const ZoneSnapshot& from = owner.nameOffset < current->nameBase_ ? *flat : *current;
+            if (!inDelta(from.ownerName(owner))) carry(from, owner);
+        });
+    } else {
+        builder.setBase(flat);
+        if (current->base_) {
+            for (const Owner& owner : current->owners_) {
+                auto name = current->ownerName(owner);
+                if (inDelta(name)) continue;
+                if (owner.flags & TOMBSTONE) {
+                    builder.addTombstone(name);
+                } else {
+                    carry(*current, owner);
+                    if (owner.flags & (EMPTY_NONTERMINAL | ANCESTOR)) builder.addFlags(name, owner.flags);
+                }
+            }
+        }
+    }
+
+    // A compacted snapshot finds its empty non-terminals anew. An overlay
+    // keeps every name that had others below it, as an empty non-terminal
+    // if deleted: names below may remain, and telling would take a walk of
+    // the zone. Should none remain, the name answers NODATA rather than
+    // NXDOMAIN until the next compaction.
+    for (const auto& [name, tails] : delta.owners) {
+        const Owner* before = compact ? nullptr : current->find(name, dns_packet::hashName(name));
+        bool ancestor = before != nullptr && (before->flags & ANCESTOR);
+        if (tails.empty()) {
+            if (ancestor) {
+                builder.addFlags(name, EMPTY_NONTERMINAL | ANCESTOR);
+            } else if (!compact && flat->find(name, dns_packet::hashName(name)) != nullptr) {
+                builder.addTombstone(name);
+            }
+            continue;
+        }
+        for (const auto& tail : tails) builder.addEncoded(name, tail);
+        if (ancestor) builder.addFlags(name, ANCESTOR);
+    }
+    return builder.build(options);
+}
+
+void ZoneSnapshot::save(checkpoint::Writer& out) const {
+    out.u8(base_ ? 1 : 0);
+    if (base_) base_->save(out);
+    out.string(origin_);
+    out.string(soa_.mname);
+    out.string(soa_.rname);
+    for (uint32_t field : {soa_.serial, soa_.refresh, soa_.retry, soa_.expire, soa_.minimum}) out.u32(field);
+    out.u32(nameBase_);
+    out.u32(rrsetBase_);
+    out.u32(rrBase_);
+    out.u64(ownerTotal_);
+    out.u64(recordTotal_);
+    out.array(names_);
+    out.array(owners_);
+    out.array(rrsets_);
+    out.array(rrOffsets_);
+    out.array(wire_);
+    out.array(index_);
+    perfect_.save(out);
+    filter_.save(out);
+    out.u8(reverseIndexed_ ? 1 : 0);
+    reverse_.save(out);
+    out.array(subsets_);
+    out.array(alias_);
+    out.array(glue_);
+    out.array(chains_);
+    out.array(chainRRs_);
+}
+
+std::shared_ptr<const ZoneSnapshot> ZoneSnapshot::load(checkpoint::Reader& in) {
+    auto snap = std::make_shared<ZoneSnapshot>();
+    uint8_t hasBase = 0;
+    if (!in.u8(hasBase) || hasBase > 1) return nullptr;
+    if (hasBase && (!(snap->base_ = load(in)) || snap->base_->base_)) return nullptr;
+
+    uint64_t owners = 0;
+    uint64_t records = 0;
+    uint8_t reverseIndexed = 0;
+    if (!in.string(snap->origin_) || !in.string(snap->soa_.mname) || !in.string(snap->soa_.rname) ||
+        !in.u32(snap->soa_.serial) || !in.u32(snap->soa_.refresh) || !in.u32(snap->soa_.retry) ||
+        !in.u32(snap->soa_.expire) || !in.u32(snap->soa_.minimum) || !in.u32(snap->nameBase_) ||
+        !in.u32(snap->rrsetBase_) || !in.u32(snap->rrBase_) || !in.u64(owners) || !in.u64(records) ||
+        !in.array(snap->names_) || !in.array(snap->owners_) || !in.array(snap->rrsets_) ||
+        !in.array(snap->rrOffsets_) || !in.array(snap->wire_) || !in.array(snap->index_) ||
+        !snap->perfect_.load(in) || !snap->filter_.load(in) || !in.u8(reverseIndexed) ||
+        !snap->reverse_.load(in) || !in.array(snap->subsets_) || !in.array(snap->alias_) ||
+        !in.array(snap->glue_) || !in.array(snap->chains_) || !in.array(snap->chainRRs_)) {
+        return nullptr;
+    }
+    snap->ownerTotal_ = owners;
+    snap->recordTotal_ = records;
+    snap->reverseIndexed_ = reverseIndexed != 0;
+
+    // Enough to keep lookups inside the arrays; the contents are trusted
+    // as written
+    bool indexed = snap->perfect_.empty() ? std::has_single_bit(snap->index_.size())
+                                          : snap->perfect_.size() == snap->owners_.size();
+    const auto& offsets = std::as_const(snap->rrOffsets_);
+    if (!indexed || offsets.empty() || offsets.back() != snap->wire_.size() || snap->origin_.empty()) {
+        return nullptr;
+    }
+    snap->buildNegativeSoa();
+    return snap;
+}
+
+std::shared_ptr<const ZoneChange> ZoneChange::between(const ZoneSnapshot& before, const ZoneSnapshot& after,
+                                                      std::span<const uint8_t> apex, const ZoneDelta& delta) {
+    auto change = std::make_shared<ZoneChange>();
+    auto fromSoa = before.firstRR(apex, TYPE_SOA);
+    auto toSoa = after.firstRR(apex, TYPE_SOA);
+    change->fromSerial = before.soa().serial;
+    change->toSerial = after.soa().serial;
+    change->fromSoa.assign(fromSoa.begin(), fromSoa.end());
+    change->toSoa.assign(toSoa.begin(), toSoa.end());
+    change->bytes = fromSoa.size() + toSoa.size();
+
+    auto lessBytes = [](std::span<const uint8_t> a, std::span<const uint8_t> b) {
+        return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+    };
+    std::vector<std::span<const uint8_t>> old, next, gone, fresh;
+    for (const auto& [name, tails] : delta.owners) {
+        bool atApex = sameName(name, apex);
+        old.clear();
+        next.clear();
+        if (const ZoneSnapshot::Owner* owner = before.find(name, dns_packet::hashName(name))) {
+            for (const auto& rrset : before.rrsets(*owner)) {
+                if (atApex && rrset.type == TYPE_SOA) continue;
+                for (uint32_t i = 0; i < rrset.rrCount; ++i) old.push_back(before.rr(rrset.firstRR + i));
+            }
+        }
+        for (const auto& tail : tails) {
+            if (!(atApex && dns_packet::readUint16(tail, 0) == TYPE_SOA)) next.push_back(tail);
+        }
+
+        // Both sides sorted, the differences fall out of one merge each way
+        std::sort(old.begin(), old.end(), lessBytes);
+        std::sort(next.begin(), next.end(), lessBytes);
+        gone.clear();
+        fresh.clear();
+        std::set_difference(old.begin(), old.end(), next.begin(), next.end(), std::back_inserter(gone), lessBytes);
+        std::set_difference(next.begin(), next.end(), old.begin(), old.end(), std::back_inserter(fresh), lessBytes);
+        if (gone.empty() && fresh.empty()) continue;
+
+        auto index = static_cast<uint32_t>(change->names.size());
+        change->names.emplace_back(name);
+        change->bytes += name.size();
+        for (auto tail : gone) {
+            change->removed.push_back({index, {tail.begin(), tail.end()}});
+            change->bytes += tail.size();
+        }
+        for (auto tail : fresh) {
+            change->added.push_back({index, {tail.begin(), tail.end()}});
+            change->bytes += tail.size();
+        }
+    }
+    return change;
+}
+
+void ZoneHistory::record(std::shared_ptr<const ZoneChange> change) {
+    std::lock_guard lock(mutex);
+    bool continues = changes.empty() || changes.back()->toSerial == change->fromSerial;
+    if (!continues || change->fromSerial == change->toSerial) {
+        // A gap, or a step IXFR cannot name: nothing before it is usable
+        changes.clear();
+        bytes = 0;
+        if (change->fromSerial == change->toSerial) return;
+    }
+    bytes += change->bytes;
+    changes.push_back(std::move(change));
+    while (!changes.empty() && (changes.size() > capacity || bytes > maxBytes)) {
+        bytes -= changes.front()->bytes;
+        changes.pop_front();
+    }
+}
+
+bool ZoneHistory::since(uint32_t serial, std::vector<std::shared_ptr<const ZoneChange>>& out) const {
+    std::lock_guard lock(mutex);
+    auto start = std::find_if(changes.begin(), changes.end(), [&](const auto& change) {
+        return change->fromSerial == serial;
+    });
+    if (start == changes.end()) return false;
+    out.assign(start, changes.end());
+    return true;
+}
+
+void ZoneHistory::clear() {
+    std::lock_guard lock(mutex);
+    changes.clear();
+    bytes = 0;
+}
+
+size_t ZoneHistory::size() const {
+    std::lock_guard lock(mutex);
+    return changes.size();
+}
+
+Zone::Zone(const dns_packet::WireName& origin, std::shared_ptr<const ZoneSnapshot> snapshot)
+    : origin_(origin.toString()),
+      originWire_(origin.bytes().begin(), origin.bytes().end()),
+      labelCount_(origin.labelCount()),
+      current(std::move(snapshot)) {}
+
+ZoneRegistry::ZoneRegistry(std::vector<std::shared_ptr<Zone>> zoneList)
+    : zones(std::move(zoneList)) {
+    std::vector<ReverseIndex::Entry> reverse;
+    slots.assign(tableCapacity(zones.size()), Slot{0, 0});
+    size_t mask = slots.size() - 1;
+    for (uint32_t i = 0; i < zones.size(); ++i) {
+        const Zone& zone = *zones[i];
+        uint64_t hash = dns_packet::hashName(zone.originWire());
+        size_t slot = hash & mask;
+        while (slots[slot].zone != 0) slot = (slot + 1) & mask;
+        slots[slot] = {hash, i + 1};
+
+        size_t depth = zone.labelCount();
+        depths[depth / 64] |= uint64_t{1} << (depth % 64);
+        maxDepth = std::max(maxDepth, depth);
+
+        reverse_name::Prefix prefix;
+        if (reverse_name::parse(zone.originWire(), prefix)) reverse.push_back({prefix, i});
+    }
+    reverseZones.build(std::move(reverse));
+}
+
+uint32_t ZoneRegistry::probe(std::span<const uint8_t> suffix, uint64_t hash) const noexcept {
+    size_t mask = slots.size() - 1;
+    for (size_t slot = hash & mask; slots[slot].zone != 0; slot = (slot + 1) & mask) {
+        if (slots[slot].hash != hash) continue;
+        if (sameName(zones[slots[slot].zone - 1]->originWire(), suffix)) return slots[slot].zone;
+    }
+    return 0;
+}
+
+const Zone* ZoneRegistry::select(const dns_packet::WireName& name, const uint64_t* hashes) const noexcept {
+    if (zones.empty()) return nullptr;
+    size_t labels = name.labelCount();
+    for (size_t depth = std::min(labels, maxDepth) + 1; depth-- > 0;) {
+        if (!(depths[depth / 64] & (uint64_t{1} << (depth % 64)))) continue;
+        if (uint32_t zone = probe(name.suffix(depth), hashes[labels - depth])) return zones[zone - 1].get();
+    }
+    return nullptr;
+}
+
+const Zone* ZoneRegistry::select(const dns_packet::WireName& name) const noexcept {
+    uint64_t hashes[dns_packet::WireName::MAX_LABELS + 1];
+    name.suffixHashes(hashes);
+    return select(name, hashes);
+}
+
+std::shared_ptr<Zone> ZoneRegistry::find(std::string_view origin) const noexcept {
+    dns_packet::WireName name;
+    if (!name.assign(origin)) return nullptr;
+    uint32_t zone = probe(name.bytes(), name.hash());
+    return zone != 0 ? zones[zone - 1] : nullptr;
+}
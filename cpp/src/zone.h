@@ -0,0 +1,497 @@
+#pragma once
+
+#include "answer_subset.h"
+#include "dns_packet.h"
+#include "dns_server.h"
+#include "mapped_array.h"
+#include "negative_filter.h"
+#include "perfect_hash.h"
+#include "reverse_index.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Replacement contents for the names a batch of updates touched. Each entry
+// holds every RR the name has afterwards as a pre-encoded TYPE..RDATA tail
+// (see dns_packet::appendRecordTail); an empty list deletes the name.
+// fromSerial, when set, is the serial of the version the delta was made
+// against; the delta is refused by a zone that has moved on since.
+// generation, when set, is the DNSServer::generation() it was made in, so
+// a reload in between refuses it too; it only means something to the
+// running process and is not journaled.
+struct ZoneDelta {
+    dns_packet::SOAData soa;
+    std::optional<uint32_t> fromSerial;
+    std::optional<uint64_t> generation;
+    std::map<std::vector<uint8_t>, std::vector<std::vector<uint8_t>>> owners;
+};
+
+// Immutable, compiled form of one zone as served by the packet path. Owner
+// names, RRsets and pre-encoded RRs live in a few flat arrays; nothing in a
+// snapshot changes after build(), so readers need no locking.
+//
+// A snapshot is either flat or an overlay: the names changed since a flat
+// base, with everything else read through to the base. Owner, RRset and RR
+// indexes of an overlay continue where the base's end, so an Owner from
+// either layer works with the accessors of the overlay.
+class ZoneSnapshot {
+public:
+    static constexpr uint8_t TOMBSTONE = 1;   // Overlay entry for a deleted name
+    static constexpr uint8_t EMPTY_NONTERMINAL = 2;   // No RRs, but names below it (RFC8020)
+    static constexpr uint8_t ANCESTOR = 4;    // Some other name of the zone lies below it
+    static constexpr size_t COMPACT_MIN_OVERLAY = 1024;   // Overlay size that may trigger compaction
+
+    struct Owner {
+        uint32_t nameOffset;   // Lowercased wire-format name in names()
+        uint8_t nameLength;
+        uint8_t flags;
+        uint16_t rrsetCount;
+        uint32_t firstRRset;
+        uint32_t fingerprint;  // High half of the name hash
+    };
+
+    struct RRset {
+        uint16_t type;
+        uint16_t rrCount;
+        uint32_t firstRR;      // Index of the first RR, see rr()
+    };
+
+    // An address RRset that goes in the additional section after an NS, MX
+    // or SRV RR naming its owner. rrset is NONE for an overlay entry that
+    // drops the base's links of rr, whose target the overlay changed.
+    struct Glue {
+        static constexpr uint32_t NONE = UINT32_MAX;
+
+        uint32_t rr;           // The answer RR, as in rr()
+        uint32_t rrset;        // A or AAAA RRset of the target, as in Owner::firstRRset
+        uint32_t nameOffset;   // Of the target name within the RR's TYPE..RDATA
+    };
+
+    // A name's CNAME followed through the zone, as the packet path answers
+    // it for any other type: each CNAME RR in turn, then the RRsets of the
+    // name the last one points to
+    struct CnameChain {
+        static constexpr size_t MAX_LENGTH = 8;   // CNAMEs followed before giving up
+
+        std::span<const uint32_t> rrs;   // CNAME RRs from the question name on, as in rr()
+        uint32_t target = 0;             // RRsets of the final name, as in Owner::firstRRset
+        uint16_t targetCount = 0;        // 0 when the chain leaves the zone, loops or is too long
+        bool missing = false;            // The final name is in the zone but does not exist
+    };
+
+    // Accumulates records of one zone and compiles them into a snapshot
+    class Builder {
+    public:
+        Builder(std::string_view origin, dns_packet::SOAData soa);
+
+        // Queue a record. Values are only viewed, so they must outlive build();
+        // unknown types are rejected here, values that fail to encode are
+        // dropped by build().
+        bool add(const dns_packet::WireName& owner, std::string_view type, std::string_view value);
+
+        // Queue an RR that is already encoded (TYPE..RDATA); viewed like values
+        void addEncoded(std::span<const uint8_t> owner, std::span<const uint8_t> tail);
+
+        // Build an overlay over a flat base instead of a flat snapshot
+        void setBase(std::shared_ptr<const ZoneSnapshot> base);
+
+        // Mark a name of the base as deleted in the overlay
+        void addTombstone(std::span<const uint8_t> owner);
+
+        // Set EMPTY_NONTERMINAL or ANCESTOR on a name, adding it if new
+        void addFlags(std::span<const uint8_t> owner, uint8_t flags);
+
+        // Encodes every queued record into wire form, spread over
+        // options.buildThreads workers, and indexes the result
+        [[nodiscard]]
+        std::shared_ptr<const ZoneSnapshot> build(const SnapshotOptions& options = {});
+
+    private:
+        struct Pending {
+            uint32_t owner;
+            uint16_t type;
+            bool encoded;            // value holds TYPE..RDATA rather than text
+            std::string_view value;
+        };
+
+        static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+        // Owner index for a name, appending it to the snapshot if new
+        uint32_t intern(std::span<const uint8_t> name);
+
+        // Owner index for a name added already, or NOT_FOUND
+        [[nodiscard]]
+        uint32_t lookup(std::span<const uint8_t> name, uint64_t hash) const;
+
+        // Add every missing name between the owners and the apex as an empty
+        // non-terminal, and flag the names that have others below them. An
+        // overlay takes in the base names that become ancestors only now.
+        void addEmptyNonTerminals();
+
+        std::shared_ptr<ZoneSnapshot> snapshot;
+        std::vector<Pending> pending;
+        std::vector<uint64_t> ownerHashes;
+        std::vector<uint32_t> ownerSlots;   // Owner index + 1, 0 marks an empty slot
+    };
+
+    [[nodiscard]]
+    const std::string& origin() const noexcept { return origin_; }
+
+    [[nodiscard]]
+    const dns_packet::SOAData& soa() const noexcept { return soa_; }
+
+    // TYPE..RDATA of the zone's SOA as NXDOMAIN and NODATA answers carry it
+    // in the authority section (RFC2308 section 3): the TTL is the lesser
+    // of its own and MINIMUM, which is how long resolvers keep the miss
+    [[nodiscard]]
+    std::span<const uint8_t> negativeSoa() const noexcept { return negativeSoa_; }
+
+    // False when the name is definitely not in the zone. Costs one cache line,
+    // so the packet path asks this before probing the index.
+    [[nodiscard]]
+    bool mayContain(uint64_t hash) const noexcept {
+        return filter_.mayContain(hash) || (base_ && base_->mayContain(hash));
+    }
+
+    [[nodiscard]]
+    const NegativeFilter& filter() const noexcept { return filter_; }
+
+    // Find the owner node for a name; hash must be name.hash(). Empty
+    // non-terminals are found too, with no RRsets, so they answer NODATA.
+    [[nodiscard]]
+    const Owner* find(const dns_packet::WireName& name, uint64_t hash) const noexcept {
+        return find(name.bytes(), hash);
+    }
+
+    // Same for a lowercased wire-format name
+    [[nodiscard]]
+    const Owner* find(std::span<const uint8_t> name, uint64_t hash) const noexcept;
+
+    // Reverse zones also index their owners by the address the name spells
+    [[nodiscard]]
+    bool reverseIndexed() const noexcept { return reverseIndexed_; }
+
+    // Find the owner whose name parses to prefix (see reverse_name::parse);
+    // only for reverseIndexed() snapshots
+    [[nodiscard]]
+    const Owner* findReverse(const reverse_name::Prefix& prefix) const noexcept;
+
+    [[nodiscard]]
+    std::span<const RRset> rrsets(const Owner& owner) const noexcept {
+        if (owner.firstRRset < rrsetBase_) return base_->rrsets(owner);
+        return {rrsets_.data() + (owner.firstRRset - rrsetBase_), owner.rrsetCount};
+    }
+
+    // Pre-encoded TYPE..RDATA of one RR
+    [[nodiscard]]
+    std::span<const uint8_t> rr(uint32_t index) const noexcept {
+        if (index < rrBase_) return base_->rr(index);
+        index -= rrBase_;
+        return {wire_.data() + rrOffsets_[index], rrOffsets_[index + 1] - rrOffsets_[index]};
+    }
+
+    [[nodiscard]]
+    std::span<const uint8_t> ownerName(const Owner& owner) const noexcept {
+        if (owner.nameOffset < nameBase_) return base_->ownerName(owner);
+        return {names_.data() + (owner.nameOffset - nameBase_), owner.nameLength};
+    }
+
+    // Alias table and records per answer of an RRset that is answered with
+    // a weighted subset; rrset counts like Owner::firstRRset. False when
+    // the RRset has no subset rule or no more records than the rule takes.
+    [[nodiscard]]
+    bool subset(uint32_t rrset, std::span<const answer_subset::AliasSlot>& table, uint32_t& count) const noexcept;
+
+    // Glue of an RR, in the order it goes out; empty for most RRs
+    [[nodiscard]]
+    std::span<const Glue> glue(uint32_t rr) const noexcept;
+
+    // The chain starting at a CNAME RRset, as in Owner::firstRRset; false
+    // for other RRsets
+    [[nodiscard]]
+    bool chain(uint32_t rrset, CnameChain& out) const noexcept;
+
+    // RRset by index, as in Owner::firstRRset
+    [[nodiscard]]
+    const RRset& rrset(uint32_t index) const noexcept {
+        return index < rrsetBase_ ? base_->rrset(index) : rrsets_[index - rrsetBase_];
+    }
+
+    // First RR of a type at a lowercased wire-format name, empty if none
+    [[nodiscard]]
+    std::span<const uint8_t> firstRR(std::span<const uint8_t> name, uint16_t type) const noexcept;
+
+    // Call f(owner) for every live name, overlay and base alike
+    template <typename F>
+    void forEachOwner(F&& f) const {
+        for (const Owner& owner : owners_) {
+            if (!(owner.flags & TOMBSTONE)) f(owner);
+        }
+        if (!base_) return;
+        for (const Owner& owner : base_->owners_) {
+            auto name = base_->ownerName(owner);
+            if (findLocal(name, dns_packet::hashName(name)) == nullptr) f(owner);
+        }
+    }
+
+    // A new version with delta applied. Only the names in the delta are
+    // encoded; the result is an overlay over the current flat base, which
+    // is compacted into a new flat snapshot once the overlay grows large.
+    [[nodiscard]]
+    static std::shared_ptr<const ZoneSnapshot> apply(const std::shared_ptr<const ZoneSnapshot>& current,
+                                                     const ZoneDelta& delta, const SnapshotOptions& options = {});
+
+    [[nodiscard]]
+    size_t ownerCount() const noexcept { return ownerTotal_; }
+
+    [[nodiscard]]
+    size_t recordCount() const noexcept { return recordTotal_; }
+
+    // Names held by the overlay layer, 0 for a flat snapshot
+    [[nodiscard]]
+    size_t overlayCount() const noexcept { return base_ ? owners_.size() : 0; }
+
+    // Write the snapshot in checkpoint form (see checkpoint.h), an overlay
+    // after its base
+    void save(checkpoint::Writer& out) const;
+
+    // Read one back, or nullptr when the image is short or inconsistent
+    [[nodiscard]]
+    static std::shared_ptr<const ZoneSnapshot> load(checkpoint::Reader& in);
+
+    [[nodiscard]]
+    bool hasPerfectHash() const noexcept { return !perfect_.empty() || (base_ && base_->hasPerfectHash()); }
+
+    // Bytes spent on the name index (hash table or perfect hash)
+    [[nodiscard]]
+    size_t indexMemory() const noexcept {
+        return index_.capacity() * sizeof(IndexSlot) + perfect_.memoryUsage() + reverse_.memoryUsage() +
+               (base_ ? base_->indexMemory() : 0);
+    }
+
+private:
+    void buildIndex(const SnapshotOptions& options);
+
+    // Encode negativeSoa() from soa_; done on build and on load, so the
+    // checkpoint does not hold it
+    void buildNegativeSoa();
+
+    // Alias tables for the RRsets of this layer that options.subsets names
+    void buildSubsets(const SnapshotOptions& options);
+
+    // Links from the NS, MX and SRV RRs of this layer to in-zone addresses,
+    // plus, in an overlay, replacements for base links whose target changed;
+    // runs after buildIndex() since it looks the targets up
+    void buildGlue();
+
+    // CNAME chains of this layer's names, and in an overlay the base chains
+    // that pass through a name it replaces; runs after buildIndex()
+    void buildChains();
+
+    // Lookup in this layer only; may return a tombstone
+    const Owner* findLocal(std::span<const uint8_t> name, uint64_t hash) const noexcept;
+
+    struct IndexSlot {
+        uint32_t tag;          // High half of the name hash
+        uint32_t owner;        // Owner index + 1, 0 marks an empty slot
+    };
+
+    struct Chain {
+        uint32_t rrset;        // The CNAME RRset it starts at
+        uint32_t first;        // Position of its RRs in chainRRs_
+        uint32_t length;
+        uint32_t target;       // See CnameChain
+        uint16_t targetCount;
+        uint16_t missing;
+    };
+
+    // Follow the chain from the CNAME RR hop of rrset as far as it stays
+    // inside apex, appending its RRs to chainRRs_
+    Chain follow(uint32_t rrset, uint32_t hop, const dns_packet::WireName& apex);
+
+    struct Subset {
+        uint32_t rrset;        // As in Owner::firstRRset
+        uint32_t count;        // Records per answer
+        uint32_t table;        // First slot in alias_, one per RR of the RRset
+    };
+
+    std::string origin_;
+    dns_packet::SOAData soa_;
+    std::vector<uint8_t> negativeSoa_;
+    std::shared_ptr<const ZoneSnapshot> base_;   // Set for an overlay
+    uint32_t nameBase_ = 0;                      // Index spaces taken by the base
+    uint32_t rrsetBase_ = 0;
+    uint32_t rrBase_ = 0;
+    size_t ownerTotal_ = 0;
+    size_t recordTotal_ = 0;
+    MappedArray<uint8_t> names_;
+    MappedArray<Owner> owners_;
+    MappedArray<RRset> rrsets_;
+    MappedArray<uint32_t> rrOffsets_;
+    MappedArray<uint8_t> wire_;
+    MappedArray<IndexSlot> index_;   // Open addressing, linear probing
+    PerfectHash perfect_;            // Replaces index_ when built; owners_ are in hash order
+    NegativeFilter filter_;          // Rebuilt with the index for every snapshot
+    bool reverseIndexed_ = false;    // Apex is under in-addr.arpa or ip6.arpa
+    ReverseIndex reverse_;           // Owner index by address, tombstones included
+    MappedArray<Subset> subsets_;    // Ordered by rrset
+    MappedArray<answer_subset::AliasSlot> alias_;
+    MappedArray<Glue> glue_;         // Ordered by rr
+    MappedArray<Chain> chains_;      // Ordered by rrset
+    MappedArray<uint32_t> chainRRs_;
+};
+
+// One published version step as IXFR sends it (RFC1995): the RRs removed
+// and added between two serials. The SOA itself is only in fromSoa/toSoa.
+struct ZoneChange {
+    struct RR {
+        uint32_t name;                 // Index into names
+        std::vector<uint8_t> tail;     // TYPE..RDATA
+    };
+
+    uint32_t fromSerial = 0;
+    uint32_t toSerial = 0;
+    std::vector<uint8_t> fromSoa;      // TYPE..RDATA of the SOA on each side
+    std::vector<uint8_t> toSoa;
+    std::vector<std::vector<uint8_t>> names;
+    std::vector<RR> removed;
+    std::vector<RR> added;
+    size_t bytes = 0;                  // Payload held, for the history bound
+
+    // The step from before to after, where after is before with delta
+    // applied; only the names in the delta are compared
+    [[nodiscard]]
+    static std::shared_ptr<const ZoneChange> between(const ZoneSnapshot& before, const ZoneSnapshot& after,
+                                                     std::span<const uint8_t> apex, const ZoneDelta& delta);
+};
+
+// Bounded ring of the latest version steps of one zone, oldest first. The
+// update path records a step for every version it publishes; transfers
+// read it from their own thread, hence the lock. Steps are shared, so a
+// reader holds on to its sequence without copying it.
+class ZoneHistory {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 64;          // Steps kept
+    static constexpr size_t DEFAULT_MAX_BYTES = 16u << 20;  // Payload kept
+
+    explicit ZoneHistory(size_t capacity = DEFAULT_CAPACITY, size_t maxBytes = DEFAULT_MAX_BYTES)
+        : capacity(capacity), maxBytes(maxBytes) {}
+
+    // Append the newest step, evicting the oldest beyond either bound. A step
+    // that does not continue from the last one starts the history over.
+    void record(std::shared_ptr<const ZoneChange> change);
+
+    // Steps from serial up to the newest version; false when serial is not
+    // the start of any step kept
+    [[nodiscard]]
+    bool since(uint32_t serial, std::vector<std::shared_ptr<const ZoneChange>>& out) const;
+
+    // Forget every step, e.g. after the zone was replaced wholesale
+    void clear();
+
+    [[nodiscard]]
+    size_t size() const;
+
+private:
+    const size_t capacity;
+    const size_t maxBytes;
+    mutable std::mutex mutex;
+    std::deque<std::shared_ptr<const ZoneChange>> changes;
+    size_t bytes = 0;
+};
+
+// A zone apex and its currently published snapshot
+class Zone {
+public:
+    Zone(const dns_packet::WireName& origin, std::shared_ptr<const ZoneSnapshot> snapshot);
+
+    [[nodiscard]]
+    const std::string& origin() const noexcept { return origin_; }
+
+    [[nodiscard]]
+    std::span<const uint8_t> originWire() const noexcept { return originWire_; }
+
+    [[nodiscard]]
+    size_t labelCount() const noexcept { return labelCount_; }
+
+    [[nodiscard]]
+    std::shared_ptr<const ZoneSnapshot> snapshot() const noexcept {
+        return std::atomic_load_explicit(&current, std::memory_order_acquire);
+    }
+
+    // Replace the served snapshot; readers holding the old one keep it alive
+    void publish(std::shared_ptr<const ZoneSnapshot> next) noexcept {
+        std::atomic_store_explicit(&current, std::move(next), std::memory_order_release);
+    }
+
+    // Version steps published since the zone was built, for IXFR
+    [[nodiscard]]
+    ZoneHistory& history() noexcept { return history_; }
+
+    [[nodiscard]]
+    const ZoneHistory& history() const noexcept { return history_; }
+
+private:
+    std::string origin_;
+    std::vector<uint8_t> originWire_;
+    size_t labelCount_;
+    std::shared_ptr<const ZoneSnapshot> current;
+    ZoneHistory history_;
+};
+
+// The set of zones we are authoritative for. select() finds the closest
+// enclosing zone of a question name by probing a hash table with the hashes
+// of the name's suffixes, longest first, skipping suffix lengths no zone has.
+class ZoneRegistry {
+public:
+    explicit ZoneRegistry(std::vector<std::shared_ptr<Zone>> zones);
+
+    // hashes must come from name.suffixHashes()
+    [[nodiscard]]
+    const Zone* select(const dns_packet::WireName& name, const uint64_t* hashes) const noexcept;
+
+    [[nodiscard]]
+    const Zone* select(const dns_packet::WireName& name) const noexcept;
+
+    // Closest enclosing reverse zone of a parsed reverse name, found by
+    // longest prefix instead of by hashing suffixes, or nullptr when no
+    // zone under in-addr.arpa or ip6.arpa encloses it
+    [[nodiscard]]
+    const Zone* selectReverse(const reverse_name::Prefix& prefix) const noexcept {
+        uint32_t zone = reverseZones.longest(prefix);
+        return zone != ReverseIndex::NONE ? zones[zone].get() : nullptr;
+    }
+
+    // Exact lookup by apex name
+    [[nodiscard]]
+    std::shared_ptr<Zone> find(std::string_view origin) const noexcept;
+
+    [[nodiscard]]
+    const std::vector<std::shared_ptr<Zone>>& all() const noexcept { return zones; }
+
+    [[nodiscard]]
+    size_t size() const noexcept { return zones.size(); }
+
+private:
+    struct Slot {
+        uint64_t hash;
+        uint32_t zone;         // Zone index + 1, 0 marks an empty slot
+    };
+
+    // Zone index + 1 of the apex equal to suffix, or 0
+    uint32_t probe(std::span<const uint8_t> suffix, uint64_t hash) const noexcept;
+
+    std::vector<std::shared_ptr<Zone>> zones;
+    std::vector<Slot> slots;
+    ReverseIndex reverseZones;     // Zone index by apex address, for reverse apexes
+    uint64_t depths[2] = {0, 0};   // Bit d set when some apex has d labels
+    size_t maxDepth = 0;
+};
@@ -0,0 +1,111 @@
+#include "zone_reload.h"
+#include "zone.h"
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+
+namespace {
+    // Start measuring the peak resident set afresh. Needs Linux 4.0; when
+    // it fails the peak covers the whole life of the process instead.
+    void resetPeakMemory() {
+        std::ofstream("/proc/self/clear_refs") << "5";
+    }
+
+    // VmHWM, in bytes
+    size_t peakMemory() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.starts_with("VmHWM:")) return std::stoull(line.substr(6)) * 1024;
+        }
+        return 0;
+    }
+
+    // Next whitespace-separated field of line at offset, or empty
+    std::string_view field(std::string_view line, size_t& offset) {
+        while (offset < line.size() && std::isspace(static_cast<unsigned char>(line[offset]))) offset++;
+        size_t begin = offset;
+        while (offset < line.size() && !std::isspace(static_cast<unsigned char>(line[offset]))) offset++;
+        return line.substr(begin, offset - begin);
+    }
+}
+
+bool readZoneFile(const std::string& path, std::vector<DNSRecord>& records, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = path + ": " + std::strerror(errno);
+        return false;
+    }
+    std::string line;
+    for (size_t number = 1; std::getline(in, line); ++number) {
+        size_t offset = 0;
+        std::string_view name = field(line, offset);
+        if (name.empty() || name.starts_with(';') || name.starts_with('#')) continue;
+        std::string_view type = field(line, offset);
+        std::string_view rest = std::string_view(line).substr(offset);
+        size_t begin = rest.find_first_not_of(" \t");
+        size_t end = rest.find_last_not_of(" \t\r");
+        if (type.empty() || begin == std::string_view::npos) {
+            error = path + ":" + std::to_string(number) + ": expected name, type and value";
+            return false;
+        }
+        records.emplace_back(name, type, rest.substr(begin, end - begin + 1));
+    }
+    if (in.bad()) {
+        error = path + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+ZoneReloader::ZoneReloader(DNSServer& server, std::vector<std::string> paths)
+    : server(server), paths(std::move(paths)) {}
+
+ZoneReloader::~ZoneReloader() {
+    wait();
+}
+
+bool ZoneReloader::load() {
+    auto started = std::chrono::steady_clock::now();
+    resetPeakMemory();
+
+    std::vector<DNSRecord> records;
+    std::string error;
+    bool ok = true;
+    for (const auto& path : paths) {
+        ok = ok && readZoneFile(path, records, error);
+    }
+    ok = ok && server.reload(records, error);
+
+    auto zones = server.zones();
+    std::lock_guard lock(mutex);
+    (ok ? counters.reloads : counters.failures)++;
+    counters.lastDuration = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started);
+    counters.lastPeakBytes = peakMemory();
+    counters.lastRecords = records.size();
+    counters.lastZones = zones ? zones->size() : 0;
+    if (!ok) counters.lastError = std::move(error);
+    return ok;
+}
+
+bool ZoneReloader::start() {
+    if (running.exchange(true, std::memory_order_acq_rel)) return false;
+    if (worker.joinable()) worker.join();
+    worker = std::thread([this] {
+        bool ok = load();
+        if (done) done(ok, stats());
+        running.store(false, std::memory_order_release);
+    });
+    return true;
+}
+
+void ZoneReloader::wait() {
+    if (worker.joinable()) worker.join();
+}
+
+ZoneReloader::Stats ZoneReloader::stats() const {
+    std::lock_guard lock(mutex);
+    return counters;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "dns_server.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Read a zone file into records. The format is the server's own record
+// triple, one per line: owner name, type and value, the value running to
+// the end of the line in the form addRecord() takes. Blank lines and lines
+// starting with ';' or '#' are skipped. False with error set when the file
+// cannot be read or a line has fewer than three fields.
+[[nodiscard]]
+bool readZoneFile(const std::string& path, std::vector<DNSRecord>& records, std::string& error);
+
+// Reloads the zones from their files on a thread of its own, e.g. on
+// SIGHUP. The files are read, every record is checked and the complete new
+// set of indexed snapshots is built there; only then does DNSServer::reload()
+// swap it in, so queries are answered from the old zones at full rate until
+// the new ones are ready, and a bad file leaves the old zones in place.
+// load(), start() and wait() belong to one controlling thread.
+class ZoneReloader {
+public:
+    struct Stats {
+        uint64_t reloads = 0;                       // Published
+        uint64_t failures = 0;                      // Rejected, old zones kept
+        std::chrono::milliseconds lastDuration{0};  // Read, check, build and publish
+        size_t lastPeakBytes = 0;   // Peak resident set of the process during the last attempt
+        size_t lastRecords = 0;
+        size_t lastZones = 0;       // Served after the last attempt
+        std::string lastError;      // Of the last failure
+    };
+
+    ZoneReloader(DNSServer& server, std::vector<std::string> paths);
+    ~ZoneReloader();
+    ZoneReloader(const ZoneReloader&) = delete;
+    ZoneReloader& operator=(const ZoneReloader&) = delete;
+
+    // Called on the reload thread after every background attempt
+    void setListener(std::function<void(bool ok, const Stats& stats)> listener) { done = std::move(listener); }
+
+    // Reload on the calling thread, e.g. for the first load at startup
+    bool load();
+
+    // Reload in the background; false when a reload is already running
+    bool start();
+
+    [[nodiscard]]
+    bool busy() const noexcept { return running.load(std::memory_order_acquire); }
+
+    // Wait for a background reload to finish
+    void wait();
+
+    [[nodiscard]]
+    Stats stats() const;
+
+private:
+    DNSServer& server;
+    const std::vector<std::string> paths;
+    std::function<void(bool ok, const Stats& stats)> done;
+    mutable std::mutex mutex;      // Guards counters
+    Stats counters;
+    std::atomic<bool> running{false};
+    std::thread worker;
+};
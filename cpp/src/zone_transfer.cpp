@@ -0,0 +1,382 @@
+#include "zone_transfer.h"
+#include "dns_response.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace dns_packet;
+
+namespace {
+    constexpr uint16_t TYPE_SOA = 6;
+    constexpr size_t PREFIX_SIZE = 2;   // TCP message length
+    constexpr int ACCEPT_POLL_MS = 200;
+
+    // Header and names of one message: at most the message target plus one
+    // RR's owner, so reserving this once means iovecs into it stay valid
+    constexpr size_t SCRATCH_SIZE = zone_transfer::MESSAGE_TARGET + 1024;
+
+    bool endsWith(std::span<const uint8_t> name, std::span<const uint8_t> suffix) {
+        return name.size() >= suffix.size() &&
+               std::equal(suffix.begin(), suffix.end(), name.end() - static_cast<ptrdiff_t>(suffix.size()));
+    }
+
+    // Wait for events on fd; false on error or once the deadline has passed
+    bool waitFor(int fd, short events, zone_transfer::Deadline deadline) {
+        for (;;) {
+            using std::chrono::milliseconds;
+            auto left = std::chrono::duration_cast<milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0) return false;
+            pollfd ready{fd, events, 0};
+            int n = poll(&ready, 1, static_cast<int>(std::min<milliseconds::rep>(left, INT_MAX)));
+            if (n < 0 && errno == EINTR) continue;
+            return n > 0;
+        }
+    }
+
+    bool isLoopback(const sockaddr_in& address) {
+        return (ntohl(address.sin_addr.s_addr) >> 24) == 127;
+    }
+
+    // Serial of the SOA an IXFR request carries in its authority section,
+    // which starts at offset; false when there is none
+    bool clientSerial(std::span<const uint8_t> request, size_t offset, uint32_t& serial) {
+        if (readUint16(request, 6) != 0 || readUint16(request, 8) != 1) return false;
+        WireName name;
+        if (!name.parse(request, offset) || offset + 10 > request.size() || readUint16(request, offset) != TYPE_SOA) {
+            return false;
+        }
+        size_t end = offset + 10 + readUint16(request, offset + 8);
+        offset += 10;
+        if (end > request.size() || !name.parse(request, offset) || !name.parse(request, offset) || offset + 4 > end) {
+            return false;
+        }
+        serial = static_cast<uint32_t>(readUint16(request, offset)) << 16 | readUint16(request, offset + 2);
+        return true;
+    }
+}
+
+namespace {
+    // Builds the messages of one transfer and hands each to the sink when
+    // full. Owner names and tails are only viewed, so they must outlive it.
+    class MessageStream {
+    public:
+        MessageStream(std::span<const uint8_t> apex, uint16_t id, uint16_t qtype, const zone_transfer::Sink& sink)
+            : apex(apex), id(id), qtype(qtype), sink(sink) {
+            scratch.reserve(SCRATCH_SIZE);
+            begin();
+        }
+
+        void add(std::span<const uint8_t> owner, std::span<const uint8_t> tail) {
+            if (!ok) return;
+            bool repeat = owner.data() == lastOwner;
+            size_t nameBytes = repeat ? 2 : owner.size() - apex.size() + 2;
+            bool full = size + nameBytes + tail.size() > zone_transfer::MESSAGE_TARGET ||
+                        iov.size() + 2 > static_cast<size_t>(IOV_MAX);
+            if (answers > 0 && full) {
+                if (!(ok = flush())) return;
+                begin();
+                repeat = false;
+            }
+
+            // Point at the owner's first RR in this message, or spell out the
+            // labels below the apex and point at the question for the rest
+            size_t offset = size;
+            if (repeat) {
+                const uint8_t pointer[] = {static_cast<uint8_t>(0xC0 | (lastOwnerOffset >> 8)),
+                                           static_cast<uint8_t>(lastOwnerOffset)};
+                appendScratch(pointer);
+            } else if (endsWith(owner, apex)) {
+                appendScratch(owner.first(owner.size() - apex.size()));
+                const uint8_t pointer[] = {0xC0, static_cast<uint8_t>(HEADER_SIZE)};
+                appendScratch(pointer);
+                lastOwner = owner.data();
+                lastOwnerOffset = offset;
+            } else {
+                appendScratch(owner);
+                lastOwner = nullptr;
+            }
+            iov.push_back({const_cast<uint8_t*>(tail.data()), tail.size()});
+            size += tail.size();
+            answers++;
+        }
+
+        // Send the last message; false when the sink aborted at any point
+        bool finish() { return ok && flush(); }
+
+    private:
+        // Scratch bytes go into the current iovec when it already ends there
+        void appendScratch(std::span<const uint8_t> bytes) {
+            const uint8_t* start = scratch.data() + scratch.size();
+            scratch.insert(scratch.end(), bytes.begin(), bytes.end());
+            if (!iov.empty() && static_cast<const uint8_t*>(iov.back().iov_base) + iov.back().iov_len == start) {
+                iov.back().iov_len += bytes.size();
+            } else {
+                iov.push_back({const_cast<uint8_t*>(start), bytes.size()});
+            }
+            size += bytes.size();
+        }
+
+        void begin() {
+            scratch.clear();
+            iov.clear();
+            size = 0;
+            answers = 0;
+            lastOwner = nullptr;
+            const uint8_t header[] = {0, 0, static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id),
+                                      FLAG_QR | FLAG_AA, 0, 0, 1, 0, 0, 0, 0, 0, 0};
+            appendScratch(header);
+            appendScratch(apex);
+            const uint8_t question[] = {static_cast<uint8_t>(qtype >> 8), static_cast<uint8_t>(qtype), 0, CLASS_IN};
+            appendScratch(question);
+            size -= PREFIX_SIZE;
+        }
+
+        bool flush() {
+            writeUint16(scratch, 0, static_cast<uint16_t>(size));
+            writeUint16(scratch, PREFIX_SIZE + 6, answers);
+            return sink(iov);
+        }
+
+        std::span<const uint8_t> apex;
+        uint16_t id;
+        uint16_t qtype;
+        const zone_transfer::Sink& sink;
+        std::vector<uint8_t> scratch;
+        std::vector<iovec> iov;
+        size_t size = 0;                  // Message bytes so far, prefix excluded
+        uint16_t answers = 0;
+        const uint8_t* lastOwner = nullptr;
+        size_t lastOwnerOffset = 0;
+        bool ok = true;
+    };
+}
+
+bool zone_transfer::streamZone(const ZoneSnapshot& snapshot, std::span<const uint8_t> apex, uint16_t id,
+                               const Sink& sink, uint16_t qtype) {
+    auto soa = snapshot.firstRR(apex, TYPE_SOA);
+    if (soa.empty()) return false;
+
+    MessageStream out(apex, id, qtype, sink);
+    out.add(apex, soa);
+    snapshot.forEachOwner([&](const ZoneSnapshot::Owner& owner) {
+        auto name = snapshot.ownerName(owner);
+        bool atApex = name.size() == apex.size() && endsWith(name, apex);
+        for (const auto& rrset : snapshot.rrsets(owner)) {
+            if (atApex && rrset.type == TYPE_SOA) continue;
+            for (uint32_t i = 0; i < rrset.rrCount; ++i) out.add(name, snapshot.rr(rrset.firstRR + i));
+        }
+    });
+    out.add(apex, soa);
+    return out.finish();
+}
+
+bool zone_transfer::streamChanges(std::span<const std::shared_ptr<const ZoneChange>> changes,
+                                  std::span<const uint8_t> soa, std::span<const uint8_t> apex, uint16_t id,
+                                  const Sink& sink) {
+    MessageStream out(apex, id, TYPE_IXFR, sink);
+    if (!changes.empty()) soa = changes.back()->toSoa;
+    out.add(apex, soa);
+    if (changes.empty()) return out.finish();
+
+    for (const auto& change : changes) {
+        out.add(apex, change->fromSoa);
+        for (const auto& rr : change->removed) out.add(change->names[rr.name], rr.tail);
+        out.add(apex, change->toSoa);
+        for (const auto& rr : change->added) out.add(change->names[rr.name], rr.tail);
+    }
+    out.add(apex, soa);
+    return out.finish();
+}
+
+bool zone_transfer::sendAll(int fd, std::span<const iovec> iov, Deadline deadline) {
+    std::vector<iovec> pending(iov.begin(), iov.end());
+    size_t first = 0;
+    while (first < pending.size()) {
+        msghdr message{};
+        message.msg_iov = pending.data() + first;
+        message.msg_iovlen = std::min<size_t>(pending.size() - first, IOV_MAX);
+        ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!waitFor(fd, POLLOUT, deadline)) return false;
+            continue;
+        }
+        if (sent < 0) return false;
+
+        // Skip what went out, possibly stopping inside an iovec
+        auto remaining = static_cast<size_t>(sent);
+        while (first < pending.size() && remaining >= pending[first].iov_len) {
+            remaining -= pending[first].iov_len;
+            first++;
+        }
+        if (remaining > 0) {
+            pending[first].iov_base = static_cast<uint8_t*>(pending[first].iov_base) + remaining;
+            pending[first].iov_len -= remaining;
+        }
+    }
+    return true;
+}
+
+bool zone_transfer::receiveAll(int fd, uint8_t* data, size_t length, Deadline deadline) {
+    for (size_t done = 0; done < length;) {
+        ssize_t n = recv(fd, data + done, length - done, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!waitFor(fd, POLLIN, deadline)) return false;
+            continue;
+        }
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+namespace {
+    // One length-prefixed reply
+    bool sendMessage(int fd, std::span<const uint8_t> message, zone_transfer::Deadline deadline) {
+        uint8_t prefix[PREFIX_SIZE] = {static_cast<uint8_t>(message.size() >> 8), static_cast<uint8_t>(message.size())};
+        const iovec reply[] = {{prefix, sizeof(prefix)}, {const_cast<uint8_t*>(message.data()), message.size()}};
+        return zone_transfer::sendAll(fd, reply, deadline);
+    }
+}
+
+TransferServer::~TransferServer() {
+    stop();
+}
+
+bool TransferServer::start(uint16_t port) {
+    listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) return false;
+    int reuse = 1;
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    socklen_t length = sizeof(address);
+    if (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(listener, reinterpret_cast<sockaddr*>(&address), length) != 0 || listen(listener, 16) != 0 ||
+        getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        close(listener);
+        listener = -1;
+        return false;
+    }
+    boundPort = ntohs(address.sin_port);
+    running = true;
+    worker = std::thread(&TransferServer::run, this);
+    return true;
+}
+
+void TransferServer::stop() {
+    running = false;
+    if (worker.joinable()) worker.join();
+    reap(true);
+    if (listener >= 0) close(listener);
+    listener = -1;
+}
+
+void TransferServer::run() {
+    while (running) {
+        pollfd ready{listener, POLLIN, 0};
+        int events = poll(&ready, 1, ACCEPT_POLL_MS);
+        reap(false);
+        if (events <= 0) continue;
+
+        sockaddr_in peer{};
+        socklen_t length = sizeof(peer);
+        int fd = accept4(listener, reinterpret_cast<sockaddr*>(&peer), &length, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        if (connections.size() >= MAX_CONNECTIONS) {
+            close(fd);
+            continue;
+        }
+        auto& connection = connections.emplace_back();
+        connection.fd = fd;
+        connection.thread = std::thread([this, &connection, trusted = isLoopback(peer)] {
+            serve(connection.fd, trusted);
+            connection.done = true;
+        });
+    }
+}
+
+void TransferServer::reap(bool wait) {
+    for (auto it = connections.begin(); it != connections.end();) {
+        if (!wait && !it->done) {
+            ++it;
+            continue;
+        }
+        // Wakes a connection still waiting on its peer; the fd stays ours
+        // until the thread is joined, so it cannot be reused under it
+        shutdown(it->fd, SHUT_RDWR);
+        it->thread.join();
+        close(it->fd);
+        it = connections.erase(it);
+    }
+}
+
+void TransferServer::serve(int fd, bool trusted) {
+    using std::chrono::steady_clock;
+    const auto deadline = steady_clock::now() + std::chrono::seconds(CONNECTION_TIMEOUT_SECONDS);
+    std::vector<uint8_t> request;
+    while (running) {
+        auto idle = std::min(deadline, steady_clock::now() + std::chrono::seconds(IDLE_TIMEOUT_SECONDS));
+        uint8_t prefix[PREFIX_SIZE];
+        if (!zone_transfer::receiveAll(fd, prefix, sizeof(prefix), idle)) return;
+        request.resize(readUint16(prefix, 0));
+        if (!zone_transfer::receiveAll(fd, request.data(), request.size(), idle) ||
+            !answer(fd, request, trusted, deadline)) {
+            return;
+        }
+    }
+}
+
+bool TransferServer::answer(int fd, std::span<const uint8_t> request, bool trusted, zone_transfer::Deadline deadline) {
+    // Parse just enough of the question to spot AXFR and IXFR
+    WireName qname;
+    size_t offset = HEADER_SIZE;
+    uint16_t qtype = 0;
+    if (request.size() >= HEADER_SIZE && opcodeOf(request) == OPCODE_QUERY && readUint16(request, 4) == 1 &&
+        qname.parse(request, offset) && offset + 4 <= request.size()) {
+        qtype = readUint16(request, offset);
+    }
+
+    if (qtype == zone_transfer::TYPE_AXFR || qtype == zone_transfer::TYPE_IXFR) {
+        auto zones = server.zones();
+        const Zone* zone = zones ? zones->select(qname) : nullptr;
+        bool atApex = zone != nullptr && zone->originWire().size() == qname.bytes().size();
+        auto snapshot = atApex ? zone->snapshot() : nullptr;   // Pinned until the transfer ends
+        if (trusted && snapshot) {
+            uint16_t id = readUint16(request, 0);
+            auto send = [&](std::span<const iovec> message) { return zone_transfer::sendAll(fd, message, deadline); };
+            uint32_t serial = 0;
+            if (qtype == zone_transfer::TYPE_IXFR && clientSerial(request, offset + 4, serial)) {
+                // A client at or past our serial just gets the SOA back
+                auto soa = snapshot->firstRR(zone->originWire(), TYPE_SOA);
+                if (static_cast<int32_t>(serial - snapshot->soa().serial) >= 0) {
+                    return zone_transfer::streamChanges({}, soa, zone->originWire(), id, send);
+                }
+                std::vector<std::shared_ptr<const ZoneChange>> changes;
+                if (zone->history().since(serial, changes)) {
+                    return zone_transfer::streamChanges(changes, soa, zone->originWire(), id, send);
+                }
+            }
+            return zone_transfer::streamZone(*snapshot, zone->originWire(), id, send, qtype);
+        }
+        // Everything else gets the query path's reply with the refusal patched in
+        auto response = createDNSResponse(request, server);
+        writeUint16(response, 6, 0);
+        writeUint16(response, 8, 0);
+        writeUint16(response, 10, 0);
+        response.resize(std::min(response.size(), offset + 4));
+        response[3] = (response[3] & 0xF0) | (trusted ? RCODE_NOTAUTH : RCODE_REFUSED);
+        return sendMessage(fd, response, deadline);
+    }
+
+    auto response = createDNSResponse(request, server, Transport::Tcp);
+    return !response.empty() && sendMessage(fd, response, deadline);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "dns_server.h"
+#include "zone.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <span>
+#include <sys/uio.h>
+#include <thread>
+#include <vector>
+
+// Outbound zone transfer, full (AXFR, RFC5936) and incremental (IXFR,
+// RFC1995), and the TCP side of the server.
+namespace zone_transfer {
+    constexpr uint16_t TYPE_IXFR = 251;
+    constexpr uint16_t TYPE_AXFR = 252;
+
+    // Messages are cut at about this size. Every compression pointer then
+    // fits in 14 bits, and the iovecs of one message stay below IOV_MAX.
+    constexpr size_t MESSAGE_TARGET = 16 * 1024;
+
+    // Receives one message as iovecs, 2-byte TCP length prefix included;
+    // returns false to abort the transfer
+    using Sink = std::function<bool(std::span<const iovec> message)>;
+
+    // Stream every RR of a snapshot as AXFR messages: the apex SOA, all other
+    // RRs owner by owner, and the SOA again. Headers and owner names are built
+    // per message in a small buffer; owners are compressed against the zone
+    // name in the question. The TYPE..RDATA of each RR is not copied at all:
+    // its iovec points into the snapshot, which the caller keeps alive.
+    // Returns false when the sink aborted or the zone has no SOA. qtype is
+    // echoed in the question, IXFR when this is the fallback for one.
+    bool streamZone(const ZoneSnapshot& snapshot, std::span<const uint8_t> apex, uint16_t id, const Sink& sink,
+                    uint16_t qtype = TYPE_AXFR);
+
+    // Stream an IXFR answer: the newest SOA, then for every step the old
+    // SOA, the RRs it removed, the new SOA and the RRs it added, and the
+    // newest SOA again. Without steps the answer is the single SOA given,
+    // which tells the client it is up to date.
+    bool streamChanges(std::span<const std::shared_ptr<const ZoneChange>> changes, std::span<const uint8_t> soa,
+                       std::span<const uint8_t> apex, uint16_t id, const Sink& sink);
+
+    using Deadline = std::chrono::steady_clock::time_point;
+
+    // Write all of iov to a socket, resuming after partial writes; false on
+    // error or when the deadline passes first, however steadily the peer
+    // keeps reading
+    bool sendAll(int fd, std::span<const iovec> iov, Deadline deadline);
+
+    // Read exactly length bytes; false on error, end of stream or when the
+    // deadline passes first
+    bool receiveAll(int fd, uint8_t* data, size_t length, Deadline deadline);
+}
+
+// Serves DNS over TCP on its own thread: ordinary queries are answered like
+// UDP ones, and AXFR streams the zone from a pinned snapshot. IXFR sends
+// the steps from the client's serial out of the zone history, or the whole
+// zone when that serial has left it. A transfer
+// therefore never holds up the UDP loop, and publishing a new version
+// while one is running neither blocks nor changes what it sends.
+// Every connection gets its own thread, up to MAX_CONNECTIONS; past that new
+// ones are closed at once. A request must arrive within the idle timeout of
+// the previous reply, and a connection is dropped at its deadline whatever
+// it is doing, so neither a slow transfer nor a peer trickling bytes keeps
+// others from being served. Transfers are allowed to loopback clients only.
+class TransferServer {
+public:
+    static constexpr size_t MAX_CONNECTIONS = 32;
+    static constexpr int IDLE_TIMEOUT_SECONDS = 10;
+    static constexpr int CONNECTION_TIMEOUT_SECONDS = 300;
+
+    explicit TransferServer(const DNSServer& server) : server(server) {}
+    ~TransferServer();
+    TransferServer(const TransferServer&) = delete;
+    TransferServer& operator=(const TransferServer&) = delete;
+
+    // Listen on port (0 picks one) and start the thread; false on error
+    [[nodiscard]]
+    bool start(uint16_t port);
+
+    void stop();
+
+    // Bound port once started
+    [[nodiscard]]
+    uint16_t port() const noexcept { return boundPort; }
+
+private:
+    struct Connection {
+        int fd = -1;
+        std::atomic<bool> done{false};
+        std::thread thread;
+    };
+
+    void run();
+    void serve(int fd, bool trusted);
+
+    // Join connections that have finished; all of them when wait is set
+    void reap(bool wait);
+
+    // Answer one length-prefixed request; false to close the connection
+    bool answer(int fd, std::span<const uint8_t> request, bool trusted, zone_transfer::Deadline deadline);
+
+    const DNSServer& server;
+    int listener = -1;
+    uint16_t boundPort = 0;
+    std::atomic<bool> running{false};
+    std::thread worker;
+    std::list<Connection> connections;   // Accept thread only, then stop()
+};
@@ -1,6 +1,7 @@
 #include "catch.hpp"
 #include "../src/dns_server.h"
 #include <vector>
+#include <ranges>
 #include <string>
 
 // Simple direct unit tests for the current implementation
@@ -104,3 +105,103 @@ TEST_CASE("DNS Record Tests", "[dns_records]") {
         CHECK(mxRecords[0].value == "mail.example.com");
     }
 }
+
+TEST_CASE("Interned Record Storage", "[dns_records]") {
+    SECTION("Arena Offsets Stay Valid Across Chunks") {
+        ByteArena arena;
+        std::string filler(ByteArena::CHUNK_SIZE - 2, 'x');
+        uint32_t first = arena.append("abc");
+        uint32_t second = arena.append(filler);
+        uint32_t third = arena.append("defg");
+        
+        CHECK(arena.view(first, 3) == "abc");
+        CHECK(arena.view(second, static_cast<uint32_t>(filler.size())) == filler);
+        CHECK(arena.view(third, 4) == "defg");
+        CHECK((third >> ByteArena::CHUNK_BITS) == 2);
+    }
+    
+    SECTION("Owner Names Are Stored Once") {
+        RecordStore store;
+        store.add("example.com", "A", "192.0.2.1");
+        store.add("example.com", "MX", "10 mail.example.com");
+        store.add("www.example.com", "A", "192.0.2.2");
+        
+        REQUIRE(store.ownerCount() == 2);
+        CHECK(store.recordCount() == 3);
+        
+        uint32_t owner = store.findOwner("example.com");
+        REQUIRE(owner != RecordStore::NONE);
+        std::vector<std::string> values;
+        store.forEachRecord(store.owner(owner), [&](const RecordStore::Record& record) {
+            values.emplace_back(store.value(record));
+        });
+        CHECK(values == std::vector<std::string>{"192.0.2.1", "10 mail.example.com"});
+        CHECK(store.findOwner("missing.example.com") == RecordStore::NONE);
+    }
+}
+
+TEST_CASE("Bulk Record Loading", "[dns_records]") {
+    SECTION("Scattered Records Are Grouped By Owner In Input Order") {
+        std::vector<DNSRecord> records = {
+            {"Example.com", "A", "192.0.2.1"},
+            {"www.example.com", "A", "192.0.2.2"},
+            {"example.COM", "MX", "10 mail.example.com"},
+            {"www.example.com", "TXT", "hello"},
+            {"example.com", "A", "192.0.2.3"},
+        };
+        DNSServer server;
+        server.addRecord("example.com", "NS", "ns1.example.com");
+        server.addRecords(std::move(records));
+        
+        auto results = server.query("example.com");
+        REQUIRE(results.size() == 4);
+        CHECK(results[0].value == "ns1.example.com");
+        CHECK(results[1].value == "192.0.2.1");
+        CHECK(results[2].value == "10 mail.example.com");
+        CHECK(results[3].value == "192.0.2.3");
+        CHECK(server.queryByType("WWW.example.com", "TXT").size() == 1);
+        CHECK(server.memoryUsage() > 0);
+    }
+    
+    SECTION("Ranges Of Temporaries Are Accepted") {
+        DNSServer server;
+        server.addRecords(std::views::iota(0, 100) | std::views::transform([](int i) {
+            return DNSRecord{"host" + std::to_string(i % 10) + ".example.com", RecordType::A, "192.0.2.1"};
+        }));
+        CHECK(server.query("host3.example.com").size() == 10);
+        CHECK(server.query("host10.example.com").empty());
+    }
+}
+
+TEST_CASE("Huge Page Backing", "[dns_records]") {
+    SECTION("Large Blocks Are Mapped And Fall Back Cleanly") {
+        for (auto mode : {huge_pages::Mode::Off, huge_pages::Mode::Transparent, huge_pages::Mode::Explicit}) {
+            huge_pages::setMode(mode);
+            auto before = huge_pages::stats();
+            {
+                LargeVector<uint64_t> table(huge_pages::PAGE_SIZE / sizeof(uint64_t) + 1, 7);
+                CHECK(table.back() == 7);
+                auto during = huge_pages::stats();
+                size_t mapped = (during.explicitBytes + during.transparentBytes + during.plainBytes) -
+                                (before.explicitBytes + before.transparentBytes + before.plainBytes);
+                CHECK(mapped == 2 * huge_pages::PAGE_SIZE);
+                if (mode == huge_pages::Mode::Off) CHECK(during.plainBytes > before.plainBytes);
+                
+                LargeVector<uint64_t> small(16, 1);
+                CHECK(small[15] == 1);
+            }
+            auto after = huge_pages::stats();
+            CHECK(after.explicitBytes == before.explicitBytes);
+            CHECK(after.transparentBytes == before.transparentBytes);
+            CHECK(after.plainBytes == before.plainBytes);
+        }
+        huge_pages::setMode(huge_pages::Mode::Off);
+    }
+    
+    SECTION("Mode Names Parse") {
+        huge_pages::Mode mode;
+        REQUIRE(huge_pages::parseMode("hugetlb", mode));
+        CHECK(mode == huge_pages::Mode::Explicit);
+        CHECK_FALSE(huge_pages::parseMode("always", mode));
+    }
+}
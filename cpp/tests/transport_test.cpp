@@ -0,0 +1,785 @@
+#include "catch.hpp"
+#include "../src/dns_server.h"
+#include "../src/receive_pool.h"
+#include "../src/timer_wheel.h"
+#include "../src/transfer_client.h"
+#include "../src/zone.h"
+#include "../src/zone_transfer.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    // UDP socket bound to an ephemeral loopback port
+    int boundSocket(sockaddr_in& address) {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 ||
+            getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+            return -1;
+        }
+        return fd;
+    }
+
+    void transferZone(DNSServer& server, size_t hosts) {
+        server.addRecord("example.com", "SOA", "ns1.example.com admin.example.com 1 3600 900 1209600 300");
+        server.addRecord("example.com", "NS", "ns1.example.com");
+        for (size_t i = 0; i < hosts; ++i) {
+            server.addRecord("host" + std::to_string(i) + ".example.com", RecordType::A, "192.0.2.1");
+            server.addRecord("host" + std::to_string(i) + ".example.com", "TXT", "transfer me");
+        }
+        server.publish();
+    }
+
+    // Walk the RRs of one AXFR message (length prefix included), checking
+    // every owner name decodes and falls inside example.com
+    struct TransferMessage {
+        size_t answers = 0;
+        std::vector<uint16_t> types;
+        bool wellFormed = true;
+    };
+
+    TransferMessage parseTransferMessage(std::span<const uint8_t> framed) {
+        TransferMessage result;
+        auto message = framed.subspan(2);
+        result.wellFormed = dns_packet::readUint16(framed, 0) == message.size();
+        result.answers = dns_packet::readUint16(message, 6);
+        size_t offset = dns_packet::HEADER_SIZE;
+        dns_packet::WireName name;
+        result.wellFormed = result.wellFormed && name.parse(message, offset);
+        offset += 4;
+        for (size_t i = 0; i < result.answers && result.wellFormed; ++i) {
+            result.wellFormed = name.parse(message, offset) && name.toString().ends_with("example.com") &&
+                                offset + 10 <= message.size();
+            if (!result.wellFormed) break;
+            result.types.push_back(dns_packet::readUint16(message, offset));
+            offset += 10 + dns_packet::readUint16(message, offset + 8);
+        }
+        result.wellFormed = result.wellFormed && offset == message.size();
+        return result;
+    }
+
+    // Publish the next version of the transferZone() zone: a new serial and
+    // a new address for one host
+    void stepZone(DNSServer& server, uint32_t serial, size_t host, const std::string& address) {
+        std::string soa = "ns1.example.com admin.example.com " + std::to_string(serial) + " 3600 900 1209600 300";
+        ZoneDelta delta;
+        REQUIRE(dns_packet::SOAData::parse(soa, delta.soa));
+        auto& apex = delta.owners[dns_packet::encodeDomainName("example.com")];
+        apex.resize(2);
+        REQUIRE(dns_packet::appendRecordTail(apex[0], 6, dns_packet::DEFAULT_TTL, soa));
+        REQUIRE(dns_packet::appendRecordTail(apex[1], 2, dns_packet::DEFAULT_TTL, "ns1.example.com"));
+        auto& changed = delta.owners[dns_packet::encodeDomainName("host" + std::to_string(host) + ".example.com")];
+        changed.resize(2);
+        REQUIRE(dns_packet::appendRecordTail(changed[0], 1, dns_packet::DEFAULT_TTL, address));
+        REQUIRE(dns_packet::appendRecordTail(changed[1], 16, dns_packet::DEFAULT_TTL, "transfer me"));
+        REQUIRE(server.applyDelta("example.com", delta));
+    }
+
+    // Types of all RRs of a transfer, in order; stops at the sink's last call
+    std::vector<uint16_t> transferTypes(const std::function<bool(const zone_transfer::Sink&)>& stream) {
+        std::vector<uint16_t> types;
+        bool done = stream([&](std::span<const iovec> iov) {
+            std::vector<uint8_t> bytes;
+            for (const iovec& part : iov) {
+                auto* data = static_cast<const uint8_t*>(part.iov_base);
+                bytes.insert(bytes.end(), data, data + part.iov_len);
+            }
+            auto message = parseTransferMessage(bytes);
+            CHECK(message.wellFormed);
+            types.insert(types.end(), message.types.begin(), message.types.end());
+            return true;
+        });
+        CHECK(done);
+        return types;
+    }
+
+    bool receiveExactly(int fd, uint8_t* data, size_t length) {
+        for (size_t done = 0; done < length;) {
+            ssize_t n = recv(fd, data + done, length - done, 0);
+            if (n <= 0) return false;
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+}
+
+TEST_CASE("Receive Buffer Pool", "[transport]") {
+    SECTION("Slots Are Aligned And Recycled") {
+        ReceivePool pool(4);
+        CHECK(reinterpret_cast<uintptr_t>(pool.base()) % 64 == 0);
+
+        std::vector<uint32_t> taken;
+        for (int i = 0; i < 4; ++i) {
+            uint32_t slot = pool.acquire();
+            REQUIRE(slot != ReceivePool::NONE);
+            CHECK(pool.buffer(slot).size() == ReceivePool::SLOT_SIZE);
+            CHECK(pool.buffer(slot).data() == pool.base() + slot * ReceivePool::SLOT_SIZE);
+            taken.push_back(slot);
+        }
+        CHECK(pool.acquire() == ReceivePool::NONE);
+
+        pool.release(taken[2]);
+        CHECK(pool.acquire() == taken[2]);
+    }
+
+    SECTION("Batched Receive Fills Slots And Returns Them") {
+        sockaddr_in address;
+        int server = boundSocket(address);
+        REQUIRE(server >= 0);
+        int client = socket(AF_INET, SOCK_DGRAM, 0);
+        REQUIRE(client >= 0);
+
+        std::vector<uint8_t> large(3000, 0xAB);
+        for (size_t size : {12, 100, 3000}) {
+            REQUIRE(sendto(client, large.data(), size, 0, reinterpret_cast<sockaddr*>(&address),
+                           sizeof(address)) == static_cast<ssize_t>(size));
+        }
+
+        ReceivePool pool(8);
+        {
+            ReceiveBatch batch(pool);
+            size_t received = batch.receive(server);
+            REQUIRE(received == 3);
+            CHECK(batch.packet(0).size() == 12);
+            CHECK(batch.packet(2).size() == 3000);
+            CHECK(batch.packet(2)[2999] == 0xAB);
+            CHECK(batch.source(1)->sa_family == AF_INET);
+            CHECK(pool.available() == 5);
+
+            batch.release(0);
+            CHECK(pool.available() == 6);
+
+            // Nothing queued: every slot comes straight back
+            CHECK(batch.receive(server) == 0);
+            CHECK(pool.available() == 8);
+        }
+        CHECK(pool.available() == 8);
+
+        close(client);
+        close(server);
+    }
+}
+
+TEST_CASE("Zone Transfer", "[transport]") {
+    DNSServer server;
+    transferZone(server, 2000);
+    auto zone = server.zones()->find("example.com");
+    auto snapshot = zone->snapshot();
+
+    SECTION("Stream Covers The Zone Between Two SOAs In Bounded Messages") {
+        std::vector<TransferMessage> messages;
+        bool done = zone_transfer::streamZone(*snapshot, zone->originWire(), 0x4242,
+                                              [&](std::span<const iovec> iov) {
+            std::vector<uint8_t> bytes;
+            for (const iovec& part : iov) {
+                auto* data = static_cast<const uint8_t*>(part.iov_base);
+                bytes.insert(bytes.end(), data, data + part.iov_len);
+            }
+            CHECK(bytes.size() <= zone_transfer::MESSAGE_TARGET + 2);
+            CHECK(dns_packet::readUint16(bytes, 2) == 0x4242);
+            messages.push_back(parseTransferMessage(bytes));
+            return true;
+        });
+        REQUIRE(done);
+        REQUIRE(messages.size() > 1);
+
+        size_t total = 0;
+        for (const auto& message : messages) {
+            CHECK(message.wellFormed);
+            total += message.answers;
+        }
+        CHECK(total == snapshot->recordCount() + 1);
+        CHECK(messages.front().types.front() == 6);
+        CHECK(messages.back().types.back() == 6);
+    }
+
+    SECTION("A Transfer Keeps Its Snapshot While New Versions Are Published") {
+        size_t total = 0;
+        size_t messages = 0;
+        bool done = zone_transfer::streamZone(*snapshot, zone->originWire(), 1, [&](std::span<const iovec> iov) {
+            std::vector<uint8_t> bytes;
+            for (const iovec& part : iov) {
+                auto* data = static_cast<const uint8_t*>(part.iov_base);
+                bytes.insert(bytes.end(), data, data + part.iov_len);
+            }
+            total += parseTransferMessage(bytes).answers;
+            if (messages++ == 0) {
+                server.addRecord("late.example.com", RecordType::A, "192.0.2.9");
+                server.publish();
+            }
+            return true;
+        });
+        CHECK(done);
+        CHECK(total == snapshot->recordCount() + 1);
+        CHECK(server.zones()->find("example.com")->snapshot()->recordCount() == snapshot->recordCount() + 1);
+    }
+
+    SECTION("An Aborting Sink Stops The Stream") {
+        size_t calls = 0;
+        CHECK_FALSE(zone_transfer::streamZone(*snapshot, zone->originWire(), 1, [&](std::span<const iovec>) {
+            calls++;
+            return false;
+        }));
+        CHECK(calls == 1);
+    }
+
+    SECTION("TCP Server Answers Queries And Transfers") {
+        TransferServer tcp(server);
+        REQUIRE(tcp.start(0));
+        int client = socket(AF_INET, SOCK_STREAM, 0);
+        REQUIRE(client >= 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(tcp.port());
+        REQUIRE(connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+
+        auto request = [&](const std::string& name, uint16_t qtype) {
+            std::vector<uint8_t> query = {0, 0, 0x00, 0x07, 0x01, 0x00, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+            auto encoded = dns_packet::encodeDomainName(name);
+            query.insert(query.end(), encoded.begin(), encoded.end());
+            dns_packet::appendUint16(query, qtype);
+            dns_packet::appendUint16(query, dns_packet::CLASS_IN);
+            dns_packet::writeUint16(query, 0, static_cast<uint16_t>(query.size() - 2));
+            REQUIRE(send(client, query.data(), query.size(), 0) == static_cast<ssize_t>(query.size()));
+        };
+        auto reply = [&] {
+            uint8_t prefix[2];
+            REQUIRE(receiveExactly(client, prefix, 2));
+            std::vector<uint8_t> message(2 + dns_packet::readUint16(prefix, 0));
+            message[0] = prefix[0];
+            message[1] = prefix[1];
+            REQUIRE(receiveExactly(client, message.data() + 2, message.size() - 2));
+            return message;
+        };
+
+        request("host7.example.com", 1);
+        auto answer = reply();
+        CHECK((answer[5] & 0x0F) == dns_packet::RCODE_NOERROR);
+        CHECK(dns_packet::readUint16(answer, 2 + 6) == 1);
+
+        request("example.com", zone_transfer::TYPE_AXFR);
+        size_t soas = 0;
+        size_t total = 0;
+        while (soas < 2) {
+            auto message = parseTransferMessage(reply());
+            REQUIRE(message.wellFormed);
+            total += message.answers;
+            soas += std::count(message.types.begin(), message.types.end(), uint16_t{6});
+        }
+        CHECK(total == snapshot->recordCount() + 1);
+
+        request("host7.example.com", zone_transfer::TYPE_AXFR);
+        CHECK((reply()[5] & 0x0F) == dns_packet::RCODE_NOTAUTH);
+
+        close(client);
+        tcp.stop();
+    }
+
+    SECTION("Stalled Connections Do Not Hold Up Others") {
+        TransferServer tcp(server);
+        REQUIRE(tcp.start(0));
+        auto connectClient = [&] {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = htons(tcp.port());
+            REQUIRE(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+            return fd;
+        };
+        auto query = [](const std::string& name, uint16_t qtype) {
+            std::vector<uint8_t> message = {0, 0, 0x00, 0x07, 0x01, 0x00, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+            auto encoded = dns_packet::encodeDomainName(name);
+            message.insert(message.end(), encoded.begin(), encoded.end());
+            dns_packet::appendUint16(message, qtype);
+            dns_packet::appendUint16(message, dns_packet::CLASS_IN);
+            dns_packet::writeUint16(message, 0, static_cast<uint16_t>(message.size() - 2));
+            return message;
+        };
+
+        // One peer sends half a length prefix, another asks for the zone and
+        // never reads it
+        int trickling = connectClient();
+        REQUIRE(send(trickling, "\0", 1, 0) == 1);
+        int transfer = connectClient();
+        auto axfr = query("example.com", zone_transfer::TYPE_AXFR);
+        REQUIRE(send(transfer, axfr.data(), axfr.size(), 0) == static_cast<ssize_t>(axfr.size()));
+
+        int client = connectClient();
+        timeval timeout{2, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        auto a = query("host7.example.com", 1);
+        REQUIRE(send(client, a.data(), a.size(), 0) == static_cast<ssize_t>(a.size()));
+        uint8_t prefix[2];
+        REQUIRE(receiveExactly(client, prefix, 2));
+        std::vector<uint8_t> answer(dns_packet::readUint16(prefix, 0));
+        REQUIRE(receiveExactly(client, answer.data(), answer.size()));
+        CHECK((answer[3] & 0x0F) == dns_packet::RCODE_NOERROR);
+        CHECK(dns_packet::readUint16(answer, 6) == 1);
+
+        // Stopping does not wait for the idle timeout of the stalled peers
+        auto started = std::chrono::steady_clock::now();
+        tcp.stop();
+        CHECK(std::chrono::steady_clock::now() - started < std::chrono::seconds(TransferServer::IDLE_TIMEOUT_SECONDS));
+        close(trickling);
+        close(transfer);
+        close(client);
+    }
+}
+
+TEST_CASE("Incremental Zone Transfer", "[transport]") {
+    DNSServer server;
+    transferZone(server, 50);
+    auto zone = server.zones()->find("example.com");
+    stepZone(server, 2, 7, "192.0.2.2");
+    stepZone(server, 3, 8, "192.0.2.3");
+    stepZone(server, 4, 7, "192.0.2.4");
+
+    SECTION("Every Published Version Leaves One Step") {
+        REQUIRE(zone->history().size() == 3);
+        std::vector<std::shared_ptr<const ZoneChange>> changes;
+        REQUIRE(zone->history().since(2, changes));
+        REQUIRE(changes.size() == 2);
+        CHECK(changes.front()->fromSerial == 2);
+        CHECK(changes.back()->toSerial == 4);
+
+        // Only the address moved; the TXT beside it and the apex NS did not
+        const ZoneChange& last = *changes.back();
+        REQUIRE(last.removed.size() == 1);
+        REQUIRE(last.added.size() == 1);
+        CHECK(last.names[last.removed[0].name] == dns_packet::encodeDomainName("host7.example.com"));
+        CHECK(dns_packet::readUint16(last.added[0].tail, 0) == 1);
+
+        CHECK_FALSE(zone->history().since(4, changes));
+        CHECK_FALSE(zone->history().since(99, changes));
+    }
+
+    SECTION("The Ring Is Bounded And Restarts After A Gap") {
+        ZoneHistory history(2);
+        auto step = [](uint32_t from, uint32_t to) {
+            auto change = std::make_shared<ZoneChange>();
+            change->fromSerial = from;
+            change->toSerial = to;
+            return change;
+        };
+        history.record(step(1, 2));
+        history.record(step(2, 3));
+        history.record(step(3, 4));
+        std::vector<std::shared_ptr<const ZoneChange>> changes;
+        CHECK(history.size() == 2);
+        CHECK_FALSE(history.since(1, changes));
+        CHECK(history.since(2, changes));
+
+        history.record(step(10, 11));
+        CHECK(history.size() == 1);
+        CHECK_FALSE(history.since(3, changes));
+    }
+
+    SECTION("IXFR Sends Only The Differences") {
+        std::vector<std::shared_ptr<const ZoneChange>> changes;
+        REQUIRE(zone->history().since(1, changes));
+        auto types = transferTypes([&](const zone_transfer::Sink& sink) {
+            return zone_transfer::streamChanges(changes, {}, zone->originWire(), 9, sink);
+        });
+        // Newest SOA, then old SOA, deletions, new SOA, additions per step
+        std::vector<uint16_t> expected = {6};
+        for (size_t i = 0; i < 3; ++i) expected.insert(expected.end(), {6, 1, 6, 1});
+        expected.push_back(6);
+        CHECK(types == expected);
+    }
+
+    SECTION("TCP Server Falls Back To AXFR For Serials It No Longer Has") {
+        TransferServer tcp(server);
+        REQUIRE(tcp.start(0));
+        int client = socket(AF_INET, SOCK_STREAM, 0);
+        REQUIRE(client >= 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(tcp.port());
+        REQUIRE(connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+
+        // IXFR for example.com from serial, the client's SOA in the authority section
+        auto ixfr = [&](uint32_t serial) {
+            std::vector<uint8_t> query = {0, 0, 0x00, 0x08, 0x00, 0x00, 0x00, 0x01, 0, 0, 0, 1, 0, 0};
+            auto apex = dns_packet::encodeDomainName("example.com");
+            query.insert(query.end(), apex.begin(), apex.end());
+            dns_packet::appendUint16(query, zone_transfer::TYPE_IXFR);
+            dns_packet::appendUint16(query, dns_packet::CLASS_IN);
+            query.insert(query.end(), {0xC0, 12, 0, 6, 0, 1, 0, 0, 0, 0, 0, 22, 0, 0});
+            dns_packet::appendUint32(query, serial);
+            for (int i = 0; i < 4; ++i) dns_packet::appendUint32(query, 0);
+            dns_packet::writeUint16(query, 0, static_cast<uint16_t>(query.size() - 2));
+            REQUIRE(send(client, query.data(), query.size(), 0) == static_cast<ssize_t>(query.size()));
+        };
+        // The zone is small enough for every answer to fit one message
+        auto transfer = [&] {
+            uint8_t prefix[2];
+            REQUIRE(receiveExactly(client, prefix, 2));
+            std::vector<uint8_t> message(2 + dns_packet::readUint16(prefix, 0));
+            message[0] = prefix[0];
+            message[1] = prefix[1];
+            REQUIRE(receiveExactly(client, message.data() + 2, message.size() - 2));
+            auto parsed = parseTransferMessage(message);
+            REQUIRE(parsed.wellFormed);
+            return parsed.types;
+        };
+
+        ixfr(3);
+        CHECK(transfer() == std::vector<uint16_t>{6, 6, 1, 6, 1, 6});
+
+        ixfr(4);
+        CHECK(transfer() == std::vector<uint16_t>{6});
+
+        ixfr(0);
+        CHECK(transfer().size() == zone->snapshot()->recordCount() + 1);
+
+        close(client);
+        tcp.stop();
+    }
+}
+
+TEST_CASE("Secondary Zones", "[transport]") {
+    DNSServer primary;
+    transferZone(primary, 50);
+    TransferServer tcp(primary);
+    REQUIRE(tcp.start(0));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(tcp.port());
+
+    DNSServer secondary;
+    TransferClient client(secondary);
+    REQUIRE(client.addZone("example.com", address));
+    auto records = [](DNSServer& server) {
+        return server.zones()->find("example.com")->snapshot()->recordCount();
+    };
+
+    SECTION("Full Then Incremental Then Nothing") {
+        CHECK(client.follows(dns_packet::encodeDomainName("example.com")));
+        CHECK_FALSE(client.follows(dns_packet::encodeDomainName("example.org")));
+        REQUIRE(client.refresh("example.com") == TransferClient::Outcome::Full);
+        REQUIRE(secondary.zones()->find("example.com") != nullptr);
+        CHECK(records(secondary) == records(primary));
+        CHECK(secondary.zones()->find("example.com")->snapshot()->soa().serial == 1);
+
+        stepZone(primary, 2, 7, "192.0.2.2");
+        stepZone(primary, 3, 8, "192.0.2.3");
+        REQUIRE(client.refresh("example.com") == TransferClient::Outcome::Incremental);
+        auto zone = secondary.zones()->find("example.com");
+        CHECK(zone->snapshot()->soa().serial == 3);
+        CHECK(records(secondary) == records(primary));
+        CHECK(secondary.queryByType("host7.example.com", "A").front().value == "192.0.2.2");
+        CHECK(secondary.queryByType("host8.example.com", "A").front().value == "192.0.2.3");
+        CHECK(secondary.queryByType("host8.example.com", "TXT").size() == 1);
+
+        // The secondary's own history lets it feed a further secondary
+        CHECK(zone->history().size() == 1);
+        CHECK(client.refresh("example.com") == TransferClient::Outcome::UpToDate);
+    }
+
+    SECTION("An Incremental Transfer Applies Only To Its Base") {
+        REQUIRE(client.refresh("example.com") == TransferClient::Outcome::Full);
+        stepZone(primary, 2, 7, "192.0.2.2");
+        std::vector<std::shared_ptr<const ZoneChange>> changes;
+        REQUIRE(primary.zones()->find("example.com")->history().since(1, changes));
+
+        auto zone = secondary.zones()->find("example.com");
+        TransferReader reader(zone->originWire(), 9, zone->snapshot());
+        REQUIRE(zone_transfer::streamChanges(changes, {}, zone->originWire(), 9, [&](std::span<const iovec> iov) {
+            std::vector<uint8_t> bytes;
+            for (const iovec& part : iov) {
+                auto* data = static_cast<const uint8_t*>(part.iov_base);
+                bytes.insert(bytes.end(), data, data + part.iov_len);
+            }
+            reader.feed(std::span<const uint8_t>(bytes).subspan(2));
+            return true;
+        }));
+        REQUIRE(reader.state() == TransferReader::State::Incremental);
+        CHECK(reader.result().fromSerial == 1u);
+
+        // The zone moved on meanwhile, so the delta no longer applies
+        ZoneDelta newer;
+        newer.soa = zone->snapshot()->soa();
+        newer.soa.serial = 5;
+        REQUIRE(secondary.applyDelta("example.com", newer));
+        CHECK_FALSE(secondary.applyDelta("example.com", reader.result()));
+        CHECK(secondary.queryByType("host7.example.com", "A").front().value != "192.0.2.2");
+    }
+
+    SECTION("Deletions Match The RRs Held Whatever Their TTL") {
+        REQUIRE(client.refresh("example.com") == TransferClient::Outcome::Full);
+        stepZone(primary, 2, 7, "192.0.2.2");
+        std::vector<std::shared_ptr<const ZoneChange>> changes;
+        REQUIRE(primary.zones()->find("example.com")->history().since(1, changes));
+
+        // The primary sends every RR but the SOAs with a TTL of its own
+        auto zone = secondary.zones()->find("example.com");
+        TransferReader reader(zone->originWire(), 9, zone->snapshot());
+        REQUIRE(zone_transfer::streamChanges(changes, {}, zone->originWire(), 9, [&](std::span<const iovec> iov) {
+            std::vector<uint8_t> bytes;
+            for (const iovec& part : iov) {
+                auto* data = static_cast<const uint8_t*>(part.iov_base);
+                bytes.insert(bytes.end(), data, data + part.iov_len);
+            }
+            std::span<uint8_t> message = std::span<uint8_t>(bytes).subspan(2);
+            size_t offset = dns_packet::HEADER_SIZE;
+            dns_packet::WireName name;
+            REQUIRE(name.parse(message, offset));
+            offset += 4;
+            for (uint16_t i = 0, count = dns_packet::readUint16(message, 6); i < count; ++i) {
+                REQUIRE(name.parse(message, offset));
+                if (dns_packet::readUint16(message, offset) != 6) {
+                    dns_packet::writeUint16(bytes, 2 + offset + 4, 0);
+                    dns_packet::writeUint16(bytes, 2 + offset + 6, 60);
+                }
+                offset += 10 + dns_packet::readUint16(message, offset + 8);
+            }
+            reader.feed(message);
+            return true;
+        }));
+        REQUIRE(reader.state() == TransferReader::State::Incremental);
+        REQUIRE(secondary.applyDelta("example.com", reader.result()));
+        CHECK(records(secondary) == records(primary));
+        auto host7 = secondary.queryByType("host7.example.com", "A");
+        REQUIRE(host7.size() == 1);
+        CHECK(host7.front().value == "192.0.2.2");
+    }
+
+    SECTION("A Serial The Primary No Longer Has Gets A Full Transfer") {
+        REQUIRE(client.refresh("example.com") == TransferClient::Outcome::Full);
+        stepZone(primary, 2, 7, "192.0.2.2");
+        primary.zones()->find("example.com")->history().clear();
+        CHECK(client.refresh("example.com") == TransferClient::Outcome::Full);
+        CHECK(secondary.queryByType("host7.example.com", "A").front().value == "192.0.2.2");
+        CHECK(secondary.zones()->find("example.com")->history().size() == 0);
+    }
+
+    SECTION("The Refresh Thread Pulls The Zone On Its Own") {
+        REQUIRE(client.start());
+        for (int i = 0; i < 500 && !secondary.zones(); ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        client.stop();
+        REQUIRE(secondary.zones() != nullptr);
+        CHECK(records(secondary) == records(primary));
+    }
+
+    SECTION("A Stalled Primary Holds Up Only Its Own Zone") {
+        // Connections to it complete in the backlog and are never answered
+        int silent = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in stalled = address;
+        stalled.sin_port = 0;
+        socklen_t length = sizeof(stalled);
+        REQUIRE(bind(silent, reinterpret_cast<sockaddr*>(&stalled), length) == 0);
+        REQUIRE(listen(silent, 4) == 0);
+        REQUIRE(getsockname(silent, reinterpret_cast<sockaddr*>(&stalled), &length) == 0);
+
+        TransferClient both(secondary);
+        REQUIRE(both.addZone("example.org", stalled));
+        REQUIRE(both.addZone("example.com", address));
+        REQUIRE(both.start());
+        auto started = std::chrono::steady_clock::now();
+        for (int i = 0; i < 500 && !secondary.zones(); ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        CHECK(std::chrono::steady_clock::now() - started < std::chrono::seconds(TransferClient::IO_TIMEOUT_SECONDS));
+        REQUIRE(secondary.zones() != nullptr);
+        CHECK(records(secondary) == records(primary));
+
+        // The check still waiting on the silent primary is cut short
+        started = std::chrono::steady_clock::now();
+        both.stop();
+        CHECK(std::chrono::steady_clock::now() - started < std::chrono::seconds(TransferClient::IO_TIMEOUT_SECONDS));
+        close(silent);
+    }
+
+    SECTION("An Unreachable Primary Fails") {
+        TransferClient orphan(secondary);
+        sockaddr_in nowhere = address;
+        nowhere.sin_port = 0;
+        REQUIRE(orphan.addZone("example.com", nowhere));
+        CHECK(orphan.refresh("example.com") == TransferClient::Outcome::Failed);
+        CHECK(orphan.refresh("example.org") == TransferClient::Outcome::Failed);
+    }
+
+    tcp.stop();
+}
+
+TEST_CASE("Timer Wheel", "[transport]") {
+    SECTION("Timers Fire At Their Deadline Across All Levels") {
+        TimerWheel wheel(1000);
+        std::mt19937_64 random(7);
+        std::vector<uint64_t> deadlines(2000);
+        for (uint32_t id = 0; id < deadlines.size(); ++id) {
+            deadlines[id] = 1001 + random() % (TimerWheel::SLOTS * TimerWheel::SLOTS * TimerWheel::SLOTS * 2);
+            wheel.schedule(id, deadlines[id]);
+        }
+        REQUIRE(wheel.size() == deadlines.size());
+
+        size_t fired = 0;
+        bool onTime = true;
+        uint64_t end = 1001 + TimerWheel::SLOTS * TimerWheel::SLOTS * TimerWheel::SLOTS * 2;
+        for (uint64_t now = 1000; now < end; now += 97) {
+            wheel.advance(now, [&](uint32_t id) {
+                onTime = onTime && deadlines[id] == wheel.now();
+                fired++;
+            });
+        }
+        wheel.advance(end, [&](uint32_t) { fired++; });
+        CHECK(onTime);
+        CHECK(fired == deadlines.size());
+        CHECK(wheel.size() == 0);
+        CHECK(wheel.nextEvent() == TimerWheel::NEVER);
+    }
+
+    SECTION("Rescheduling And Cancelling") {
+        TimerWheel wheel;
+        wheel.schedule(1, 500);
+        wheel.schedule(2, 10);
+        wheel.schedule(1, 20);   // Replaces 500
+        wheel.schedule(3, 30);
+        wheel.cancel(3);
+        CHECK(wheel.deadline(1) == 20);
+        CHECK(wheel.deadline(3) == TimerWheel::NEVER);
+        CHECK(wheel.nextEvent() == 10);
+
+        std::vector<std::pair<uint32_t, uint64_t>> fired;
+        wheel.advance(1000, [&](uint32_t id) { fired.emplace_back(id, wheel.now()); });
+        CHECK(fired == std::vector<std::pair<uint32_t, uint64_t>>{{2, 10}, {1, 20}});
+    }
+
+    SECTION("Past Deadlines Fire Next And Far Ones Are Clamped") {
+        TimerWheel wheel(100);
+        wheel.schedule(0, 5);
+        wheel.schedule(1, TimerWheel::NEVER);
+        CHECK(wheel.deadline(0) == 101);
+        CHECK(wheel.deadline(1) == 100 + TimerWheel::MAX_DELAY);
+        size_t fired = 0;
+        wheel.advance(101, [&](uint32_t id) { fired += id == 0; });
+        CHECK(fired == 1);
+
+        // Only wraps of level 0 are due while nothing is close
+        CHECK(wheel.nextEvent() == 128);
+    }
+}
+
+namespace {
+    // NOTIFY for example.com
+    std::vector<uint8_t> notifyMessage(uint16_t id) {
+        std::vector<uint8_t> message = {static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id),
+                                        dns_packet::OPCODE_NOTIFY << 3 | dns_packet::FLAG_AA, 0, 0, 1, 0, 0, 0, 0, 0, 0};
+        auto apex = dns_packet::encodeDomainName("example.com");
+        message.insert(message.end(), apex.begin(), apex.end());
+        dns_packet::appendUint16(message, 6);
+        dns_packet::appendUint16(message, dns_packet::CLASS_IN);
+        return message;
+    }
+
+    template <typename Done>
+    bool waitFor(Done&& done) {
+        for (int i = 0; i < 500 && !done(); ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return done();
+    }
+}
+
+TEST_CASE("Zone Change Notification", "[transport]") {
+    DNSServer primary;
+    transferZone(primary, 50);
+    TransferServer tcp(primary);
+    REQUIRE(tcp.start(0));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(tcp.port());
+
+    DNSServer secondary;
+    TransferClient client(secondary);
+    client.setNotifyWindow(std::chrono::milliseconds(200));
+    REQUIRE(client.addZone("example.com", address));
+
+    SECTION("NOTIFYs Are Checked And Answered") {
+        auto reply = client.notify(notifyMessage(0x1234), address);
+        REQUIRE(reply.size() == notifyMessage(0).size());
+        CHECK(dns_packet::readUint16(reply, 0) == 0x1234);
+        CHECK((reply[2] & dns_packet::FLAG_QR));
+        CHECK(dns_packet::opcodeOf(reply) == dns_packet::OPCODE_NOTIFY);
+        CHECK((reply[3] & 0x0F) == dns_packet::RCODE_NOERROR);
+
+        sockaddr_in stranger = address;
+        stranger.sin_addr.s_addr = htonl(0x0A000001);
+        CHECK((client.notify(notifyMessage(1), stranger)[3] & 0x0F) == dns_packet::RCODE_REFUSED);
+
+        TransferClient other(secondary);
+        CHECK((other.notify(notifyMessage(1), address)[3] & 0x0F) == dns_packet::RCODE_NOTAUTH);
+        CHECK(client.stats().notifiesReceived == 1);
+    }
+
+    SECTION("A Burst Of NOTIFYs Costs One Transfer") {
+        REQUIRE(client.start());
+        REQUIRE(waitFor([&] { return client.stats().transfers == 1; }));
+
+        // Primary REFRESH is an hour, so only the NOTIFYs can bring this in
+        stepZone(primary, 2, 7, "192.0.2.2");
+        for (uint16_t id = 0; id < 20; ++id) (void)client.notify(notifyMessage(id), address);
+        REQUIRE(waitFor([&] { return secondary.zones()->find("example.com")->snapshot()->soa().serial == 2; }));
+        std::this_thread::sleep_for(std::chrono::milliseconds(400));
+        auto stats = client.stats();
+        CHECK(stats.notifiesReceived == 20);
+        CHECK(stats.transfers == 2);
+        CHECK(stats.checks == 2);
+        client.stop();
+    }
+
+    SECTION("Changes Are Announced Once Per Window Until Acknowledged") {
+        sockaddr_in listener{};
+        int fd = boundSocket(listener);
+        REQUIRE(fd >= 0);
+        timeval timeout{2, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        TransferClient announcer(primary);
+        announcer.setNotifyWindow(std::chrono::milliseconds(100));
+        announcer.addNotifyTarget(listener);
+        REQUIRE(announcer.start());
+        primary.setChangeListener([&](std::string_view origin) { announcer.zoneChanged(origin); });
+        stepZone(primary, 2, 7, "192.0.2.2");
+        stepZone(primary, 3, 8, "192.0.2.3");
+        stepZone(primary, 4, 9, "192.0.2.4");
+
+        uint8_t buffer[512];
+        sockaddr_in from{};
+        socklen_t length = sizeof(from);
+        ssize_t size = recvfrom(fd, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&from), &length);
+        REQUIRE(size >= static_cast<ssize_t>(dns_packet::HEADER_SIZE));
+        std::span<const uint8_t> received(buffer, static_cast<size_t>(size));
+        CHECK(dns_packet::opcodeOf(received) == dns_packet::OPCODE_NOTIFY);
+        size_t offset = dns_packet::HEADER_SIZE;
+        CHECK(dns_packet::parseDomainName(received, offset) == "example.com");
+
+        // Acknowledge it; nothing more may follow, not even a resend
+        std::vector<uint8_t> ack(received.begin(), received.end());
+        ack[2] |= dns_packet::FLAG_QR;
+        sendto(fd, ack.data(), ack.size(), 0, reinterpret_cast<sockaddr*>(&from), length);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+        CHECK(recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT) < 0);
+        CHECK(announcer.stats().notifiesSent == 1);
+
+        primary.setChangeListener(nullptr);
+        announcer.stop();
+        close(fd);
+    }
+
+    tcp.stop();
+}
@@ -0,0 +1,814 @@
+#include "catch.hpp"
+#include "../src/checkpoint.h"
+#include "../src/dns_response.h"
+#include "../src/dns_server.h"
+#include "../src/dns_update.h"
+#include "../src/journal.h"
+#include "../src/zone.h"
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    constexpr uint16_t TYPE_A = 1;
+    constexpr uint16_t TYPE_NS = 2;
+    constexpr uint16_t TYPE_CNAME = 5;
+    constexpr uint16_t TYPE_SOA = 6;
+    constexpr uint16_t TYPE_TXT = 16;
+
+    // RFC2136 message builder; add prerequisites before updates
+    class UpdateMessage {
+    public:
+        explicit UpdateMessage(const std::string& zone) {
+            bytes = {0xAB, 0xCD, dns_packet::OPCODE_UPDATE << 3, 0x00, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+            appendName(zone);
+            dns_packet::appendUint16(bytes, TYPE_SOA);
+            dns_packet::appendUint16(bytes, dns_packet::CLASS_IN);
+        }
+
+        UpdateMessage& prerequisite(const std::string& name, uint16_t type, uint16_t rrClass,
+                                    const std::string& value = "") {
+            appendRR(name, type, rrClass, 0, value);
+            dns_packet::writeUint16(bytes, 6, dns_packet::readUint16(bytes, 6) + 1);
+            return *this;
+        }
+
+        UpdateMessage& update(const std::string& name, uint16_t type, uint16_t rrClass,
+                              const std::string& value = "") {
+            appendRR(name, type, rrClass, rrClass == dns_packet::CLASS_IN ? 3600 : 0, value);
+            dns_packet::writeUint16(bytes, 8, dns_packet::readUint16(bytes, 8) + 1);
+            return *this;
+        }
+
+        std::vector<uint8_t> bytes;
+
+    private:
+        void appendName(const std::string& name) {
+            auto encoded = dns_packet::encodeDomainName(name);
+            bytes.insert(bytes.end(), encoded.begin(), encoded.end());
+        }
+
+        void appendRR(const std::string& name, uint16_t type, uint16_t rrClass, uint32_t ttl,
+                      const std::string& value) {
+            appendName(name);
+            dns_packet::appendUint16(bytes, type);
+            dns_packet::appendUint16(bytes, rrClass);
+            dns_packet::appendUint32(bytes, ttl);
+            std::vector<uint8_t> rdata;
+            if (!value.empty()) REQUIRE(dns_packet::encodeRData(type, value, rdata));
+            dns_packet::appendUint16(bytes, static_cast<uint16_t>(rdata.size()));
+            bytes.insert(bytes.end(), rdata.begin(), rdata.end());
+        }
+    };
+
+    std::vector<uint8_t> question(const std::string& name, uint16_t qtype) {
+        std::vector<uint8_t> packet = {0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+        auto encoded = dns_packet::encodeDomainName(name);
+        packet.insert(packet.end(), encoded.begin(), encoded.end());
+        dns_packet::appendUint16(packet, qtype);
+        dns_packet::appendUint16(packet, dns_packet::CLASS_IN);
+        return packet;
+    }
+
+    uint8_t rcode(const std::vector<uint8_t>& response) {
+        return response[3] & 0x0F;
+    }
+
+    uint16_t answers(const DNSServer& server, const std::string& name, uint16_t qtype) {
+        auto response = createDNSResponse(question(name, qtype), server);
+        return rcode(response) == dns_packet::RCODE_NOERROR ? dns_packet::readUint16(response, 6) : 0;
+    }
+
+    std::shared_ptr<const ZoneSnapshot> snapshotOf(const DNSServer& server, const std::string& zone) {
+        return server.zones()->find(zone)->snapshot();
+    }
+
+    void loadZone(DNSServer& server) {
+        server.addRecord("example.com", "SOA", "ns1.example.com admin.example.com 100 3600 900 1209600 300");
+        server.addRecord("example.com", "NS", "ns1.example.com");
+        server.addRecord("example.com", "NS", "ns2.example.com");
+        server.addRecord("example.com", RecordType::A, "192.0.2.1");
+        server.addRecord("www.example.com", RecordType::A, "192.0.2.10");
+        server.addRecord("alias.example.com", "CNAME", "www.example.com");
+        server.publish();
+    }
+}
+
+TEST_CASE("Dynamic Updates", "[update]") {
+    DNSServer server;
+    loadZone(server);
+    ZoneUpdater updater(server);
+
+    SECTION("Adds Are Published On Commit With The Next Serial") {
+        auto before = snapshotOf(server, "example.com");
+        UpdateMessage message("example.com");
+        message.update("new.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.20")
+               .update("new.example.com", TYPE_TXT, dns_packet::CLASS_IN, "hello");
+        auto response = updater.stage(message.bytes);
+        REQUIRE(response.size() == dns_packet::HEADER_SIZE);
+        CHECK((response[2] & dns_packet::FLAG_QR) != 0);
+        CHECK(dns_packet::opcodeOf(response) == dns_packet::OPCODE_UPDATE);
+        CHECK(rcode(response) == dns_packet::RCODE_NOERROR);
+
+        // Staged, not yet served
+        CHECK(answers(server, "new.example.com", TYPE_A) == 0);
+        CHECK(updater.commit().published() == 1);
+        CHECK(updater.empty());
+
+        CHECK(answers(server, "new.example.com", TYPE_A) == 1);
+        CHECK(answers(server, "new.example.com", TYPE_TXT) == 1);
+        CHECK(server.queryByType("new.example.com", "TXT").front().value == "hello");
+
+        auto after = snapshotOf(server, "example.com");
+        CHECK(after->soa().serial == 101);
+        CHECK(server.queryByType("example.com", "SOA").front().value ==
+              "ns1.example.com admin.example.com 101 3600 900 1209600 300");
+        CHECK(after->ownerCount() == before->ownerCount() + 1);
+
+        // Readers holding the old version still see it unchanged
+        dns_packet::WireName name;
+        REQUIRE(name.assign("new.example.com"));
+        CHECK(before->find(name, name.hash()) == nullptr);
+        CHECK(before->soa().serial == 100);
+    }
+
+    SECTION("Deletes Follow The RRset, Name And Apex Rules") {
+        UpdateMessage message("example.com");
+        message.update("www.example.com", TYPE_A, dns_packet::CLASS_NONE, "192.0.2.10")
+               .update("alias.example.com", dns_packet::QTYPE_ANY, dns_packet::CLASS_ANY)
+               .update("example.com", dns_packet::QTYPE_ANY, dns_packet::CLASS_ANY)
+               .update("example.com", TYPE_NS, dns_packet::CLASS_NONE, "ns1.example.com")
+               .update("example.com", TYPE_NS, dns_packet::CLASS_NONE, "ns2.example.com");
+        CHECK(rcode(updater.stage(message.bytes)) == dns_packet::RCODE_NOERROR);
+        updater.commit();
+
+        CHECK(rcode(createDNSResponse(question("www.example.com", TYPE_A), server)) == dns_packet::RCODE_NXDOMAIN);
+        CHECK(rcode(createDNSResponse(question("alias.example.com", TYPE_A), server)) ==
+              dns_packet::RCODE_NXDOMAIN);
+        CHECK(server.query("www.example.com").empty());
+
+        // The apex keeps its SOA and at least one NS
+        CHECK(answers(server, "example.com", TYPE_A) == 0);
+        CHECK(answers(server, "example.com", TYPE_SOA) == 1);
+        CHECK(answers(server, "example.com", TYPE_NS) == 1);
+    }
+
+    SECTION("Prerequisites Gate The Whole Message") {
+        auto check = [&](UpdateMessage& message, uint8_t expected) {
+            message.update("gated.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.30");
+            CHECK(rcode(updater.stage(message.bytes)) == expected);
+            CHECK(updater.empty() == (expected != dns_packet::RCODE_NOERROR));
+        };
+
+        UpdateMessage nameInUse("example.com");
+        nameInUse.prerequisite("missing.example.com", dns_packet::QTYPE_ANY, dns_packet::CLASS_ANY);
+        check(nameInUse, dns_packet::RCODE_NXDOMAIN);
+
+        UpdateMessage nameNotInUse("example.com");
+        nameNotInUse.prerequisite("www.example.com", dns_packet::QTYPE_ANY, dns_packet::CLASS_NONE);
+        check(nameNotInUse, dns_packet::RCODE_YXDOMAIN);
+
+        UpdateMessage rrsetExists("example.com");
+        rrsetExists.prerequisite("www.example.com", TYPE_TXT, dns_packet::CLASS_ANY);
+        check(rrsetExists, dns_packet::RCODE_NXRRSET);
+
+        UpdateMessage rrsetAbsent("example.com");
+        rrsetAbsent.prerequisite("www.example.com", TYPE_A, dns_packet::CLASS_NONE);
+        check(rrsetAbsent, dns_packet::RCODE_YXRRSET);
+
+        UpdateMessage wrongValue("example.com");
+        wrongValue.prerequisite("www.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.99");
+        check(wrongValue, dns_packet::RCODE_NXRRSET);
+
+        UpdateMessage outsideZone("example.com");
+        outsideZone.prerequisite("www.example.org", TYPE_A, dns_packet::CLASS_ANY);
+        check(outsideZone, dns_packet::RCODE_NOTZONE);
+
+        UpdateMessage exactValue("example.com");
+        exactValue.prerequisite("www.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.10")
+                  .prerequisite("example.com", TYPE_NS, dns_packet::CLASS_IN, "ns2.example.com")
+                  .prerequisite("example.com", TYPE_NS, dns_packet::CLASS_IN, "ns1.example.com");
+        check(exactValue, dns_packet::RCODE_NOERROR);
+    }
+
+    SECTION("Messages In One Batch See Each Other") {
+        UpdateMessage add("example.com");
+        add.update("batch.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.40");
+        UpdateMessage dependent("example.com");
+        dependent.prerequisite("batch.example.com", TYPE_A, dns_packet::CLASS_ANY)
+                 .update("batch.example.com", TYPE_TXT, dns_packet::CLASS_IN, "second");
+        CHECK(rcode(updater.stage(add.bytes)) == dns_packet::RCODE_NOERROR);
+        CHECK(rcode(updater.stage(dependent.bytes)) == dns_packet::RCODE_NOERROR);
+        CHECK(updater.commit().published() == 1);
+        CHECK(answers(server, "batch.example.com", dns_packet::QTYPE_ANY) == 2);
+        CHECK(snapshotOf(server, "example.com")->soa().serial == 101);
+    }
+
+    SECTION("CNAME Chains Follow Updated Targets") {
+        CHECK(answers(server, "alias.example.com", TYPE_A) == 2);
+
+        UpdateMessage add("example.com");
+        add.update("www.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.11");
+        REQUIRE(rcode(updater.stage(add.bytes)) == dns_packet::RCODE_NOERROR);
+        updater.commit();
+        CHECK(answers(server, "alias.example.com", TYPE_A) == 3);
+
+        UpdateMessage remove("example.com");
+        remove.update("www.example.com", dns_packet::QTYPE_ANY, dns_packet::CLASS_ANY);
+        REQUIRE(rcode(updater.stage(remove.bytes)) == dns_packet::RCODE_NOERROR);
+        updater.commit();
+        auto response = createDNSResponse(question("alias.example.com", TYPE_A), server);
+        CHECK(rcode(response) == dns_packet::RCODE_NXDOMAIN);
+        CHECK(dns_packet::readUint16(response, 6) == 1);
+    }
+
+    SECTION("CNAME Conflicts And Stale Serials Are Ignored") {
+        UpdateMessage message("example.com");
+        message.update("www.example.com", TYPE_CNAME, dns_packet::CLASS_IN, "example.com")
+               .update("alias.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.50")
+               .update("example.com", TYPE_SOA, dns_packet::CLASS_IN,
+                       "ns1.example.com admin.example.com 50 3600 900 1209600 300");
+        CHECK(rcode(updater.stage(message.bytes)) == dns_packet::RCODE_NOERROR);
+        CHECK(updater.empty());
+        CHECK(updater.commit().published() == 0);
+        CHECK(snapshotOf(server, "example.com")->soa().serial == 100);
+    }
+
+    SECTION("Updates Dropped At Commit Are Reported Per Zone") {
+        UpdateMessage message("example.com");
+        message.update("late.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.80");
+        std::string zone;
+        REQUIRE(rcode(updater.stage(message.bytes, &zone)) == dns_packet::RCODE_NOERROR);
+        CHECK(zone == "example.com");
+
+        // The zone moves on while the batch is being journaled
+        const std::vector<DNSRecord> files = {
+            {"example.com", "SOA", "ns1.example.com admin.example.com 100 3600 900 1209600 300"},
+            {"example.com", "NS", "ns1.example.com"},
+        };
+        std::string error;
+        REQUIRE(server.reload(files, error));
+        updater.setReloadHandler([&] {
+            ZoneDelta newer;
+            newer.soa = snapshotOf(server, "example.com")->soa();
+            newer.soa.serial = 200;
+            REQUIRE(server.applyDelta("example.com", newer));
+        });
+        auto outcome = updater.commit();
+        CHECK(outcome.published() == 0);
+        CHECK_FALSE(outcome.published("example.com"));
+        CHECK(outcome.published("example.org"));
+        CHECK(answers(server, "late.example.com", TYPE_A) == 0);
+        CHECK(snapshotOf(server, "example.com")->soa().serial == 200);
+    }
+
+    SECTION("Updates Staged Before A Reload Are Not Published Over It") {
+        const std::vector<DNSRecord> files = {
+            {"example.com", "SOA", "ns1.example.com admin.example.com 500 3600 900 1209600 300"},
+            {"example.com", "NS", "ns1.example.com"},
+            {"www.example.com", "A", "198.51.100.1"},
+        };
+        std::string error;
+        auto stageWww = [&] {
+            UpdateMessage message("example.com");
+            message.update("www.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.11");
+            REQUIRE(rcode(updater.stage(message.bytes)) == dns_packet::RCODE_NOERROR);
+        };
+        auto reloadedOnly = [&] {
+            CHECK(snapshotOf(server, "example.com")->soa().serial == 500);
+            auto www = server.queryByType("www.example.com", "A");
+            REQUIRE(www.size() == 1);
+            CHECK(www.front().value == "198.51.100.1");
+        };
+
+        stageWww();
+        REQUIRE(server.reload(files, error));
+        auto outcome = updater.commit();
+        CHECK(outcome.published() == 0);
+        CHECK_FALSE(outcome.published("example.com"));
+        reloadedOnly();
+
+        // Also when the reload is followed between the batch and its commit
+        stageWww();
+        REQUIRE(server.reload(files, error));
+        updater.followReload();
+        CHECK(updater.empty());
+        outcome = updater.commit();
+        CHECK_FALSE(outcome.published("example.com"));
+        reloadedOnly();
+
+        // A batch staged after the reload goes through
+        stageWww();
+        CHECK(updater.commit().published("example.com"));
+        CHECK(server.queryByType("www.example.com", "A").size() == 2);
+        CHECK(snapshotOf(server, "example.com")->soa().serial == 501);
+    }
+
+    SECTION("A Newer Serial From The Update Is Kept") {
+        UpdateMessage message("example.com");
+        message.update("example.com", TYPE_SOA, dns_packet::CLASS_IN,
+                       "ns1.example.com admin.example.com 2000 7200 900 1209600 300");
+        CHECK(rcode(updater.stage(message.bytes)) == dns_packet::RCODE_NOERROR);
+        updater.commit();
+        auto snapshot = snapshotOf(server, "example.com");
+        CHECK(snapshot->soa().serial == 2000);
+        CHECK(snapshot->soa().refresh == 7200);
+    }
+
+    SECTION("Malformed Or Foreign Updates Are Rejected") {
+        UpdateMessage foreign("example.org");
+        foreign.update("www.example.org", TYPE_A, dns_packet::CLASS_IN, "192.0.2.1");
+        CHECK(rcode(updater.stage(foreign.bytes)) == dns_packet::RCODE_NOTAUTH);
+
+        UpdateMessage belowApex("www.example.com");
+        CHECK(rcode(updater.stage(belowApex.bytes)) == dns_packet::RCODE_NOTAUTH);
+
+        UpdateMessage truncated("example.com");
+        truncated.update("www.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.1");
+        truncated.bytes.pop_back();
+        CHECK(rcode(updater.stage(truncated.bytes)) == dns_packet::RCODE_FORMERR);
+        CHECK(updater.empty());
+
+        // The query path never applies updates itself
+        UpdateMessage viaQueryPath("example.com");
+        CHECK(rcode(createDNSResponse(viaQueryPath.bytes, server)) == dns_packet::RCODE_REFUSED);
+    }
+
+    SECTION("Secondary Zones Are Not Updated Here") {
+        updater.setSecondary([](std::span<const uint8_t> apex) {
+            return std::ranges::equal(apex, dns_packet::encodeDomainName("example.com"));
+        });
+        UpdateMessage message("example.com");
+        message.update("new.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.20");
+        CHECK(rcode(updater.stage(message.bytes)) == dns_packet::RCODE_NOTAUTH);
+        CHECK(updater.empty());
+    }
+}
+
+TEST_CASE("Copy-On-Write Snapshot Versions", "[update]") {
+    DNSServer server;
+    server.addRecord("example.com", "SOA", "ns1.example.com admin.example.com 1 3600 900 1209600 300");
+    server.addRecord("example.com", "NS", "ns1.example.com");
+    constexpr int HOSTS = 3000;
+    for (int i = 0; i < HOSTS; ++i) {
+        server.addRecord("host" + std::to_string(i) + ".example.com", RecordType::A, "192.0.2.1");
+    }
+    server.addRecord("mx.example.com", "MX", "10 host1.example.com");
+    server.publish();
+    ZoneUpdater updater(server);
+    auto flat = snapshotOf(server, "example.com");
+    size_t owners = flat->ownerCount();
+
+    SECTION("Only Changed Names Are Encoded Into The New Version") {
+        UpdateMessage message("example.com");
+        message.update("host1.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.2")
+               .update("host2.example.com", dns_packet::QTYPE_ANY, dns_packet::CLASS_ANY)
+               .update("fresh.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.3");
+        REQUIRE(rcode(updater.stage(message.bytes)) == dns_packet::RCODE_NOERROR);
+        updater.commit();
+
+        auto next = snapshotOf(server, "example.com");
+        CHECK(next->overlayCount() == 4);   // Three names and the apex with its new SOA
+        CHECK(next->ownerCount() == owners);
+        CHECK(next->recordCount() == flat->recordCount() + 1);
+        CHECK(answers(server, "host1.example.com", TYPE_A) == 2);
+        CHECK(answers(server, "host3.example.com", TYPE_A) == 1);
+        CHECK(rcode(createDNSResponse(question("host2.example.com", TYPE_A), server)) ==
+              dns_packet::RCODE_NXDOMAIN);
+
+        // Every live name is visited once across both layers
+        size_t visited = 0;
+        next->forEachOwner([&](const ZoneSnapshot::Owner&) { visited++; });
+        CHECK(visited == owners);
+
+        // A second version replaces the overlay rather than stacking on it
+        UpdateMessage again("example.com");
+        again.update("host2.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.4");
+        REQUIRE(rcode(updater.stage(again.bytes)) == dns_packet::RCODE_NOERROR);
+        updater.commit();
+        auto third = snapshotOf(server, "example.com");
+        CHECK(third->overlayCount() == 4);
+        CHECK(third->ownerCount() == owners + 1);
+        CHECK(answers(server, "host2.example.com", TYPE_A) == 1);
+        CHECK(answers(server, "fresh.example.com", TYPE_A) == 1);
+        CHECK(third->soa().serial == 3);
+    }
+
+    SECTION("Glue Follows Targets The Overlay Changes") {
+        auto glue = [&](const std::string& name, uint16_t qtype) {
+            return dns_packet::readUint16(createDNSResponse(question(name, qtype), server), 10);
+        };
+        CHECK(glue("mx.example.com", 15) == 1);
+        CHECK(glue("example.com", TYPE_NS) == 0);
+
+        UpdateMessage message("example.com");
+        message.update("host1.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.2")
+               .update("ns1.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.53");
+        REQUIRE(rcode(updater.stage(message.bytes)) == dns_packet::RCODE_NOERROR);
+        updater.commit();
+        CHECK(snapshotOf(server, "example.com")->overlayCount() > 0);
+        CHECK(glue("mx.example.com", 15) == 2);
+        CHECK(glue("example.com", TYPE_NS) == 1);   // The apex is in the overlay with its new SOA
+
+        UpdateMessage remove("example.com");
+        remove.update("host1.example.com", dns_packet::QTYPE_ANY, dns_packet::CLASS_ANY);
+        REQUIRE(rcode(updater.stage(remove.bytes)) == dns_packet::RCODE_NOERROR);
+        updater.commit();
+        CHECK(glue("mx.example.com", 15) == 0);
+    }
+
+    SECTION("A Large Overlay Is Compacted Into A Flat Version") {
+        UpdateMessage message("example.com");
+        for (int i = 0; i < HOSTS / 2; ++i) {
+            message.update("host" + std::to_string(i) + ".example.com", TYPE_TXT, dns_packet::CLASS_IN, "bulk");
+        }
+        REQUIRE(rcode(updater.stage(message.bytes)) == dns_packet::RCODE_NOERROR);
+        updater.commit();
+
+        auto next = snapshotOf(server, "example.com");
+        CHECK(next->overlayCount() == 0);
+        CHECK(next->ownerCount() == owners);
+        CHECK(next->recordCount() == flat->recordCount() + HOSTS / 2);
+        CHECK(answers(server, "host0.example.com", dns_packet::QTYPE_ANY) == 2);
+        CHECK(answers(server, "host2999.example.com", dns_packet::QTYPE_ANY) == 1);
+    }
+}
+
+TEST_CASE("RDATA Decoding", "[update]") {
+    auto roundTrip = [](uint16_t type, const std::string& value) {
+        std::vector<uint8_t> rdata;
+        REQUIRE(dns_packet::encodeRData(type, value, rdata));
+        std::string text;
+        REQUIRE(dns_packet::decodeRData(type, rdata, 0, rdata.size(), text));
+        return text;
+    };
+
+    CHECK(roundTrip(TYPE_A, "192.0.2.1") == "192.0.2.1");
+    CHECK(roundTrip(28, "2001:db8::1") == "2001:db8::1");
+    CHECK(roundTrip(TYPE_NS, "NS1.Example.com") == "ns1.example.com");
+    CHECK(roundTrip(15, "10 mail.example.com") == "10 mail.example.com");
+    CHECK(roundTrip(33, "0 5 5060 sip.example.com") == "0 5 5060 sip.example.com");
+    CHECK(roundTrip(TYPE_TXT, "This is a test record") == "This is a test record");
+    CHECK(roundTrip(TYPE_SOA, "ns1.example.com admin.example.com 7 3600 900 1209600 300") ==
+          "ns1.example.com admin.example.com 7 3600 900 1209600 300");
+
+    std::vector<uint8_t> rdata;
+    CHECK_FALSE(dns_packet::encodeRData(33, "0 5 sip.example.com", rdata));
+
+    // Names that do not fit the wire format are refused, not mangled
+    CHECK(roundTrip(TYPE_CNAME, "www.example.com.") == "www.example.com");
+    CHECK_FALSE(dns_packet::encodeRData(TYPE_CNAME, "a..example.com", rdata));
+    CHECK_FALSE(dns_packet::encodeRData(TYPE_NS, std::string(200, 'a') + ".example.com", rdata));
+    CHECK_FALSE(dns_packet::encodeRData(15, "10 " + std::string(64, 'm') + ".example.com", rdata));
+    std::string longName;
+    for (int i = 0; i < 5; ++i) longName += std::string(60, 'x') + ".";
+    CHECK_FALSE(dns_packet::encodeRData(TYPE_NS, longName + "com", rdata));
+    CHECK_FALSE(dns_packet::encodeRData(TYPE_SOA, "ns1..example.com admin.example.com 7 3600 900 1209600 300",
+                                        rdata));
+    CHECK(rdata.empty());
+    CHECK(dns_packet::encodeDomainName("a..example.com").empty());
+
+    std::vector<uint8_t> shortAddress = {192, 0, 2};
+    std::string text;
+    CHECK_FALSE(dns_packet::decodeRData(TYPE_A, shortAddress, 0, shortAddress.size(), text));
+}
+
+TEST_CASE("Update Journal", "[update]") {
+    std::string path = "/tmp/dns_update_journal_test." + std::to_string(getpid());
+    std::remove(path.c_str());
+
+    SECTION("Entries Round-Trip Through The Encoding") {
+        ZoneDelta delta;
+        REQUIRE(dns_packet::SOAData::parse("ns1.example.com admin.example.com 7 3600 900 1209600 300", delta.soa));
+        std::vector<uint8_t> tail;
+        REQUIRE(dns_packet::appendRecordTail(tail, TYPE_A, dns_packet::DEFAULT_TTL, "192.0.2.1"));
+        auto www = dns_packet::encodeDomainName("www.example.com");
+        auto gone = dns_packet::encodeDomainName("gone.example.com");
+        delta.owners[www] = {tail, tail};
+        delta.owners[gone] = {};
+
+        std::vector<uint8_t> payload;
+        Journal::encode("example.com", delta, payload);
+        std::string origin;
+        ZoneDelta decoded;
+        REQUIRE(Journal::decode(payload, origin, decoded));
+        CHECK(origin == "example.com");
+        CHECK(decoded.soa.serial == 7);
+        CHECK(decoded.owners == delta.owners);
+        CHECK_FALSE(decoded.fromSerial);
+
+        delta.fromSerial = 6;
+        payload.clear();
+        Journal::encode("example.com", delta, payload);
+        REQUIRE(Journal::decode(payload, origin, decoded));
+        CHECK(decoded.fromSerial == 6u);
+
+        payload.pop_back();
+        CHECK_FALSE(Journal::decode(payload, origin, decoded));
+
+        // Standard CRC-32C check value
+        std::string digits = "123456789";
+        CHECK(Journal::checksum({reinterpret_cast<const uint8_t*>(digits.data()), digits.size()}) == 0xE3069283);
+    }
+
+    SECTION("A Batch Is Flushed Once And Replayed After A Restart") {
+        {
+            DNSServer server;
+            loadZone(server);
+            ZoneUpdater updater(server);
+            Journal journal;
+            REQUIRE(journal.open(path));
+            CHECK(journal.replay([](std::string_view, const ZoneDelta&) {}) == 0);
+            updater.setJournal(&journal);
+
+            for (int i = 0; i < 10; ++i) {
+                UpdateMessage message("example.com");
+                message.update("h" + std::to_string(i) + ".example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.60");
+                REQUIRE(rcode(updater.stage(message.bytes)) == dns_packet::RCODE_NOERROR);
+            }
+            updater.commit();
+            UpdateMessage remove("example.com");
+            remove.update("www.example.com", dns_packet::QTYPE_ANY, dns_packet::CLASS_ANY);
+            REQUIRE(rcode(updater.stage(remove.bytes)) == dns_packet::RCODE_NOERROR);
+            updater.commit();
+
+            CHECK(journal.stats().entries == 2);
+            CHECK(journal.stats().syncs == 2);
+        }
+
+        // A crash in the middle of the next write leaves a torn entry
+        {
+            std::FILE* file = std::fopen(path.c_str(), "ab");
+            REQUIRE(file != nullptr);
+            const uint8_t torn[] = {0x00, 0x00, 0x01, 0x00, 0xDE, 0xAD};
+            std::fwrite(torn, 1, sizeof(torn), file);
+            std::fclose(file);
+        }
+
+        DNSServer restarted;
+        loadZone(restarted);
+        Journal journal;
+        REQUIRE(journal.open(path));
+        size_t replayed = journal.replay([&](std::string_view origin, const ZoneDelta& delta) {
+            CHECK(restarted.applyDelta(origin, delta));
+        });
+        CHECK(replayed == 2);
+        CHECK(answers(restarted, "h9.example.com", TYPE_A) == 1);
+        CHECK(rcode(createDNSResponse(question("www.example.com", TYPE_A), restarted)) ==
+              dns_packet::RCODE_NXDOMAIN);
+        CHECK(snapshotOf(restarted, "example.com")->soa().serial == 102);
+
+        // The torn tail is gone, so entries appended now are found next time
+        ZoneUpdater updater(restarted);
+        updater.setJournal(&journal);
+        UpdateMessage more("example.com");
+        more.update("late.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.61");
+        REQUIRE(rcode(updater.stage(more.bytes)) == dns_packet::RCODE_NOERROR);
+        updater.commit();
+
+        Journal reopened;
+        REQUIRE(reopened.open(path));
+        CHECK(reopened.replay([](std::string_view, const ZoneDelta&) {}) == 3);
+    }
+
+    SECTION("Entries That No Longer Follow The Zone Are Refused") {
+        {
+            DNSServer server;
+            loadZone(server);
+            ZoneUpdater updater(server);
+            Journal journal;
+            REQUIRE(journal.open(path));
+            updater.setJournal(&journal);
+            UpdateMessage remove("example.com");
+            remove.update("www.example.com", dns_packet::QTYPE_ANY, dns_packet::CLASS_ANY);
+            REQUIRE(rcode(updater.stage(remove.bytes)) == dns_packet::RCODE_NOERROR);
+            updater.commit();
+        }
+
+        // The zone file was edited and its serial raised before the restart
+        DNSServer restarted;
+        restarted.addRecord("example.com", "SOA", "ns1.example.com admin.example.com 500 3600 900 1209600 300");
+        restarted.addRecord("example.com", "NS", "ns1.example.com");
+        restarted.addRecord("www.example.com", RecordType::A, "192.0.2.10");
+        restarted.publish();
+        Journal journal;
+        REQUIRE(journal.open(path));
+        size_t refused = 0;
+        CHECK(journal.replay([&](std::string_view origin, const ZoneDelta& delta) {
+            refused += !restarted.applyDelta(origin, delta);
+        }) == 1);
+        CHECK(refused == 1);
+        CHECK(answers(restarted, "www.example.com", TYPE_A) == 1);
+        CHECK(snapshotOf(restarted, "example.com")->soa().serial == 500);
+
+        // Replaying an entry twice changes nothing either
+        DNSServer original;
+        loadZone(original);
+        size_t applied = 0;
+        auto apply = [&](std::string_view origin, const ZoneDelta& delta) { applied += original.applyDelta(origin, delta); };
+        CHECK(journal.replay(apply) == 1);
+        CHECK(journal.replay(apply) == 1);
+        CHECK(applied == 1);
+        CHECK(snapshotOf(original, "example.com")->soa().serial == 101);
+    }
+
+    SECTION("A Reload Starts A New Generation That A Restart Reproduces") {
+        const std::vector<DNSRecord> files = {
+            {"example.com", "SOA", "ns1.example.com admin.example.com 100 3600 900 1209600 300"},
+            {"example.com", "NS", "ns1.example.com"},
+            {"www.example.com", "A", "192.0.2.10"},
+        };
+        auto add = [](ZoneUpdater& updater, const std::string& name) {
+            UpdateMessage message("example.com");
+            message.update(name, TYPE_A, dns_packet::CLASS_IN, "192.0.2.70");
+            REQUIRE(rcode(updater.stage(message.bytes)) == dns_packet::RCODE_NOERROR);
+            updater.commit();
+        };
+        std::string error;
+        {
+            DNSServer server;
+            REQUIRE(server.reload(files, error));
+            ZoneUpdater updater(server);
+            Journal journal;
+            REQUIRE(journal.open(path));
+            updater.setJournal(&journal);
+            size_t restarts = 0;
+            updater.setReloadHandler([&] {
+                journal.restart();
+                restarts++;
+            });
+            add(updater, "before.example.com");
+            CHECK(answers(server, "before.example.com", TYPE_A) == 1);
+
+            // The files did not change, so the zone is back at the same serial
+            REQUIRE(server.reload(files, error));
+            CHECK(answers(server, "before.example.com", TYPE_A) == 0);
+            updater.followReload();
+            updater.followReload();
+            CHECK(restarts == 1);
+
+            // A delta made before the reload no longer applies
+            ZoneDelta stale;
+            stale.soa = snapshotOf(server, "example.com")->soa();
+            stale.soa.serial++;
+            stale.generation = server.generation() - 1;
+            CHECK_FALSE(server.applyDelta("example.com", stale));
+
+            add(updater, "after.example.com");
+            CHECK(answers(server, "after.example.com", TYPE_A) == 1);
+        }
+
+        // The restart serves what the reloaded instance did
+        DNSServer restarted;
+        REQUIRE(restarted.reload(files, error));
+        Journal journal;
+        REQUIRE(journal.open(path));
+        CHECK(journal.replay([&](std::string_view origin, const ZoneDelta& delta) {
+            CHECK(restarted.applyDelta(origin, delta));
+        }) == 1);
+        CHECK(answers(restarted, "before.example.com", TYPE_A) == 0);
+        CHECK(answers(restarted, "after.example.com", TYPE_A) == 1);
+        CHECK(snapshotOf(restarted, "example.com")->soa().serial == 101);
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Snapshot Checkpoints", "[update]") {
+    std::string path = "/tmp/dns_checkpoint_test." + std::to_string(getpid());
+    std::string journalPath = path + ".journal";
+    std::remove(path.c_str());
+    std::remove(journalPath.c_str());
+
+    DNSServer server;
+    server.setSnapshotOptions({.perfectHash = true, .buildThreads = 2});
+    server.addRecord("2.0.192.in-addr.arpa", "SOA", "ns1.example.com admin.example.com 5 3600 900 1209600 300");
+    server.addRecord("1.2.0.192.in-addr.arpa", "PTR", "www.example.com");
+    loadZone(server);
+    ZoneUpdater updater(server);
+    Journal journal;
+    REQUIRE(journal.open(path + ".journal"));
+    updater.setJournal(&journal);
+
+    // The checkpoint holds an overlay version, and the journal goes on after it
+    UpdateMessage before("example.com");
+    before.update("before.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.70");
+    REQUIRE(rcode(updater.stage(before.bytes)) == dns_packet::RCODE_NOERROR);
+    updater.commit();
+    REQUIRE(snapshotOf(server, "example.com")->overlayCount() > 0);
+    Checkpointer checkpointer(server, path);
+    REQUIRE(checkpointer.start(journal.position()));
+    checkpointer.wait();
+    REQUIRE(checkpointer.stats().written == 1);
+    CHECK(checkpointer.stats().lastZones == 2);
+
+    UpdateMessage after("example.com");
+    after.update("after.example.com", TYPE_A, dns_packet::CLASS_IN, "192.0.2.71");
+    REQUIRE(rcode(updater.stage(after.bytes)) == dns_packet::RCODE_NOERROR);
+    updater.commit();
+
+    SECTION("A Restart Serves The Checkpoint And Replays Only The Tail") {
+        std::vector<ZoneImage> images;
+        uint64_t journalFrom = 0;
+        std::string error;
+        REQUIRE(checkpoint::read(path, images, journalFrom, error));
+        REQUIRE(images.size() == 2);
+        DNSServer restarted;
+        REQUIRE(restarted.restore(std::move(images)));
+        CHECK(answers(restarted, "before.example.com", TYPE_A) == 1);
+        CHECK(answers(restarted, "after.example.com", TYPE_A) == 0);
+        CHECK(answers(restarted, "1.2.0.192.in-addr.arpa", 12) == 1);
+        CHECK(snapshotOf(restarted, "2.0.192.in-addr.arpa")->reverseIndexed());
+        CHECK(snapshotOf(restarted, "2.0.192.in-addr.arpa")->hasPerfectHash());
+
+        Journal reopened;
+        REQUIRE(reopened.open(journalPath));
+        size_t replayed = reopened.replay([&](std::string_view origin, const ZoneDelta& delta) {
+            CHECK(restarted.applyDelta(origin, delta));
+        }, journalFrom);
+        CHECK(replayed == 1);
+        CHECK(answers(restarted, "after.example.com", TYPE_A) == 1);
+        CHECK(answers(restarted, "www.example.com", TYPE_A) == 1);
+        CHECK(snapshotOf(restarted, "example.com")->soa().serial == snapshotOf(server, "example.com")->soa().serial);
+    }
+
+    SECTION("A Checkpoint Is Served In Place And Written Back Byte For Byte") {
+        auto contents = [](const std::string& file) {
+            std::vector<uint8_t> bytes;
+            std::FILE* in = std::fopen(file.c_str(), "rb");
+            REQUIRE(in != nullptr);
+            for (int c; (c = std::fgetc(in)) != EOF;) bytes.push_back(static_cast<uint8_t>(c));
+            std::fclose(in);
+            return bytes;
+        };
+        std::vector<uint8_t> written = contents(path);
+        std::vector<ZoneImage> images;
+        uint64_t journalFrom = 0;
+        std::string error;
+        REQUIRE(checkpoint::read(path, images, journalFrom, error));
+        DNSServer restarted;
+        REQUIRE(restarted.restore(std::move(images)));
+
+        // The restored tables live in the mapping, which outlasts the file
+        std::remove(path.c_str());
+        CHECK(answers(restarted, "before.example.com", TYPE_A) == 1);
+        CHECK(answers(restarted, "1.2.0.192.in-addr.arpa", 12) == 1);
+
+        std::string again = path + ".again";
+        checkpoint::write(again, restarted.capture(), journalFrom);
+        CHECK(contents(again) == written);
+        std::remove(again.c_str());
+
+        // Separately built copies of a zone checkpoint to the same bytes,
+        // padding inside the index entries included
+        std::vector<std::vector<uint8_t>> copies;
+        for (int copy = 0; copy < 2; ++copy) {
+            DNSServer twin;
+            twin.setSnapshotOptions({.perfectHash = true, .buildThreads = 2});
+            twin.addRecord("2.0.192.in-addr.arpa", "SOA", "ns1.example.com admin.example.com 5 3600 900 1209600 300");
+            twin.addRecord("1.2.0.192.in-addr.arpa", "PTR", "www.example.com");
+            twin.addRecord("2.2.0.192.in-addr.arpa", "PTR", "mail.example.com");
+            twin.publish();
+            checkpoint::write(again, twin.capture(), 0);
+            copies.push_back(contents(again));
+        }
+        CHECK(copies[0] == copies[1]);
+        std::remove(again.c_str());
+    }
+
+    SECTION("A Damaged Checkpoint Is Refused") {
+        REQUIRE(truncate(path.c_str(), 100) == 0);
+        std::vector<ZoneImage> images;
+        uint64_t journalFrom = 0;
+        std::string error;
+        CHECK_FALSE(checkpoint::read(path, images, journalFrom, error));
+        CHECK_FALSE(error.empty());
+        CHECK(images.empty());
+        CHECK_FALSE(checkpoint::read(path + ".missing", images, journalFrom, error));
+    }
+
+    SECTION("A Checkpoint With A Flipped Bit Fails Its Checksum") {
+        // Somewhere in the snapshot arrays, past the header and the end mark checks
+        std::FILE* file = std::fopen(path.c_str(), "r+b");
+        REQUIRE(file != nullptr);
+        REQUIRE(std::fseek(file, 0, SEEK_END) == 0);
+        long size = std::ftell(file);
+        REQUIRE(std::fseek(file, size / 2, SEEK_SET) == 0);
+        int byte = std::fgetc(file);
+        REQUIRE(byte != EOF);
+        REQUIRE(std::fseek(file, size / 2, SEEK_SET) == 0);
+        std::fputc(byte ^ 0x10, file);
+        std::fclose(file);
+
+        std::vector<ZoneImage> images;
+        uint64_t journalFrom = 0;
+        std::string error;
+        CHECK_FALSE(checkpoint::read(path, images, journalFrom, error));
+        CHECK(error.find("checksum") != std::string::npos);
+        CHECK(images.empty());
+    }
+
+    std::remove(path.c_str());
+    std::remove(journalPath.c_str());
+}
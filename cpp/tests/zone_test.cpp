@@ -0,0 +1,1198 @@
+#include "catch.hpp"
+#include "../src/answer_subset.h"
+#include "../src/dns_server.h"
+#include "../src/dns_response.h"
+#include "../src/reverse_index.h"
+#include "../src/reverse_name.h"
+#include "../src/scratch_arena.h"
+#include "../src/zone.h"
+#include "../src/zone_reload.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    // Minimal wire-format question for the packet path
+    std::vector<uint8_t> buildQuery(const std::string& name, uint16_t qtype) {
+        std::vector<uint8_t> packet = {0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+        auto encoded = dns_packet::encodeDomainName(name);
+        packet.insert(packet.end(), encoded.begin(), encoded.end());
+        dns_packet::appendUint16(packet, qtype);
+        dns_packet::appendUint16(packet, dns_packet::CLASS_IN);
+        return packet;
+    }
+
+    uint8_t rcodeOf(const std::vector<uint8_t>& response) {
+        return response[3] & 0x0F;
+    }
+
+    uint16_t answerCountOf(const std::vector<uint8_t>& response) {
+        return dns_packet::readUint16(response, 6);
+    }
+
+    // RDATA of the first answer of a response to a single question
+    std::vector<uint8_t> firstAnswerRData(const std::vector<uint8_t>& response) {
+        size_t offset = dns_packet::HEADER_SIZE;
+        dns_packet::WireName question;
+        if (!question.parse(response, offset)) return {};
+        offset += 4 + 2 + 8;   // QTYPE, QCLASS, owner pointer, TYPE..TTL
+        uint16_t length = dns_packet::readUint16(response, offset);
+        return {response.begin() + offset + 2, response.begin() + offset + 2 + length};
+    }
+
+    // Owner and type of every RR in one section: 0 answer, 1 authority,
+    // 2 additional
+    std::vector<std::pair<std::string, uint16_t>> sectionOf(const std::vector<uint8_t>& response, int section) {
+        size_t offset = dns_packet::HEADER_SIZE;
+        dns_packet::WireName name;
+        if (!name.parse(response, offset)) return {};
+        offset += 4;
+        size_t skip = 0;
+        for (int i = 0; i < section; ++i) skip += dns_packet::readUint16(response, 6 + 2 * i);
+        std::vector<std::pair<std::string, uint16_t>> records;
+        for (size_t i = 0; i < skip + dns_packet::readUint16(response, 6 + 2 * section); ++i) {
+            if (!name.parse(response, offset)) return {};
+            uint16_t type = dns_packet::readUint16(response, offset);
+            if (i >= skip) records.emplace_back(name.toString(), type);
+            offset += 10 + dns_packet::readUint16(response, offset + 8);
+        }
+        return records;
+    }
+
+    // TTL of the first authority RR
+    uint32_t authorityTtlOf(const std::vector<uint8_t>& response) {
+        size_t offset = dns_packet::HEADER_SIZE;
+        dns_packet::WireName name;
+        if (!name.parse(response, offset)) return 0;
+        offset += 4;
+        for (size_t i = 0; i <= dns_packet::readUint16(response, 6); ++i) {
+            if (!name.parse(response, offset)) return 0;
+            if (i == dns_packet::readUint16(response, 6)) break;
+            offset += 10 + dns_packet::readUint16(response, offset + 8);
+        }
+        return (static_cast<uint32_t>(dns_packet::readUint16(response, offset + 4)) << 16) |
+               dns_packet::readUint16(response, offset + 6);
+    }
+
+    std::vector<std::pair<std::string, uint16_t>> additionalOf(const std::vector<uint8_t>& response) {
+        return sectionOf(response, 2);
+    }
+
+    // Query with an OPT record appended to the additional section
+    std::vector<uint8_t> withOpt(std::vector<uint8_t> query, uint16_t payload, uint8_t version = 0) {
+        auto opt = dns_packet::optRecord(payload);
+        opt[6] = version;
+        query.insert(query.end(), opt.begin(), opt.end());
+        dns_packet::writeUint16(query, 10, dns_packet::readUint16(query, 10) + 1);
+        return query;
+    }
+
+    std::string soaFor(const std::string& zone) {
+        return "ns1." + zone + " admin." + zone + " 1 3600 900 1209600 300";
+    }
+}
+
+TEST_CASE("Wire Names", "[zone]") {
+    SECTION("Parse Lowercases And Records Labels") {
+        auto packet = buildQuery("WWW.Example.COM", 1);
+        dns_packet::WireName name;
+        size_t offset = dns_packet::HEADER_SIZE;
+        REQUIRE(name.parse(packet, offset));
+        CHECK(offset == packet.size() - 4);
+        CHECK(name.labelCount() == 3);
+        CHECK(name.toString() == "www.example.com");
+
+        dns_packet::WireName apex;
+        REQUIRE(apex.assign("example.com."));
+        CHECK(std::vector<uint8_t>(name.suffix(2).begin(), name.suffix(2).end()) ==
+              std::vector<uint8_t>(apex.bytes().begin(), apex.bytes().end()));
+    }
+
+    SECTION("Suffix Hashes Match Whole-Name Hashes") {
+        dns_packet::WireName name;
+        REQUIRE(name.assign("a.b.example.com"));
+        uint64_t hashes[dns_packet::WireName::MAX_LABELS + 1];
+        name.suffixHashes(hashes);
+
+        for (size_t labels = 0; labels <= name.labelCount(); ++labels) {
+            CHECK(hashes[name.labelCount() - labels] == dns_packet::hashName(name.suffix(labels)));
+        }
+        CHECK(hashes[0] == name.hash());
+    }
+
+    SECTION("Compression Loops Are Rejected") {
+        std::vector<uint8_t> packet = {0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0, 0, 0, 0, 0, 0, 0xC0, 0x0C};
+        dns_packet::WireName name;
+        size_t offset = dns_packet::HEADER_SIZE;
+        CHECK_FALSE(name.parse(packet, offset));
+    }
+}
+
+TEST_CASE("Zone Registry", "[zone]") {
+    SECTION("Longest Suffix Wins Among Thousands Of Zones") {
+        std::vector<std::shared_ptr<Zone>> zones;
+        for (int i = 0; i < 5000; ++i) {
+            dns_packet::WireName origin;
+            REQUIRE(origin.assign("zone" + std::to_string(i) + ".example"));
+            zones.push_back(std::make_shared<Zone>(origin, nullptr));
+        }
+        dns_packet::WireName nested;
+        REQUIRE(nested.assign("sub.zone42.example"));
+        zones.push_back(std::make_shared<Zone>(nested, nullptr));
+        ZoneRegistry registry(zones);
+
+        dns_packet::WireName name;
+        REQUIRE(name.assign("host.sub.ZONE42.example"));
+        const Zone* zone = registry.select(name);
+        REQUIRE(zone != nullptr);
+        CHECK(zone->origin() == "sub.zone42.example");
+
+        REQUIRE(name.assign("host.zone4999.example"));
+        zone = registry.select(name);
+        REQUIRE(zone != nullptr);
+        CHECK(zone->origin() == "zone4999.example");
+
+        REQUIRE(name.assign("zone5000.example"));
+        CHECK(registry.select(name) == nullptr);
+        CHECK(registry.find("zone17.example") != nullptr);
+        CHECK(registry.size() == 5001);
+    }
+
+    SECTION("Each Zone Gets Its Own SOA And Snapshot") {
+        DNSServer server;
+        server.addRecord("example.com", "SOA", soaFor("example.com"));
+        server.addRecord("example.com", RecordType::A, "192.0.2.1");
+        server.addRecord("example.net", "SOA", soaFor("example.net"));
+        server.addRecord("www.example.net", RecordType::A, "192.0.2.9");
+        server.publish();
+
+        auto zones = server.zones();
+        REQUIRE(zones != nullptr);
+        REQUIRE(zones->size() == 2);
+
+        auto com = zones->find("example.com")->snapshot();
+        auto net = zones->find("example.net")->snapshot();
+        CHECK(com->soa().mname == "ns1.example.com");
+        CHECK(net->soa().mname == "ns1.example.net");
+        CHECK(com->ownerCount() == 1);
+        CHECK(net->ownerCount() == 2);
+    }
+}
+
+TEST_CASE("Zone-Aware Responses", "[zone]") {
+    DNSServer server;
+    server.addRecord("example.com", "SOA", soaFor("example.com"));
+    server.addRecord("example.com", RecordType::A, "192.0.2.1");
+    server.addRecord("example.com", "NS", "ns1.example.com");
+    server.addRecord("example.com", "NS", "ns2.example.com");
+    server.addRecord("outside.org", RecordType::A, "192.0.2.50");
+    server.publish();
+
+    SECTION("Known Name Is Answered Authoritatively") {
+        auto response = createDNSResponse(buildQuery("Example.com", 2), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NOERROR);
+        CHECK((response[2] & dns_packet::FLAG_AA) != 0);
+        CHECK(answerCountOf(response) == 2);
+    }
+
+    SECTION("Unknown Name Inside A Zone Is NXDOMAIN") {
+        auto response = createDNSResponse(buildQuery("missing.example.com", 1), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NXDOMAIN);
+        CHECK(answerCountOf(response) == 0);
+    }
+
+    SECTION("Existing Name Without The Type Is NODATA") {
+        auto response = createDNSResponse(buildQuery("example.com", 16), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NOERROR);
+        CHECK(answerCountOf(response) == 0);
+    }
+
+    SECTION("Names Outside Every Zone Are REFUSED") {
+        auto response = createDNSResponse(buildQuery("outside.org", 1), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_REFUSED);
+        CHECK((response[2] & dns_packet::FLAG_AA) == 0);
+
+        response = createDNSResponse(buildQuery("nonexistent-domain-12345.com", 1), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_REFUSED);
+    }
+
+    SECTION("Malformed Question Is FORMERR") {
+        auto query = buildQuery("example.com", 1);
+        query.resize(query.size() - 3);
+        auto response = createDNSResponse(query, server);
+        REQUIRE(response.size() == dns_packet::HEADER_SIZE);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_FORMERR);
+    }
+}
+
+TEST_CASE("Truncation At Record Boundaries", "[zone]") {
+    DNSServer server;
+    server.setRRsetOrder(RRsetOrder::Fixed);
+    server.addRecord("example.com", "SOA", soaFor("example.com"));
+    for (int i = 0; i < 40; ++i) server.addRecord("many.example.com", RecordType::A, "192.0.2." + std::to_string(i));
+    server.addRecord("many.example.com", "TXT", std::string(200, 'x'));
+    server.publish();
+    auto query = buildQuery("many.example.com", 1);
+
+    SECTION("UDP Replies Stop At The Last Whole RR And Set TC") {
+        auto response = createDNSResponse(query, server);
+        size_t fits = (MAX_DNS_PACKET_SIZE - query.size()) / 16;
+        CHECK((response[2] & dns_packet::FLAG_TC) != 0);
+        CHECK(answerCountOf(response) == fits);
+        CHECK(response.size() == query.size() + 16 * fits);
+        CHECK(response.back() == fits - 1);   // Last octet of the last address that fit
+    }
+
+    SECTION("A Record That Does Not Fit Ends The Answer Section") {
+        auto response = createDNSResponse(buildQuery("many.example.com", 255), server);
+        CHECK((response[2] & dns_packet::FLAG_TC) != 0);
+        CHECK(response.size() <= MAX_DNS_PACKET_SIZE);
+        CHECK(response.size() == buildQuery("many.example.com", 255).size() + 16 * answerCountOf(response));
+    }
+
+    SECTION("TCP Replies Carry Everything") {
+        auto response = createDNSResponse(query, server, Transport::Tcp);
+        CHECK((response[2] & dns_packet::FLAG_TC) == 0);
+        CHECK(answerCountOf(response) == 40);
+        CHECK(answerCountOf(createDNSResponse(buildQuery("many.example.com", 255), server, Transport::Tcp)) == 41);
+    }
+}
+
+TEST_CASE("EDNS", "[zone]") {
+    DNSServer server;
+    server.setRRsetOrder(RRsetOrder::Fixed);
+    server.addRecord("example.com", "SOA", soaFor("example.com"));
+    for (int i = 0; i < 100; ++i) server.addRecord("many.example.com", RecordType::A, "192.0.2." + std::to_string(i));
+    server.publish();
+    auto query = buildQuery("many.example.com", 1);
+
+    SECTION("Plain Queries Get No OPT") {
+        auto response = createDNSResponse(query, server);
+        CHECK(response.size() <= MAX_DNS_PACKET_SIZE);
+        CHECK(dns_packet::readUint16(response, 10) == 0);
+    }
+
+    SECTION("The Advertised Payload Is Honoured Up To The Server Limit") {
+        server.setMaxUdpPayload(4096);
+        auto response = createDNSResponse(withOpt(query, 4096), server);
+        CHECK((response[2] & dns_packet::FLAG_TC) == 0);
+        CHECK(answerCountOf(response) == 100);
+        REQUIRE(dns_packet::readUint16(response, 10) == 1);
+        std::vector<uint8_t> opt(response.end() - dns_packet::OPT_RR_SIZE, response.end());
+        auto expected = dns_packet::optRecord(4096);
+        CHECK(std::ranges::equal(opt, expected));
+
+        server.setMaxUdpPayload(1232);
+        response = createDNSResponse(withOpt(query, 4096), server);
+        CHECK((response[2] & dns_packet::FLAG_TC) != 0);
+        CHECK(response.size() <= 1232);
+        CHECK(response.size() + 16 > 1232);
+        CHECK(dns_packet::readUint16(response, 10) == 1);
+        CHECK(dns_packet::readUint16(response, response.size() - 8) == 1232);
+    }
+
+    SECTION("Small Payloads Count As 512") {
+        server.setMaxUdpPayload(4096);
+        auto response = createDNSResponse(withOpt(query, 100), server);
+        CHECK((response[2] & dns_packet::FLAG_TC) != 0);
+        CHECK(response.size() <= MAX_DNS_PACKET_SIZE);
+        CHECK(response.size() + 16 > MAX_DNS_PACKET_SIZE);
+    }
+
+    SECTION("Server Limit Is Clamped") {
+        server.setMaxUdpPayload(100000);
+        CHECK(server.maxUdpPayload() == dns_packet::MAX_EDNS_PAYLOAD);
+        server.setMaxUdpPayload(10);
+        CHECK(server.maxUdpPayload() == MAX_DNS_PACKET_SIZE);
+    }
+
+    SECTION("Unknown Versions Get BADVERS") {
+        auto response = createDNSResponse(withOpt(query, 4096, 1), server);
+        CHECK(rcodeOf(response) == 0);
+        CHECK(answerCountOf(response) == 0);
+        REQUIRE(dns_packet::readUint16(response, 10) == 1);
+        CHECK(response[response.size() - 6] == dns_packet::RCODE_BADVERS >> 4);
+    }
+
+    SECTION("Malformed Additional Sections Are FORMERR") {
+        auto twice = withOpt(withOpt(query, 4096), 4096);
+        CHECK(rcodeOf(createDNSResponse(twice, server)) == dns_packet::RCODE_FORMERR);
+
+        auto cut = withOpt(query, 4096);
+        cut.pop_back();
+        CHECK(rcodeOf(createDNSResponse(cut, server)) == dns_packet::RCODE_FORMERR);
+    }
+}
+
+TEST_CASE("Additional Section Glue", "[zone]") {
+    DNSServer server;
+    server.setRRsetOrder(RRsetOrder::Fixed);
+    server.addRecord("example.com", "SOA", soaFor("example.com"));
+    server.addRecord("example.com", "NS", "ns1.example.com");
+    server.addRecord("example.com", "NS", "ns.example.net");
+    server.addRecord("example.com", "MX", "10 Mail.Example.com");
+    server.addRecord("ns1.example.com", RecordType::A, "192.0.2.53");
+    server.addRecord("ns1.example.com", RecordType::AAAA, "2001:db8::53");
+    server.addRecord("mail.example.com", RecordType::A, "192.0.2.25");
+    server.addRecord("_sip._tcp.example.com", "SRV", "0 5 5060 mail.example.com");
+    server.publish();
+
+    SECTION("NS Answers Carry The Addresses Of In-Zone Servers") {
+        auto response = createDNSResponse(buildQuery("example.com", 2), server);
+        CHECK(answerCountOf(response) == 2);
+        std::vector<std::pair<std::string, uint16_t>> expected = {{"ns1.example.com", 1}, {"ns1.example.com", 28}};
+        CHECK(additionalOf(response) == expected);
+    }
+
+    SECTION("MX And SRV Targets Are Glued Too") {
+        std::vector<std::pair<std::string, uint16_t>> expected = {{"mail.example.com", 1}};
+        CHECK(additionalOf(createDNSResponse(buildQuery("example.com", 15), server)) == expected);
+        CHECK(additionalOf(createDNSResponse(buildQuery("_sip._tcp.example.com", 33), server)) == expected);
+    }
+
+    SECTION("Glue Owners Point Into The Answer") {
+        auto response = createDNSResponse(buildQuery("example.com", 15), server);
+        size_t tail = 10 + 2;   // Owner pointer, TYPE..RDLENGTH
+        size_t answer = buildQuery("example.com", 15).size();
+        size_t glue = response.size() - 16;
+        CHECK(response[glue] == 0xC0);
+        CHECK(response[glue + 1] == answer + tail + 2);   // Past the preference
+        CHECK(response.size() == answer + 2 + 10 + 2 + 18 + 16);
+    }
+
+    SECTION("Other Answers Have No Additional Section") {
+        CHECK(additionalOf(createDNSResponse(buildQuery("ns1.example.com", 1), server)).empty());
+    }
+
+    SECTION("Glue Is Left Out When It Does Not Fit") {
+        for (int i = 0; i < 40; ++i) server.addRecord("mail.example.com", RecordType::A, "192.0.2." + std::to_string(100 + i));
+        server.publish();
+        auto response = createDNSResponse(buildQuery("example.com", 15), server);
+        CHECK((response[2] & dns_packet::FLAG_TC) == 0);
+        CHECK(answerCountOf(response) == 1);
+        CHECK(response.size() <= MAX_DNS_PACKET_SIZE);
+        CHECK(!additionalOf(response).empty());
+        CHECK(additionalOf(response).size() < 41);
+    }
+}
+
+TEST_CASE("CNAME Chains", "[zone]") {
+    constexpr uint16_t A = 1, CNAME = 5, TXT = 16;
+    DNSServer server;
+    server.addRecord("example.com", "SOA", soaFor("example.com"));
+    server.addRecord("a.example.com", "CNAME", "B.example.com");
+    server.addRecord("b.example.com", "CNAME", "c.example.com");
+    server.addRecord("c.example.com", RecordType::A, "192.0.2.7");
+    server.addRecord("loop1.example.com", "CNAME", "loop2.example.com");
+    server.addRecord("loop2.example.com", "CNAME", "loop1.example.com");
+    server.addRecord("outside.example.com", "CNAME", "www.example.net");
+    server.addRecord("dangling.example.com", "CNAME", "nothing.example.com");
+    for (int i = 0; i < 20; ++i) {
+        server.addRecord("hop" + std::to_string(i) + ".example.com", "CNAME",
+                         "hop" + std::to_string(i + 1) + ".example.com");
+    }
+    server.publish();
+
+    SECTION("The Whole Chain And The Final RRset Are Answered Together") {
+        auto response = createDNSResponse(buildQuery("a.example.com", A), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NOERROR);
+        std::vector<std::pair<std::string, uint16_t>> expected = {
+            {"a.example.com", CNAME}, {"b.example.com", CNAME}, {"c.example.com", A}};
+        CHECK(sectionOf(response, 0) == expected);
+        CHECK(firstAnswerRData(createDNSResponse(buildQuery("c.example.com", A), server)) ==
+              std::vector<uint8_t>{192, 0, 2, 7});
+    }
+
+    SECTION("CNAME Queries Are Not Followed") {
+        CHECK(answerCountOf(createDNSResponse(buildQuery("a.example.com", CNAME), server)) == 1);
+        CHECK(answerCountOf(createDNSResponse(buildQuery("a.example.com", dns_packet::QTYPE_ANY), server)) == 1);
+    }
+
+    SECTION("A Final Name Without The Type Ends The Answer") {
+        auto response = createDNSResponse(buildQuery("a.example.com", TXT), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NOERROR);
+        CHECK(answerCountOf(response) == 2);
+    }
+
+    SECTION("Loops, Long Chains And Other Zones Stop The Chain") {
+        auto loop = createDNSResponse(buildQuery("loop1.example.com", A), server);
+        CHECK(rcodeOf(loop) == dns_packet::RCODE_NOERROR);
+        CHECK(answerCountOf(loop) == 2);
+        CHECK(answerCountOf(createDNSResponse(buildQuery("hop0.example.com", A), server)) ==
+              ZoneSnapshot::CnameChain::MAX_LENGTH);
+        CHECK(answerCountOf(createDNSResponse(buildQuery("outside.example.com", A), server)) == 1);
+    }
+
+    SECTION("A Missing Final Name Is NXDOMAIN") {
+        auto response = createDNSResponse(buildQuery("dangling.example.com", A), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NXDOMAIN);
+        CHECK(answerCountOf(response) == 1);
+    }
+}
+
+TEST_CASE("Negative Answers", "[zone]") {
+    constexpr uint16_t A = 1, SOA = 6, TXT = 16, PTR = 12;
+    DNSServer server;
+    server.addRecord("example.com", "SOA", "ns1.example.com admin.example.com 1 3600 900 1209600 60");
+    server.addRecord("www.example.com", RecordType::A, "192.0.2.1");
+    server.addRecord("dangling.example.com", "CNAME", "nothing.example.com");
+    server.addRecord("2.0.192.in-addr.arpa", "SOA", "ns1.example.com admin.example.com 1 3600 900 1209600 86400");
+    server.addRecord("1.2.0.192.in-addr.arpa", "PTR", "www.example.com");
+    server.publish();
+    std::vector<std::pair<std::string, uint16_t>> apexSoa = {{"example.com", SOA}};
+
+    SECTION("NXDOMAIN Carries The SOA With The MINIMUM TTL") {
+        auto response = createDNSResponse(buildQuery("Missing.Deep.example.com", A), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NXDOMAIN);
+        CHECK(answerCountOf(response) == 0);
+        CHECK(sectionOf(response, 1) == apexSoa);
+        CHECK(authorityTtlOf(response) == 60);
+    }
+
+    SECTION("NODATA Carries It Too") {
+        auto response = createDNSResponse(buildQuery("www.example.com", TXT), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NOERROR);
+        CHECK(answerCountOf(response) == 0);
+        CHECK(sectionOf(response, 1) == apexSoa);
+    }
+
+    SECTION("So Does A Chain Ending At A Missing Name") {
+        auto response = createDNSResponse(buildQuery("dangling.example.com", A), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NXDOMAIN);
+        CHECK(answerCountOf(response) == 1);
+        CHECK(sectionOf(response, 1) == apexSoa);
+    }
+
+    SECTION("The TTL Is Capped By The SOA's Own") {
+        auto response = createDNSResponse(buildQuery("9.2.0.192.in-addr.arpa", PTR), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NXDOMAIN);
+        std::vector<std::pair<std::string, uint16_t>> reverseSoa = {{"2.0.192.in-addr.arpa", SOA}};
+        CHECK(sectionOf(response, 1) == reverseSoa);
+        CHECK(authorityTtlOf(response) == dns_packet::DEFAULT_TTL);
+    }
+
+    SECTION("Empty Non-Terminals Are NODATA, Not NXDOMAIN") {
+        // Only a.b.example.com has records; b.example.com exists all the same
+        server.addRecord("a.b.example.com", RecordType::A, "192.0.2.7");
+        server.addRecord("c.example.com", RecordType::A, "192.0.2.8");
+        server.addRecord("x.c.example.com", RecordType::A, "192.0.2.9");
+        server.publish();
+        auto response = createDNSResponse(buildQuery("B.example.com", A), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NOERROR);
+        CHECK(answerCountOf(response) == 0);
+        CHECK(sectionOf(response, 1) == apexSoa);
+        CHECK(rcodeOf(createDNSResponse(buildQuery("z.b.example.com", A), server)) == dns_packet::RCODE_NXDOMAIN);
+        CHECK(answerCountOf(createDNSResponse(buildQuery("a.b.example.com", A), server)) == 1);
+
+        // Through an overlay: names added below new empty non-terminals, and
+        // a deleted name that still has one below it
+        auto name = [](const std::string& text) {
+            auto encoded = dns_packet::encodeDomainName(text);
+            return std::vector<uint8_t>(encoded.begin(), encoded.end());
+        };
+        ZoneDelta delta;
+        delta.soa = server.zones()->find("example.com")->snapshot()->soa();
+        delta.soa.serial++;
+        auto& added = delta.owners[name("n.m.l.example.com")];
+        added.emplace_back();
+        REQUIRE(dns_packet::appendRecordTail(added.back(), A, dns_packet::DEFAULT_TTL, "192.0.2.10"));
+        delta.owners[name("c.example.com")];
+        REQUIRE(server.applyDelta("example.com", delta));
+        REQUIRE(server.zones()->find("example.com")->snapshot()->overlayCount() > 0);
+        for (const char* empty : {"m.l.example.com", "l.example.com", "c.example.com", "b.example.com"}) {
+            INFO(empty);
+            response = createDNSResponse(buildQuery(empty, A), server);
+            CHECK(rcodeOf(response) == dns_packet::RCODE_NOERROR);
+            CHECK(answerCountOf(response) == 0);
+            CHECK(sectionOf(response, 1) == apexSoa);
+        }
+        CHECK(answerCountOf(createDNSResponse(buildQuery("x.c.example.com", A), server)) == 1);
+        CHECK(answerCountOf(createDNSResponse(buildQuery("n.m.l.example.com", A), server)) == 1);
+        CHECK(rcodeOf(createDNSResponse(buildQuery("k.example.com", A), server)) == dns_packet::RCODE_NXDOMAIN);
+    }
+
+    SECTION("Positive Answers Have No Authority Section") {
+        auto response = createDNSResponse(buildQuery("www.example.com", A), server);
+        CHECK(dns_packet::readUint16(response, 8) == 0);
+    }
+}
+
+TEST_CASE("RRset Order", "[zone]") {
+    DNSServer server;
+    server.addRecord("example.com", "SOA", soaFor("example.com"));
+    for (int i = 1; i <= 4; ++i) server.addRecord("pool.example.com", RecordType::A, "192.0.2." + std::to_string(i));
+    server.addRecord("single.example.com", RecordType::A, "192.0.2.9");
+    server.publish();
+
+    // Last octet of the first answer of each of n queries
+    auto firsts = [&](const std::string& name, int n) {
+        std::vector<int> out;
+        for (int i = 0; i < n; ++i) {
+            auto response = createDNSResponse(buildQuery(name, 1), server);
+            REQUIRE(answerCountOf(response) == (name == "pool.example.com" ? 4 : 1));
+            out.push_back(firstAnswerRData(response).back());
+        }
+        return out;
+    };
+
+    SECTION("Fixed Keeps Insertion Order") {
+        server.setRRsetOrder(RRsetOrder::Fixed);
+        CHECK(firsts("pool.example.com", 3) == std::vector<int>{1, 1, 1});
+    }
+
+    SECTION("Cyclic Starts One Record Further Each Time") {
+        server.setRRsetOrder(RRsetOrder::Cyclic);
+        auto seen = firsts("pool.example.com", 8);
+        for (size_t i = 1; i < seen.size(); ++i) CHECK(seen[i] == seen[i - 1] % 4 + 1);
+
+        // Every record is still there once, in rotated order
+        auto response = createDNSResponse(buildQuery("pool.example.com", 1), server);
+        size_t offset = response.size();
+        std::vector<int> octets;
+        for (int i = 0; i < 4; ++i) {
+            offset -= 16;
+            octets.insert(octets.begin(), response[offset + 15]);
+        }
+        for (size_t i = 1; i < octets.size(); ++i) CHECK(octets[i] == octets[i - 1] % 4 + 1);
+        CHECK(firsts("single.example.com", 2) == std::vector<int>{9, 9});
+    }
+
+    SECTION("Random Reaches Every Record") {
+        server.setRRsetOrder(RRsetOrder::Random);
+        auto seen = firsts("pool.example.com", 200);
+        for (int octet = 1; octet <= 4; ++octet) CHECK(std::ranges::count(seen, octet) > 10);
+    }
+
+    SECTION("Orders Parse From Their Names") {
+        RRsetOrder order = RRsetOrder::Fixed;
+        CHECK(parse_rrset_order("random", order));
+        CHECK(order == RRsetOrder::Random);
+        CHECK_FALSE(parse_rrset_order("sorted", order));
+    }
+}
+
+TEST_CASE("Weighted Answer Subsets", "[zone]") {
+    SECTION("Alias Tables Draw In Proportion To The Weights") {
+        std::vector<uint32_t> weights = {1, 3, 4, 2};
+        std::vector<answer_subset::AliasSlot> table(weights.size());
+        answer_subset::buildAlias(weights, table);
+        std::vector<int> hits(weights.size(), 0);
+        uint64_t random = 0x9E3779B97F4A7C15ull;
+        for (int i = 0; i < 100000; ++i) {
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            hits[answer_subset::draw(table, random)]++;
+        }
+        for (size_t i = 0; i < weights.size(); ++i) {
+            CHECK(std::abs(hits[i] - 10000 * static_cast<int>(weights[i])) < 1000);
+        }
+    }
+
+    SECTION("Rules Parse Their Weights") {
+        answer_subset::Rules rules;
+        CHECK(rules.add("pool.example.com/A/8"));
+        CHECK(rules.add("Big.Example.com/AAAA/4/2001:db8::1=7"));
+        CHECK_FALSE(rules.add("pool.example.com/A"));
+        CHECK_FALSE(rules.add("pool.example.com/BOGUS/8"));
+        CHECK_FALSE(rules.add("pool.example.com/A/0"));
+        CHECK_FALSE(rules.add("pool.example.com/A/8/192.0.2.1=0"));
+        CHECK_FALSE(rules.add("pool.example.com/A/8/not-an-address=2"));
+
+        dns_packet::WireName big;
+        REQUIRE(big.assign("big.example.com"));
+        const auto* rule = rules.find(big.bytes(), 28);
+        REQUIRE(rule != nullptr);
+        CHECK(rule->count == 4);
+        std::vector<uint8_t> tail;
+        REQUIRE(dns_packet::appendRecordTail(tail, 28, dns_packet::DEFAULT_TTL, "2001:db8::1"));
+        CHECK(rule->weightOf(tail) == 7);
+        CHECK(rules.find(big.bytes(), 1) == nullptr);
+    }
+
+    SECTION("Large RRsets Are Answered With A Weighted Sample That Fits") {
+        auto rules = std::make_shared<answer_subset::Rules>();
+        REQUIRE(rules->add("pool.example.com/A/8/10.0.0.0=400"));
+        DNSServer server;
+        server.setSnapshotOptions({.perfectHash = true, .subsets = rules});
+        server.addRecord("example.com", "SOA", soaFor("example.com"));
+        for (int i = 0; i < 300; ++i) {
+            server.addRecord("pool.example.com", RecordType::A, "10.0." + std::to_string(i / 256) + "." + std::to_string(i % 256));
+        }
+        for (int i = 0; i < 5; ++i) server.addRecord("small.example.com", RecordType::A, "192.0.2." + std::to_string(i));
+        server.publish();
+
+        int heavy = 0;
+        for (int round = 0; round < 200; ++round) {
+            auto response = createDNSResponse(buildQuery("pool.example.com", 1), server);
+            REQUIRE(answerCountOf(response) == 8);
+            CHECK(response.size() <= MAX_DNS_PACKET_SIZE);
+            CHECK((response[2] & dns_packet::FLAG_TC) == 0);
+            std::vector<uint16_t> seen;
+            for (size_t offset = response.size() - 8 * 16; offset < response.size(); offset += 16) {
+                seen.push_back(dns_packet::readUint16(response, offset + 14));
+            }
+            std::ranges::sort(seen);
+            CHECK(std::ranges::adjacent_find(seen) == seen.end());
+            heavy += seen.front() == 0;
+        }
+        // 10.0.0.0 holds about 57% of the weight, so it is in nearly every sample
+        CHECK(heavy > 180);
+
+        // RRsets within the rule's count and names without a rule are whole
+        CHECK(answerCountOf(createDNSResponse(buildQuery("small.example.com", 1), server)) == 5);
+
+        // The tables follow the RRset into later versions
+        ZoneDelta delta;
+        delta.soa = server.zones()->find("example.com")->snapshot()->soa();
+        delta.soa.serial++;
+        std::vector<uint8_t> tail;
+        REQUIRE(dns_packet::appendRecordTail(tail, 1, dns_packet::DEFAULT_TTL, "192.0.2.99"));
+        delta.owners[dns_packet::encodeDomainName("new.example.com")] = {tail};
+        REQUIRE(server.applyDelta("example.com", delta));
+        CHECK(answerCountOf(createDNSResponse(buildQuery("pool.example.com", 1), server)) == 8);
+    }
+
+    SECTION("Skewed Weights, Large RRs And Glue Still Give A Full Sample") {
+        std::string big(400, 'x');
+        auto rules = std::make_shared<answer_subset::Rules>();
+        REQUIRE(rules->add("skew.example.com/A/8/10.1.0.0=1000000"));
+        REQUIRE(rules->add("mix.example.com/TXT/3/" + big + "=1000"));
+        REQUIRE(rules->add("example.com/NS/2"));
+        DNSServer server;
+        server.setSnapshotOptions({.perfectHash = true, .subsets = rules});
+        server.addRecord("example.com", "SOA", soaFor("example.com"));
+        for (int i = 0; i < 4; ++i) {
+            std::string host = "ns" + std::to_string(i) + ".example.com";
+            server.addRecord("example.com", "NS", host);
+            server.addRecord(host, RecordType::A, "192.0.2." + std::to_string(i + 1));
+        }
+        for (int i = 0; i < 20; ++i) server.addRecord("skew.example.com", RecordType::A, "10.1.0." + std::to_string(i));
+        server.addRecord("mix.example.com", RecordType::TXT, big);
+        for (int i = 0; i < 5; ++i) server.addRecord("mix.example.com", RecordType::TXT, "small" + std::to_string(i));
+        server.publish();
+
+        // One RR holds nearly all the weight, so the draws alone repeat it
+        for (int round = 0; round < 20; ++round) {
+            auto response = createDNSResponse(buildQuery("skew.example.com", 1), server);
+            REQUIRE(answerCountOf(response) == 8);
+            std::vector<uint16_t> seen;
+            for (size_t offset = response.size() - 8 * 16; offset < response.size(); offset += 16) {
+                seen.push_back(dns_packet::readUint16(response, offset + 14));
+            }
+            std::ranges::sort(seen);
+            CHECK(std::ranges::adjacent_find(seen) == seen.end());
+        }
+
+        // The heavy TXT does not fit in 512 bytes; smaller ones take its place
+        for (int round = 0; round < 20; ++round) {
+            auto response = createDNSResponse(buildQuery("mix.example.com", 16), server);
+            CHECK(answerCountOf(response) == 3);
+            CHECK((response[2] & dns_packet::FLAG_TC) == 0);
+        }
+
+        // A sampled NS RRset brings the addresses of the servers it names
+        auto response = createDNSResponse(buildQuery("example.com", 2), server);
+        CHECK(answerCountOf(response) == 2);
+        CHECK(dns_packet::readUint16(response, 10) == 2);
+    }
+}
+
+TEST_CASE("Parallel Snapshot Build", "[zone]") {
+    SECTION("Worker Count Does Not Change The Answers") {
+        std::vector<DNSRecord> records;
+        records.emplace_back("example.com", "SOA", soaFor("example.com"));
+        for (int i = 0; i < 40000; ++i) {
+            std::string owner = "host" + std::to_string(i % 15000) + ".example.com";
+            records.emplace_back(owner, i % 3 == 2 ? RecordType::TXT : RecordType::A,
+                                 i % 3 == 2 ? "text " + std::to_string(i) : "192.0.2." + std::to_string(i % 250));
+        }
+        records.emplace_back("bad.example.com", RecordType::A, "not-an-address");
+
+        DNSServer single, parallel;
+        single.setSnapshotOptions({false, 1});
+        parallel.setSnapshotOptions({false, 4});
+        single.setRRsetOrder(RRsetOrder::Fixed);
+        parallel.setRRsetOrder(RRsetOrder::Fixed);
+        single.addRecords(records);
+        parallel.addRecords(records);
+        single.publish();
+        parallel.publish();
+
+        for (const char* name : {"host0.example.com", "host14999.example.com", "host7.example.com", "bad.example.com"}) {
+            auto query = buildQuery(name, 255);
+            CHECK(createDNSResponse(query, single) == createDNSResponse(query, parallel));
+        }
+        auto response = createDNSResponse(buildQuery("host2.example.com", 255), parallel);
+        CHECK(answerCountOf(response) == 3);
+        response = createDNSResponse(buildQuery("bad.example.com", 1), parallel);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NOERROR);
+        CHECK(answerCountOf(response) == 0);
+    }
+}
+
+TEST_CASE("Perfect Hash Index", "[zone]") {
+    SECTION("Keys Map One-To-One Onto The Directory") {
+        std::vector<uint64_t> keys;
+        uint64_t x = 88172645463325252ULL;
+        for (int i = 0; i < 100000; ++i) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            keys.push_back(x);
+        }
+        PerfectHash hash;
+        REQUIRE(hash.build(keys, 4));
+
+        std::vector<bool> used(keys.size(), false);
+        for (uint64_t key : keys) {
+            uint64_t index = hash.lookup(key);
+            REQUIRE(index < keys.size());
+            CHECK_FALSE(used[index]);
+            used[index] = true;
+        }
+        CHECK(hash.memoryUsage() * 8 < keys.size() * 5);
+    }
+
+    SECTION("Duplicate Keys Are Rejected") {
+        std::vector<uint64_t> keys = {1, 2, 3, 2};
+        PerfectHash hash;
+        CHECK_FALSE(hash.build(keys));
+    }
+
+    SECTION("Static Zone Lookups Go Through The Directory") {
+        DNSServer server;
+        server.setSnapshotOptions({true, 2});
+        server.addRecord("example.com", "SOA", soaFor("example.com"));
+        for (int i = 0; i < 2000; ++i) {
+            server.addRecord("host" + std::to_string(i) + ".example.com", RecordType::A, "192.0.2.1");
+        }
+        server.publish();
+
+        auto snapshot = server.zones()->find("example.com")->snapshot();
+        REQUIRE(snapshot->hasPerfectHash());
+        for (int i = 0; i < 2000; ++i) {
+            dns_packet::WireName name;
+            REQUIRE(name.assign("HOST" + std::to_string(i) + ".example.com"));
+            const auto* owner = snapshot->find(name, name.hash());
+            REQUIRE(owner != nullptr);
+            CHECK(snapshot->rrsets(*owner).size() == 1);
+        }
+
+        auto response = createDNSResponse(buildQuery("host2000.example.com", 1), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NXDOMAIN);
+        response = createDNSResponse(buildQuery("host1999.example.com", 1), server);
+        CHECK(answerCountOf(response) == 1);
+    }
+}
+
+TEST_CASE("Negative Lookup Filter", "[zone]") {
+    SECTION("Members Always Pass And Most Non-Members Are Rejected") {
+        std::vector<uint64_t> members;
+        for (int i = 0; i < 20000; ++i) {
+            dns_packet::WireName name;
+            REQUIRE(name.assign("host" + std::to_string(i) + ".example.com"));
+            members.push_back(name.hash());
+        }
+        NegativeFilter filter;
+        filter.build(members);
+
+        for (uint64_t hash : members) {
+            REQUIRE(filter.mayContain(hash));
+        }
+        size_t passed = 0;
+        for (int i = 0; i < 20000; ++i) {
+            dns_packet::WireName name;
+            REQUIRE(name.assign("x" + std::to_string(i) + ".random.example.com"));
+            passed += filter.mayContain(name.hash());
+        }
+        CHECK(passed < 20000 * 3 / 100);
+        CHECK(filter.estimatedFalsePositiveRate() < 0.03);
+    }
+
+    SECTION("Random Subdomains Are Absorbed And Counted") {
+        DNSServer server;
+        server.addRecord("example.com", "SOA", soaFor("example.com"));
+        server.addRecord("www.example.com", RecordType::A, "192.0.2.1");
+        server.publish();
+
+        for (int i = 0; i < 1000; ++i) {
+            auto response = createDNSResponse(buildQuery("q" + std::to_string(i) + ".example.com", 1), server);
+            REQUIRE(rcodeOf(response) == dns_packet::RCODE_NXDOMAIN);
+        }
+        auto stats = server.filterStats();
+        CHECK(stats.rejected + stats.falsePositives == 1000);
+        CHECK(stats.rejected > 900);
+        CHECK(stats.observedFalsePositiveRate() < 0.1);
+        CHECK(stats.estimatedFalsePositiveRate < 0.1);
+
+        auto response = createDNSResponse(buildQuery("www.example.com", 1), server);
+        CHECK(answerCountOf(response) == 1);
+    }
+}
+
+TEST_CASE("Scratch Arena", "[zone]") {
+    DNSServer server;
+    server.addRecord("example.com", "SOA", soaFor("example.com"));
+    server.addRecord("example.com", "MX", "10 mail.example.com");
+    server.addRecord("www.example.com", RecordType::A, "192.0.2.1");
+    server.publish();
+
+    SECTION("Arena Replies Match Heap Replies") {
+        ScratchArena arena;
+        for (const auto& [name, qtype] : std::vector<std::pair<std::string, uint16_t>>{
+                 {"example.com", 255}, {"www.example.com", 1}, {"missing.example.com", 1}, {"outside.org", 1}}) {
+            auto query = buildQuery(name, qtype);
+            auto expected = createDNSResponse(query, server);
+            auto response = createDNSResponse(query, server, arena.resource());
+            CHECK(std::vector<uint8_t>(response.begin(), response.end()) == expected);
+
+            size_t offset = dns_packet::HEADER_SIZE;
+            CHECK(std::string_view(dns_packet::parseDomainName(query, offset, arena.resource())) == name);
+            CHECK(offset == query.size() - 4);
+            arena.reset();
+        }
+    }
+
+    SECTION("Reset Rewinds To The Start Of The Buffer") {
+        ScratchArena arena;
+        void* first = arena.resource()->allocate(100);
+        arena.reset();
+        CHECK(arena.resource()->allocate(100) == first);
+    }
+
+    SECTION("Compressed Names Decode With Their Separator") {
+        auto query = buildQuery("example.com", 1);
+        size_t pointerAt = query.size();
+        query.insert(query.end(), {3, 'w', 'w', 'w', 0xC0, 0x0C});
+        size_t offset = pointerAt;
+        CHECK(dns_packet::parseDomainName(query, offset) == "www.example.com");
+        CHECK(offset == query.size());
+    }
+}
+
+TEST_CASE("Reverse Names", "[zone]") {
+    auto parse = [](const std::string& text, reverse_name::Prefix& out) {
+        dns_packet::WireName name;
+        return name.assign(text) && reverse_name::parse(name.bytes(), out);
+    };
+    reverse_name::Prefix prefix;
+    reverse_name::Prefix network;
+
+    SECTION("IPv4 Labels Map Into The Shared Key Space") {
+        REQUIRE(parse("1.2.0.192.IN-ADDR.ARPA", prefix));
+        CHECK(prefix.length == 128);
+        CHECK(prefix.ipv4);
+        CHECK(prefix.key.byte(12) == 192);
+        CHECK(prefix.key.byte(15) == 1);
+
+        REQUIRE(parse("2.0.192.in-addr.arpa", prefix));
+        REQUIRE(reverse_name::parseNetwork("192.0.2.0/24", network));
+        CHECK(prefix == network);
+        CHECK(parse("in-addr.arpa", prefix));
+        CHECK(prefix.length == reverse_name::IPV4_MAPPED_BITS);
+    }
+
+    SECTION("IPv6 Nibbles Are Read Backwards") {
+        std::string name;
+        for (int i = 0; i < 24; ++i) name += "0.";
+        name += "8.b.d.0.1.0.0.2.ip6.arpa";
+        REQUIRE(parse(name, prefix));
+        REQUIRE(reverse_name::parseNetwork("2001:db8::/32", network));
+        CHECK(prefix.length == 128);
+        CHECK(network.contains(prefix));
+        CHECK_FALSE(prefix.ipv4);
+        REQUIRE(parse("8.b.d.0.1.0.0.2.ip6.arpa", prefix));
+        CHECK(prefix == network);
+    }
+
+    SECTION("Non-Canonical Or Foreign Names Are Rejected") {
+        CHECK_FALSE(parse("01.2.0.192.in-addr.arpa", prefix));
+        CHECK_FALSE(parse("256.2.0.192.in-addr.arpa", prefix));
+        CHECK_FALSE(parse("1.1.2.0.192.in-addr.arpa", prefix));
+        CHECK_FALSE(parse("10.8.b.d.0.1.0.0.2.ip6.arpa", prefix));
+        CHECK_FALSE(parse("g.ip6.arpa", prefix));
+        CHECK_FALSE(parse("1.2.0.192.example.com", prefix));
+        CHECK_FALSE(reverse_name::parseNetwork("192.0.2.1/24", network));
+        CHECK_FALSE(reverse_name::parseNetwork("192.0.2.0/33", network));
+    }
+}
+
+TEST_CASE("Reverse Index", "[zone]") {
+    auto prefix = [](const std::string& text) {
+        dns_packet::WireName name;
+        reverse_name::Prefix out;
+        REQUIRE(name.assign(text));
+        REQUIRE(reverse_name::parse(name.bytes(), out));
+        return out;
+    };
+
+    SECTION("Exact And Longest-Prefix Lookups") {
+        ReverseIndex index;
+        index.build({{prefix("in-addr.arpa"), 0}, {prefix("192.in-addr.arpa"), 1},
+                     {prefix("2.0.192.in-addr.arpa"), 2}, {prefix("1.2.0.192.in-addr.arpa"), 3},
+                     {prefix("1.2.0.192.in-addr.arpa"), 9}, {prefix("ip6.arpa"), 4}});
+        CHECK(index.size() == 5);
+        CHECK(index.exact(prefix("1.2.0.192.in-addr.arpa")) == 3);
+        CHECK(index.exact(prefix("2.2.0.192.in-addr.arpa")) == ReverseIndex::NONE);
+        CHECK(index.longest(prefix("2.2.0.192.in-addr.arpa")) == 2);
+        CHECK(index.longest(prefix("1.1.0.192.in-addr.arpa")) == 1);
+        CHECK(index.longest(prefix("1.1.1.10.in-addr.arpa")) == 0);
+        CHECK(index.longest(prefix("0.0.0.0.0.0.0.0.0.0.f.f.f.f.ip6.arpa")) == 4);
+    }
+
+    SECTION("Large Tables Agree With A Plain Search") {
+        std::vector<ReverseIndex::Entry> entries;
+        for (uint32_t i = 0; i < 5000; ++i) {
+            uint8_t bytes[4] = {10, static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i * 7), 1};
+            entries.push_back({{reverse_name::fromBytes(bytes), 128, true}, i});
+        }
+        ReverseIndex index;
+        index.build(entries);
+        for (const auto& entry : entries) {
+            REQUIRE(index.exact(entry.prefix) == entry.value);
+        }
+        uint8_t missing[4] = {10, 200, 0, 1};
+        CHECK(index.exact({reverse_name::fromBytes(missing), 128, true}) == ReverseIndex::NONE);
+    }
+
+    SECTION("Reverse Zones Are Served Through The Index") {
+        DNSServer server;
+        server.addRecord("in-addr.arpa", "SOA", soaFor("example.com"));
+        server.addRecord("2.0.192.in-addr.arpa", "SOA", soaFor("example.com"));
+        server.addRecord("1.2.0.192.in-addr.arpa", "PTR", "one.example.com");
+        server.addRecord("1.1.0.192.in-addr.arpa", "PTR", "other.example.com");
+        server.addRecord("_tag.2.0.192.in-addr.arpa", "TXT", "not an address");
+        for (bool perfect : {false, true}) {
+            server.setSnapshotOptions({perfect, 1});
+            server.publish();
+            auto zones = server.zones();
+            CHECK(zones->selectReverse(prefix("1.2.0.192.in-addr.arpa"))->origin() == "2.0.192.in-addr.arpa");
+            CHECK(zones->selectReverse(prefix("1.1.0.192.in-addr.arpa"))->origin() == "in-addr.arpa");
+
+            auto snapshot = zones->find("2.0.192.in-addr.arpa")->snapshot();
+            REQUIRE(snapshot->reverseIndexed());
+            CHECK(snapshot->findReverse(prefix("1.2.0.192.in-addr.arpa")) != nullptr);
+            CHECK(snapshot->findReverse(prefix("2.0.192.in-addr.arpa")) != nullptr);
+
+            auto response = createDNSResponse(buildQuery("1.2.0.192.in-addr.arpa", 12), server);
+            CHECK(firstAnswerRData(response) == dns_packet::encodeDomainName("one.example.com"));
+            response = createDNSResponse(buildQuery("1.1.0.192.IN-ADDR.ARPA", 12), server);
+            CHECK(firstAnswerRData(response) == dns_packet::encodeDomainName("other.example.com"));
+            response = createDNSResponse(buildQuery("9.2.0.192.in-addr.arpa", 12), server);
+            CHECK(rcodeOf(response) == dns_packet::RCODE_NXDOMAIN);
+            response = createDNSResponse(buildQuery("_tag.2.0.192.in-addr.arpa", 16), server);
+            CHECK(answerCountOf(response) == 1);
+        }
+    }
+
+    SECTION("Overlays Read Through To The Base And Honour Deletes") {
+        DNSServer server;
+        server.addRecord("2.0.192.in-addr.arpa", "SOA", soaFor("example.com"));
+        server.addRecord("1.2.0.192.in-addr.arpa", "PTR", "one.example.com");
+        server.addRecord("2.2.0.192.in-addr.arpa", "PTR", "two.example.com");
+        server.publish();
+
+        ZoneDelta delta;
+        REQUIRE(dns_packet::SOAData::parse(soaFor("example.com"), delta.soa));
+        delta.soa.serial = 2;
+        auto one = dns_packet::encodeDomainName("1.2.0.192.in-addr.arpa");
+        auto three = dns_packet::encodeDomainName("3.2.0.192.in-addr.arpa");
+        delta.owners[std::vector<uint8_t>(one.begin(), one.end())];
+        auto& added = delta.owners[std::vector<uint8_t>(three.begin(), three.end())];
+        added.emplace_back();
+        REQUIRE(dns_packet::appendRecordTail(added.back(), 12, dns_packet::DEFAULT_TTL, "three.example.com"));
+        REQUIRE(server.applyDelta("2.0.192.in-addr.arpa", delta));
+
+        auto snapshot = server.zones()->find("2.0.192.in-addr.arpa")->snapshot();
+        REQUIRE(snapshot->overlayCount() > 0);
+        CHECK(snapshot->findReverse(prefix("1.2.0.192.in-addr.arpa")) == nullptr);
+        CHECK(snapshot->findReverse(prefix("2.2.0.192.in-addr.arpa")) != nullptr);
+        CHECK(snapshot->findReverse(prefix("3.2.0.192.in-addr.arpa")) != nullptr);
+        auto response = createDNSResponse(buildQuery("1.2.0.192.in-addr.arpa", 12), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NXDOMAIN);
+    }
+}
+
+TEST_CASE("Synthesized Records", "[zone]") {
+    DNSServer server;
+    server.addRecord("example.net", "SOA", soaFor("example.net"));
+    server.addRecord("ip-192-0-2-9.example.net", RecordType::A, "198.51.100.9");
+    server.addRecord("in-addr.arpa", "SOA", soaFor("example.net"));
+    server.addRecord("9.2.0.192.in-addr.arpa", "PTR", "stored.example.net");
+    server.addRecord("ip6.arpa", "SOA", soaFor("example.net"));
+    server.publish();
+    REQUIRE(server.synthesis().addRule("192.0.0.0/8", "ip-*.Example.NET"));
+    REQUIRE(server.synthesis().addRule("2001:db8::/32", "v6-*-host.example.net"));
+    CHECK_FALSE(server.synthesis().addRule("192.0.2.0/24", "no-star.example.net"));
+    CHECK_FALSE(server.synthesis().addRule("192.0.2.0", "ip-*.example.net"));
+
+    SECTION("Reverse Names Of The Range Get A PTR") {
+        auto response = createDNSResponse(buildQuery("1.2.0.192.in-addr.arpa", 12), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NOERROR);
+        REQUIRE(answerCountOf(response) == 1);
+        auto expected = dns_packet::encodeDomainName("ip-192-0-2-1.example.net");
+        CHECK(firstAnswerRData(response) == expected);
+
+        response = createDNSResponse(buildQuery("255.255.255.192.in-addr.arpa", 12), server);
+        CHECK(firstAnswerRData(response) == dns_packet::encodeDomainName("ip-192-255-255-255.example.net"));
+    }
+
+    SECTION("Rule Names Resolve Back To Their Address") {
+        auto response = createDNSResponse(buildQuery("IP-192-0-2-1.example.net", 1), server);
+        REQUIRE(answerCountOf(response) == 1);
+        CHECK(firstAnswerRData(response) == std::vector<uint8_t>{192, 0, 2, 1});
+
+        // NODATA, with the SOA for negative caching
+        response = createDNSResponse(buildQuery("ip-192-0-2-1.example.net", 16), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NOERROR);
+        CHECK(answerCountOf(response) == 0);
+        CHECK(sectionOf(response, 1) == std::vector<std::pair<std::string, uint16_t>>{{"example.net", 6}});
+    }
+
+    SECTION("IPv6 Ranges Work In Both Directions") {
+        std::string reverse;
+        for (int i = 0; i < 23; ++i) reverse += "0.";
+        reverse += "8.b.d.0.1.0.0.2.ip6.arpa";
+        auto response = createDNSResponse(buildQuery("1." + reverse, 12), server);
+        REQUIRE(answerCountOf(response) == 1);
+        std::string name = "v6-2001-0db8-0000-0000-0000-0000-0000-0001-host.example.net";
+        CHECK(firstAnswerRData(response) == dns_packet::encodeDomainName(name));
+
+        response = createDNSResponse(buildQuery(name, 28), server);
+        REQUIRE(answerCountOf(response) == 1);
+        CHECK(firstAnswerRData(response) ==
+              std::vector<uint8_t>{0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1});
+    }
+
+    SECTION("Stored Records Win And Everything Else Is NXDOMAIN") {
+        auto response = createDNSResponse(buildQuery("ip-192-0-2-9.example.net", 1), server);
+        CHECK(firstAnswerRData(response) == std::vector<uint8_t>{198, 51, 100, 9});
+        response = createDNSResponse(buildQuery("9.2.0.192.in-addr.arpa", 12), server);
+        CHECK(firstAnswerRData(response) == dns_packet::encodeDomainName("stored.example.net"));
+
+        // Above the stored PTR is an empty non-terminal, which exists
+        response = createDNSResponse(buildQuery("2.0.192.in-addr.arpa", 1), server);
+        CHECK(rcodeOf(response) == dns_packet::RCODE_NOERROR);
+        CHECK(answerCountOf(response) == 0);
+
+        for (const char* name : {"1.2.0.10.in-addr.arpa", "3.0.192.in-addr.arpa", "ip-10-0-0-1.example.net",
+                                 "ip-192-0-02-1.example.net", "ip-192-0-2.example.net", "ip-192-0-2-1.other.example.net"}) {
+            INFO(name);
+            CHECK(rcodeOf(createDNSResponse(buildQuery(name, 1), server)) == dns_packet::RCODE_NXDOMAIN);
+        }
+    }
+}
+
+TEST_CASE("Zone Reload", "[zone]") {
+    std::string path = "/tmp/dns_zone_reload_test." + std::to_string(getpid());
+    auto writeZone = [&](const std::string& text) { std::ofstream(path, std::ios::trunc) << text; };
+    writeZone("; primary data\n"
+              "example.com SOA " + soaFor("example.com") + "\n"
+              "example.com   A   192.0.2.1\n"
+              "\n"
+              "www.example.com TXT first version\n");
+
+    DNSServer server;
+    ZoneReloader reloader(server, {path});
+    REQUIRE(reloader.load());
+    CHECK(reloader.stats().lastRecords == 3);
+    CHECK(reloader.stats().lastZones == 1);
+    CHECK(reloader.stats().lastPeakBytes > 0);
+    CHECK(server.queryByType("www.example.com", "TXT").front().value == "first version");
+
+    SECTION("Zone Files Are Read Line By Line") {
+        std::vector<DNSRecord> records;
+        std::string error;
+        REQUIRE(readZoneFile(path, records, error));
+        REQUIRE(records.size() == 3);
+        CHECK(records[1] == DNSRecord("example.com", "A", "192.0.2.1"));
+        CHECK(records[2].value == "first version");
+
+        writeZone("example.com SOA\n");
+        CHECK_FALSE(readZoneFile(path, records, error));
+        CHECK(error.find(":1:") != std::string::npos);
+        CHECK_FALSE(readZoneFile(path + ".missing", records, error));
+    }
+
+    SECTION("A Reload Replaces The Zones And Announces New Serials") {
+        std::vector<std::string> changed;
+        server.setChangeListener([&](std::string_view origin) { changed.emplace_back(origin); });
+        writeZone("example.com SOA ns1.example.com admin.example.com 2 3600 900 1209600 300\n"
+                  "mail.example.com A 192.0.2.2\n"
+                  "2.0.192.in-addr.arpa SOA " + soaFor("example.com") + "\n"
+                  "1.2.0.192.in-addr.arpa PTR example.com\n");
+        REQUIRE(reloader.load());
+        CHECK(server.zones()->size() == 2);
+        CHECK(changed == std::vector<std::string>{"example.com", "2.0.192.in-addr.arpa"});
+        CHECK(rcodeOf(createDNSResponse(buildQuery("www.example.com", 16), server)) == dns_packet::RCODE_NXDOMAIN);
+        CHECK(answerCountOf(createDNSResponse(buildQuery("mail.example.com", 1), server)) == 1);
+        CHECK(answerCountOf(createDNSResponse(buildQuery("1.2.0.192.in-addr.arpa", 12), server)) == 1);
+        CHECK(server.query("www.example.com").empty());
+    }
+
+    SECTION("A Bad File Leaves The Served Zones Alone") {
+        auto before = server.zones();
+        writeZone("example.com SOA " + soaFor("example.com") + "\n"
+                  "www.example.com A 192.0.2.300\n");
+        CHECK_FALSE(reloader.load());
+        CHECK(reloader.stats().failures == 1);
+        CHECK(reloader.stats().lastError.find("www.example.com") != std::string::npos);
+
+        writeZone("example.com SOA " + soaFor("example.com") + "\n"
+                  "alias.example.com CNAME a..example.com\n");
+        CHECK_FALSE(reloader.load());
+        CHECK(reloader.stats().lastError.find("alias.example.com") != std::string::npos);
+
+        writeZone("www.example.com A 192.0.2.3\n");
+        CHECK_FALSE(reloader.load());
+        CHECK(server.zones() == before);
+        CHECK(server.queryByType("www.example.com", "TXT").size() == 1);
+    }
+
+    SECTION("Transferred Zones Carry Over") {
+        ZoneDelta contents;
+        REQUIRE(dns_packet::SOAData::parse(soaFor("example.org"), contents.soa));
+        auto apex = dns_packet::encodeDomainName("example.org");
+        auto& apexRRs = contents.owners[std::vector<uint8_t>(apex.begin(), apex.end())];
+        apexRRs.emplace_back();
+        REQUIRE(dns_packet::appendRecordTail(apexRRs.back(), 6, dns_packet::DEFAULT_TTL, soaFor("example.org")));
+        apexRRs.emplace_back();
+        REQUIRE(dns_packet::appendRecordTail(apexRRs.back(), 1, dns_packet::DEFAULT_TTL, "198.51.100.1"));
+        REQUIRE(server.loadZone("example.org", contents));
+
+        REQUIRE(reloader.load());
+        CHECK(server.zones()->size() == 2);
+        CHECK(answerCountOf(createDNSResponse(buildQuery("example.org", 1), server)) == 1);
+        CHECK(server.queryByType("example.org", "A").front().value == "198.51.100.1");
+    }
+
+    SECTION("Queries Are Answered Throughout A Background Reload") {
+        std::string text = "example.com SOA " + soaFor("example.com") + "\n";
+        for (int i = 0; i < 20000; ++i) text += "host" + std::to_string(i) + ".example.com A 192.0.2.7\n";
+        writeZone(text);
+
+        // The listener runs on the reload thread, so it only raises a flag
+        std::atomic<bool> finished{false};
+        reloader.setListener([&](bool, const ZoneReloader::Stats&) { finished = true; });
+        REQUIRE(reloader.start());
+        size_t answered = 0;
+        while (!finished) {
+            auto response = createDNSResponse(buildQuery("example.com", 1), server);
+            CHECK(rcodeOf(response) == dns_packet::RCODE_NOERROR);
+            answered++;
+        }
+        reloader.wait();
+        CHECK(answered > 0);
+        CHECK(reloader.stats().reloads == 2);
+        CHECK(reloader.stats().lastRecords == 20001);
+        CHECK(answerCountOf(createDNSResponse(buildQuery("host19999.example.com", 1), server)) == 1);
+    }
+
+    std::remove(path.c_str());
+}